@@ -0,0 +1,596 @@
+#include "GlyphAtlas.h"
+
+#include <GL/glut.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory.h>
+
+#define ATLAS_TEXSIZE 512
+#define ATLAS_MAXPAGES 4
+#define ATLAS_MAXSHELVES 128
+#define ATLAS_PADDING 1
+//a white texel block at (0, 0) of every page, for underlines
+#define ATLAS_WHITESIZE 2
+#define ATLAS_STYLEMASK (TTF_STYLE_BOLD | TTF_STYLE_ITALIC)
+
+typedef struct
+{
+	GLfloat u, v;
+	GLubyte r, g, b, a;
+	GLfloat x, y;
+} AtlasVertex;
+
+typedef struct
+{
+	int y;
+	int height;
+	int x; //next free column
+} AtlasShelf;
+
+typedef struct
+{
+	GLuint texture;
+	int numshelves;
+	AtlasShelf shelves[ATLAS_MAXSHELVES];
+	int top; //first row below the last shelf
+	AtlasVertex * vertices;
+	int numvertices;
+	int maxvertices;
+} AtlasPage;
+
+typedef struct
+{
+	int used;
+	uint32_t ch;
+	int style;
+	int page; //-1 for glyphs without pixels, e.g. space
+	int x, y, w, h;
+	int index;
+	int minx;
+	int maxx;
+	int yoffset;
+	int advance;
+	int overhang;
+	int padding; //distance field border
+} AtlasGlyph;
+
+struct GlyphAtlas
+{
+	TTF_Font * font;
+	int texsize;
+	int numpages;
+	AtlasPage pages[ATLAS_MAXPAGES];
+	AtlasGlyph * glyphs; //open addressing, tablesize is a power of 2
+	int numglyphs;
+	int tablesize;
+	int width, height; //of the last flush
+	int sdf; //pages hold distance fields, drawn scaled
+	int ptsize; //size quads are drawn at
+	int refsize; //size the font was opened with
+	GLfloat scale;
+};
+
+typedef struct
+{
+	int x, y;
+	int xstart;
+	int sizex; //as in TTF_SizeUNICODE, for the string width
+	int minx, maxx;
+	int prev_index;
+	int first;
+	SDL_Color fg;
+} AtlasPen;
+
+static int atlasAddPage(GlyphAtlas * atlas)
+{
+	AtlasPage * page;
+	unsigned char * zero;
+	unsigned char white[ATLAS_WHITESIZE * ATLAS_WHITESIZE];
+
+	if (atlas->numpages >= ATLAS_MAXPAGES)
+	{
+		return -1;
+	}
+	zero = (unsigned char *)calloc(atlas->texsize, atlas->texsize);
+	if (zero == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	page = &atlas->pages[atlas->numpages];
+	glGenTextures(1, &page->texture);
+	glBindTexture(GL_TEXTURE_2D, page->texture);
+	if (atlas->sdf)
+	{
+		//distance fields interpolate, the alpha test finds the outline
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	else
+	{
+		//glyphs are drawn at whole pixels, never filtered
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlas->texsize, atlas->texsize, 0,
+		GL_ALPHA, GL_UNSIGNED_BYTE, zero);
+	memset(white, 0xFF, sizeof(white));
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ATLAS_WHITESIZE, ATLAS_WHITESIZE,
+		GL_ALPHA, GL_UNSIGNED_BYTE, white);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	free(zero);
+
+	page->numshelves = 0;
+	page->top = ATLAS_WHITESIZE + ATLAS_PADDING;
+	page->numvertices = 0;
+	return atlas->numpages++;
+}
+
+static void atlasReset(GlyphAtlas * atlas)
+{
+	int i;
+
+	for (i = 0; i < atlas->numpages; i++)
+	{
+		glDeleteTextures(1, &atlas->pages[i].texture);
+		if (atlas->pages[i].vertices)
+		{
+			free(atlas->pages[i].vertices);
+		}
+	}
+	memset(atlas->pages, 0, sizeof(atlas->pages));
+	atlas->numpages = 0;
+	if (atlas->glyphs)
+	{
+		memset(atlas->glyphs, 0, atlas->tablesize * sizeof(AtlasGlyph));
+	}
+	atlas->numglyphs = 0;
+}
+
+GlyphAtlas * createGlyphAtlas(TTF_Font * font, int texsize)
+{
+	GlyphAtlas * atlas;
+
+	if (font == NULL)
+	{
+		fprintf(stderr, "font is NULL\n");
+		return NULL;
+	}
+	atlas = (GlyphAtlas *)malloc(sizeof(*atlas));
+	if (atlas == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	memset(atlas, 0, sizeof(*atlas));
+	atlas->font = font;
+	atlas->texsize = texsize > 0 ? texsize : ATLAS_TEXSIZE;
+	atlas->refsize = atlas->ptsize = TTF_FontPtSize(font);
+	atlas->scale = 1.0f;
+	atlas->tablesize = 256;
+	atlas->glyphs = (AtlasGlyph *)calloc(atlas->tablesize, sizeof(AtlasGlyph));
+	if (atlas->glyphs == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(atlas);
+		return NULL;
+	}
+	return atlas;
+}
+
+GlyphAtlas * createGlyphAtlasSDF(TTF_Font * font, int texsize)
+{
+	GlyphAtlas * atlas = createGlyphAtlas(font, texsize);
+
+	if (atlas)
+	{
+		atlas->sdf = 1;
+	}
+	return atlas;
+}
+
+void setGlyphAtlasPtSize(GlyphAtlas * atlas, int ptsize)
+{
+	if (atlas->sdf && ptsize > 0)
+	{
+		atlas->ptsize = ptsize;
+		atlas->scale = (GLfloat)ptsize / atlas->refsize;
+	}
+}
+
+void freeGlyphAtlas(GlyphAtlas * atlas)
+{
+	if (atlas)
+	{
+		atlasReset(atlas);
+		free(atlas->glyphs);
+		free(atlas);
+	}
+}
+
+static AtlasGlyph * atlasLookup(GlyphAtlas * atlas, uint32_t ch, int style)
+{
+	unsigned int i = ((unsigned int)ch * 2654435761U ^ style) & (atlas->tablesize - 1);
+
+	while (atlas->glyphs[i].used)
+	{
+		if (atlas->glyphs[i].ch == ch && atlas->glyphs[i].style == style)
+		{
+			break;
+		}
+		i = (i + 1) & (atlas->tablesize - 1);
+	}
+	return &atlas->glyphs[i];
+}
+
+static int atlasGrowTable(GlyphAtlas * atlas)
+{
+	AtlasGlyph * old = atlas->glyphs;
+	int oldsize = atlas->tablesize;
+	int i;
+
+	atlas->glyphs = (AtlasGlyph *)calloc(oldsize * 2, sizeof(AtlasGlyph));
+	if (atlas->glyphs == NULL)
+	{
+		atlas->glyphs = old;
+		return -1;
+	}
+	atlas->tablesize = oldsize * 2;
+	for (i = 0; i < oldsize; i++)
+	{
+		if (old[i].used)
+		{
+			*atlasLookup(atlas, old[i].ch, old[i].style) = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+//shelf packing: the lowest shelf the glyph fits on, or a new one
+static int atlasPack(GlyphAtlas * atlas, int w, int h, int * page, int * x, int * y)
+{
+	int i, j;
+	int pw = w + ATLAS_PADDING;
+	int ph = h + ATLAS_PADDING;
+
+	for (i = 0; i < atlas->numpages; i++)
+	{
+		AtlasPage * p = &atlas->pages[i];
+		AtlasShelf * best = NULL;
+
+		for (j = 0; j < p->numshelves; j++)
+		{
+			AtlasShelf * s = &p->shelves[j];
+			if (s->height >= ph && s->x + pw <= atlas->texsize &&
+				(best == NULL || s->height < best->height))
+			{
+				best = s;
+			}
+		}
+		if (best == NULL && p->numshelves < ATLAS_MAXSHELVES &&
+			p->top + ph <= atlas->texsize && pw <= atlas->texsize)
+		{
+			best = &p->shelves[p->numshelves++];
+			best->y = p->top;
+			best->height = ph;
+			best->x = 0;
+			p->top += ph;
+		}
+		if (best)
+		{
+			*page = i;
+			*x = best->x;
+			*y = best->y;
+			best->x += pw;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static AtlasGlyph * atlasFindGlyph(GlyphAtlas * atlas, uint32_t ch)
+{
+	int style = TTF_GetFontStyle(atlas->font) & ATLAS_STYLEMASK;
+	AtlasGlyph * glyph = atlasLookup(atlas, ch, style);
+	TTF_GlyphInfo info;
+	int page, x, y;
+
+	if (glyph->used)
+	{
+		return glyph;
+	}
+	//info.pixels stays valid until TTF_ReleaseGlyph
+	if (TTF_GetGlyph(atlas->font, ch, 
+		atlas->sdf ? TTF_GLYPH_SDF : TTF_GLYPH_PIXELS, &info) < 0)
+	{
+		return NULL;
+	}
+	page = -1;
+	x = y = 0;
+	if (info.width > 0 && info.rows > 0)
+	{
+		if (atlasPack(atlas, info.width, info.rows, &page, &x, &y) < 0 &&
+			(atlasAddPage(atlas) < 0 ||
+			 atlasPack(atlas, info.width, info.rows, &page, &x, &y) < 0))
+		{
+			//full: draw what is queued, then start over
+			if (atlas->numpages == 0)
+			{
+				TTF_ReleaseGlyph(atlas->font);
+				return NULL;
+			}
+			flushGlyphAtlas(atlas, atlas->width, atlas->height);
+			atlasReset(atlas);
+			if (atlasAddPage(atlas) < 0 ||
+				atlasPack(atlas, info.width, info.rows, &page, &x, &y) < 0)
+			{
+				//bigger than a whole page
+				TTF_ReleaseGlyph(atlas->font);
+				return NULL;
+			}
+			glyph = atlasLookup(atlas, ch, style);
+		}
+		glBindTexture(GL_TEXTURE_2D, atlas->pages[page].texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, info.pitch);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, info.width, info.rows,
+			GL_ALPHA, GL_UNSIGNED_BYTE, info.pixels);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	TTF_ReleaseGlyph(atlas->font);
+	glyph->used = 1;
+	glyph->ch = ch;
+	glyph->style = style;
+	glyph->page = page;
+	glyph->x = x;
+	glyph->y = y;
+	glyph->w = info.width;
+	glyph->h = info.rows;
+	glyph->index = info.index;
+	glyph->minx = info.minx;
+	glyph->maxx = info.maxx;
+	glyph->yoffset = info.yoffset;
+	glyph->advance = info.advance;
+	glyph->overhang = info.overhang;
+	glyph->padding = info.padding;
+	if (++atlas->numglyphs * 2 > atlas->tablesize)
+	{
+		if (atlasGrowTable(atlas) == 0)
+		{
+			glyph = atlasLookup(atlas, ch, style);
+		}
+	}
+	return glyph;
+}
+
+static int atlasAddQuad(GlyphAtlas * atlas, int page, GLfloat x, GLfloat y, 
+	GLfloat w, GLfloat h, int tx, int ty, int tw, int th, SDL_Color fg)
+{
+	AtlasPage * p = &atlas->pages[page];
+	AtlasVertex * v;
+	GLfloat scale = 1.0f / atlas->texsize;
+
+	if (p->numvertices + 4 > p->maxvertices)
+	{
+		int maxvertices = p->maxvertices ? p->maxvertices * 2 : 1024;
+		AtlasVertex * vertices = (AtlasVertex *)realloc(p->vertices,
+			maxvertices * sizeof(AtlasVertex));
+		if (vertices == NULL)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+		p->vertices = vertices;
+		p->maxvertices = maxvertices;
+	}
+	v = p->vertices + p->numvertices;
+	p->numvertices += 4;
+
+	v[0].x = x;                v[0].y = y;
+	v[0].u = tx * scale;       v[0].v = ty * scale;
+	v[1].x = x;                v[1].y = y + h;
+	v[1].u = tx * scale;       v[1].v = (ty + th) * scale;
+	v[2].x = x + w;            v[2].y = y + h;
+	v[2].u = (tx + tw) * scale; v[2].v = (ty + th) * scale;
+	v[3].x = x + w;            v[3].y = y;
+	v[3].u = (tx + tw) * scale; v[3].v = ty * scale;
+	v[0].r = v[1].r = v[2].r = v[3].r = fg.r;
+	v[0].g = v[1].g = v[2].g = v[3].g = fg.g;
+	v[0].b = v[1].b = v[2].b = v[3].b = fg.b;
+	v[0].a = v[1].a = v[2].a = v[3].a = 0xFF;
+	return 0;
+}
+
+//same pen movement as TTF_RenderUNICODE_Blended, at the size the font
+//was opened with, quads are scaled to ptsize
+static int atlasDrawChar(GlyphAtlas * atlas, AtlasPen * pen, uint32_t ch)
+{
+	AtlasGlyph * glyph;
+	int kerning, z;
+
+	if (ch == UNICODE_BOM_NATIVE || ch == UNICODE_BOM_SWAPPED)
+	{
+		return 0;
+	}
+	glyph = atlasFindGlyph(atlas, ch);
+	if (glyph == NULL)
+	{
+		return -1;
+	}
+	kerning = TTF_GetKerning(atlas->font, pen->prev_index, glyph->index);
+	pen->xstart += kerning;
+	pen->sizex += kerning;
+	z = pen->sizex + glyph->minx;
+	if (pen->minx > z)
+	{
+		pen->minx = z;
+	}
+	pen->sizex += glyph->overhang;
+	z = pen->sizex + (glyph->advance > glyph->maxx ? glyph->advance : glyph->maxx);
+	if (pen->maxx < z)
+	{
+		pen->maxx = z;
+	}
+	pen->sizex += glyph->advance;
+	if (pen->first && glyph->minx < 0)
+	{
+		pen->xstart -= glyph->minx;
+	}
+	pen->first = 0;
+	if (glyph->page >= 0)
+	{
+		atlasAddQuad(atlas, glyph->page,
+			pen->x + (pen->xstart + glyph->minx - glyph->padding) * atlas->scale, 
+			pen->y + (glyph->yoffset - glyph->padding) * atlas->scale,
+			glyph->w * atlas->scale, glyph->h * atlas->scale,
+			glyph->x, glyph->y, glyph->w, glyph->h, pen->fg);
+	}
+	pen->xstart += glyph->advance + glyph->overhang;
+	pen->prev_index = glyph->index;
+	return 0;
+}
+
+//rounded up, as TTF_SizeUNICODE_Scaled does
+static int atlasScaled(GlyphAtlas * atlas, int size)
+{
+	return (size * atlas->ptsize + atlas->refsize - 1) / atlas->refsize;
+}
+
+static void atlasUnderline(GlyphAtlas * atlas, AtlasPen * pen)
+{
+	int offset, height;
+
+	if (TTF_FontUnderline(atlas->font, &offset, &height) && pen->maxx > pen->minx)
+	{
+		if (atlas->numpages == 0 && atlasAddPage(atlas) < 0)
+		{
+			return;
+		}
+		//stretch the middle of the white block so edges don't blend
+		atlasAddQuad(atlas, 0, (GLfloat)pen->x, pen->y + offset * atlas->scale, 
+			(pen->maxx - pen->minx) * atlas->scale, height * atlas->scale,
+			ATLAS_WHITESIZE / 2, ATLAS_WHITESIZE / 2, 0, 0, pen->fg);
+	}
+}
+
+int drawGlyphAtlasUNICODE(GlyphAtlas * atlas,
+	const uint16_t * text, int x, int y, SDL_Color fg)
+{
+	AtlasPen pen;
+
+	memset(&pen, 0, sizeof(pen));
+	pen.x = x;
+	pen.y = y;
+	pen.first = 1;
+	pen.fg = fg;
+	for (; *text; text++)
+	{
+		uint32_t ch = *text;
+		//surrogate pairs
+		if (ch >= 0xD800 && ch < 0xDC00 && text[1] >= 0xDC00 && text[1] <= 0xDFFF)
+		{
+			ch = 0x10000 + ((ch - 0xD800) << 10) + (text[1] - 0xDC00);
+			text++;
+		}
+		if (atlasDrawChar(atlas, &pen, ch) < 0)
+		{
+			break;
+		}
+	}
+	atlasUnderline(atlas, &pen);
+	return atlasScaled(atlas, pen.maxx - pen.minx);
+}
+
+int drawGlyphAtlasUTF8(GlyphAtlas * atlas,
+	const char * text, int x, int y, SDL_Color fg)
+{
+	uint32_t ch;
+	AtlasPen pen;
+
+	memset(&pen, 0, sizeof(pen));
+	pen.x = x;
+	pen.y = y;
+	pen.first = 1;
+	pen.fg = fg;
+	while ((ch = TTF_DecodeUTF8(&text)) != 0)
+	{
+		if (atlasDrawChar(atlas, &pen, ch) < 0)
+		{
+			break;
+		}
+	}
+	atlasUnderline(atlas, &pen);
+	return atlasScaled(atlas, pen.maxx - pen.minx);
+}
+
+void flushGlyphAtlas(GlyphAtlas * atlas, int width, int height)
+{
+	int i;
+
+	if (width <= 0 || height <= 0)
+	{
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		width = viewport[2];
+		height = viewport[3];
+	}
+	atlas->width = width;
+	atlas->height = height;
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, width, height, 0, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_2D);
+	if (atlas->sdf)
+	{
+		//inside the outline is at least half way up the distance field,
+		//blending would fade thin stems
+		glDisable(GL_BLEND);
+		glEnable(GL_ALPHA_TEST);
+		glAlphaFunc(GL_GEQUAL, 0.5f);
+	}
+	else
+	{
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+
+	//one draw call per atlas page
+	for (i = 0; i < atlas->numpages; i++)
+	{
+		AtlasPage * p = &atlas->pages[i];
+		if (p->numvertices == 0)
+		{
+			continue;
+		}
+		glBindTexture(GL_TEXTURE_2D, p->texture);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(AtlasVertex), &p->vertices[0].u);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(AtlasVertex), &p->vertices[0].r);
+		glVertexPointer(2, GL_FLOAT, sizeof(AtlasVertex), &p->vertices[0].x);
+		glDrawArrays(GL_QUADS, 0, p->numvertices);
+		p->numvertices = 0;
+	}
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopClientAttrib();
+	glPopAttrib();
+}
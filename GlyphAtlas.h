@@ -0,0 +1,38 @@
+#pragma once
+
+#include "SDL_ttf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//NOTE: draws text as batched GL quads, glyphs are rasterised once
+//into shared GL_ALPHA textures instead of a new surface per string
+typedef struct GlyphAtlas GlyphAtlas;
+
+//texsize: size of each atlas texture, 0 for 512
+extern GlyphAtlas * createGlyphAtlas(TTF_Font * font, int texsize);
+
+//keeps signed distance fields instead, so one atlas draws the font at
+//any size, open the font at the largest size needed
+extern GlyphAtlas * createGlyphAtlasSDF(TTF_Font * font, int texsize);
+
+//size the following strings are drawn at, distance field atlases only
+extern void setGlyphAtlasPtSize(GlyphAtlas * atlas, int ptsize);
+
+extern void freeGlyphAtlas(GlyphAtlas * atlas);
+
+//queue a string with its top left corner at (x, y), returns the width
+//TTF_SizeUNICODE (or TTF_SizeUNICODE_Scaled) would report
+extern int drawGlyphAtlasUNICODE(GlyphAtlas * atlas,
+	const uint16_t * text, int x, int y, SDL_Color fg);
+extern int drawGlyphAtlasUTF8(GlyphAtlas * atlas,
+	const char * text, int x, int y, SDL_Color fg);
+
+//draw everything queued, (x, y) coordinates span width x height
+//with the origin at the top left of the viewport
+extern void flushGlyphAtlas(GlyphAtlas * atlas, int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
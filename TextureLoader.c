@@ -1,20 +1,20 @@
 #include "TextureLoader.h"
+#include "SDL_image.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <memory.h>
 
+//NOTE: decoding is done by SDL_image, which also handles 8/16/32bpp,
+//palettized, RLE and top-down files in a single pass
 unsigned char * loadBMPRaw(const char * filename, 
 	unsigned int* outWidth, unsigned int* outHeight, 
 	int flipY, int flipToBGR)
 {
-	unsigned char header[54] = {0};
-	unsigned int dataPos;
-	unsigned int imageSize;
 	unsigned char * data;
-	unsigned int zeroByteSize = 0;
-	FILE * file;
+	int format;
+	int width, height;
 
 	if (!filename || !outWidth || !outHeight)
 	{
@@ -23,126 +23,20 @@ unsigned char * loadBMPRaw(const char * filename,
 	}
 	*outWidth = -1;
 	*outHeight = -1;
-	file = fopen(filename, "rb");
-	if (!file)
-	{
-		fprintf(stderr, "Open input bmp file error\n");
-		return NULL;
-	}
-	if (fread(header, 1, sizeof(header), file) != 54)
-	{ 
-		fprintf(stderr, "Read input bmp file header error\n");
-		fclose(file);
-		return NULL;
-	}
-	if (header[0] != 'B' || header[1] != 'M')
-	{
-		fprintf(stderr, "Not a correct BMP file (magic BM)\n");
-		fclose(file);
-		return NULL;
-	}
-	if (header[24 + 4] != 24 || header[24 + 5] != 0) //biBitCount
-	{
-		fprintf(stderr, "Not a correct BMP file (24bpp) \n");
-		fclose(file);
-		return NULL;
-	}
-	dataPos = (header[8 + 2]) | (header[8 + 3] << 8) | (header[8 + 4] << 16) | (header[8 + 5] << 24); //bfOffBits
-	imageSize = (header[32 + 2]) | (header[32 + 3] << 8) | (header[32 + 4] << 16) | (header[32 + 5] << 24); //biSizeImage
-	*outWidth = (header[16 + 2]) | (header[16 + 3] << 8) | (header[16 + 4] << 16) | (header[16 + 5] << 24); //biWidth
-	*outHeight = (header[16 + 6]) | (header[16 + 7] << 8) | (header[16 + 8] << 16) | (header[16 + 9] << 24); //biHeight
-	if (imageSize == 0)    
-	{
-		imageSize = (*outWidth) * (*outHeight) * 3;
-	}
-	zeroByteSize = (imageSize - (*outWidth) * (*outHeight) * 3) / (*outHeight);
-	if (zeroByteSize < 0)
-	{
-		fprintf(stderr, "zeroByteSize < 0\n");
-		fclose(file);
-		return NULL;
-	}
-#ifdef _DEBUG
-		fprintf(stderr, "[loadBMPRaw][%s]imageSize = %d >= (%d x %d x 3)\n", 
-			filename, imageSize, (*outWidth), (*outHeight));
-		fprintf(stderr, "[loadBMPRaw][%s]zeroByteSize = %d\n", 
-			filename, zeroByteSize);
-#endif
-	if (dataPos == 0)
+	//BMP stores B,G,R bottom-up, flipToBGR swaps it to R,G,B
+	format = flipToBGR ? IMG_PIXELS_RGB24 : IMG_PIXELS_BGR24;
+	if (flipY)
 	{
-		dataPos = 54;
+		format |= IMG_PIXELS_TOPDOWN;
 	}
-	data = (unsigned char *)malloc(imageSize * sizeof(unsigned char));
+	data = IMG_LoadBMPPixels(filename, format, &width, &height);
 	if (data == NULL)
 	{
-		fprintf(stderr, "Out of memory\n");
-		fclose(file);
+		fprintf(stderr, "Read input bmp file error\n");
 		return NULL;
 	}
-	//biSizeImage = ((((bi.biWidth * bi.biBitCount) + 31) & ~31) / 8) * bi.biHeight;
-	if (zeroByteSize == 0)
-	{
-		if (imageSize != fread(data, 1, imageSize, file))
-		{
-			fprintf(stderr, "Read input bmp file data error\n");
-			fclose(file);
-			return NULL;
-		}
-	}
-	else
-	{
-		unsigned int i;
-		unsigned char * p = data;
-		for (i = 0; i < *outHeight; i++)
-		{
-			unsigned int linesize = *outWidth * 3 + zeroByteSize;
-			if (linesize != fread(p, 1, linesize, file))
-			{
-				fprintf(stderr, "Read input bmp file data error\n");
-				fclose(file);
-				return NULL;
-			}
-			p += *outWidth * 3;
-		}
-	}
-	fclose(file);
-
-	if (flipY)
-	{
-		unsigned char * tmpBuffer;
-		int size;
-		unsigned int i;
-		size = (*outWidth) * 3;
-		tmpBuffer = (unsigned char *)malloc((*outWidth) * 3 * sizeof(unsigned char));
-		if (tmpBuffer == NULL)
-		{
-			fprintf(stderr, "Out of memory\n");
-			return NULL;
-		}
-		for (i = 0; i < (*outHeight) / 2; i++)
-		{
-			memcpy(tmpBuffer, data + (*outWidth) * 3 * i, size);
-			memcpy(data + (*outWidth) * 3 * i, data + (*outWidth) * 3 * ( (*outHeight) - i - 1), size);
-			memcpy(data + (*outWidth) * 3 * ((*outHeight) - i - 1), tmpBuffer, size);
-		}
-		free(tmpBuffer);
-	}
-	if (flipToBGR)
-	{
-		unsigned int i, j;
-		unsigned char * pPixel;
-		unsigned char tmpChanel;
-		for (i = 0; i < (*outHeight); i++)
-		{
-			for (j = 0; j < (*outWidth); j++)
-			{
-				pPixel = data + (*outWidth) * 3 * i + j * 3;
-				tmpChanel = *pPixel;
-				*pPixel = *(pPixel + 2);
-				*(pPixel + 2) = tmpChanel;
-			}
-		}
-	}
+	*outWidth = width;
+	*outHeight = height;
 	return data;
 }
 
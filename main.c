@@ -56,30 +56,60 @@ void display(void)
 
 	glTranslatef(0.0f, 0.0f, 0.0f);
 
-	if (textureContainsData) {
-		glDeleteTextures(1, &g_TextureArray[g_ID]);
+	if (!textureContainsData) {
+		glGenTextures(1, &g_TextureArray[g_ID]);
+		glBindTexture(GL_TEXTURE_2D, g_TextureArray[g_ID]);
+		
+		//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+		
+		//glTexImage2D(GL_TEXTURE_2D, 0, nOfColors, frame->w, frame->h, 0,
+		//			  texture_format, GL_UNSIGNED_BYTE, frame->pixels);
+		
+		SDL_LockSurface(screen);
+		//dumpBMPRaw("image1_out.bmp", screen->pixels, screen->w, screen->h);
+		//color depth
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB/*GL_RGBA*/, 
+			screen->w, screen->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 
+			screen->pixels);
+		SDL_UnlockSurface(screen);
+		SDL_ClearDirtyRects(screen);
+		textureContainsData = 1;
+	} else {
+		SDL_Rect *rects;
+		int i, numrects;
+
+		glBindTexture(GL_TEXTURE_2D, g_TextureArray[g_ID]);
+
+		//NOTE: only re-upload what changed since the last frame
+		numrects = SDL_GetDirtyRects(screen, &rects);
+		if (numrects != 0) {
+			SDL_LockSurface(screen);
+			if (numrects < 0) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 
+					screen->w, screen->h, GL_RGBA, GL_UNSIGNED_BYTE, 
+					screen->pixels);
+			} else {
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, screen->pitch / 4);
+				for (i = 0; i < numrects; ++i) {
+					glPixelStorei(GL_UNPACK_SKIP_PIXELS, rects[i].x);
+					glPixelStorei(GL_UNPACK_SKIP_ROWS, rects[i].y);
+					glTexSubImage2D(GL_TEXTURE_2D, 0, 
+						rects[i].x, rects[i].y, rects[i].w, rects[i].h, 
+						GL_RGBA, GL_UNSIGNED_BYTE, screen->pixels);
+				}
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+				glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+				glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+			}
+			SDL_UnlockSurface(screen);
+			SDL_ClearDirtyRects(screen);
+		}
 	}
 	
-	glGenTextures(1, &g_TextureArray[g_ID]);
-	glBindTexture(GL_TEXTURE_2D, g_TextureArray[g_ID]);
-	
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	
-	//glTexImage2D(GL_TEXTURE_2D, 0, nOfColors, frame->w, frame->h, 0,
-	//			  texture_format, GL_UNSIGNED_BYTE, frame->pixels);
-	
-	SDL_LockSurface(screen);
-	//dumpBMPRaw("image1_out.bmp", screen->pixels, screen->w, screen->h);
-	//color depth
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB/*GL_RGBA*/, 
-		screen->w, screen->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 
-		screen->pixels);
-	SDL_UnlockSurface(screen);
-	
 	glScalef(1.0f, -1.0f, 1.0f);
 
 	glBegin(GL_QUADS);
@@ -93,8 +123,7 @@ void display(void)
 		glVertex3f(1.0f, 1.0f, 0.0f);
 	glEnd();
 
-	//NOTE: avoid memory leak
-	glDeleteTextures(1, &g_TextureArray[g_ID]);
+	//test_ttf_atlas(screen->w, screen->h);
 
 	glutSwapBuffers();
 	
@@ -329,6 +358,10 @@ void init()
 		640, 480, 32,
 		MY_Rmask, MY_Gmask, MY_Bmask, MY_Amask
 		);
+	//the format SDL_DisplayFormat() converts to
+	SDL_SetVideoSurface(screen);
+	//only re-upload the parts of the screen that were drawn to
+	SDL_EnableDirtyRects(screen, 1);
 	SDL_ext_fillRectangle(screen, 0xCC, 0xCC, 0xCC, 0xff, 0, 0, screen->w, screen->h); 
 	//test_bmp(screen);
 	//test_ttf(screen);
@@ -395,6 +428,11 @@ void run(int argc, char **argv)
 
 int main(int argc, char* argv[])
 {
+	//sdlport -test runs the self checks in test.c and exits
+	if (argc > 1 && strcmp(argv[1], "-test") == 0)
+	{
+		return test_checks() ? 1 : 0;
+	}
 	printf("Hello World!\n");
 	init();
 	run(argc, argv);
@@ -0,0 +1,418 @@
+/*
+    SDL - Simple DirectMedia Layer
+    Copyright (C) 1997-2012 Sam Lantinga
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Sam Lantinga
+    slouken@libsdl.org
+*/
+
+/*
+ * RLE encoding for software colorkey and alpha-channel acceleration
+ *
+ * The first blit of a surface with SDL_RLEACCELOK set encodes it for the
+ * surface it is being blitted to.  Each row becomes a list of runs
+ *
+ *	uint16_t skip, run;	transparent pixels, then visible ones
+ *	run pixels, padded to 4 bytes
+ *
+ * ended by a run of 0.  Visible pixels are stored already converted to
+ * the destination format, so a colorkeyed row is a memcpy() per run and
+ * the transparent pixels between runs cost nothing.
+ *
+ * ARGB8888 surfaces with an alpha channel get two lists per row, one for
+ * the opaque pixels, which are copied under the destination alpha byte,
+ * and one for the translucent ones, which are blended exactly as
+ * BlitRGBtoRGBPixelAlpha() does.
+ *
+ * Unlike SDL proper the original pixels are kept, so locking the surface
+ * just throws the encoding away, and the next blit makes it again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include "SDL_video.h"
+
+void SDL_InvalidateMap(SDL_BlitMap *map);
+
+#define RLE_PAD(n)	(((n) + 3) & ~3)
+
+/* What each source pixel is to the encoder */
+#define RLE_SKIP	0
+#define RLE_OPAQUE	1
+#define RLE_TRANSLUCENT	2
+
+typedef struct RLEData {
+	int alpha;		/* two lists per row, else one */
+	int bpp;		/* of the stored pixels */
+	uint32_t *rows;		/* offset of each list in data */
+	uint8_t *data;
+} RLEData;
+
+/* Sorts one source row into kinds and converts the visible pixels */
+static void RLEConvertRow(SDL_Surface *surface, int y, int alpha,
+			  uint8_t *kind, uint8_t *pixels)
+{
+	SDL_PixelFormat *srcfmt = surface->format;
+	SDL_PixelFormat *dstfmt = surface->map->dst->format;
+	uint8_t *table = surface->map->table;
+	uint8_t *src = (uint8_t *)surface->pixels + y * surface->pitch;
+	int srcbpp = srcfmt->BytesPerPixel;
+	int dstbpp = dstfmt->BytesPerPixel;
+	int width = surface->w;
+	int x;
+
+	if ( alpha ) {
+		uint32_t *srcp = (uint32_t *)src;
+		uint32_t *dstp = (uint32_t *)pixels;
+
+		for ( x = 0; x < width; ++x ) {
+			uint32_t s = srcp[x];
+			uint32_t a = s >> 24;
+
+			if ( a == SDL_ALPHA_OPAQUE ) {
+				kind[x] = RLE_OPAQUE;
+				dstp[x] = s & 0x00ffffff;
+			} else {
+				kind[x] = a ? RLE_TRANSLUCENT : RLE_SKIP;
+				dstp[x] = s;
+			}
+		}
+	} else if ( srcbpp == 1 ) {
+		/* Same lookups as the Blit1to*Key blitters */
+		uint32_t ckey = srcfmt->colorkey;
+		int mapbpp = (dstbpp == 3) ? 4 : dstbpp;
+
+		for ( x = 0; x < width; ++x ) {
+			kind[x] = (src[x] != ckey) ? RLE_OPAQUE : RLE_SKIP;
+			if ( table == NULL ) {
+				pixels[x] = src[x];
+			} else if ( dstbpp == 1 ) {
+				pixels[x] = table[src[x]];
+			} else {
+				memcpy(pixels + x * dstbpp,
+				       table + src[x] * mapbpp, dstbpp);
+			}
+		}
+	} else if ( srcbpp == 2 && surface->map->identity ) {
+		/* Blit2to2Key copies the unused bit too */
+		uint16_t *srcp = (uint16_t *)src;
+		uint16_t rgbmask = (uint16_t)~srcfmt->Amask;
+		uint16_t ckey = (uint16_t)srcfmt->colorkey & rgbmask;
+
+		for ( x = 0; x < width; ++x ) {
+			kind[x] = ((srcp[x] & rgbmask) != ckey) ? RLE_OPAQUE : RLE_SKIP;
+		}
+		memcpy(pixels, src, width * 2);
+	} else {
+		/* Same conversions as BlitNtoNKey and BlitNtoNKeyCopyAlpha */
+		uint32_t rgbmask = ~srcfmt->Amask;
+		uint32_t ckey = srcfmt->colorkey & rgbmask;
+		unsigned alpha = dstfmt->Amask ? srcfmt->alpha : 0;
+		int copy_alpha = (srcfmt->Amask && dstfmt->Amask);
+
+		for ( x = 0; x < width; ++x ) {
+			uint8_t *dst = pixels + x * dstbpp;
+			uint32_t Pixel;
+			unsigned sR, sG, sB, sA;
+
+			RETRIEVE_RGB_PIXEL(src + x * srcbpp, srcbpp, Pixel);
+			if ( (Pixel & rgbmask) == ckey ) {
+				kind[x] = RLE_SKIP;
+				continue;
+			}
+			kind[x] = RLE_OPAQUE;
+			if ( copy_alpha ) {
+				RGBA_FROM_PIXEL(Pixel, srcfmt, sR, sG, sB, sA);
+				ASSEMBLE_RGBA(dst, dstbpp, dstfmt, sR, sG, sB, sA);
+			} else {
+				RGB_FROM_PIXEL(Pixel, srcfmt, sR, sG, sB);
+				ASSEMBLE_RGBA(dst, dstbpp, dstfmt, sR, sG, sB, alpha);
+			}
+		}
+	}
+}
+
+/* Writes the runs of one kind of pixel, or just measures them if out is
+   NULL, and returns the bytes used */
+static size_t RLEEncodeList(uint8_t *out, const uint8_t *kind,
+			    const uint8_t *pixels, int bpp, int width, int want)
+{
+	size_t used = 0;
+	int x = 0;
+	int start, skip, run;
+
+	for ( ; ; ) {
+		start = x;
+		while ( x < width && kind[x] != want ) {
+			++x;
+		}
+		skip = x - start;
+		start = x;
+		while ( x < width && kind[x] == want ) {
+			++x;
+		}
+		run = x - start;
+		if ( out ) {
+			uint16_t *hdr = (uint16_t *)(out + used);
+
+			hdr[0] = (uint16_t)skip;
+			hdr[1] = (uint16_t)run;
+			memcpy(out + used + 4, pixels + start * bpp, run * bpp);
+			memset(out + used + 4 + run * bpp, 0,
+			       RLE_PAD(run * bpp) - run * bpp);
+		}
+		used += 4 + RLE_PAD(run * bpp);
+		if ( run == 0 ) {
+			break;
+		}
+	}
+	return used;
+}
+
+int SDL_RLESurface(SDL_Surface *surface)
+{
+	SDL_Surface *dst = surface->map->dst;
+	SDL_PixelFormat *srcfmt = surface->format;
+	SDL_PixelFormat *dstfmt;
+	RLEData *rle;
+	uint8_t *kind, *pixels;
+	size_t size;
+	int alpha, lists, bpp;
+	int pass, y;
+
+	if ( dst == NULL || dst == surface || surface->pixels == NULL ||
+	     surface->w <= 0 || surface->w > 65535 || surface->h <= 0 ||
+	     srcfmt->BitsPerPixel < 8 ) {
+		return(-1);
+	}
+	dstfmt = dst->format;
+
+	/* Only the blits the encoding reproduces exactly */
+	if ( (surface->flags & SDL_SRCALPHA) && srcfmt->Amask ) {
+		if ( (surface->flags & SDL_SRCCOLORKEY) ||
+		     srcfmt->BytesPerPixel != 4 ||
+		     srcfmt->Amask != 0xff000000 ||
+		     dstfmt->BytesPerPixel != 4 ||
+		     srcfmt->Rmask != dstfmt->Rmask ||
+		     srcfmt->Gmask != dstfmt->Gmask ||
+		     srcfmt->Bmask != dstfmt->Bmask ) {
+			return(-1);
+		}
+		alpha = 1;
+	} else if ( surface->flags & SDL_SRCCOLORKEY ) {
+		if ( ((surface->flags & SDL_SRCALPHA) &&
+		      srcfmt->alpha != SDL_ALPHA_OPAQUE) ||
+		     (dstfmt->BytesPerPixel == 1 && srcfmt->BytesPerPixel != 1) ) {
+			return(-1);
+		}
+		alpha = 0;
+	} else {
+		return(-1);
+	}
+	lists = alpha ? 2 : 1;
+	bpp = dstfmt->BytesPerPixel;
+
+	kind = (uint8_t *)malloc(RLE_PAD(surface->w) + surface->w * 4);
+	if ( kind == NULL ) {
+		fprintf(stderr, "Out of memory\n");
+		return(-1);
+	}
+	pixels = kind + RLE_PAD(surface->w);
+
+	/* Measure, then encode */
+	rle = NULL;
+	size = 0;
+	for ( pass = 0; pass < 2; ++pass ) {
+		uint8_t *out = NULL;
+
+		if ( pass ) {
+			rle = (RLEData *)malloc(sizeof(*rle) +
+				surface->h * lists * sizeof(uint32_t) + size);
+			if ( rle == NULL ) {
+				free(kind);
+				fprintf(stderr, "Out of memory\n");
+				return(-1);
+			}
+			rle->alpha = alpha;
+			rle->bpp = bpp;
+			rle->rows = (uint32_t *)(rle + 1);
+			rle->data = (uint8_t *)(rle->rows + surface->h * lists);
+			out = rle->data;
+			size = 0;
+		}
+		for ( y = 0; y < surface->h; ++y ) {
+			RLEConvertRow(surface, y, alpha, kind, pixels);
+			if ( out ) {
+				rle->rows[y * lists] = (uint32_t)size;
+			}
+			size += RLEEncodeList(out ? out + size : NULL,
+				kind, pixels, bpp, surface->w, RLE_OPAQUE);
+			if ( alpha ) {
+				if ( out ) {
+					rle->rows[y * lists + 1] = (uint32_t)size;
+				}
+				size += RLEEncodeList(out ? out + size : NULL,
+					kind, pixels, 4, surface->w, RLE_TRANSLUCENT);
+			}
+		}
+	}
+	free(kind);
+
+	surface->map->sw_data->aux_data = rle;
+	surface->flags |= SDL_RLEACCEL;
+	return(0);
+}
+
+void SDL_UnRLESurface(SDL_Surface *surface)
+{
+	if ( (surface->flags & SDL_RLEACCEL) != SDL_RLEACCEL ) {
+		return;
+	}
+	surface->flags &= ~SDL_RLEACCEL;
+	if ( surface->map ) {
+		free(surface->map->sw_data->aux_data);
+		surface->map->sw_data->aux_data = NULL;
+		/* The blit has to be worked out again */
+		SDL_InvalidateMap(surface->map);
+	}
+}
+
+/* Copies the opaque runs of a row list that fall in [x0, x1), those of
+   alpha channel surfaces leave the top byte of the destination alone */
+static void RLEBlitOpaque(const uint8_t *list, uint8_t *dstrow,
+			  int x0, int x1, int bpp, int keep_alpha)
+{
+	int x = 0;
+
+	for ( ; ; ) {
+		int skip = ((const uint16_t *)list)[0];
+		int run = ((const uint16_t *)list)[1];
+		int start, end;
+
+		if ( run == 0 ) {
+			break;
+		}
+		x += skip;
+		if ( x >= x1 ) {
+			break;
+		}
+		start = (x < x0) ? x0 : x;
+		end = (x + run > x1) ? x1 : x + run;
+		if ( start < end ) {
+			const uint8_t *src = list + 4 + (start - x) * bpp;
+			uint8_t *dst = dstrow + (start - x0) * bpp;
+
+			if ( keep_alpha ) {
+				const uint32_t *srcp = (const uint32_t *)src;
+				uint32_t *dstp = (uint32_t *)dst;
+				int n = end - start;
+
+				while ( n-- ) {
+					*dstp = *srcp++ | (*dstp & 0xff000000);
+					++dstp;
+				}
+			} else {
+				memcpy(dst, src, (end - start) * bpp);
+			}
+		}
+		x += run;
+		list += 4 + RLE_PAD(run * bpp);
+	}
+}
+
+/* Blends the translucent ARGB8888 runs of a row list in [x0, x1) */
+static void RLEBlitTranslucent(const uint8_t *list, uint8_t *dstrow,
+			       int x0, int x1)
+{
+	int x = 0;
+
+	for ( ; ; ) {
+		int skip = ((const uint16_t *)list)[0];
+		int run = ((const uint16_t *)list)[1];
+		int start, end;
+
+		if ( run == 0 ) {
+			break;
+		}
+		x += skip;
+		if ( x >= x1 ) {
+			break;
+		}
+		start = (x < x0) ? x0 : x;
+		end = (x + run > x1) ? x1 : x + run;
+		if ( start < end ) {
+			const uint32_t *srcp = (const uint32_t *)(list + 4) +
+						(start - x);
+			uint32_t *dstp = (uint32_t *)dstrow + (start - x0);
+			int n = end - start;
+
+			while ( n-- ) {
+				uint32_t s = *srcp++;
+				uint32_t d = *dstp;
+				uint32_t alpha = s >> 24;
+				uint32_t dalpha = d & 0xff000000;
+				uint32_t s1 = s & 0xff00ff;
+				uint32_t d1 = d & 0xff00ff;
+
+				d1 = (d1 + ((s1 - d1) * alpha >> 8)) & 0xff00ff;
+				s &= 0xff00;
+				d &= 0xff00;
+				d = (d + ((s - d) * alpha >> 8)) & 0xff00;
+				*dstp++ = d1 | d | dalpha;
+			}
+		}
+		x += run;
+		list += 4 + RLE_PAD(run * 4);
+	}
+}
+
+int SDL_RLEBlit(SDL_Surface *src, SDL_Rect *srcrect,
+		SDL_Surface *dst, SDL_Rect *dstrect)
+{
+	RLEData *rle = (RLEData *)src->map->sw_data->aux_data;
+	int lists = rle->alpha ? 2 : 1;
+	int x0 = srcrect->x;
+	int x1 = srcrect->x + srcrect->w;
+	int dst_locked = 0;
+	uint8_t *dstrow;
+	int y;
+
+	if ( SDL_MUSTLOCK(dst) ) {
+		if ( SDL_LockSurface(dst) < 0 ) {
+			return(-1);
+		}
+		dst_locked = 1;
+	}
+	dstrow = (uint8_t *)dst->pixels + dstrect->y * dst->pitch +
+		 dstrect->x * rle->bpp;
+	for ( y = srcrect->y; y < srcrect->y + srcrect->h; ++y ) {
+		const uint32_t *rows = rle->rows + y * lists;
+
+		RLEBlitOpaque(rle->data + rows[0], dstrow, x0, x1,
+			      rle->bpp, rle->alpha);
+		if ( rle->alpha ) {
+			RLEBlitTranslucent(rle->data + rows[1], dstrow, x0, x1);
+		}
+		dstrow += dst->pitch;
+	}
+	if ( dst_locked ) {
+		SDL_UnlockSurface(dst);
+	}
+	return(0);
+}
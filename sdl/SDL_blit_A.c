@@ -77,9 +77,7 @@ static void BlitNto1SurfaceAlpha(SDL_BlitInfo *info)
 			  ((dG>>5)<<(2))|
 			  ((dB>>6)<<(0));
 		} else {
-		    *dst = palmap[((dR>>5)<<(3+2))|
-				  ((dG>>5)<<(2))  |
-				  ((dB>>6)<<(0))];
+		    *dst = palmap[PALETTE_CUBE_INDEX(dR, dG, dB)];
 		}
 		dst++;
 		src += srcbpp;
@@ -130,9 +128,7 @@ static void BlitNto1PixelAlpha(SDL_BlitInfo *info)
 			  ((dG>>5)<<(2))|
 			  ((dB>>6)<<(0));
 		} else {
-		    *dst = palmap[((dR>>5)<<(3+2))|
-				  ((dG>>5)<<(2))  |
-				  ((dB>>6)<<(0))  ];
+		    *dst = palmap[PALETTE_CUBE_INDEX(dR, dG, dB)];
 		}
 		dst++;
 		src += srcbpp;
@@ -185,9 +181,7 @@ static void BlitNto1SurfaceAlphaKey(SDL_BlitInfo *info)
 			      ((dG>>5)<<(2)) |
 			      ((dB>>6)<<(0));
 		    } else {
-			*dst = palmap[((dR>>5)<<(3+2))|
-				      ((dG>>5)<<(2))  |
-				      ((dB>>6)<<(0))  ];
+			*dst = palmap[PALETTE_CUBE_INDEX(dR, dG, dB)];
 		    }
 		}
 		dst++;
@@ -25,6 +25,13 @@
 #include <stdio.h>
 #endif
 #include "SDL_video.h"
+#include "SDL_cpuinfo.h"
+#if SDL_SSE2_INTRINSICS
+#include <emmintrin.h>
+#endif
+#if SDL_SSSE3_INTRINSICS
+#include <tmmintrin.h>
+#endif
 
 /* Functions to blit from N-bit surfaces to other surfaces */
 
@@ -46,6 +53,12 @@
 	              (((src)&0x0000E000)>>11)| \
 	              (((src)&0x000000C0)>>6)); \
 }
+/* Index into the palette cube, see PALETTE_CUBE_INDEX() */
+#define RGB888_CUBE(dst, src) { \
+	dst = (((src)&0x00F80000)>>9)| \
+	      (((src)&0x0000F800)>>6)| \
+	      (((src)&0x000000F8)>>3); \
+}
 static void Blit_RGB888_index8(SDL_BlitInfo *info)
 {
 #ifndef USE_DUFFS_LOOP
@@ -104,37 +117,37 @@ static void Blit_RGB888_index8(SDL_BlitInfo *info)
 		while ( height-- ) {
 #ifdef USE_DUFFS_LOOP
 			DUFFS_LOOP(
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
 			, width);
 #else
 			for ( c=width/4; c; --c ) {
 				/* Pack RGB into 8bit pixel */
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
 			}
 			switch ( width & 3 ) {
 				case 3:
-					RGB888_RGB332(Pixel, *src);
+					RGB888_CUBE(Pixel, *src);
 					*dst++ = map[Pixel];
 					++src;
 				case 2:
-					RGB888_RGB332(Pixel, *src);
+					RGB888_CUBE(Pixel, *src);
 					*dst++ = map[Pixel];
 					++src;
 				case 1:
-					RGB888_RGB332(Pixel, *src);
+					RGB888_CUBE(Pixel, *src);
 					*dst++ = map[Pixel];
 					++src;
 			}
@@ -1025,7 +1038,7 @@ static void Blit_RGB888_index8_map(SDL_BlitInfo *info)
 #ifdef USE_DUFFS_LOOP
 	while ( height-- ) {
 		DUFFS_LOOP(
-			RGB888_RGB332(Pixel, *src);
+			RGB888_CUBE(Pixel, *src);
 			*dst++ = map[Pixel];
 			++src;
 		, width);
@@ -1036,30 +1049,30 @@ static void Blit_RGB888_index8_map(SDL_BlitInfo *info)
 	while ( height-- ) {
 		for ( c=width/4; c; --c ) {
 			/* Pack RGB into 8bit pixel */
-			RGB888_RGB332(Pixel, *src);
+			RGB888_CUBE(Pixel, *src);
 			*dst++ = map[Pixel];
 			++src;
-			RGB888_RGB332(Pixel, *src);
+			RGB888_CUBE(Pixel, *src);
 			*dst++ = map[Pixel];
 			++src;
-			RGB888_RGB332(Pixel, *src);
+			RGB888_CUBE(Pixel, *src);
 			*dst++ = map[Pixel];
 			++src;
-			RGB888_RGB332(Pixel, *src);
+			RGB888_CUBE(Pixel, *src);
 			*dst++ = map[Pixel];
 			++src;
 		}
 		switch ( width & 3 ) {
 			case 3:
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
 			case 2:
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
 			case 1:
-				RGB888_RGB332(Pixel, *src);
+				RGB888_CUBE(Pixel, *src);
 				*dst++ = map[Pixel];
 				++src;
 		}
@@ -1134,9 +1147,7 @@ static void BlitNto1(SDL_BlitInfo *info)
 								sR, sG, sB);
 				if ( 1 ) {
 				  	/* Pack RGB into 8bit pixel */
-				  	*dst = map[((sR>>5)<<(3+2))|
-						   ((sG>>5)<<(2))  |
-						   ((sB>>6)<<(0))  ];
+				  	*dst = map[PALETTE_CUBE_INDEX(sR, sG, sB)];
 				}
 				dst++;
 				src += srcbpp;
@@ -1147,9 +1158,7 @@ static void BlitNto1(SDL_BlitInfo *info)
 								sR, sG, sB);
 				if ( 1 ) {
 				  	/* Pack RGB into 8bit pixel */
-				  	*dst = map[((sR>>5)<<(3+2))|
-						   ((sG>>5)<<(2))  |
-						   ((sB>>6)<<(0))  ];
+				  	*dst = map[PALETTE_CUBE_INDEX(sR, sG, sB)];
 				}
 				dst++;
 				src += srcbpp;
@@ -1161,6 +1170,72 @@ static void BlitNto1(SDL_BlitInfo *info)
 	}
 }
 
+/* Ordered dithering through the palette cube: each pixel is moved by a
+   4x4 Bayer threshold scaled to the spacing of the palette before it is
+   looked up, so gradients turn into patterns instead of bands */
+static const uint8_t dither_bayer4[16] = {
+	 0,  8,  2, 10,
+	12,  4, 14,  6,
+	 3, 11,  1,  9,
+	15,  7, 13,  5
+};
+#define DITHER_CHANNEL(v, o) \
+	(((v)+(o) < 0) ? 0 : (((v)+(o) > 255) ? 255 : (v)+(o)))
+static void BlitNto1Dither(SDL_BlitInfo *info)
+{
+	int width, height;
+	uint8_t *src;
+	const uint8_t *map;
+	uint8_t *dst;
+	int srcskip, dstskip;
+	int srcbpp;
+	uint32_t Pixel;
+	int  sR, sG, sB;
+	SDL_PixelFormat *srcfmt;
+	int offset[16];
+	int spread;
+	int x, y, i;
+
+	/* Set up some basic variables */
+	width = info->d_width;
+	height = info->d_height;
+	src = info->s_pixels;
+	srcskip = info->s_skip;
+	dst = info->d_pixels;
+	dstskip = info->d_skip;
+	map = info->table;
+	srcfmt = info->src;
+	srcbpp = srcfmt->BytesPerPixel;
+
+	/* About the distance between neighbours in a palette spread evenly
+	   over the color cube */
+	spread = 256;
+	for ( i=2; i*i*i <= info->dst->palette->ncolors; ++i ) {
+		spread = 256 / i;
+	}
+	for ( i=0; i<16; ++i ) {
+		offset[i] = ((2*dither_bayer4[i] - 15) * spread) / 32;
+	}
+
+	for ( y=0; y<height; ++y ) {
+		const int *row = &offset[(y & 3) * 4];
+
+		for ( x=0; x<width; ++x ) {
+			int o = row[x & 3];
+
+			DISEMBLE_RGB(src, srcbpp, srcfmt, Pixel, sR, sG, sB);
+			*dst = map[PALETTE_CUBE_INDEX(DITHER_CHANNEL(sR, o),
+						      DITHER_CHANNEL(sG, o),
+						      DITHER_CHANNEL(sB, o))];
+			dst++;
+			src += srcbpp;
+		}
+		src += srcskip;
+		dst += dstskip;
+	}
+}
+#undef DITHER_CHANNEL
+
 /* blits 32 bit RGB<->RGBA with both surfaces having the same R,G,B fields */
 static void Blit4to4MaskAlpha(SDL_BlitInfo *info)
 {
@@ -1269,6 +1344,222 @@ static void BlitNtoNCopyAlpha(SDL_BlitInfo *info)
 	}
 }
 
+/* Blits between 24 and 32 bit formats whose channels are all whole bytes
+   only move bytes around: every destination byte is either a byte of the
+   source pixel or a constant (the alpha value, or zero for unused bits).
+   This gives the same pixels as BlitNtoN() / BlitNtoNCopyAlpha().
+ */
+#define SWIZZLE_CONST	0x80	/* not a source byte, use fill[] */
+
+struct swizzle {
+	int srcbpp;
+	int dstbpp;
+	uint8_t index[4];	/* source byte of each destination byte */
+	uint8_t fill[4];	/* destination byte if index is SWIZZLE_CONST */
+};
+
+/* Which byte of a bpp byte pixel holds the bits at shift */
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define SWIZZLE_BYTE(bpp, shift)	((shift) / 8)
+#else
+#define SWIZZLE_BYTE(bpp, shift)	((bpp) - 1 - (shift) / 8)
+#endif
+
+static int Swizzle_Channel(int bpp, uint32_t mask, uint8_t loss, uint8_t shift)
+{
+	if ( mask == 0 || loss != 0 || (shift & 7) != 0 || shift/8 >= bpp ) {
+		return(-1);
+	}
+	return(SWIZZLE_BYTE(bpp, shift));
+}
+
+static int Swizzle_Setup(SDL_PixelFormat *srcfmt, SDL_PixelFormat *dstfmt,
+					struct swizzle *swz)
+{
+	int srcbpp = srcfmt->BytesPerPixel;
+	int dstbpp = dstfmt->BytesPerPixel;
+	int sR, sG, sB, sA, dR, dG, dB, dA;
+	int i;
+
+	if ( (srcbpp != 3 && srcbpp != 4) || (dstbpp != 3 && dstbpp != 4) ) {
+		return(-1);
+	}
+	sR = Swizzle_Channel(srcbpp, srcfmt->Rmask, srcfmt->Rloss, srcfmt->Rshift);
+	sG = Swizzle_Channel(srcbpp, srcfmt->Gmask, srcfmt->Gloss, srcfmt->Gshift);
+	sB = Swizzle_Channel(srcbpp, srcfmt->Bmask, srcfmt->Bloss, srcfmt->Bshift);
+	dR = Swizzle_Channel(dstbpp, dstfmt->Rmask, dstfmt->Rloss, dstfmt->Rshift);
+	dG = Swizzle_Channel(dstbpp, dstfmt->Gmask, dstfmt->Gloss, dstfmt->Gshift);
+	dB = Swizzle_Channel(dstbpp, dstfmt->Bmask, dstfmt->Bloss, dstfmt->Bshift);
+	if ( sR < 0 || sG < 0 || sB < 0 || dR < 0 || dG < 0 || dB < 0 ) {
+		return(-1);
+	}
+	/* ASSEMBLE_RGB only stores the colour bytes of 24 bit pixels */
+	if ( dstbpp == 3 && dstfmt->Amask ) {
+		return(-1);
+	}
+
+	swz->srcbpp = srcbpp;
+	swz->dstbpp = dstbpp;
+	for ( i=0; i<4; ++i ) {
+		swz->index[i] = SWIZZLE_CONST;
+		swz->fill[i] = 0;
+	}
+	swz->index[dR] = (uint8_t)sR;
+	swz->index[dG] = (uint8_t)sG;
+	swz->index[dB] = (uint8_t)sB;
+	if ( dstfmt->Amask ) {
+		dA = Swizzle_Channel(dstbpp, dstfmt->Amask,
+					dstfmt->Aloss, dstfmt->Ashift);
+		if ( dA < 0 ) {
+			return(-1);
+		}
+		if ( srcfmt->Amask ) {
+			/* COPY_ALPHA */
+			sA = Swizzle_Channel(srcbpp, srcfmt->Amask,
+					srcfmt->Aloss, srcfmt->Ashift);
+			if ( sA < 0 ) {
+				return(-1);
+			}
+			swz->index[dA] = (uint8_t)sA;
+		} else {
+			/* SET_ALPHA */
+			swz->fill[dA] = srcfmt->alpha;
+		}
+	}
+	return(0);
+}
+
+static void BlitNtoNSwizzle(SDL_BlitInfo *info)
+{
+	int width = info->d_width;
+	int height = info->d_height;
+	uint8_t *src = info->s_pixels;
+	int srcskip = info->s_skip;
+	uint8_t *dst = info->d_pixels;
+	int dstskip = info->d_skip;
+	struct swizzle swz;
+	int srcbpp, dstbpp;
+	int i0, i1, i2, i3;
+	uint8_t f0, f1, f2, f3;
+
+	Swizzle_Setup(info->src, info->dst, &swz);
+	srcbpp = swz.srcbpp;
+	dstbpp = swz.dstbpp;
+	i0 = swz.index[0]; i1 = swz.index[1];
+	i2 = swz.index[2]; i3 = swz.index[3];
+	f0 = swz.fill[0]; f1 = swz.fill[1];
+	f2 = swz.fill[2]; f3 = swz.fill[3];
+
+	if ( dstbpp == 4 ) {
+		while ( height-- ) {
+			DUFFS_LOOP(
+			{
+				dst[0] = i0 == SWIZZLE_CONST ? f0 : src[i0];
+				dst[1] = i1 == SWIZZLE_CONST ? f1 : src[i1];
+				dst[2] = i2 == SWIZZLE_CONST ? f2 : src[i2];
+				dst[3] = i3 == SWIZZLE_CONST ? f3 : src[i3];
+				dst += 4;
+				src += srcbpp;
+			},
+			width);
+			src += srcskip;
+			dst += dstskip;
+		}
+	} else {
+		/* 24 bit destinations take exactly the three colour bytes */
+		while ( height-- ) {
+			DUFFS_LOOP(
+			{
+				dst[0] = src[i0];
+				dst[1] = src[i1];
+				dst[2] = src[i2];
+				dst += 3;
+				src += srcbpp;
+			},
+			width);
+			src += srcskip;
+			dst += dstskip;
+		}
+	}
+}
+
+#if SDL_SSSE3_INTRINSICS
+/* The pshufb control and fill vectors for four pixels of a swizzle */
+static void Swizzle_Control(const struct swizzle *swz,
+					__m128i *vcontrol, __m128i *vfill)
+{
+	uint8_t control[16], fill[16];
+	int i, j;
+
+	memset(control, 0x80, sizeof(control));
+	memset(fill, 0, sizeof(fill));
+	for ( i=0; i<4; ++i ) {
+		for ( j=0; j<swz->dstbpp; ++j ) {
+			if ( swz->index[j] != SWIZZLE_CONST ) {
+				control[i*swz->dstbpp+j] =
+					(uint8_t)(i*swz->srcbpp + swz->index[j]);
+			} else {
+				fill[i*swz->dstbpp+j] = swz->fill[j];
+			}
+		}
+	}
+	*vcontrol = _mm_loadu_si128((const __m128i *)control);
+	*vfill = _mm_loadu_si128((const __m128i *)fill);
+}
+
+/* Four pixels per pshufb, the control picks each destination byte out of
+   the 16 source bytes loaded, or zero, and the fill is or'ed in after.
+ */
+static void BlitNtoNSwizzleSSSE3(SDL_BlitInfo *info)
+{
+	int width = info->d_width;
+	int height = info->d_height;
+	uint8_t *src = info->s_pixels;
+	int srcskip = info->s_skip;
+	uint8_t *dst = info->d_pixels;
+	int dstskip = info->d_skip;
+	struct swizzle swz;
+	int srcbpp, dstbpp, vecwidth;
+	__m128i vcontrol, vfill;
+	int j;
+
+	Swizzle_Setup(info->src, info->dst, &swz);
+	srcbpp = swz.srcbpp;
+	dstbpp = swz.dstbpp;
+	Swizzle_Control(&swz, &vcontrol, &vfill);
+
+	/* Each load reads 16 bytes, 24 bit rows must have that many left */
+	vecwidth = srcbpp == 4 ? width : width - 2;
+
+	while ( height-- ) {
+		int n = 0;
+		for ( ; n+4 <= vecwidth; n += 4 ) {
+			__m128i v = _mm_loadu_si128((const __m128i *)src);
+			v = _mm_or_si128(_mm_shuffle_epi8(v, vcontrol), vfill);
+			if ( dstbpp == 4 ) {
+				_mm_storeu_si128((__m128i *)dst, v);
+			} else {
+				_mm_storel_epi64((__m128i *)dst, v);
+				*(uint32_t *)(dst + 8) =
+					(uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+			}
+			src += 4*srcbpp;
+			dst += 4*dstbpp;
+		}
+		for ( ; n < width; ++n ) {
+			for ( j=0; j<dstbpp; ++j ) {
+				dst[j] = swz.index[j] == SWIZZLE_CONST ?
+					swz.fill[j] : src[swz.index[j]];
+			}
+			src += srcbpp;
+			dst += dstbpp;
+		}
+		src += srcskip;
+		dst += dstskip;
+	}
+}
+#endif /* SDL_SSSE3_INTRINSICS */
+
 static void BlitNto1Key(SDL_BlitInfo *info)
 {
 	int width = info->d_width;
@@ -1316,9 +1607,7 @@ static void BlitNto1Key(SDL_BlitInfo *info)
 								sR, sG, sB);
 				if ( (Pixel & rgbmask) != ckey ) {
 				  	/* Pack RGB into 8bit pixel */
-				  	*dst = (uint8_t)palmap[((sR>>5)<<(3+2))|
-							             ((sG>>5)<<(2))  |
-							             ((sB>>6)<<(0))  ];
+				  	*dst = palmap[PALETTE_CUBE_INDEX(sR, sG, sB)];
 				}
 				dst++;
 				src += srcbpp;
@@ -1444,6 +1733,198 @@ static void BlitNtoNKeyCopyAlpha(SDL_BlitInfo *info)
 	}
 }
 
+#if SDL_SSE2_INTRINSICS
+/* 32 bit to 32 bit with the same colour channels: BlitNtoNKey() and
+   BlitNtoNKeyCopyAlpha() come down to (Pixel & keep) | set.
+ */
+static int Key4to4_Setup(SDL_PixelFormat *srcfmt, SDL_PixelFormat *dstfmt,
+				uint32_t *keep, uint32_t *set)
+{
+	if ( srcfmt->BytesPerPixel != 4 || dstfmt->BytesPerPixel != 4 ||
+	     srcfmt->Rmask != dstfmt->Rmask ||
+	     srcfmt->Gmask != dstfmt->Gmask ||
+	     srcfmt->Bmask != dstfmt->Bmask ) {
+		return(-1);
+	}
+	/* Channels wider than 8 bits don't survive RGB_FROM_PIXEL */
+	if ( srcfmt->Rloss > 8 || srcfmt->Gloss > 8 || srcfmt->Bloss > 8 ||
+	     (srcfmt->Amask && srcfmt->Aloss > 8) ) {
+		return(-1);
+	}
+	*keep = srcfmt->Rmask | srcfmt->Gmask | srcfmt->Bmask;
+	*set = 0;
+	if ( dstfmt->Amask ) {
+		if ( srcfmt->Amask ) {
+			/* COPY_ALPHA */
+			if ( srcfmt->Amask != dstfmt->Amask ) {
+				return(-1);
+			}
+			*keep |= srcfmt->Amask;
+		} else {
+			/* SET_ALPHA */
+			*set = (uint32_t)(srcfmt->alpha >> dstfmt->Aloss)
+							<< dstfmt->Ashift;
+		}
+	}
+	return(0);
+}
+
+/* The vector colorkey blitters compare several pixels with the key at
+   once, and merge them into the destination through the compare mask
+   instead of branching on every pixel.
+ */
+static void Blit2to2KeySSE2(SDL_BlitInfo *info)
+{
+	int width = info->d_width;
+	int height = info->d_height;
+	uint16_t *srcp = (uint16_t *)info->s_pixels;
+	int srcskip = info->s_skip;
+	uint16_t *dstp = (uint16_t *)info->d_pixels;
+	int dstskip = info->d_skip;
+	uint32_t ckey = info->src->colorkey;
+	uint32_t rgbmask = ~info->src->Amask;
+	__m128i vkey, vmask;
+
+	/* Set up some basic variables */
+        srcskip /= 2;
+        dstskip /= 2;
+	ckey &= rgbmask;
+	vkey = _mm_set1_epi16((short)ckey);
+	vmask = _mm_set1_epi16((short)rgbmask);
+
+	while ( height-- ) {
+		int n = 0;
+		for ( ; n+8 <= width; n += 8 ) {
+			__m128i s = _mm_loadu_si128((const __m128i *)srcp);
+			__m128i d = _mm_loadu_si128((const __m128i *)dstp);
+			__m128i k = _mm_cmpeq_epi16(_mm_and_si128(s, vmask), vkey);
+			d = _mm_or_si128(_mm_andnot_si128(k, s), _mm_and_si128(k, d));
+			_mm_storeu_si128((__m128i *)dstp, d);
+			srcp += 8;
+			dstp += 8;
+		}
+		for ( ; n < width; ++n ) {
+			if ( (*srcp & rgbmask) != ckey ) {
+				*dstp = *srcp;
+			}
+			dstp++;
+			srcp++;
+		}
+		srcp += srcskip;
+		dstp += dstskip;
+	}
+}
+
+static void Blit4to4KeySSE2(SDL_BlitInfo *info)
+{
+	int width = info->d_width;
+	int height = info->d_height;
+	uint32_t *srcp = (uint32_t *)info->s_pixels;
+	int srcskip = info->s_skip;
+	uint32_t *dstp = (uint32_t *)info->d_pixels;
+	int dstskip = info->d_skip;
+	uint32_t ckey = info->src->colorkey;
+	uint32_t rgbmask = ~info->src->Amask;
+	uint32_t keep, set;
+	__m128i vkey, vmask, vkeep, vset;
+
+	/* Set up some basic variables */
+	srcskip /= 4;
+	dstskip /= 4;
+	ckey &= rgbmask;
+	Key4to4_Setup(info->src, info->dst, &keep, &set);
+	vkey = _mm_set1_epi32((int)ckey);
+	vmask = _mm_set1_epi32((int)rgbmask);
+	vkeep = _mm_set1_epi32((int)keep);
+	vset = _mm_set1_epi32((int)set);
+
+	while ( height-- ) {
+		int n = 0;
+		for ( ; n+4 <= width; n += 4 ) {
+			__m128i s = _mm_loadu_si128((const __m128i *)srcp);
+			__m128i d = _mm_loadu_si128((const __m128i *)dstp);
+			__m128i k = _mm_cmpeq_epi32(_mm_and_si128(s, vmask), vkey);
+			s = _mm_or_si128(_mm_and_si128(s, vkeep), vset);
+			d = _mm_or_si128(_mm_andnot_si128(k, s), _mm_and_si128(k, d));
+			_mm_storeu_si128((__m128i *)dstp, d);
+			srcp += 4;
+			dstp += 4;
+		}
+		for ( ; n < width; ++n ) {
+			if ( (*srcp & rgbmask) != ckey ) {
+				*dstp = (*srcp & keep) | set;
+			}
+			dstp++;
+			srcp++;
+		}
+		srcp += srcskip;
+		dstp += dstskip;
+	}
+}
+#endif /* SDL_SSE2_INTRINSICS */
+
+#if SDL_SSSE3_INTRINSICS
+/* 24/32 bit with byte sized channels to 32 bit, one pshufb widens the
+   source pixels for the compare, another reorders them for the store */
+static void BlitNtoNKeySwizzleSSSE3(SDL_BlitInfo *info)
+{
+	int width = info->d_width;
+	int height = info->d_height;
+	uint8_t *src = info->s_pixels;
+	int srcskip = info->s_skip;
+	uint8_t *dst = info->d_pixels;
+	int dstskip = info->d_skip;
+	uint32_t ckey = info->src->colorkey;
+	uint32_t rgbmask = ~info->src->Amask;
+	struct swizzle swz;
+	int srcbpp, vecwidth;
+	__m128i vcontrol, vfill, vwiden, vkey, vmask;
+	int j;
+
+	/* Set up some basic variables */
+	ckey &= rgbmask;
+	Swizzle_Setup(info->src, info->dst, &swz);
+	srcbpp = swz.srcbpp;
+	Swizzle_Control(&swz, &vcontrol, &vfill);
+	vwiden = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128,
+				6, 7, 8, -128, 9, 10, 11, -128);
+	vkey = _mm_set1_epi32((int)ckey);
+	vmask = _mm_set1_epi32((int)rgbmask);
+
+	/* Each load reads 16 bytes, 24 bit rows must have that many left */
+	vecwidth = srcbpp == 4 ? width : width - 2;
+
+	while ( height-- ) {
+		int n = 0;
+		for ( ; n+4 <= vecwidth; n += 4 ) {
+			__m128i s = _mm_loadu_si128((const __m128i *)src);
+			__m128i d = _mm_loadu_si128((const __m128i *)dst);
+			__m128i p = srcbpp == 4 ? s : _mm_shuffle_epi8(s, vwiden);
+			__m128i k = _mm_cmpeq_epi32(_mm_and_si128(p, vmask), vkey);
+			s = _mm_or_si128(_mm_shuffle_epi8(s, vcontrol), vfill);
+			d = _mm_or_si128(_mm_andnot_si128(k, s), _mm_and_si128(k, d));
+			_mm_storeu_si128((__m128i *)dst, d);
+			src += 4*srcbpp;
+			dst += 4*4;
+		}
+		for ( ; n < width; ++n ) {
+			uint32_t Pixel;
+			RETRIEVE_RGB_PIXEL(src, srcbpp, Pixel);
+			if ( (Pixel & rgbmask) != ckey ) {
+				for ( j=0; j<4; ++j ) {
+					dst[j] = swz.index[j] == SWIZZLE_CONST ?
+						swz.fill[j] : src[swz.index[j]];
+				}
+			}
+			src += srcbpp;
+			dst += 4;
+		}
+		src += srcskip;
+		dst += dstskip;
+	}
+}
+#endif /* SDL_SSSE3_INTRINSICS */
+
 /* Normal N to N optimized blitters */
 struct blit_table {
 	uint32_t srcR, srcG, srcB;
@@ -1498,6 +1979,7 @@ SDL_loblit SDL_CalculateBlitN(SDL_Surface *surface, int blit_index)
 	const struct blit_table *table;
 	int which;
 	SDL_loblit blitfun;
+	struct swizzle swz;
 
 	/* Set up data for choosing the blit */
 	sdata = surface->map->sw_data;
@@ -1520,12 +2002,32 @@ SDL_loblit SDL_CalculateBlitN(SDL_Surface *surface, int blit_index)
 	       If a particular case turns out to be useful we'll add it. */
 
 	    if(srcfmt->BytesPerPixel == 2
-	       && surface->map->identity)
+	       && surface->map->identity) {
+#if SDL_SSE2_INTRINSICS
+		if(SDL_HasSSE2())
+		    return &Blit2to2KeySSE2;
+#endif
 		return &Blit2to2Key;
-	    else if(dstfmt->BytesPerPixel == 1)
+	    } else if(dstfmt->BytesPerPixel == 1)
 		return &BlitNto1Key;
 	    else {
+#if SDL_SSE2_INTRINSICS
+		uint32_t keep, set;
+#endif
+#if SDL_SSSE3_INTRINSICS
+		struct swizzle swz;
+#endif
 
+#if SDL_SSE2_INTRINSICS
+		if(SDL_HasSSE2()
+		   && Key4to4_Setup(srcfmt, dstfmt, &keep, &set) == 0)
+		    return &Blit4to4KeySSE2;
+#endif
+#if SDL_SSSE3_INTRINSICS
+		if(SDL_HasSSSE3() && dstfmt->BytesPerPixel == 4
+		   && Swizzle_Setup(srcfmt, dstfmt, &swz) == 0)
+		    return &BlitNtoNKeySwizzleSSSE3;
+#endif
 		if(srcfmt->Amask && dstfmt->Amask)
 		    return &BlitNtoNKeyCopyAlpha;
 		else
@@ -1536,7 +2038,9 @@ SDL_loblit SDL_CalculateBlitN(SDL_Surface *surface, int blit_index)
 	blitfun = NULL;
 	if ( dstfmt->BitsPerPixel == 8 ) {
 		/* We assume 8-bit destinations are palettized */
-		if ( (srcfmt->BytesPerPixel == 4) &&
+		if ( surface->map->dither && surface->map->table ) {
+			blitfun = BlitNto1Dither;
+		} else if ( (srcfmt->BytesPerPixel == 4) &&
 		     (srcfmt->Rmask == 0x00FF0000) &&
 		     (srcfmt->Gmask == 0x0000FF00) &&
 		     (srcfmt->Bmask == 0x000000FF) ) {
@@ -1576,6 +2080,14 @@ SDL_loblit SDL_CalculateBlitN(SDL_Surface *surface, int blit_index)
 			     srcfmt->Gmask == dstfmt->Gmask &&
 			     srcfmt->Bmask == dstfmt->Bmask ) {
 				blitfun = Blit4to4MaskAlpha;
+			} else if ( Swizzle_Setup(srcfmt, dstfmt, &swz) == 0 ) {
+				/* 24/32 bit with byte sized channels */
+				blitfun = BlitNtoNSwizzle;
+#if SDL_SSSE3_INTRINSICS
+				if ( SDL_HasSSSE3() ) {
+					blitfun = BlitNtoNSwizzleSSSE3;
+				}
+#endif
 			} else if ( a_need == COPY_ALPHA ) {
 			    blitfun = BlitNtoNCopyAlpha;
 			}
@@ -0,0 +1,113 @@
+/*
+    SDL - Simple DirectMedia Layer
+    Copyright (C) 1997-2012 Sam Lantinga
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Sam Lantinga
+    slouken@libsdl.org
+*/
+
+/* CPU feature detection for SDL */
+
+#include "SDL_cpuinfo.h"
+
+#if defined(_MSC_VER) && _MSC_VER >= 1400 && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define HAVE_CPUID	1
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#define HAVE_CPUID	1
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define CPU_HAS_SSE2	0x00000001
+#define CPU_HAS_SSSE3	0x00000002
+
+static int SDL_CPUFeatures = -1;
+static int SDL_CPUCount = 0;
+
+static int CPU_getCPUIDFeatures(void)
+{
+	int features = 0;
+#if HAVE_CPUID
+	int regs[4];	/* eax, ebx, ecx, edx */
+
+#if defined(_MSC_VER)
+	__cpuid(regs, 0);
+	if ( regs[0] >= 1 ) {
+		__cpuid(regs, 1);
+#else
+	unsigned int a, b, c, d;
+
+	if ( __get_cpuid(1, &a, &b, &c, &d) ) {
+		regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+		if ( regs[3] & 0x04000000 ) {
+			features |= CPU_HAS_SSE2;
+		}
+		if ( regs[2] & 0x00000200 ) {
+			features |= CPU_HAS_SSSE3;
+		}
+	}
+#endif
+	return features;
+}
+
+static int SDL_GetCPUFeatures(void)
+{
+	if ( SDL_CPUFeatures < 0 ) {
+		SDL_CPUFeatures = CPU_getCPUIDFeatures();
+	}
+	return SDL_CPUFeatures;
+}
+
+int SDL_HasSSE2(void)
+{
+	if ( SDL_GetCPUFeatures() & CPU_HAS_SSE2 ) {
+		return 1;
+	}
+	return 0;
+}
+
+int SDL_HasSSSE3(void)
+{
+	if ( SDL_GetCPUFeatures() & CPU_HAS_SSSE3 ) {
+		return 1;
+	}
+	return 0;
+}
+
+int SDL_GetCPUCount(void)
+{
+	if ( ! SDL_CPUCount ) {
+#if defined(_WIN32)
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		SDL_CPUCount = (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+		SDL_CPUCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if ( SDL_CPUCount <= 0 ) {
+			SDL_CPUCount = 1;
+		}
+	}
+	return SDL_CPUCount;
+}
@@ -0,0 +1,52 @@
+/*
+    SDL - Simple DirectMedia Layer
+    Copyright (C) 1997-2012 Sam Lantinga
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Sam Lantinga
+    slouken@libsdl.org
+*/
+
+#pragma once
+
+/* CPU feature detection */
+
+/* Whether this compiler can build the SSE2/SSSE3 code paths at all.
+   VC6 has no intrinsics, so only the scalar loops are built there.
+ */
+#if (defined(_MSC_VER) && _MSC_VER >= 1400 && (defined(_M_IX86) || defined(_M_X64))) || \
+    defined(__SSE2__)
+#define SDL_SSE2_INTRINSICS	1
+#endif
+#if (defined(_MSC_VER) && _MSC_VER >= 1500 && (defined(_M_IX86) || defined(_M_X64))) || \
+    defined(__SSSE3__)
+#define SDL_SSSE3_INTRINSICS	1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* These return non-zero if the CPU we're running on has the feature */
+extern int SDL_HasSSE2(void);
+extern int SDL_HasSSSE3(void);
+
+/* This returns the number of CPU cores available, at least 1 */
+extern int SDL_GetCPUCount(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -20,11 +20,14 @@
     slouken@libsdl.org
 */
 
-#if defined(_DEBUG)
 #include <stdio.h>
-#endif
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "SDL_endian.h"
+#include "SDL_cpuinfo.h"
 #include "SDL_ext_pixel.h"
 /*#include "SDL_audio.h"*/
 
@@ -32,6 +35,41 @@
 #define ABS(x) ((x)<0?-(x):(x))
 #endif
 
+#if SDL_SSE2_INTRINSICS
+#include <emmintrin.h>
+#endif
+
+static void SDL_ext_markDirty(SDL_Surface* surface, 
+	int x, int y, int width, int height)
+{
+	SDL_Rect rect;
+
+	if (!surface->dirty || width <= 0 || height <= 0)
+	{
+		return;
+	}
+	//clip here, SDL_Rect can't hold the unclipped values
+	if (x < 0)
+	{
+		width += x;
+		x = 0;
+	}
+	if (y < 0)
+	{
+		height += y;
+		y = 0;
+	}
+	if (width <= 0 || height <= 0 || x >= surface->w || y >= surface->h)
+	{
+		return;
+	}
+	rect.x = x;
+	rect.y = y;
+	rect.w = width > surface->w ? surface->w : width;
+	rect.h = height > surface->h ? surface->h : height;
+	SDL_AddDirtyRect(surface, &rect);
+}
+
 void SDL_ext_getPixel(SDL_Surface* surface, int x, int y, 
 	uint8_t* colorR, uint8_t* colorG, uint8_t* colorB, uint8_t* colorA)
 {
@@ -82,11 +120,9 @@ void SDL_ext_putPixel(SDL_Surface* surface, int x, int y,
 	uint32_t pixel;
 
 	if (x < surface->clip_rect.x || 
-		x > surface->clip_rect.x + surface->clip_rect.w ||
+		x >= surface->clip_rect.x + surface->clip_rect.w ||
 		y < surface->clip_rect.y ||
-		y > surface->clip_rect.y + surface->clip_rect.h ||
-		surface->clip_rect.w == 0 ||
-		surface->clip_rect.h == 0)
+		y >= surface->clip_rect.y + surface->clip_rect.h)
 	{
 		return;
 	}
@@ -161,11 +197,9 @@ void SDL_ext_putPixelAlpha(SDL_Surface* surface, int x, int y,
 	uint32_t pixel;
 
 	if (x < surface->clip_rect.x || 
-		x > surface->clip_rect.x + surface->clip_rect.w ||
+		x >= surface->clip_rect.x + surface->clip_rect.w ||
 		y < surface->clip_rect.y ||
-		y > surface->clip_rect.y + surface->clip_rect.h ||
-		surface->clip_rect.w == 0 ||
-		surface->clip_rect.h == 0)
+		y >= surface->clip_rect.y + surface->clip_rect.h)
 	{
 		return;
 	}
@@ -219,198 +253,427 @@ void SDL_ext_putPixelAlpha(SDL_Surface* surface, int x, int y,
     SDL_UnlockSurface(surface);
 }
 
-/*===============================*/
-
-void SDL_ext_drawPoint(SDL_Surface* mTarget, 
-	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA, 
-	int x, int y)
+//same rounding as ALPHA_BLEND: d + (((s - d) * a + 255) >> 8),
+//except that full coverage gives exactly the colour like the blitters do
+static void SDL_ext_blendSpan32(uint32_t* dst, int width, 
+	const uint8_t* coverage, SDL_PixelFormat* fmt, 
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
 {
-	if (x < mTarget->clip_rect.x || 
-		x > mTarget->clip_rect.x + mTarget->clip_rect.w ||
-		y < mTarget->clip_rect.y ||
-		y > mTarget->clip_rect.y + mTarget->clip_rect.h ||
-		mTarget->clip_rect.w == 0 ||
-		mTarget->clip_rect.h == 0)
+	int i;
+	for (i = 0; i < width; ++i)
 	{
-		return;
-	}
+		uint32_t pixel = dst[i];
+		int a = colorA;
+		int dR, dG, dB;
 
-    if (colorA != 255)
-    {
-        SDL_ext_putPixelAlpha(mTarget, x, y, colorR, colorG, colorB, colorA);
-    }
-    else
-    {
-        SDL_ext_putPixel(mTarget, x, y, colorR, colorG, colorB);
-    }
+		if (coverage)
+		{
+			a = coverage[i];
+			if (colorA != 255)
+			{
+				a = (a * colorA + 255) >> 8;
+			}
+		}
+		if (a == 0)
+		{
+			continue;
+		}
+		if (a == 255)
+		{
+			dR = colorR; dG = colorG; dB = colorB;
+		}
+		else
+		{
+			RGB_FROM_PIXEL(pixel, fmt, dR, dG, dB);
+			ALPHA_BLEND(colorR, colorG, colorB, a, dR, dG, dB);
+		}
+		dst[i] = (pixel & ~(fmt->Rmask | fmt->Gmask | fmt->Bmask)) |
+			((dR >> fmt->Rloss) << fmt->Rshift) |
+			((dG >> fmt->Gloss) << fmt->Gshift) |
+			((dB >> fmt->Bloss) << fmt->Bshift);
+	}
 }
 
-void SDL_ext_fillRectangle(SDL_Surface* mTarget, 
-	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA, 
-	int areaX, int areaY, int areaWidth, int areaHeight)
+static void SDL_ext_blendSpan16(uint16_t* dst, int width, 
+	const uint8_t* coverage, SDL_PixelFormat* fmt, 
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
 {
-    if (colorA != 255)
-    {
-        int x1 = areaX;
-        int y1 = areaY;
-        int x2 = areaX + areaWidth;
-        int y2 = areaY + areaHeight;
-        int x, y;
-
-        SDL_LockSurface(mTarget);
-        for (y = y1; y < y2; y++)
-        {
-            for (x = x1; x < x2; x++)
-            {
-                SDL_ext_putPixelAlpha(mTarget, x, y, 
-					colorR, colorG, colorB, colorA);
-            }
-        }
-        SDL_UnlockSurface(mTarget);
-    }
-    else
-    {
-        SDL_Rect rect;
-        uint32_t color;
-		
-		rect.x = areaX;
-        rect.y = areaY;
-        rect.w = areaWidth;
-        rect.h = areaHeight;
+	int i;
+	for (i = 0; i < width; ++i)
+	{
+		uint32_t pixel = dst[i];
+		int a = colorA;
+		int dR, dG, dB;
 
-        color = SDL_MapRGBA(mTarget->format,
-			colorR,
-			colorG,
-			colorB,
-			colorA);
-        SDL_FillRect(mTarget, &rect, color);
-    }
+		if (coverage)
+		{
+			a = coverage[i];
+			if (colorA != 255)
+			{
+				a = (a * colorA + 255) >> 8;
+			}
+		}
+		if (a == 0)
+		{
+			continue;
+		}
+		if (a == 255)
+		{
+			dR = colorR; dG = colorG; dB = colorB;
+		}
+		else
+		{
+			RGB_FROM_PIXEL(pixel, fmt, dR, dG, dB);
+			ALPHA_BLEND(colorR, colorG, colorB, a, dR, dG, dB);
+		}
+		dst[i] = (uint16_t)((pixel & ~(fmt->Rmask | fmt->Gmask | fmt->Bmask)) |
+			((dR >> fmt->Rloss) << fmt->Rshift) |
+			((dG >> fmt->Gloss) << fmt->Gshift) |
+			((dB >> fmt->Bloss) << fmt->Bshift));
+	}
 }
 
-void SDL_ext_drawHLine(SDL_Surface* mTarget, 
-	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA, 
-	int x1, int y, int x2)
+#if SDL_SSE2_INTRINSICS
+//32bpp with whole-byte colour channels, 4 pixels at a time.
+//(s * a + d * (256 - a) + 255) >> 8 is ALPHA_BLEND rearranged so that
+//every term stays unsigned and fits in 16 bits, the result is bit exact.
+//Lanes outside the RGB masks get a = 0, which leaves them untouched,
+//lanes with a = 255 take the colour as is.
+static void SDL_ext_blendSpan32SSE2(uint32_t* dst, int width, 
+	const uint8_t* coverage, SDL_PixelFormat* fmt, 
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
 {
-    int bpp;
-	uint8_t *p;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i v255 = _mm_set1_epi16(255);
+	const __m128i v256 = _mm_set1_epi16(256);
+	const __m128i valpha = _mm_set1_epi16(colorA);
+	__m128i color, lanes, solid;
 	uint32_t pixel;
+	int i;
+
+	pixel = ((uint32_t)colorR << fmt->Rshift) | 
+		((uint32_t)colorG << fmt->Gshift) | 
+		((uint32_t)colorB << fmt->Bshift);
+	color = _mm_unpacklo_epi8(_mm_set1_epi32(pixel), zero);
+	lanes = _mm_unpacklo_epi8(
+		_mm_set1_epi32(fmt->Rmask | fmt->Gmask | fmt->Bmask), zero);
+	lanes = _mm_cmpeq_epi16(lanes, _mm_set1_epi16(255));
+	solid = _mm_set1_epi32(pixel);
+
+	for (i = 0; i + 4 <= width; i += 4)
+	{
+		__m128i a, alo, ahi, d, dlo, dhi, m;
 
-	//prevent overflow
-	if (y < mTarget->clip_rect.y ||
-		y > mTarget->clip_rect.y + mTarget->clip_rect.h ||
-		mTarget->clip_rect.w == 0 ||
-		mTarget->clip_rect.h == 0)
+		if (coverage)
+		{
+			//byte loads, coverage rows aren't 4 byte aligned
+			uint32_t c4 = coverage[i] | (coverage[i + 1] << 8) |
+				(coverage[i + 2] << 16) | ((uint32_t)coverage[i + 3] << 24);
+			if (c4 == 0)
+			{
+				continue;
+			}
+			if (c4 == 0xFFFFFFFF && colorA == 255)
+			{
+				d = _mm_loadu_si128((__m128i*)(dst + i));
+				d = _mm_or_si128(_mm_andnot_si128(
+					_mm_set1_epi32(fmt->Rmask | fmt->Gmask | fmt->Bmask), d), solid);
+				_mm_storeu_si128((__m128i*)(dst + i), d);
+				continue;
+			}
+			a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(c4), zero);
+			if (colorA != 255)
+			{
+				a = _mm_srli_epi16(_mm_add_epi16(
+					_mm_mullo_epi16(a, valpha), v255), 8);
+			}
+		}
+		else
+		{
+			a = valpha;
+		}
+		//a0 a0 a1 a1 a2 a2 a3 a3 -> a0 x4 a1 x4 | a2 x4 a3 x4
+		a = _mm_unpacklo_epi16(a, a);
+		alo = _mm_and_si128(_mm_unpacklo_epi32(a, a), lanes);
+		ahi = _mm_and_si128(_mm_unpackhi_epi32(a, a), lanes);
+
+		d = _mm_loadu_si128((__m128i*)(dst + i));
+		dlo = _mm_unpacklo_epi8(d, zero);
+		dhi = _mm_unpackhi_epi8(d, zero);
+		dlo = _mm_add_epi16(_mm_mullo_epi16(color, alo), 
+			_mm_mullo_epi16(dlo, _mm_sub_epi16(v256, alo)));
+		dhi = _mm_add_epi16(_mm_mullo_epi16(color, ahi), 
+			_mm_mullo_epi16(dhi, _mm_sub_epi16(v256, ahi)));
+		dlo = _mm_srli_epi16(_mm_add_epi16(dlo, v255), 8);
+		dhi = _mm_srli_epi16(_mm_add_epi16(dhi, v255), 8);
+		m = _mm_cmpeq_epi16(alo, v255);
+		dlo = _mm_or_si128(_mm_andnot_si128(m, dlo), _mm_and_si128(m, color));
+		m = _mm_cmpeq_epi16(ahi, v255);
+		dhi = _mm_or_si128(_mm_andnot_si128(m, dhi), _mm_and_si128(m, color));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(dlo, dhi));
+	}
+	if (i < width)
 	{
-		return;
+		SDL_ext_blendSpan32(dst + i, width - i, coverage ? coverage + i : NULL, 
+			fmt, colorR, colorG, colorB, colorA);
 	}
-	if (x1 > x2)
+}
+
+//16bpp, 8 pixels at a time, same arithmetic as SDL_ext_blendSpan32SSE2
+//on channels unpacked the way RGB_FROM_PIXEL does
+static void SDL_ext_blendSpan16SSE2(uint16_t* dst, int width, 
+	const uint8_t* coverage, SDL_PixelFormat* fmt, 
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i v255 = _mm_set1_epi16(255);
+	const __m128i v256 = _mm_set1_epi16(256);
+	const __m128i valpha = _mm_set1_epi16(colorA);
+	const __m128i keep = _mm_set1_epi16(
+		(short)~(fmt->Rmask | fmt->Gmask | fmt->Bmask));
+	const uint8_t color[3] = { colorR, colorG, colorB };
+	const uint32_t masks[3] = { fmt->Rmask, fmt->Gmask, fmt->Bmask };
+	const uint8_t shifts[3] = { fmt->Rshift, fmt->Gshift, fmt->Bshift };
+	const uint8_t losses[3] = { fmt->Rloss, fmt->Gloss, fmt->Bloss };
+	__m128i vcolor[3], vmask[3], vshift[3], vloss[3];
+	int i, c;
+
+	for (c = 0; c < 3; c++)
 	{
-		int temp;
-		temp = x1;
-		x1 = x2;
-		x2 = x1;
+		vcolor[c] = _mm_set1_epi16(color[c]);
+		vmask[c] = _mm_set1_epi16((short)masks[c]);
+		vshift[c] = _mm_cvtsi32_si128(shifts[c]);
+		vloss[c] = _mm_cvtsi32_si128(losses[c]);
 	}
-	// x1 <= x2
-	if (x1 < mTarget->clip_rect.x)
+
+	for (i = 0; i + 8 <= width; i += 8)
 	{
-		x1 = mTarget->clip_rect.x;
+		__m128i a, d, out, solid;
+
+		if (coverage)
+		{
+			__m128i c8 = _mm_loadl_epi64((const __m128i*)(coverage + i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(c8, zero)) == 0xFFFF)
+			{
+				continue;
+			}
+			a = _mm_unpacklo_epi8(c8, zero);
+			if (colorA != 255)
+			{
+				a = _mm_srli_epi16(_mm_add_epi16(
+					_mm_mullo_epi16(a, valpha), v255), 8);
+			}
+		}
+		else
+		{
+			a = valpha;
+		}
+		solid = _mm_cmpeq_epi16(a, v255);
+
+		d = _mm_loadu_si128((__m128i*)(dst + i));
+		out = _mm_and_si128(d, keep);
+		for (c = 0; c < 3; c++)
+		{
+			__m128i ch = _mm_sll_epi16(_mm_srl_epi16(
+				_mm_and_si128(d, vmask[c]), vshift[c]), vloss[c]);
+			ch = _mm_add_epi16(_mm_mullo_epi16(vcolor[c], a), 
+				_mm_mullo_epi16(ch, _mm_sub_epi16(v256, a)));
+			ch = _mm_srli_epi16(_mm_add_epi16(ch, v255), 8);
+			ch = _mm_or_si128(_mm_andnot_si128(solid, ch), 
+				_mm_and_si128(solid, vcolor[c]));
+			ch = _mm_sll_epi16(_mm_srl_epi16(ch, vloss[c]), vshift[c]);
+			out = _mm_or_si128(out, _mm_and_si128(ch, vmask[c]));
+		}
+		_mm_storeu_si128((__m128i*)(dst + i), out);
 	}
-	if (x2 > mTarget->clip_rect.x + mTarget->clip_rect.w)
+	if (i < width)
 	{
-		x2 = mTarget->clip_rect.x + mTarget->clip_rect.w;
+		SDL_ext_blendSpan16(dst + i, width - i, coverage ? coverage + i : NULL, 
+			fmt, colorR, colorG, colorB, colorA);
 	}
+}
+#endif
 
-	bpp = mTarget->format->BytesPerPixel;
-
-    SDL_LockSurface(mTarget);
+void SDL_ext_blendSpan(SDL_Surface* surface, int x, int y, int width, 
+	const uint8_t* coverage, 
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
+{
+	SDL_PixelFormat* fmt = surface->format;
+	uint8_t* p;
 
-    p = (uint8_t *)mTarget->pixels + y * mTarget->pitch + x1 * bpp;
+	if (width <= 0 || colorA == 0)
+	{
+		return;
+	}
+	p = (uint8_t*)surface->pixels + y * surface->pitch + 
+		x * fmt->BytesPerPixel;
+	switch (fmt->BytesPerPixel)
+	{
+	case 2:
+#if SDL_SSE2_INTRINSICS
+		if (SDL_HasSSE2())
+		{
+			SDL_ext_blendSpan16SSE2((uint16_t*)p, width, coverage, fmt,
+				colorR, colorG, colorB, colorA);
+			break;
+		}
+#endif
+		SDL_ext_blendSpan16((uint16_t*)p, width, coverage, fmt,
+			colorR, colorG, colorB, colorA);
+		break;
 
-    pixel = SDL_MapRGB(mTarget->format,
-						colorR,
-                        colorG,
-                        colorB);
-    switch(bpp)
-    {
-        case 1:
-            for (;x1 <= x2; ++x1)
-            {
-                *(p++) = pixel;
-            }
-            break;
-            
-        case 2:
-        {
-            uint16_t* q = (uint16_t*)p;
-            for (;x1 <= x2; ++x1)
-            {
-                *(q++) = pixel;
-            }
-            break;
-        }
-        case 3:
-            if(SDL_BYTEORDER == SDL_BIG_ENDIAN)
-            {
-                for (;x1 <= x2; ++x1)
-                {
-                    p[0] = (pixel >> 16) & 0xff;
-                    p[1] = (pixel >> 8) & 0xff;
-                    p[2] = pixel & 0xff;
-                    p += 3;
-                }
-            }
-            else
-            {
-                for (;x1 <= x2; ++x1)
-                {
-                    p[0] = pixel & 0xff;
-                    p[1] = (pixel >> 8) & 0xff;
-                    p[2] = (pixel >> 16) & 0xff;
-                    p += 3;
-                }
-            }
-            break;
-
-        case 4:  
-        {          
-            uint32_t* q = (uint32_t*)p;
-            for (;x1 <= x2; ++x1)
-            {
-                if (colorA != 255)
-                {
-                    *q = SDL_ext_Alpha32(pixel,*q,colorA);
-                    q++;
-                }
-                else
-                {
-                    *(q++) = pixel;
-                }
-            }
-            break;
-        }
-            
-    } // end switch
+	case 4:
+#if SDL_SSE2_INTRINSICS
+		if (fmt->Rloss == 0 && fmt->Gloss == 0 && fmt->Bloss == 0 &&
+			(fmt->Rshift & 7) == 0 && (fmt->Gshift & 7) == 0 &&
+			(fmt->Bshift & 7) == 0 && SDL_HasSSE2())
+		{
+			SDL_ext_blendSpan32SSE2((uint32_t*)p, width, coverage, fmt,
+				colorR, colorG, colorB, colorA);
+			break;
+		}
+#endif
+		SDL_ext_blendSpan32((uint32_t*)p, width, coverage, fmt,
+			colorR, colorG, colorB, colorA);
+		break;
 
-    SDL_UnlockSurface(mTarget);
+	default:
+		//palettized and 24bpp targets go through the slow path
+		{
+			int i;
+			for (i = 0; i < width; ++i)
+			{
+				int a = colorA;
+				if (coverage)
+				{
+					a = (coverage[i] * colorA + 255) >> 8;
+				}
+				if (a == 255)
+				{
+					SDL_ext_putPixel(surface, x + i, y, 
+						colorR, colorG, colorB);
+				}
+				else if (a != 0)
+				{
+					SDL_ext_putPixelAlpha(surface, x + i, y, 
+						colorR, colorG, colorB, (uint8_t)a);
+				}
+			}
+		}
+		break;
+	}
 }
 
+/*===============================*/
 
-void SDL_ext_drawVLine(SDL_Surface* mTarget,
-	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA, 
-	int x, int y1, int y2)
+//one draw colour, mapped once for the target
+typedef struct SDL_ext_Paint
 {
-    int bpp;
-	uint8_t *p;
 	uint32_t pixel;
+	uint8_t r, g, b, a;
+} SDL_ext_Paint;
+
+static void SDL_ext_setPaint(SDL_ext_Paint* paint, SDL_PixelFormat* fmt,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
+{
+	paint->pixel = SDL_MapRGB(fmt, colorR, colorG, colorB);
+	paint->r = colorR;
+	paint->g = colorG;
+	paint->b = colorB;
+	paint->a = colorA;
+}
+
+//paint one clipped run of pixels, the caller locks.
+//opaque colours are stored, the rest goes through SDL_ext_blendSpan
+static void SDL_ext_paintSpan(SDL_Surface* surface, int x, int y, int width,
+	const SDL_ext_Paint* paint)
+{
+	uint8_t* p;
+	uint32_t pixel = paint->pixel;
+
+	if (paint->a != 255)
+	{
+		SDL_ext_blendSpan(surface, x, y, width, NULL,
+			paint->r, paint->g, paint->b, paint->a);
+		return;
+	}
+	p = (uint8_t*)surface->pixels + y * surface->pitch +
+		x * surface->format->BytesPerPixel;
+	switch (surface->format->BytesPerPixel)
+	{
+	case 1:
+		memset(p, (uint8_t)pixel, width);
+		break;
+
+	case 2:
+		{
+			uint16_t* q = (uint16_t*)p;
+			while (width--)
+			{
+				*(q++) = (uint16_t)pixel;
+			}
+		}
+		break;
+
+	case 3:
+		while (width--)
+		{
+			if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
+			{
+				p[0] = (pixel >> 16) & 0xff;
+				p[1] = (pixel >> 8) & 0xff;
+				p[2] = pixel & 0xff;
+			}
+			else
+			{
+				p[0] = pixel & 0xff;
+				p[1] = (pixel >> 8) & 0xff;
+				p[2] = (pixel >> 16) & 0xff;
+			}
+			p += 3;
+		}
+		break;
+
+	case 4:
+		SDL_memset4(p, pixel, width);
+		break;
+	}
+}
 
-	//prevent overflow
-	if (x < mTarget->clip_rect.x ||
-		x > mTarget->clip_rect.x + mTarget->clip_rect.w ||
-		mTarget->clip_rect.w == 0 ||
-		mTarget->clip_rect.h == 0)
+//the raster functions below are shared by the immediate draw calls
+//and SDL_ext_flushBatch, so both put down exactly the same pixels.
+//clip is the target clip_rect, or one band of it when batching
+static void SDL_ext_rasterHLine(SDL_Surface* surface, const SDL_Rect* clip,
+	const SDL_ext_Paint* paint, int x1, int y, int x2)
+{
+	if (x1 > x2)
+	{
+		int temp;
+		temp = x1;
+		x1 = x2;
+		x2 = temp;
+	}
+	if (y < clip->y || y >= clip->y + clip->h)
 	{
 		return;
 	}
+	if (x1 < clip->x)
+	{
+		x1 = clip->x;
+	}
+	if (x2 >= clip->x + clip->w)
+	{
+		x2 = clip->x + clip->w - 1;
+	}
+	if (x1 <= x2)
+	{
+		SDL_ext_paintSpan(surface, x1, y, x2 - x1 + 1, paint);
+	}
+}
+
+static void SDL_ext_rasterVLine(SDL_Surface* surface, const SDL_Rect* clip,
+	const SDL_ext_Paint* paint, int x, int y1, int y2)
+{
 	if (y1 > y2)
 	{
 		int temp;
@@ -418,244 +681,290 @@ void SDL_ext_drawVLine(SDL_Surface* mTarget,
 		y1 = y2;
 		y2 = temp;
 	}
-	// y1 <= y2
-	if (y1 < mTarget->clip_rect.y)
+	if (x < clip->x || x >= clip->x + clip->w)
 	{
-		y1 = mTarget->clip_rect.y;
+		return;
+	}
+	if (y1 < clip->y)
+	{
+		y1 = clip->y;
+	}
+	if (y2 >= clip->y + clip->h)
+	{
+		y2 = clip->y + clip->h - 1;
 	}
-	if (y2 > mTarget->clip_rect.y + mTarget->clip_rect.h)
+	for (; y1 <= y2; ++y1)
 	{
-		y2 = mTarget->clip_rect.y + mTarget->clip_rect.h;
+		SDL_ext_paintSpan(surface, x, y1, 1, paint);
 	}
+}
 
-	bpp = mTarget->format->BytesPerPixel;
+//x1, y1, x2, y2 are inclusive corners
+static void SDL_ext_rasterFill(SDL_Surface* surface, const SDL_Rect* clip,
+	const SDL_ext_Paint* paint, int x1, int y1, int x2, int y2)
+{
+	if (x1 < clip->x)
+	{
+		x1 = clip->x;
+	}
+	if (y1 < clip->y)
+	{
+		y1 = clip->y;
+	}
+	if (x2 >= clip->x + clip->w)
+	{
+		x2 = clip->x + clip->w - 1;
+	}
+	if (y2 >= clip->y + clip->h)
+	{
+		y2 = clip->y + clip->h - 1;
+	}
+	if (x1 > x2)
+	{
+		return;
+	}
+	for (; y1 <= y2; ++y1)
+	{
+		SDL_ext_paintSpan(surface, x1, y1, x2 - x1 + 1, paint);
+	}
+}
 
-    SDL_LockSurface(mTarget);
+#define SDL_EXT_PLOT(x, y) \
+	if ((x) >= clip->x && (x) < clip->x + clip->w && \
+		(y) >= clip->y && (y) < clip->y + clip->h) \
+	{ \
+		SDL_ext_paintSpan(surface, (x), (y), 1, paint); \
+	}
 
-    p = (uint8_t *)mTarget->pixels + y1 * mTarget->pitch + x * bpp;
+static void SDL_ext_rasterLine(SDL_Surface* surface, const SDL_Rect* clip,
+	const SDL_ext_Paint* paint, int x1, int y1, int x2, int y2)
+{
+	int dx, dy;
 
-    pixel = SDL_MapRGB(mTarget->format, colorR, colorG, colorB);
+	if (x1 == x2)
+	{
+		SDL_ext_rasterVLine(surface, clip, paint, x1, y1, y2);
+		return;
+	}
+	if (y1 == y2)
+	{
+		SDL_ext_rasterHLine(surface, clip, paint, x1, y1, x2);
+		return;
+	}
 
-    switch (bpp)
-    {            
-      case 1:
-          for (;y1 <= y2; ++y1)
-          {
-              *p = pixel;
-              p += mTarget->pitch;
-          }
-          break;
+	// Draw a line with Bresenham
 
-      case 2:
-          for (;y1 <= y2; ++y1)
-          {
-              *(uint16_t*)p = pixel;
-              p += mTarget->pitch;
-          }
-          break;
+	dx = ABS(x2 - x1);
+	dy = ABS(y2 - y1);
 
-      case 3:
-          if(SDL_BYTEORDER == SDL_BIG_ENDIAN)
-          {
-              for (;y1 <= y2; ++y1)
-              {
-                  p[0] = (pixel >> 16) & 0xff;
-                  p[1] = (pixel >> 8) & 0xff;
-                  p[2] = pixel & 0xff;
-                  p += mTarget->pitch;
-              }
-          }
-          else
-          {
-              for (;y1 <= y2; ++y1)
-              {
-                  p[0] = pixel & 0xff;
-                  p[1] = (pixel >> 8) & 0xff;
-                  p[2] = (pixel >> 16) & 0xff;
-                  p += mTarget->pitch;
-              }
-          }
-          break;
+	if (dx > dy)
+	{
+		int y, p = 0;
+		int x;
 
-      case 4:
-          for (;y1 <= y2; ++y1)
-          {
-              if (colorA != 255)
-              {
-                  *(uint32_t*)p = SDL_ext_Alpha32(pixel,*(uint32_t*)p,colorA);
-              }
-              else
-              {
-                  *(uint32_t*)p = pixel;
-              }
-              p += mTarget->pitch;
-          }
-          break;
-    } 
-	
-    SDL_UnlockSurface(mTarget);
-}
+		if (x1 > x2)
+		{
+			// swap x1, x2
+			x1 ^= x2;
+			x2 ^= x1;
+			x1 ^= x2;
+
+			// swap y1, y2
+			y1 ^= y2;
+			y2 ^= y1;
+			y1 ^= y2;
+		}
 
-void SDL_ext_drawLine(SDL_Surface* mTarget,
-	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA, 
-	int x1, int y1, int x2, int y2)
-{
-	int dx, dy;
+		y = y1;
+		for (x = x1; x <= x2; x++)
+		{
+			SDL_EXT_PLOT(x, y);
 
-    if (x1 == x2)
-    {
-        SDL_ext_drawVLine(mTarget, colorR, colorG, colorB, colorA, x1, y1, y2);
-        return;
-    }
-    if (y1 == y2)
-    {
-        SDL_ext_drawHLine(mTarget, colorR, colorG, colorB, colorA, x1, y1, x2);
-        return;
-    }
+			p += dy;
 
-    // Draw a line with Bresenham
+			if (p * 2 >= dx)
+			{
+				y += y1 < y2 ? 1 : -1;
+				p -= dx;
+			}
+		}
+	}
+	else
+	{
+		int x, p = 0;
+		int y;
 
-    dx = ABS(x2 - x1);
-    dy = ABS(y2 - y1);
+		if (y1 > y2)
+		{
+			// swap y1, y2
+			y1 ^= y2;
+			y2 ^= y1;
+			y1 ^= y2;
+
+			// swap x1, x2
+			x1 ^= x2;
+			x2 ^= x1;
+			x1 ^= x2;
+		}
 
-    if (dx > dy)
+		//y only grows, so stop once the line leaves the clip
+		if (y2 >= clip->y + clip->h)
+		{
+			y2 = clip->y + clip->h - 1;
+		}
+		x = x1;
+		for (y = y1; y <= y2; y++)
+		{
+			SDL_EXT_PLOT(x, y);
+
+			p += dx;
+
+			if (p * 2 >= dy)
+			{
+				x += x1 < x2 ? 1 : -1;
+				p -= dy;
+			}
+		}
+	}
+}
+
+#undef SDL_EXT_PLOT
+
+void SDL_ext_drawPoint(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y)
+{
+	const SDL_Rect *clip = &mTarget->clip_rect;
+	SDL_ext_Paint paint;
+
+	if (x < clip->x || x >= clip->x + clip->w ||
+		y < clip->y || y >= clip->y + clip->h)
+	{
+		return;
+	}
+
+	SDL_ext_setPaint(&paint, mTarget->format,
+		colorR, colorG, colorB, colorA);
+	SDL_LockSurface(mTarget);
+	SDL_ext_paintSpan(mTarget, x, y, 1, &paint);
+	SDL_UnlockSurface(mTarget);
+
+	SDL_ext_markDirty(mTarget, x, y, 1, 1);
+}
+
+void SDL_ext_fillRectangle(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int areaX, int areaY, int areaWidth, int areaHeight)
+{
+    if (areaWidth <= 0 || areaHeight <= 0)
     {
-        if (x1 > x2)
-        {
-            // swap x1, x2
-            x1 ^= x2;
-            x2 ^= x1;
-            x1 ^= x2;
-
-            // swap y1, y2
-            y1 ^= y2;
-            y2 ^= y1;
-            y1 ^= y2;
-        }
+        return;
+    }
+    if (colorA != 255)
+    {
+        //clip once, then blend whole rows, which keeps the
+        //destination alpha channel like the blitters do
+        const SDL_Rect *clip = &mTarget->clip_rect;
+        SDL_ext_Paint paint;
+        int x1 = areaX;
+        int y1 = areaY;
+        int x2 = areaX + areaWidth;
+        int y2 = areaY + areaHeight;
 
-        if (y1 < y2)
+        if (x1 < clip->x)
         {
-            int y = y1;
-            int p = 0;
-			int x;
-
-            for (x = x1; x <= x2; x++)
-            {
-                if (colorA != 255)
-                {
-                    SDL_ext_putPixelAlpha(mTarget, x, y, colorR, colorG, colorB, colorA);
-                }
-                else
-                {
-                    SDL_ext_putPixel(mTarget, x, y, colorR, colorG, colorB);
-                }
-
-                p += dy;
-
-                if (p * 2 >= dx)
-                {
-                    y++;
-                    p -= dx;
-                }
-            }
+            x1 = clip->x;
         }
-        else
+        if (y1 < clip->y)
         {
-            int y = y1;
-            int p = 0;
-			int x;
-
-            for (x = x1; x <= x2; x++)
-            {
-                if (colorA != 255)
-                {
-                    SDL_ext_putPixelAlpha(mTarget, x, y, colorR, colorG, colorB, colorA);
-                }
-                else
-                {
-                    SDL_ext_putPixel(mTarget, x, y, colorR, colorG, colorB);
-                }
-				
-                p += dy;
-
-                if (p * 2 >= dx)
-                {
-                    y--;
-                    p -= dx;
-                }
-            }
+            y1 = clip->y;
         }
-    }
-    else
-    {
-        if (y1 > y2)
+        if (x2 > clip->x + clip->w)
         {
-            // swap y1, y2
-            y1 ^= y2;
-            y2 ^= y1;
-            y1 ^= y2;
-
-            // swap x1, x2
-            x1 ^= x2;
-            x2 ^= x1;
-            x1 ^= x2;
+            x2 = clip->x + clip->w;
         }
-
-        if (x1 < x2)
+        if (y2 > clip->y + clip->h)
         {
-            int x = x1;
-            int p = 0;
-			int y;
-
-            for (y = y1; y <= y2; y++)
-            {
-                if (colorA != 255)
-                {
-                    SDL_ext_putPixelAlpha(mTarget, x, y, colorR, colorG, colorB, colorA);
-                }
-                else
-                {
-                    SDL_ext_putPixel(mTarget, x, y, colorR, colorG, colorB);
-                }
-				
-                p += dx;
-
-                if (p * 2 >= dy)
-                {
-                    x++;
-                    p -= dy;
-                }
-            }
+            y2 = clip->y + clip->h;
         }
-        else
+        if (x1 >= x2 || y1 >= y2 || colorA == 0)
         {
-            int x = x1;
-            int p = 0;
-			int y;
-
-            for (y = y1; y <= y2; y++)
-            {
-                if (colorA != 255)
-                {
-                    SDL_ext_putPixelAlpha(mTarget, x, y, colorR, colorG, colorB, colorA);
-                }
-                else
-                {
-                    SDL_ext_putPixel(mTarget, x, y, colorR, colorG, colorB);
-                }
-
-                p += dx;
-
-                if (p * 2 >= dy)
-                {
-                    x--;
-                    p -= dy;
-                }
-            }
+            return;
         }
+
+        SDL_ext_setPaint(&paint, mTarget->format,
+            colorR, colorG, colorB, colorA);
+        SDL_LockSurface(mTarget);
+        SDL_ext_rasterFill(mTarget, clip, &paint, x1, y1, x2 - 1, y2 - 1);
+        SDL_UnlockSurface(mTarget);
+        SDL_ext_markDirty(mTarget, x1, y1, x2 - x1, y2 - y1);
+    }
+    else
+    {
+        SDL_Rect rect;
+        uint32_t color;
+
+		rect.x = areaX;
+        rect.y = areaY;
+        rect.w = areaWidth;
+        rect.h = areaHeight;
+
+        color = SDL_MapRGBA(mTarget->format,
+			colorR,
+			colorG,
+			colorB,
+			colorA);
+        SDL_FillRect(mTarget, &rect, color);
     }
 }
 
+void SDL_ext_drawHLine(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y, int x2)
+{
+	SDL_ext_Paint paint;
+
+	SDL_ext_setPaint(&paint, mTarget->format,
+		colorR, colorG, colorB, colorA);
+	SDL_LockSurface(mTarget);
+	SDL_ext_rasterHLine(mTarget, &mTarget->clip_rect, &paint, x1, y, x2);
+	SDL_UnlockSurface(mTarget);
+
+	SDL_ext_markDirty(mTarget, x1 < x2 ? x1 : x2, y, ABS(x2 - x1) + 1, 1);
+}
+
+void SDL_ext_drawVLine(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y1, int y2)
+{
+	SDL_ext_Paint paint;
+
+	SDL_ext_setPaint(&paint, mTarget->format,
+		colorR, colorG, colorB, colorA);
+	SDL_LockSurface(mTarget);
+	SDL_ext_rasterVLine(mTarget, &mTarget->clip_rect, &paint, x, y1, y2);
+	SDL_UnlockSurface(mTarget);
+
+	SDL_ext_markDirty(mTarget, x, y1 < y2 ? y1 : y2, 1, ABS(y2 - y1) + 1);
+}
+
+void SDL_ext_drawLine(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y1, int x2, int y2)
+{
+	SDL_ext_Paint paint;
+
+	SDL_ext_setPaint(&paint, mTarget->format,
+		colorR, colorG, colorB, colorA);
+	SDL_LockSurface(mTarget);
+	SDL_ext_rasterLine(mTarget, &mTarget->clip_rect, &paint,
+		x1, y1, x2, y2);
+	SDL_UnlockSurface(mTarget);
+
+	SDL_ext_markDirty(mTarget, x1 < x2 ? x1 : x2, y1 < y2 ? y1 : y2,
+		ABS(x2 - x1) + 1, ABS(y2 - y1) + 1);
+}
+
 void SDL_ext_drawRectangle(SDL_Surface* mTarget, 
 	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA, 
 	int areaX, int areaY, int areaWidth, int areaHeight)
@@ -676,6 +985,568 @@ void SDL_ext_drawRectangle(SDL_Surface* mTarget,
 		x2, y1, y2);
 }
 
+/*===============================*/
+
+//the anti-aliased shapes below take pixel centres as coordinates and
+//write whole spans through SDL_ext_blendSpan, which has SSE2 kernels
+//for 16 and 32 bit targets. everything is clipped to the clip_rect
+
+//longest run of a Wu line blended at once
+#define SDL_EXT_WU_SPAN		256
+//rows the polygon filler accumulates coverage for at a time
+#define SDL_EXT_AA_STRIP	16
+//how far ellipse outlines may stray from the true curve, in pixels
+#define SDL_EXT_AA_TOLERANCE	0.125
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct SDL_ext_WuSpan
+{
+	int x, y;
+	int width;
+	uint8_t coverage[SDL_EXT_WU_SPAN];
+} SDL_ext_WuSpan;
+
+static void SDL_ext_flushWuSpan(SDL_Surface* surface, const SDL_Rect* clip,
+	SDL_ext_WuSpan* span,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
+{
+	int first = 0;
+	int last = span->width - 1;
+
+	if (span->y >= clip->y && span->y < clip->y + clip->h)
+	{
+		while (first <= last && span->coverage[first] == 0)
+		{
+			first++;
+		}
+		while (last >= first && span->coverage[last] == 0)
+		{
+			last--;
+		}
+		SDL_ext_blendSpan(surface, span->x + first, span->y,
+			last - first + 1, span->coverage + first,
+			colorR, colorG, colorB, colorA);
+	}
+	span->width = 0;
+}
+
+static void SDL_ext_addWuPixel(SDL_Surface* surface, const SDL_Rect* clip,
+	SDL_ext_WuSpan* span, int x, uint8_t coverage,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
+{
+	if (span->width == SDL_EXT_WU_SPAN)
+	{
+		SDL_ext_flushWuSpan(surface, clip, span,
+			colorR, colorG, colorB, colorA);
+	}
+	if (span->width == 0)
+	{
+		span->x = x;
+	}
+	span->coverage[span->width++] = coverage;
+}
+
+//Xiaolin Wu's line, each column (or row for steep lines) is split
+//between the two nearest pixels
+void SDL_ext_drawLineAA(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y1, int x2, int y2)
+{
+	const SDL_Rect *clip = &mTarget->clip_rect;
+	int dx = ABS(x2 - x1);
+	int dy = ABS(y2 - y1);
+
+	if (colorA == 0 || clip->w == 0 || clip->h == 0)
+	{
+		return;
+	}
+
+	SDL_LockSurface(mTarget);
+	if (dx >= dy)
+	{
+		//the rows the column pixels land on only ever step by one,
+		//so each row gets one run: the lower pixels of the columns
+		//above it, then the upper pixels of its own columns
+		SDL_ext_WuSpan spans[2];
+		SDL_ext_WuSpan *upper = &spans[0];
+		SDL_ext_WuSpan *lower = &spans[1];
+		double gradient;
+		int xstart, xend, x;
+
+		if (x1 > x2)
+		{
+			int temp;
+			temp = x1; x1 = x2; x2 = temp;
+			temp = y1; y1 = y2; y2 = temp;
+		}
+		gradient = dx ? (double)(y2 - y1) / dx : 0.0;
+		xstart = x1 < clip->x ? clip->x : x1;
+		xend = x2 >= clip->x + clip->w ? clip->x + clip->w - 1 : x2;
+		upper->width = 0;
+		lower->width = 0;
+		upper->y = (int)floor(y1 + gradient * (xstart - x1));
+		lower->y = upper->y + 1;
+		for (x = xstart; x <= xend; x++)
+		{
+			double y = y1 + gradient * (x - x1);
+			int row = (int)floor(y);
+			int bottom = (int)((y - row) * 255 + 0.5);
+
+			if (row != upper->y)
+			{
+				SDL_ext_WuSpan *temp;
+
+				if (row > upper->y)
+				{
+					SDL_ext_flushWuSpan(mTarget, clip, upper,
+						colorR, colorG, colorB, colorA);
+					temp = upper; upper = lower; lower = temp;
+					lower->y = row + 1;
+				}
+				else
+				{
+					SDL_ext_flushWuSpan(mTarget, clip, lower,
+						colorR, colorG, colorB, colorA);
+					temp = lower; lower = upper; upper = temp;
+					upper->y = row;
+				}
+			}
+			SDL_ext_addWuPixel(mTarget, clip, upper, x,
+				(uint8_t)(255 - bottom), colorR, colorG, colorB, colorA);
+			SDL_ext_addWuPixel(mTarget, clip, lower, x,
+				(uint8_t)bottom, colorR, colorG, colorB, colorA);
+		}
+		SDL_ext_flushWuSpan(mTarget, clip, upper,
+			colorR, colorG, colorB, colorA);
+		SDL_ext_flushWuSpan(mTarget, clip, lower,
+			colorR, colorG, colorB, colorA);
+	}
+	else
+	{
+		//a steep line puts two neighbouring pixels on every row
+		double gradient;
+		int ystart, yend, y;
+
+		if (y1 > y2)
+		{
+			int temp;
+			temp = x1; x1 = x2; x2 = temp;
+			temp = y1; y1 = y2; y2 = temp;
+		}
+		gradient = (double)(x2 - x1) / dy;
+		ystart = y1 < clip->y ? clip->y : y1;
+		yend = y2 >= clip->y + clip->h ? clip->y + clip->h - 1 : y2;
+		for (y = ystart; y <= yend; y++)
+		{
+			double x = x1 + gradient * (y - y1);
+			int column = (int)floor(x);
+			uint8_t coverage[2];
+			int first = 0, width = 2;
+
+			coverage[1] = (uint8_t)((x - column) * 255 + 0.5);
+			coverage[0] = (uint8_t)(255 - coverage[1]);
+			if (coverage[1] == 0)
+			{
+				width = 1;
+			}
+			if (column < clip->x)
+			{
+				first = clip->x - column;
+			}
+			if (column + width > clip->x + clip->w)
+			{
+				width = clip->x + clip->w - column;
+			}
+			if (first < width)
+			{
+				SDL_ext_blendSpan(mTarget, column + first, y, width - first,
+					coverage + first, colorR, colorG, colorB, colorA);
+			}
+		}
+	}
+	SDL_UnlockSurface(mTarget);
+
+	SDL_ext_markDirty(mTarget, x1 < x2 ? x1 : x2, y1 < y2 ? y1 : y2,
+		dx + 2, dy + 2);
+}
+
+//add the signed area an edge covers in each pixel of a strip, rows
+//of width + 2 floats, summing a row left to right gives the coverage
+//(the accumulation scheme of font-rs). 0 <= x <= width, 0 <= y <= height
+static void SDL_ext_accumulateEdge(float* acc, int width,
+	float x0, float y0, float x1, float y1)
+{
+	float dir = 1.0f;
+	float dxdy, x;
+	int y, yend;
+
+	if (y0 == y1)
+	{
+		return;
+	}
+	if (y0 > y1)
+	{
+		float temp;
+		temp = x0; x0 = x1; x1 = temp;
+		temp = y0; y0 = y1; y1 = temp;
+		dir = -1.0f;
+	}
+	dxdy = (x1 - x0) / (y1 - y0);
+	x = x0;
+	yend = (int)ceil(y1);
+	for (y = (int)y0; y < yend; y++)
+	{
+		float* line = acc + y * (width + 2);
+		float dy = (y + 1 < y1 ? y + 1 : y1) - (y > y0 ? y : y0);
+		float xnext = y + 1 < y1 ? x + dxdy * dy : x1;
+		float d = dy * dir;
+		float xa = x < xnext ? x : xnext;
+		float xb = x < xnext ? xnext : x;
+		float xafloor, xbceil;
+		int xai, xbi;
+
+		//rounding must not step outside the strip
+		if (xa < 0)
+		{
+			xa = 0;
+		}
+		if (xb > width)
+		{
+			xb = (float)width;
+		}
+		xafloor = (float)floor(xa);
+		xbceil = (float)ceil(xb);
+		xai = (int)xafloor;
+		xbi = (int)xbceil;
+		if (xbi <= xai + 1)
+		{
+			//inside one pixel
+			float xmf = 0.5f * (x + xnext) - xafloor;
+			line[xai] += d - d * xmf;
+			line[xai + 1] += d * xmf;
+		}
+		else
+		{
+			float s = 1.0f / (xb - xa);
+			float xaf = xa - xafloor;
+			float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+			float xbf = xb - xbceil + 1.0f;
+			float am = 0.5f * s * xbf * xbf;
+
+			line[xai] += d * a0;
+			if (xbi == xai + 2)
+			{
+				line[xai + 1] += d * (1.0f - a0 - am);
+			}
+			else
+			{
+				float a1 = s * (1.5f - xaf);
+				float a2 = a1 + (xbi - xai - 3) * s;
+				int xi;
+
+				line[xai + 1] += d * (a1 - a0);
+				for (xi = xai + 2; xi < xbi - 1; xi++)
+				{
+					line[xi] += d * s;
+				}
+				line[xbi - 1] += d * (1.0f - a2 - am);
+			}
+			line[xbi] += d * am;
+		}
+		x = xnext;
+	}
+}
+
+//clip an edge to a strip width x height: cut to its rows, then split
+//where it leaves the sides, those parts run down the side instead
+static void SDL_ext_addEdge(float* acc, int width, int height,
+	float x0, float y0, float x1, float y1)
+{
+	float bound;
+
+	if (y0 == y1 || (y0 <= 0 && y1 <= 0) ||
+		(y0 >= height && y1 >= height))
+	{
+		return;
+	}
+	if (y0 < 0 || y1 < 0)
+	{
+		float x = x0 + (x1 - x0) * (0 - y0) / (y1 - y0);
+		if (y0 < 0)
+		{
+			x0 = x; y0 = 0;
+		}
+		else
+		{
+			x1 = x; y1 = 0;
+		}
+	}
+	if (y0 > height || y1 > height)
+	{
+		float x = x0 + (x1 - x0) * (height - y0) / (y1 - y0);
+		if (y0 > height)
+		{
+			x0 = x; y0 = (float)height;
+		}
+		else
+		{
+			x1 = x; y1 = (float)height;
+		}
+	}
+	bound = (x0 < 0) != (x1 < 0) ? 0.0f :
+		(x0 > width) != (x1 > width) ? (float)width : -1.0f;
+	if (bound >= 0 && x0 != bound && x1 != bound)
+	{
+		float y = y0 + (y1 - y0) * (bound - x0) / (x1 - x0);
+		SDL_ext_addEdge(acc, width, height, x0, y0, bound, y);
+		SDL_ext_addEdge(acc, width, height, bound, y, x1, y1);
+		return;
+	}
+	x0 = x0 < 0 ? 0 : x0 > width ? width : x0;
+	x1 = x1 < 0 ? 0 : x1 > width ? width : x1;
+	SDL_ext_accumulateEdge(acc, width, x0, y0, x1, y1);
+}
+
+//fill closed contours with their exact area coverage. points holds
+//x, y pairs in surface space, counts[i] of them for contour i.
+//contours wound the other way cut holes, overlaps saturate
+static void SDL_ext_fillContours(SDL_Surface* surface,
+	const float* points, const int* counts, int ncontours,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA)
+{
+	const SDL_Rect *clip = &surface->clip_rect;
+	float minx, miny, maxx, maxy;
+	int left, top, right, bottom;
+	int width, total = 0;
+	float* acc;
+	uint8_t* coverage;
+	int i, j, y;
+
+	for (i = 0; i < ncontours; ++i)
+	{
+		total += counts[i];
+	}
+	if (total < 3 || colorA == 0)
+	{
+		return;
+	}
+	minx = maxx = points[0];
+	miny = maxy = points[1];
+	for (i = 1; i < total; ++i)
+	{
+		minx = points[i * 2] < minx ? points[i * 2] : minx;
+		maxx = points[i * 2] > maxx ? points[i * 2] : maxx;
+		miny = points[i * 2 + 1] < miny ? points[i * 2 + 1] : miny;
+		maxy = points[i * 2 + 1] > maxy ? points[i * 2 + 1] : maxy;
+	}
+	left = (int)floor(minx) < clip->x ? clip->x : (int)floor(minx);
+	top = (int)floor(miny) < clip->y ? clip->y : (int)floor(miny);
+	right = (int)ceil(maxx) > clip->x + clip->w ?
+		clip->x + clip->w : (int)ceil(maxx);
+	bottom = (int)ceil(maxy) > clip->y + clip->h ?
+		clip->y + clip->h : (int)ceil(maxy);
+	if (left >= right || top >= bottom)
+	{
+		return;
+	}
+	width = right - left;
+
+	acc = (float*)malloc((width + 2) * SDL_EXT_AA_STRIP * sizeof(float));
+	coverage = (uint8_t*)malloc(width);
+	if (acc == NULL || coverage == NULL)
+	{
+		fprintf(stderr, "%s\n", "Out of memory");
+		free(acc);
+		free(coverage);
+		return;
+	}
+
+	SDL_LockSurface(surface);
+	for (y = top; y < bottom; y += SDL_EXT_AA_STRIP)
+	{
+		int height = bottom - y < SDL_EXT_AA_STRIP ?
+			bottom - y : SDL_EXT_AA_STRIP;
+		const float* contour = points;
+		int row;
+
+		memset(acc, 0, (width + 2) * height * sizeof(float));
+		for (i = 0; i < ncontours; ++i)
+		{
+			for (j = 0; j < counts[i]; ++j)
+			{
+				const float* p = contour + j * 2;
+				const float* q = j + 1 < counts[i] ? p + 2 : contour;
+				SDL_ext_addEdge(acc, width, height,
+					p[0] - left, p[1] - y, q[0] - left, q[1] - y);
+			}
+			contour += counts[i] * 2;
+		}
+
+		for (row = 0; row < height; ++row)
+		{
+			const float* line = acc + row * (width + 2);
+			float sum = 0;
+			int first = width, last = -1;
+
+			for (i = 0; i < width; ++i)
+			{
+				float c;
+
+				sum += line[i];
+				c = sum < 0 ? -sum : sum;
+				coverage[i] = c >= 1.0f ? 255 : (uint8_t)(c * 255 + 0.5f);
+				if (coverage[i])
+				{
+					if (first > i)
+					{
+						first = i;
+					}
+					last = i;
+				}
+			}
+			if (first <= last)
+			{
+				SDL_ext_blendSpan(surface, left + first, y + row,
+					last - first + 1, coverage + first,
+					colorR, colorG, colorB, colorA);
+			}
+		}
+	}
+	SDL_UnlockSurface(surface);
+
+	free(acc);
+	free(coverage);
+	SDL_ext_markDirty(surface, left, top, width, bottom - top);
+}
+
+//n points on an ellipse around (cx, cy), n from SDL_ext_ellipseSteps
+static void SDL_ext_ellipsePoints(float* points, int n,
+	float cx, float cy, float rx, float ry, int reverse)
+{
+	//push the corners out so the polygon keeps the ellipse's area
+	double scale = sqrt(2 * M_PI / n / sin(2 * M_PI / n));
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		double t = 2 * M_PI * i / n;
+		points[i * 2] = (float)(cx + rx * scale * cos(t));
+		points[i * 2 + 1] = (float)(cy +
+			(reverse ? -ry : ry) * scale * sin(t));
+	}
+}
+
+static int SDL_ext_ellipseSteps(float rx, float ry)
+{
+	double r = rx > ry ? rx : ry;
+	int n = 8;
+
+	if (r > SDL_EXT_AA_TOLERANCE)
+	{
+		n = (int)ceil(M_PI / acos(1 - SDL_EXT_AA_TOLERANCE / r));
+	}
+	return n < 8 ? 8 : n > 4096 ? 4096 : n;
+}
+
+//width is the outline thickness, 0 fills
+static void SDL_ext_ellipse(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radiusX, int radiusY, float width)
+{
+	float cx = x + 0.5f;
+	float cy = y + 0.5f;
+	float outerX = radiusX + width * 0.5f;
+	float outerY = radiusY + width * 0.5f;
+	float innerX = radiusX - width * 0.5f;
+	float innerY = radiusY - width * 0.5f;
+	int counts[2];
+	float* points;
+
+	if (radiusX < 0 || radiusY < 0 || outerX <= 0 || outerY <= 0)
+	{
+		return;
+	}
+	counts[0] = SDL_ext_ellipseSteps(outerX, outerY);
+	counts[1] = width > 0 && innerX > 0 && innerY > 0 ? counts[0] : 0;
+	points = (float*)malloc((counts[0] + counts[1]) * 2 * sizeof(float));
+	if (points == NULL)
+	{
+		fprintf(stderr, "%s\n", "Out of memory");
+		return;
+	}
+	SDL_ext_ellipsePoints(points, counts[0], cx, cy, outerX, outerY, 0);
+	if (counts[1])
+	{
+		SDL_ext_ellipsePoints(points + counts[0] * 2, counts[1],
+			cx, cy, innerX, innerY, 1);
+	}
+	SDL_ext_fillContours(mTarget, points, counts, 2,
+		colorR, colorG, colorB, colorA);
+	free(points);
+}
+
+void SDL_ext_drawCircle(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radius)
+{
+	SDL_ext_ellipse(mTarget, colorR, colorG, colorB, colorA,
+		x, y, radius, radius, 1.0f);
+}
+
+void SDL_ext_fillCircle(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radius)
+{
+	SDL_ext_ellipse(mTarget, colorR, colorG, colorB, colorA,
+		x, y, radius, radius, 0);
+}
+
+void SDL_ext_drawEllipse(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radiusX, int radiusY)
+{
+	SDL_ext_ellipse(mTarget, colorR, colorG, colorB, colorA,
+		x, y, radiusX, radiusY, 1.0f);
+}
+
+void SDL_ext_fillEllipse(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radiusX, int radiusY)
+{
+	SDL_ext_ellipse(mTarget, colorR, colorG, colorB, colorA,
+		x, y, radiusX, radiusY, 0);
+}
+
+void SDL_ext_fillPolygon(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	const int* vx, const int* vy, int n)
+{
+	float* points;
+	int i;
+
+	if (n < 3)
+	{
+		return;
+	}
+	points = (float*)malloc(n * 2 * sizeof(float));
+	if (points == NULL)
+	{
+		fprintf(stderr, "%s\n", "Out of memory");
+		return;
+	}
+	for (i = 0; i < n; ++i)
+	{
+		points[i * 2] = vx[i] + 0.5f;
+		points[i * 2 + 1] = vy[i] + 0.5f;
+	}
+	SDL_ext_fillContours(mTarget, points, &n, 1,
+		colorR, colorG, colorB, colorA);
+	free(points);
+}
+
 void SDL_ext_drawImage(SDL_Surface* mTarget, 
 	SDL_Surface* srcSurface, 
 	int srcX, int srcY, int dstX, int dstY,
@@ -701,3 +1572,484 @@ void SDL_ext_drawImage(SDL_Surface* mTarget,
     SDL_BlitSurface(srcSurface, &src, mTarget, &dst);
 }
 
+/*===============================*/
+
+//a flush is split into bands of rows, one per thread, up to
+//SDL_EXT_BATCH_THREADS or the number of cpus, each band getting at
+//least SDL_EXT_BATCH_BAND_PIXELS of the pixels the calls cover, so a
+//thread is only started for more work than starting it costs. a single
+//band draws on the caller in recording order. set SDL_EXT_BATCH_THREADS
+//to 1 to always draw on the caller
+#define SDL_EXT_BATCH_THREADS	4
+#define SDL_EXT_BATCH_BAND_PIXELS	65536
+#define SDL_EXT_BATCH_MIN_ROWS	32
+
+enum
+{
+	SDL_EXT_CMD_POINT,
+	SDL_EXT_CMD_HLINE,
+	SDL_EXT_CMD_VLINE,
+	SDL_EXT_CMD_LINE,
+	SDL_EXT_CMD_FILL
+};
+
+typedef struct SDL_ext_Command
+{
+	int type;
+	int x1, y1, x2, y2;
+	SDL_ext_Paint paint;
+} SDL_ext_Command;
+
+struct SDL_ext_Batch
+{
+	SDL_Surface* target;
+	SDL_ext_Command* commands;
+	int count;
+	int capacity;
+	//pixels the calls cover, counted up to what fills every band
+	int pixels;
+	//a record call ran out of memory, reported by the next flush
+	int failed;
+	//command indices grouped by band, see SDL_ext_flushBatch
+	int* order;
+	int order_capacity;
+};
+
+typedef struct SDL_ext_BatchBand
+{
+	SDL_ext_Batch* batch;
+	SDL_Rect clip;
+	const int* order;
+	int count;
+} SDL_ext_BatchBand;
+
+//the rows and columns a call can touch inside clip, 0 if none
+static int SDL_ext_clipCommand(const SDL_ext_Command* command,
+	const SDL_Rect* clip, int* x1, int* y1, int* x2, int* y2)
+{
+	*x1 = command->x1 < command->x2 ? command->x1 : command->x2;
+	*x2 = command->x1 < command->x2 ? command->x2 : command->x1;
+	*y1 = command->y1 < command->y2 ? command->y1 : command->y2;
+	*y2 = command->y1 < command->y2 ? command->y2 : command->y1;
+	if (*x1 < clip->x)
+	{
+		*x1 = clip->x;
+	}
+	if (*y1 < clip->y)
+	{
+		*y1 = clip->y;
+	}
+	if (*x2 >= clip->x + clip->w)
+	{
+		*x2 = clip->x + clip->w - 1;
+	}
+	if (*y2 >= clip->y + clip->h)
+	{
+		*y2 = clip->y + clip->h - 1;
+	}
+	return *x1 <= *x2 && *y1 <= *y2;
+}
+
+SDL_ext_Batch* SDL_ext_createBatch(SDL_Surface* target)
+{
+	SDL_ext_Batch* batch;
+
+	batch = (SDL_ext_Batch*)malloc(sizeof(SDL_ext_Batch));
+	if (batch == NULL)
+	{
+		fprintf(stderr, "%s\n", "Out of memory");
+		return NULL;
+	}
+	memset(batch, 0, sizeof(SDL_ext_Batch));
+	batch->target = target;
+	return batch;
+}
+
+void SDL_ext_freeBatch(SDL_ext_Batch* batch)
+{
+	if (batch)
+	{
+		free(batch->commands);
+		free(batch->order);
+		free(batch);
+	}
+}
+
+static void SDL_ext_batchAdd(SDL_ext_Batch* batch, int type,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y1, int x2, int y2)
+{
+	SDL_ext_Command* command;
+
+	if (colorA == 0)
+	{
+		return;
+	}
+	if (batch->count == batch->capacity)
+	{
+		int capacity = batch->capacity ? batch->capacity * 2 : 256;
+		SDL_ext_Command* commands;
+
+		commands = (SDL_ext_Command*)realloc(batch->commands,
+			capacity * sizeof(SDL_ext_Command));
+		if (commands == NULL)
+		{
+			batch->failed = 1;
+			return;
+		}
+		batch->commands = commands;
+		batch->capacity = capacity;
+	}
+	command = &batch->commands[batch->count++];
+	command->type = type;
+	command->x1 = x1;
+	command->y1 = y1;
+	command->x2 = x2;
+	command->y2 = y2;
+	//runs of one colour, like the sides of a rectangle, map it once
+	if (batch->count > 1 &&
+		command[-1].paint.r == colorR && command[-1].paint.g == colorG &&
+		command[-1].paint.b == colorB && command[-1].paint.a == colorA)
+	{
+		command->paint = command[-1].paint;
+	}
+	else
+	{
+		SDL_ext_setPaint(&command->paint, batch->target->format,
+			colorR, colorG, colorB, colorA);
+	}
+
+	if (batch->pixels < SDL_EXT_BATCH_THREADS * SDL_EXT_BATCH_BAND_PIXELS &&
+		SDL_ext_clipCommand(command, &batch->target->clip_rect,
+			&x1, &y1, &x2, &y2))
+	{
+		int w = x2 - x1 + 1;
+		int h = y2 - y1 + 1;
+
+		if (type == SDL_EXT_CMD_FILL)
+		{
+			batch->pixels += w * h;
+		}
+		else
+		{
+			batch->pixels += w > h ? w : h;
+		}
+	}
+}
+
+void SDL_ext_batchPoint(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y)
+{
+	SDL_ext_batchAdd(batch, SDL_EXT_CMD_POINT,
+		colorR, colorG, colorB, colorA, x, y, x, y);
+}
+
+void SDL_ext_batchHLine(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y, int x2)
+{
+	SDL_ext_batchAdd(batch, SDL_EXT_CMD_HLINE,
+		colorR, colorG, colorB, colorA, x1, y, x2, y);
+}
+
+void SDL_ext_batchVLine(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y1, int y2)
+{
+	SDL_ext_batchAdd(batch, SDL_EXT_CMD_VLINE,
+		colorR, colorG, colorB, colorA, x, y1, x, y2);
+}
+
+void SDL_ext_batchSpan(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int width)
+{
+	if (width > 0)
+	{
+		SDL_ext_batchAdd(batch, SDL_EXT_CMD_HLINE,
+			colorR, colorG, colorB, colorA, x, y, x + width - 1, y);
+	}
+}
+
+void SDL_ext_batchLine(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y1, int x2, int y2)
+{
+	SDL_ext_batchAdd(batch, SDL_EXT_CMD_LINE,
+		colorR, colorG, colorB, colorA, x1, y1, x2, y2);
+}
+
+void SDL_ext_batchFillRectangle(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int areaX, int areaY, int areaWidth, int areaHeight)
+{
+	if (areaWidth > 0 && areaHeight > 0)
+	{
+		SDL_ext_batchAdd(batch, SDL_EXT_CMD_FILL,
+			colorR, colorG, colorB, colorA, areaX, areaY,
+			areaX + areaWidth - 1, areaY + areaHeight - 1);
+	}
+}
+
+//same four lines as SDL_ext_drawRectangle, so translucent corners
+//are blended twice here as well
+void SDL_ext_batchRectangle(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int areaX, int areaY, int areaWidth, int areaHeight)
+{
+	int x1 = areaX;
+	int x2 = areaX + areaWidth - 1;
+	int y1 = areaY;
+	int y2 = areaY + areaHeight - 1;
+
+	SDL_ext_batchHLine(batch, colorR, colorG, colorB, colorA, x1, y1, x2);
+	SDL_ext_batchHLine(batch, colorR, colorG, colorB, colorA, x1, y2, x2);
+	SDL_ext_batchVLine(batch, colorR, colorG, colorB, colorA, x1, y1, y2);
+	SDL_ext_batchVLine(batch, colorR, colorG, colorB, colorA, x2, y1, y2);
+}
+
+static void SDL_ext_drawCommand(SDL_Surface* surface, const SDL_Rect* clip,
+	const SDL_ext_Command* command)
+{
+	switch (command->type)
+	{
+	case SDL_EXT_CMD_POINT:
+		if (command->x1 >= clip->x && command->x1 < clip->x + clip->w &&
+			command->y1 >= clip->y && command->y1 < clip->y + clip->h)
+		{
+			SDL_ext_paintSpan(surface, command->x1, command->y1, 1,
+				&command->paint);
+		}
+		break;
+
+	case SDL_EXT_CMD_HLINE:
+		SDL_ext_rasterHLine(surface, clip, &command->paint,
+			command->x1, command->y1, command->x2);
+		break;
+
+	case SDL_EXT_CMD_VLINE:
+		SDL_ext_rasterVLine(surface, clip, &command->paint,
+			command->x1, command->y1, command->y2);
+		break;
+
+	case SDL_EXT_CMD_LINE:
+		SDL_ext_rasterLine(surface, clip, &command->paint,
+			command->x1, command->y1, command->x2, command->y2);
+		break;
+
+	case SDL_EXT_CMD_FILL:
+		SDL_ext_rasterFill(surface, clip, &command->paint,
+			command->x1, command->y1, command->x2, command->y2);
+		break;
+	}
+}
+
+static void* SDL_ext_drawBand(void* data)
+{
+	SDL_ext_BatchBand* band = (SDL_ext_BatchBand*)data;
+	SDL_ext_Batch* batch = band->batch;
+	int i;
+
+	for (i = 0; i < band->count; ++i)
+	{
+		SDL_ext_drawCommand(batch->target, &band->clip,
+			&batch->commands[band->order[i]]);
+	}
+	return NULL;
+}
+
+//draw everything recorded since the last flush with one lock, one
+//clip and one dirty rect. the calls are bucketed by the bands of rows
+//they touch, keeping their recording order inside each band, so every
+//pixel sees the same sequence of writes as with the immediate calls
+int SDL_ext_flushBatch(SDL_ext_Batch* batch)
+{
+	SDL_Surface* target = batch->target;
+	SDL_Rect clip = target->clip_rect;
+	SDL_ext_BatchBand bands[SDL_EXT_BATCH_THREADS];
+	int starts[SDL_EXT_BATCH_THREADS + 1];
+	pthread_t threads[SDL_EXT_BATCH_THREADS];
+	int started[SDL_EXT_BATCH_THREADS];
+	int nbands = 1;
+	int band_h;
+	int left, top, right, bottom;
+	int total = 0;
+	int result = batch->failed ? -1 : 0;
+	int i, j;
+
+	batch->failed = 0;
+	if (batch->count == 0 || clip.w == 0 || clip.h == 0)
+	{
+		batch->count = 0;
+		batch->pixels = 0;
+		return result;
+	}
+
+	//the 8 and 24 bit blends lock the surface per pixel
+	if (target->format->BytesPerPixel == 2 ||
+		target->format->BytesPerPixel == 4)
+	{
+		nbands = batch->pixels / SDL_EXT_BATCH_BAND_PIXELS;
+		if (nbands > clip.h / SDL_EXT_BATCH_MIN_ROWS)
+		{
+			nbands = clip.h / SDL_EXT_BATCH_MIN_ROWS;
+		}
+		if (nbands > SDL_EXT_BATCH_THREADS)
+		{
+			nbands = SDL_EXT_BATCH_THREADS;
+		}
+		if (nbands > SDL_GetCPUCount())
+		{
+			nbands = SDL_GetCPUCount();
+		}
+		if (nbands < 1)
+		{
+			nbands = 1;
+		}
+	}
+	batch->pixels = 0;
+
+	left = clip.x + clip.w;
+	top = clip.y + clip.h;
+	right = clip.x - 1;
+	bottom = clip.y - 1;
+
+	//one band needs no sorting, draw straight through the calls
+	if (nbands == 1)
+	{
+		SDL_LockSurface(target);
+		for (i = 0; i < batch->count; ++i)
+		{
+			const SDL_ext_Command* command = &batch->commands[i];
+			int x1, y1, x2, y2;
+
+			if (!SDL_ext_clipCommand(command, &clip, &x1, &y1, &x2, &y2))
+			{
+				continue;
+			}
+			left = x1 < left ? x1 : left;
+			top = y1 < top ? y1 : top;
+			right = x2 > right ? x2 : right;
+			bottom = y2 > bottom ? y2 : bottom;
+			SDL_ext_drawCommand(target, &clip, command);
+		}
+		SDL_UnlockSurface(target);
+
+		SDL_ext_markDirty(target, left, top, right - left + 1, bottom - top + 1);
+		batch->count = 0;
+		return result;
+	}
+	band_h = (clip.h + nbands - 1) / nbands;
+
+	//count the calls per band, then place them in recording order
+	memset(starts, 0, sizeof(starts));
+	for (j = 0; j < 2; ++j)
+	{
+		int fill[SDL_EXT_BATCH_THREADS];
+
+		if (j == 1)
+		{
+			if (total == 0)
+			{
+				batch->count = 0;
+				return result;
+			}
+			if (total > batch->order_capacity)
+			{
+				int* order = (int*)realloc(batch->order,
+					total * sizeof(int));
+				if (order == NULL)
+				{
+					fprintf(stderr, "%s\n", "Out of memory");
+					batch->count = 0;
+					return -1;
+				}
+				batch->order = order;
+				batch->order_capacity = total;
+			}
+			for (i = 0; i < nbands; ++i)
+			{
+				fill[i] = starts[i];
+			}
+		}
+		for (i = 0; i < batch->count; ++i)
+		{
+			const SDL_ext_Command* command = &batch->commands[i];
+			int x1, y1, x2, y2;
+			int b;
+
+			if (!SDL_ext_clipCommand(command, &clip, &x1, &y1, &x2, &y2))
+			{
+				continue;
+			}
+			if (j == 0)
+			{
+				left = x1 < left ? x1 : left;
+				top = y1 < top ? y1 : top;
+				right = x2 > right ? x2 : right;
+				bottom = y2 > bottom ? y2 : bottom;
+			}
+			for (b = (y1 - clip.y) / band_h; b <= (y2 - clip.y) / band_h; ++b)
+			{
+				if (j == 0)
+				{
+					starts[b + 1]++;
+					total++;
+				}
+				else
+				{
+					batch->order[fill[b]++] = i;
+				}
+			}
+		}
+		if (j == 0)
+		{
+			for (i = 0; i < nbands; ++i)
+			{
+				starts[i + 1] += starts[i];
+			}
+		}
+	}
+
+	for (i = 0; i < nbands; ++i)
+	{
+		SDL_ext_BatchBand* band = &bands[i];
+
+		band->batch = batch;
+		band->clip = clip;
+		band->clip.y = clip.y + i * band_h;
+		band->clip.h = i == nbands - 1 ? clip.y + clip.h - band->clip.y : band_h;
+		band->order = batch->order + starts[i];
+		band->count = starts[i + 1] - starts[i];
+	}
+
+	SDL_LockSurface(target);
+	if (nbands > 1)
+	{
+		//settle the cpu feature flags before the threads read them
+		SDL_HasSSE2();
+	}
+	for (i = 1; i < nbands; ++i)
+	{
+		started[i] = pthread_create(&threads[i], NULL,
+			SDL_ext_drawBand, &bands[i]) == 0;
+	}
+	SDL_ext_drawBand(&bands[0]);
+	for (i = 1; i < nbands; ++i)
+	{
+		if (started[i])
+		{
+			pthread_join(threads[i], NULL);
+		}
+		else
+		{
+			SDL_ext_drawBand(&bands[i]);
+		}
+	}
+	SDL_UnlockSurface(target);
+
+	SDL_ext_markDirty(target, left, top, right - left + 1, bottom - top + 1);
+	batch->count = 0;
+	return result;
+}
@@ -41,6 +41,13 @@ extern uint16_t SDL_ext_Alpha16(uint16_t src, uint16_t dst, uint8_t a,
 extern void SDL_ext_putPixelAlpha(SDL_Surface* surface, int x, int y, 
 	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA);
 
+//blend one run of pixels starting at (x, y) towards the colour,
+//coverage[i] scales colorA for pixel x + i (NULL for all 255).
+//the caller clips and locks, destination alpha is left alone
+extern void SDL_ext_blendSpan(SDL_Surface* surface, int x, int y, int width, 
+	const uint8_t* coverage, 
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA);
+
 //modified from sdlgraphics.hpp
 extern void SDL_ext_drawPoint(SDL_Surface* mTarget, 
 	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA, 
@@ -67,6 +74,63 @@ extern void SDL_ext_drawImage(SDL_Surface* mTarget,
 	int srcX, int srcY, int dstX, int dstY,
     int width, int height);
 
+//anti-aliased, coordinates are pixel centres and outlines are one
+//pixel wide. polygons fill with their exact area coverage, contours
+//that cross themselves count once where they overlap
+extern void SDL_ext_drawLineAA(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y1, int x2, int y2);
+extern void SDL_ext_drawCircle(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radius);
+extern void SDL_ext_fillCircle(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radius);
+extern void SDL_ext_drawEllipse(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radiusX, int radiusY);
+extern void SDL_ext_fillEllipse(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int radiusX, int radiusY);
+extern void SDL_ext_fillPolygon(SDL_Surface* mTarget,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	const int* vx, const int* vy, int n);
+
+//NOTE: records draw calls and puts them all down in SDL_ext_flushBatch
+//with one lock and one clip, large batches are drawn by several threads.
+//the pixels come out the same as with the aliased SDL_ext_draw* calls
+typedef struct SDL_ext_Batch SDL_ext_Batch;
+
+//colours are mapped for the target while recording
+extern SDL_ext_Batch* SDL_ext_createBatch(SDL_Surface* target);
+extern void SDL_ext_freeBatch(SDL_ext_Batch* batch);
+
+extern void SDL_ext_batchPoint(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y);
+extern void SDL_ext_batchHLine(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y, int x2);
+extern void SDL_ext_batchVLine(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y1, int y2);
+extern void SDL_ext_batchSpan(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x, int y, int width);
+extern void SDL_ext_batchLine(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int x1, int y1, int x2, int y2);
+extern void SDL_ext_batchRectangle(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int areaX, int areaY, int areaWidth, int areaHeight);
+extern void SDL_ext_batchFillRectangle(SDL_ext_Batch* batch,
+	uint8_t colorR, uint8_t colorG, uint8_t colorB, uint8_t colorA,
+	int areaX, int areaY, int areaWidth, int areaHeight);
+
+//draw and forget everything recorded, -1 if a call was dropped
+//because memory ran out
+extern int SDL_ext_flushBatch(SDL_ext_Batch* batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,12 +21,28 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
 #include "SDL_endian.h"
 #include "SDL_image.h"
 
+/* Map BMP files into memory instead of reading them */
+#define BMP_USE_MMAP 1
+
+#if BMP_USE_MMAP
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
 #define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
 
 #ifndef BI_RGB
@@ -150,86 +166,212 @@ int IMG_isBMP(FILE *src)
 	return(is_BMP);
 }
 
-static int readRlePixels(SDL_Surface * surface, FILE * src, int isRle8)
+/* The whole bitmap is mapped (or read with a single fread when mapping
+   isn't possible) and decoded from memory, rather than pulling palette
+   entries, pixels and padding through the FILE* a few bytes at a time.
+ */
+typedef struct {
+	const uint8_t *data;	/* file contents, starting at the "BM" magic */
+	size_t size;
+	uint8_t *buffer;	/* bulk read copy, when not mapped */
+	void *view;		/* mapped view of the whole file */
+#if BMP_USE_MMAP && defined(_WIN32)
+	HANDLE mapping;
+#else
+	size_t viewsize;
+#endif
+} BMP_Source;
+
+static int BMP_OpenSource(FILE *src, long offset, BMP_Source *bs)
+{
+	long end;
+
+	memset(bs, 0, sizeof(*bs));
+#if BMP_USE_MMAP
+#if defined(_WIN32)
+	{
+		HANDLE file = (HANDLE)_get_osfhandle(_fileno(src));
+		DWORD filesize = GetFileSize(file, NULL);
+
+		if ( filesize != INVALID_FILE_SIZE && (long)filesize > offset ) {
+			bs->mapping = CreateFileMapping(file, NULL,
+					PAGE_READONLY, 0, 0, NULL);
+			if ( bs->mapping ) {
+				bs->view = MapViewOfFile(bs->mapping,
+					FILE_MAP_READ, 0, 0, 0);
+				if ( bs->view ) {
+					bs->data = (const uint8_t *)bs->view + offset;
+					bs->size = filesize - offset;
+					return 0;
+				}
+				CloseHandle(bs->mapping);
+				bs->mapping = NULL;
+			}
+		}
+	}
+#else
+	{
+		struct stat st;
+
+		if ( fstat(fileno(src), &st) == 0 && S_ISREG(st.st_mode) &&
+		     st.st_size > offset ) {
+			void *view = mmap(NULL, st.st_size, PROT_READ,
+					MAP_PRIVATE, fileno(src), 0);
+			if ( view != MAP_FAILED ) {
+				bs->view = view;
+				bs->viewsize = st.st_size;
+				bs->data = (const uint8_t *)view + offset;
+				bs->size = st.st_size - offset;
+				return 0;
+			}
+		}
+	}
+#endif
+#endif /* BMP_USE_MMAP */
+
+	/* Fall back to one bulk read of the rest of the stream */
+	if ( fseek(src, 0, SEEK_END) < 0 || (end = ftell(src)) < 0 ||
+	     fseek(src, offset, SEEK_SET) < 0 ) {
+		fprintf(stderr, "%s\n", "SDL_EFSEEK");
+		return -1;
+	}
+	if ( end <= offset ) {
+		fprintf(stderr, "%s\n", "SDL_EFREAD");
+		return -1;
+	}
+	bs->size = end - offset;
+	bs->buffer = (uint8_t *)malloc(bs->size);
+	if ( bs->buffer == NULL ) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	if ( fread(bs->buffer, 1, bs->size, src) != bs->size ) {
+		fprintf(stderr, "%s\n", "SDL_EFREAD");
+		free(bs->buffer);
+		bs->buffer = NULL;
+		return -1;
+	}
+	bs->data = bs->buffer;
+	return 0;
+}
+
+static void BMP_CloseSource(BMP_Source *bs)
+{
+	if ( bs->buffer ) {
+		free(bs->buffer);
+	}
+#if BMP_USE_MMAP
+	if ( bs->view ) {
+#if defined(_WIN32)
+		UnmapViewOfFile(bs->view);
+		CloseHandle(bs->mapping);
+#else
+		munmap(bs->view, bs->viewsize);
+#endif
+	}
+#endif
+	memset(bs, 0, sizeof(*bs));
+}
+
+/* Decode an RLE4/RLE8 stream into an 8-bit surface, bottom-up.
+   Returns the number of bytes consumed, or -1 if the stream is truncated.
+   Runs and deltas that would leave the surface are clipped.
+ */
+static int readRlePixels(SDL_Surface * surface, const uint8_t *data, 
+			 size_t size, int isRle8)
 {
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
 	int pitch = surface->pitch;
-	int height = surface->h;
-	uint8_t * bits = (uint8_t *)surface->pixels + ((height-1) * pitch);
+	int width = surface->w;
+	int row = surface->h - 1;
+	uint8_t * bits = (uint8_t *)surface->pixels + (row * pitch);
 	int ofs = 0;
-	uint8_t ch;
-	uint8_t needsPad;
+	int ch;
 
-	for (;;) {
-		if (!fread(&ch, 1, 1, src)) 
-			return 1;
+	while ( row >= 0 ) {
+		if ( end - p < 2 )
+			return -1;
+		ch = *p++;
 		if (ch) {
-			uint8_t pixel;
-			if (!fread(&pixel, 1, 1, src)) 
-				return 1;
+			uint8_t pixel = *p++;
 			if (isRle8) {
-				do {
-					bits[ofs++] = pixel;
-				} while (--ch);
+				int n = (ofs + ch > width) ? width - ofs : ch;
+				if (n > 0)
+					memset(bits + ofs, pixel, n);
+				ofs += ch;
 			} else {
 				uint8_t pixel0 = pixel >> 4;
 				uint8_t pixel1 = pixel & 0x0F;
 				for (;;) {
-					bits[ofs++] = pixel0;     
+					if (ofs < width)
+						bits[ofs] = pixel0;
+					++ofs;
 					if (!--ch) 
 						break;
-					bits[ofs++] = pixel1;    
+					if (ofs < width)
+						bits[ofs] = pixel1;
+					++ofs;
 					if (!--ch) 
 						break;
 				}
 			}
 		} else {
-			if (!fread(&ch, 1, 1, src)) 
-				return 1;
+			ch = *p++;
 			switch (ch) {
 			case 0:      
 				ofs = 0;
+				--row;
 				bits -= pitch;      
 				break;
 			
 			case 1:            
-				return 0;       
+				return (int)(p - data);
 			
 			case 2:       
-				if (!fread(&ch, 1, 1, src)) 
-					return 1;
-				ofs += ch;
-				if (!fread(&ch, 1, 1, src)) 
-					return 1;
-				bits -= (ch * pitch);
+				if ( end - p < 2 )
+					return -1;
+				ofs += p[0];
+				row -= p[1];
+				bits -= (p[1] * pitch);
+				p += 2;
 				break;
 
 			default:
 				if (isRle8) {
-					needsPad = ( ch & 1 );
-					do {
-						if (!fread(bits + ofs++, 1, 1, src)) 
-							return 1;
-					} while (--ch);
+					int n;
+					if ( end - p < ch + (ch & 1) )
+						return -1;
+					n = (ofs + ch > width) ? width - ofs : ch;
+					if (n > 0)
+						memcpy(bits + ofs, p, n);
+					ofs += ch;
+					p += ch + (ch & 1);
 				} else {
-					needsPad = ( ((ch+1)>>1) & 1 ); 
+					int nbytes = (ch+1) >> 1;
+					if ( end - p < nbytes + (nbytes & 1) )
+						return -1;
 					for (;;) {
-						uint8_t pixel;
-						if (!fread(&pixel, 1, 1, src)) 
-							return 1;
-						bits[ofs++] = pixel >> 4;
+						uint8_t pixel = *p++;
+						if (ofs < width)
+							bits[ofs] = pixel >> 4;
+						++ofs;
 						if (!--ch) 
 							break;
-						bits[ofs++] = pixel & 0x0F;
+						if (ofs < width)
+							bits[ofs] = pixel & 0x0F;
+						++ofs;
 						if (!--ch) 
 							break;
 					}
+					p += nbytes & 1;
 				}
-				if (needsPad && !fread(&ch, 1, 1, src)) 
-					return 1;
 				break;
 			}
 		}
 	}
+	/* Ran off the top of the image without an end-of-bitmap marker */
+	return (int)(p - data);
 }
 
 
@@ -276,174 +418,299 @@ static uint64_t SDL_Swap64(uint64_t x)
 #define SDL_SwapBE64(X)	(X)
 #endif
 
-static uint32_t SDL_ReadLE32(FILE *src)
+static uint16_t BMP_Get16(const uint8_t *p)
 {
-	uint32_t value;
-
-	fread(&value, (sizeof value), 1, src);
-	return SDL_SwapLE32(value);
+	return (uint16_t)(p[0] | (p[1] << 8));
 }
 
-static uint16_t SDL_ReadLE16(FILE *src)
+static uint32_t BMP_Get32(const uint8_t *p)
 {
-	uint16_t value;
-
-	fread(&value, (sizeof value), 1, src);
-	return SDL_SwapLE16(value);
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
-static SDL_Surface *LoadBMP_RW(FILE *src, int freesrc)
-{
-	int was_error;
+/* Everything the decoders need to know about a bitmap, with the
+   whole file held in memory by a BMP_Source.
+ */
+typedef struct {
+	BMP_Source bs;
+	const uint8_t *data;
 	long fp_offset;
-	int bmpPitch;
-	int i, pad;
-	SDL_Surface *surface;
-	uint32_t Rmask;
-	uint32_t Gmask;
-	uint32_t Bmask;
-	uint32_t Amask;
-	SDL_Palette *palette;
-	uint8_t *bits;
-	int ExpandBMP;
-
-	char   magic[2];
-	uint32_t bfSize;
-	uint16_t bfReserved1;
-	uint16_t bfReserved2;
 	uint32_t bfOffBits;
-
 	uint32_t biSize;
 	int32_t biWidth;
 	int32_t biHeight;
-	uint16_t biPlanes;
-	uint16_t biBitCount;
+	int biBitCount;		/* as stored in the file */
 	uint32_t biCompression;
-	uint32_t biSizeImage;
-	int32_t biXPelsPerMeter;
-	int32_t biYPelsPerMeter;
 	uint32_t biClrUsed;
-	uint32_t biClrImportant;
+	int topdown;
+	int bmpPitch;
+	uint32_t Rmask;
+	uint32_t Gmask;
+	uint32_t Bmask;
+	uint32_t Amask;
+} BMP_Header;
 
-	surface = NULL;
-	was_error = 0;
+static int BMP_ReadHeader(FILE *src, BMP_Header *hdr)
+{
+	const uint8_t *data;
+
+	memset(hdr, 0, sizeof(*hdr));
 	if (src == NULL) {
-		was_error = 1;
-		goto done;
+		return -1;
 	}
-
-	fp_offset = ftell(src);
-	//SDL_ClearError();
-	if (fread(magic, 1, 2, src) != 2) {
+	hdr->fp_offset = ftell(src);
+	if (BMP_OpenSource(src, hdr->fp_offset, &hdr->bs) < 0) {
+		return -1;
+	}
+	data = hdr->data = hdr->bs.data;
+	if (hdr->bs.size < 14+12) {
 		//SDL_Error(SDL_EFREAD);
 		fprintf(stderr, "%s\n", "SDL_EFREAD");
-		was_error = 1;
-		goto done;
+		return -1;
 	}
-	if (strncmp(magic, "BM", 2) != 0) {
+	if (strncmp((const char *)data, "BM", 2) != 0) {
 		fprintf(stderr, "%s\n", "File is not a Windows BMP file");
-		was_error = 1;
-		goto done;
+		return -1;
 	}
-	bfSize		= SDL_ReadLE32(src);
-	bfReserved1	= SDL_ReadLE16(src);
-	bfReserved2	= SDL_ReadLE16(src);
-	bfOffBits	= SDL_ReadLE32(src);
-
-	biSize		= SDL_ReadLE32(src);
-	if ( biSize == 12 ) {
-		biWidth		= (uint32_t)SDL_ReadLE16(src);
-		biHeight	= (uint32_t)SDL_ReadLE16(src);
-		biPlanes	= SDL_ReadLE16(src);
-		biBitCount	= SDL_ReadLE16(src);
-		biCompression	= BI_RGB;
-		biSizeImage	= 0;
-		biXPelsPerMeter	= 0;
-		biYPelsPerMeter	= 0;
-		biClrUsed	= 0;
-		biClrImportant	= 0;
+	hdr->bfOffBits	= BMP_Get32(data + 10);
+
+	hdr->biSize	= BMP_Get32(data + 14);
+	if ( hdr->biSize == 12 ) {
+		hdr->biWidth		= (uint32_t)BMP_Get16(data + 18);
+		hdr->biHeight		= (uint32_t)BMP_Get16(data + 20);
+		hdr->biBitCount		= BMP_Get16(data + 24);
+		hdr->biCompression	= BI_RGB;
+		hdr->biClrUsed		= 0;
+	} else if ( hdr->biSize >= 40 && hdr->bs.size >= 14+hdr->biSize ) {
+		hdr->biWidth		= (int32_t)BMP_Get32(data + 18);
+		hdr->biHeight		= (int32_t)BMP_Get32(data + 22);
+		hdr->biBitCount		= BMP_Get16(data + 28);
+		hdr->biCompression	= BMP_Get32(data + 30);
+		hdr->biClrUsed		= BMP_Get32(data + 46);
 	} else {
-		biWidth		= SDL_ReadLE32(src);
-		biHeight	= SDL_ReadLE32(src);
-		biPlanes	= SDL_ReadLE16(src);
-		biBitCount	= SDL_ReadLE16(src);
-		biCompression	= SDL_ReadLE32(src);
-		biSizeImage	= SDL_ReadLE32(src);
-		biXPelsPerMeter	= SDL_ReadLE32(src);
-		biYPelsPerMeter	= SDL_ReadLE32(src);
-		biClrUsed	= SDL_ReadLE32(src);
-		biClrImportant	= SDL_ReadLE32(src);
-	}
-
-	//if ( strcmp(SDL_GetError(), "") != 0 ) {
-	//	was_error = 1;
-	//	goto done;
-	//}
-
-	switch (biBitCount) {
-		case 1:
-		case 4:
-			ExpandBMP = biBitCount;
-			biBitCount = 8;
+		fprintf(stderr, "%s\n", "Unsupported BMP header");
+		return -1;
+	}
+
+	/* A negative height marks a top-down bitmap */
+	if (hdr->biHeight < 0) {
+		hdr->topdown = 1;
+		hdr->biHeight = -hdr->biHeight;
+	}
+	if (hdr->biWidth <= 0 || hdr->biHeight <= 0 ||
+	    hdr->bfOffBits >= hdr->bs.size) {
+		fprintf(stderr, "%s\n", "Invalid BMP dimensions");
+		return -1;
+	}
+	/* The limits of SDL_CreateRGBSurface(), which also keep the row
+	   pitches below in range of an int */
+	if (hdr->biWidth >= 16384 || hdr->biHeight >= 65536) {
+		fprintf(stderr, "%s\n", "Width or height is too large");
+		return -1;
+	}
+	switch (hdr->biBitCount) {
+		case 1: case 4: case 8: case 15: case 16: case 24: case 32:
 			break;
 		default:
-			ExpandBMP = 0;
-			break;
+			fprintf(stderr, "%s\n", "Unsupported BMP bit depth");
+			return -1;
 	}
+	hdr->bmpPitch = ((hdr->biWidth * hdr->biBitCount + 31) >> 5) << 2;
 
-	Rmask = Gmask = Bmask = Amask = 0;
-	switch (biCompression) {
+	switch (hdr->biCompression) {
 		case BI_RGB:
-			if ( bfOffBits == (14+biSize) ) {
-				switch (biBitCount) {
-					case 15:
-					case 16:
-						Rmask = 0x7C00;
-						Gmask = 0x03E0;
-						Bmask = 0x001F;
-						break;
-					case 24:
+			switch (hdr->biBitCount) {
+				case 15:
+				case 16:
+					hdr->Rmask = 0x7C00;
+					hdr->Gmask = 0x03E0;
+					hdr->Bmask = 0x001F;
+					break;
+				case 24:
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-					        Rmask = 0x000000FF;
-					        Gmask = 0x0000FF00;
-					        Bmask = 0x00FF0000;
+				        hdr->Rmask = 0x000000FF;
+				        hdr->Gmask = 0x0000FF00;
+				        hdr->Bmask = 0x00FF0000;
 #else
-						Rmask = 0x00FF0000;
-						Gmask = 0x0000FF00;
-						Bmask = 0x000000FF;
+					hdr->Rmask = 0x00FF0000;
+					hdr->Gmask = 0x0000FF00;
+					hdr->Bmask = 0x000000FF;
 #endif
-						break;
-					case 32:
-						Amask = 0xFF000000;
-						Rmask = 0x00FF0000;
-						Gmask = 0x0000FF00;
-						Bmask = 0x000000FF;
-						break;
-					default:
-						break;
-				}
-				break;
+					break;
+				case 32:
+					hdr->Amask = 0xFF000000;
+					hdr->Rmask = 0x00FF0000;
+					hdr->Gmask = 0x0000FF00;
+					hdr->Bmask = 0x000000FF;
+					break;
+				default:
+					break;
 			}
-			// Fall through -- read the RGB masks
+			break;
 
-		default:
-			switch (biBitCount) {
+		case BI_BITFIELDS:
+			/* The masks follow a 40 byte header, or are part of a
+			   V2+ header; only V3+ headers carry an alpha mask. */
+			switch (hdr->biBitCount) {
 				case 15:
 				case 16:
 				case 32:
-					Rmask = SDL_ReadLE32(src);
-					Gmask = SDL_ReadLE32(src);
-					Bmask = SDL_ReadLE32(src);
-					Amask = SDL_ReadLE32(src);
+					if (hdr->bs.size < 14+40+12) {
+						fprintf(stderr, "%s\n", "SDL_EFREAD");
+						return -1;
+					}
+					hdr->Rmask = BMP_Get32(data + 54);
+					hdr->Gmask = BMP_Get32(data + 58);
+					hdr->Bmask = BMP_Get32(data + 62);
+					if (hdr->biSize >= 56)
+						hdr->Amask = BMP_Get32(data + 66);
 					break;
 				default:
 					break;
 			}
 			break;
+
+		case BI_RLE4:
+		case BI_RLE8:
+			if (hdr->biBitCount != 4 && hdr->biBitCount != 8) {
+				fprintf(stderr, "%s\n", "Invalid RLE BMP");
+				return -1;
+			}
+			break;
+
+		default:
+			break;
+	}
+	return 0;
+}
+
+/* Read up to maxcolors palette entries, returns how many there are */
+static int BMP_ReadPalette(BMP_Header *hdr, SDL_Color *colors, int maxcolors)
+{
+	int entry = (hdr->biSize == 12) ? 3 : 4;
+	const uint8_t *p = hdr->data + 14 + hdr->biSize;
+	uint32_t ncolors = hdr->biClrUsed;
+	int i;
+
+	if (ncolors == 0 || ncolors > (uint32_t)maxcolors) {
+		ncolors = 1 << hdr->biBitCount;
+	}
+	if ( 14 + hdr->biSize + ncolors * entry > hdr->bs.size ) {
+		fprintf(stderr, "%s\n", "SDL_EFREAD");
+		return -1;
+	}
+	for ( i = 0; i < (int)ncolors; ++i ) {
+		colors[i].b = p[0];
+		colors[i].g = p[1];
+		colors[i].r = p[2];
+		colors[i].unused = 0;
+		p += entry;
+	}
+	return (int)ncolors;
+}
+
+/* Returns the number of pixel bytes, or -1 if the file is short */
+static long BMP_CheckPixels(BMP_Header *hdr)
+{
+	if ( (size_t)hdr->bmpPitch * hdr->biHeight >
+	     hdr->bs.size - hdr->bfOffBits ) {
+		//SDL_Error(SDL_EFREAD);
+		fprintf(stderr, "%s\n", "SDL_EFREAD");
+		return -1;
+	}
+	return (long)hdr->bmpPitch * hdr->biHeight;
+}
+
+/* Expand 1 and 4 bit pixels to one byte per pixel */
+static void BMP_ExpandRow(uint8_t *row, const uint8_t *in, int n, int bits)
+{
+	int i;
+
+	if ( bits == 1 ) {
+		for ( ; n >= 8; n -= 8 ) {
+			uint8_t pixel = *in++;
+			row[0] = (pixel >> 7);
+			row[1] = (pixel >> 6) & 1;
+			row[2] = (pixel >> 5) & 1;
+			row[3] = (pixel >> 4) & 1;
+			row[4] = (pixel >> 3) & 1;
+			row[5] = (pixel >> 2) & 1;
+			row[6] = (pixel >> 1) & 1;
+			row[7] = pixel & 1;
+			row += 8;
+		}
+		if ( n ) {
+			uint8_t pixel = *in;
+			for ( i = 0; i < n; ++i ) {
+				row[i] = (pixel >> 7);
+				pixel <<= 1;
+			}
+		}
+	} else {
+		for ( ; n >= 2; n -= 2 ) {
+			uint8_t pixel = *in++;
+			row[0] = (pixel >> 4);
+			row[1] = pixel & 0x0F;
+			row += 2;
+		}
+		if ( n ) {
+			row[0] = (*in >> 4);
+		}
+	}
+}
+
+/* Leave the stream just past the bitmap on success, as reading it did */
+static void BMP_Finish(FILE *src, BMP_Header *hdr, long fp_end, int was_error)
+{
+	BMP_CloseSource(&hdr->bs);
+	if (src) {
+		if (was_error) {
+			fseek(src, hdr->fp_offset, SEEK_SET);
+		} else {
+			fseek(src, hdr->fp_offset + fp_end, SEEK_SET);
+		}
+	}
+}
+
+static SDL_Surface *LoadBMP_RW(FILE *src, int freesrc)
+{
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	int i;
+#endif
+	int was_error;
+	long fp_end = 0;
+	int y, h;
+	SDL_Surface *surface;
+	SDL_Palette *palette;
+	const uint8_t *bits;
+	uint8_t *row;
+	int ExpandBMP;
+	int bitcount;
+	BMP_Header hdr;
+
+	surface = NULL;
+	was_error = 0;
+	if (BMP_ReadHeader(src, &hdr) < 0) {
+		was_error = 1;
+		goto done;
+	}
+
+	switch (hdr.biBitCount) {
+		case 1:
+		case 4:
+			ExpandBMP = hdr.biBitCount;
+			bitcount = 8;
+			break;
+		default:
+			ExpandBMP = 0;
+			bitcount = hdr.biBitCount;
+			break;
 	}
 
 	surface = SDL_CreateRGBSurface(SDL_SWSURFACE,
-			biWidth, biHeight, biBitCount, Rmask, Gmask, Bmask, Amask);
+			hdr.biWidth, hdr.biHeight, bitcount,
+			hdr.Rmask, hdr.Gmask, hdr.Bmask, hdr.Amask);
 	if ( surface == NULL ) {
 		was_error = 1;
 		goto done;
@@ -451,120 +718,67 @@ static SDL_Surface *LoadBMP_RW(FILE *src, int freesrc)
 
 	palette = (surface->format)->palette;
 	if (palette) {
-		if (fseek(src, fp_offset+14+biSize, SEEK_SET) < 0) {
-			//SDL_Error(SDL_EFSEEK);
-			fprintf(stderr, "%s\n", "SDL_EFSEEK");
+		int ncolors = BMP_ReadPalette(&hdr, palette->colors,
+					      palette->ncolors);
+		if (ncolors < 0) {
 			was_error = 1;
 			goto done;
 		}
-
-		biClrUsed = 1 << biBitCount;
-		if ( biSize == 12 ) {
-			for ( i = 0; i < (int)biClrUsed; ++i ) {
-				fread(&palette->colors[i].b, 1, 1, src);
-				fread(&palette->colors[i].g, 1, 1, src);
-				fread(&palette->colors[i].r, 1, 1, src);
-				palette->colors[i].unused = 0;
-			}	
-		} else {
-			for ( i = 0; i < (int)biClrUsed; ++i ) {
-				fread(&palette->colors[i].b, 1, 1, src);
-				fread(&palette->colors[i].g, 1, 1, src);
-				fread(&palette->colors[i].r, 1, 1, src);
-				fread(&palette->colors[i].unused, 1, 1, src);
-			}	
-		}
-		palette->ncolors = biClrUsed;
+		palette->ncolors = ncolors;
 	}
 
-	if (fseek(src, fp_offset+bfOffBits, SEEK_SET) < 0) {
-		fprintf(stderr, "%s\n", "SDL_EFSEEK");
-		was_error = 1;
+	bits = hdr.data + hdr.bfOffBits;
+	if ((hdr.biCompression == BI_RLE4) || (hdr.biCompression == BI_RLE8)) {
+		int used = readRlePixels(surface, bits,
+				hdr.bs.size - hdr.bfOffBits,
+				hdr.biCompression == BI_RLE8);
+		if (used < 0) {
+			fprintf(stderr, "%s\n", "Error reading from BMP");
+			was_error = 1;
+			goto done;
+		}
+		fp_end = hdr.bfOffBits + used;
 		goto done;
 	}
-	if ((biCompression == BI_RLE4) || (biCompression == BI_RLE8)) {
-		was_error = readRlePixels(surface, src, biCompression == BI_RLE8);
-		if (was_error) 
-			fprintf(stderr, "%s\n", "Error reading from BMP");
+	if ((fp_end = BMP_CheckPixels(&hdr)) < 0) {
+		was_error = 1;
 		goto done;
 	}
-	bits = (uint8_t *)surface->pixels+(surface->h*surface->pitch);
-	switch (ExpandBMP) {
-	case 1:
-		bmpPitch = (biWidth + 7) >> 3;
-		pad  = (((bmpPitch)%4) ? (4-((bmpPitch)%4)) : 0);
-		break;
-
-	case 4:
-		bmpPitch = (biWidth + 1) >> 1;
-		pad  = (((bmpPitch)%4) ? (4-((bmpPitch)%4)) : 0);
-		break;
-	
-	default:
-		pad  = ((surface->pitch%4) ?
-				(4-(surface->pitch%4)) : 0);
-		break;
-	}
-	while ( bits > (uint8_t *)surface->pixels ) {
-		bits -= surface->pitch;
-		switch (ExpandBMP) {
-			case 1:
-			case 4: {
-					uint8_t pixel = 0;
-					int shift = (8-ExpandBMP);
-					for (i=0; i<surface->w; ++i ) {
-						if ( i%(8/ExpandBMP) == 0 ) {
-							if (!fread(&pixel, 1, 1, src)) {
-								fprintf(stderr, "%s\n", "Error reading from BMP");
-								was_error = 1;
-								goto done;
-							}
-						}
-						*(bits+i) = (pixel>>shift);
-						pixel <<= ExpandBMP;
-					} 
-				}
-				break;
-
-			default:
-				if (fread(bits, 1, surface->pitch, src) != surface->pitch ) {
-					//SDL_Error(SDL_EFREAD);
-					fprintf(stderr, "%s\n", "SDL_EFREAD");
-					was_error = 1;
-					goto done;
-				}
+	fp_end += hdr.bfOffBits;
+
+	/* Decode each row straight into its final place in the surface */
+	h = surface->h;
+	for ( y = 0; y < h; ++y, bits += hdr.bmpPitch ) {
+		row = (uint8_t *)surface->pixels +
+			(hdr.topdown ? y : (h - 1 - y)) * surface->pitch;
+		if ( ExpandBMP ) {
+			BMP_ExpandRow(row, bits, surface->w, ExpandBMP);
+			continue;
+		}
+		memcpy(row, bits, hdr.bmpPitch < surface->pitch ?
+				hdr.bmpPitch : surface->pitch);
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-				switch(biBitCount) {
-					case 15:
-					case 16: {
-							uint16_t *pix = (uint16_t *)bits;
-						for(i = 0; i < surface->w; i++)
-								pix[i] = SDL_Swap16(pix[i]);
-						break;
-					}
+		switch(bitcount) {
+			case 15:
+			case 16: {
+					uint16_t *pix = (uint16_t *)row;
+				for(i = 0; i < surface->w; i++)
+						pix[i] = SDL_Swap16(pix[i]);
+				break;
+			}
 
-					case 32: {
-							uint32_t *pix = (uint32_t *)bits;
-						for(i = 0; i < surface->w; i++)
-								pix[i] = SDL_Swap32(pix[i]);
-						break;
-					}
-				}
-#endif
-			break;
-		}
-		if (pad) {
-			uint8_t padbyte;
-			for (i = 0; i < pad; ++i) {
-				fread(&padbyte, 1, 1, src);
+			case 32: {
+					uint32_t *pix = (uint32_t *)row;
+				for(i = 0; i < surface->w; i++)
+						pix[i] = SDL_Swap32(pix[i]);
+				break;
 			}
 		}
+#endif
 	}
 done:
+	BMP_Finish(src, &hdr, fp_end, was_error);
 	if (was_error) {
-		if (src) {
-			fseek(src, fp_offset, SEEK_SET);
-		}
 		if (surface) {
 			SDL_FreeSurface(surface);
 		}
@@ -581,3 +795,273 @@ SDL_Surface *IMG_LoadBMP_RW(FILE *src)
 	return LoadBMP_RW(src, 0);
 }
 
+/* Map one masked channel to 8 bits, the same way SDL_GetRGBA() does */
+typedef struct {
+	uint32_t mask;
+	int shift;
+	uint8_t lut[256];
+} BMP_Channel;
+
+static void BMP_InitChannel(BMP_Channel *ch, uint32_t mask, uint8_t missing)
+{
+	int bits, n, i;
+
+	ch->mask = mask;
+	ch->shift = 0;
+	if ( mask == 0 ) {
+		memset(ch->lut, missing, sizeof(ch->lut));
+		return;
+	}
+	while ( !(mask & 1) ) {
+		mask >>= 1;
+		++ch->shift;
+	}
+	for ( bits = 0; mask & 1; mask >>= 1 ) {
+		++bits;
+	}
+	/* Only the top 8 bits of a wide channel matter */
+	if ( bits > 8 ) {
+		ch->shift += bits - 8;
+		bits = 8;
+	}
+	ch->mask = ((1 << bits) - 1);
+	for ( i = 0; i <= (int)ch->mask; ++i ) {
+		uint8_t v = 0;
+		for ( n = 8; n > 0; n -= bits ) {
+			v |= (n >= bits) ? (i << (n - bits)) : (i >> (bits - n));
+		}
+		ch->lut[i] = v;
+	}
+}
+
+#define BMP_CHANNEL(ch, pixel) ((ch).lut[((pixel) >> (ch).shift) & (ch).mask])
+
+uint8_t *IMG_LoadBMPPixels_RW(FILE *src, int format, int *w, int *h)
+{
+	int was_error;
+	long fp_end = 0;
+	BMP_Header hdr;
+	SDL_Surface *indices;
+	uint8_t *pixels;
+	uint8_t *expanded;
+	uint8_t lut[256][4];
+	BMP_Channel R, G, B, A;
+	const uint8_t *bits;
+	int outbpp, outpitch, swaprb;
+	int srcpitch, srctop;
+	int x, y, rows;
+
+	was_error = 0;
+	indices = NULL;
+	pixels = NULL;
+	expanded = NULL;
+	if (w) *w = 0;
+	if (h) *h = 0;
+	if (BMP_ReadHeader(src, &hdr) < 0) {
+		was_error = 1;
+		goto done;
+	}
+
+	switch (format & IMG_PIXELS_FORMATMASK) {
+		case IMG_PIXELS_RGB24:  outbpp = 3; swaprb = 1; break;
+		case IMG_PIXELS_BGR24:  outbpp = 3; swaprb = 0; break;
+		case IMG_PIXELS_RGBA32: outbpp = 4; swaprb = 1; break;
+		case IMG_PIXELS_BGRA32: outbpp = 4; swaprb = 0; break;
+		default:
+			fprintf(stderr, "%s\n", "Unsupported pixel format");
+			was_error = 1;
+			goto done;
+	}
+	outpitch = hdr.biWidth * outbpp;
+	if ( (int64_t)outpitch * hdr.biHeight > 0x7FFFFFFF ) {
+		fprintf(stderr, "Out of memory\n");
+		was_error = 1;
+		goto done;
+	}
+	pixels = (uint8_t *)malloc((size_t)outpitch * hdr.biHeight);
+	if ( pixels == NULL ) {
+		fprintf(stderr, "Out of memory\n");
+		was_error = 1;
+		goto done;
+	}
+
+	/* Palette lookups produce the output pixel directly */
+	if ( hdr.biBitCount <= 8 ) {
+		SDL_Color colors[256];
+		int ncolors = BMP_ReadPalette(&hdr, colors, 256);
+
+		if (ncolors < 0) {
+			was_error = 1;
+			goto done;
+		}
+		memset(lut, 0, sizeof(lut));
+		for ( x = 0; x < ncolors; ++x ) {
+			lut[x][0] = swaprb ? colors[x].r : colors[x].b;
+			lut[x][1] = colors[x].g;
+			lut[x][2] = swaprb ? colors[x].b : colors[x].r;
+			lut[x][3] = 0xFF;
+		}
+	} else if ( hdr.biBitCount != 24 ) {
+		BMP_InitChannel(&R, hdr.Rmask, 0);
+		BMP_InitChannel(&G, hdr.Gmask, 0);
+		BMP_InitChannel(&B, hdr.Bmask, 0);
+		BMP_InitChannel(&A, hdr.Amask, 0xFF);
+	}
+
+	bits = hdr.data + hdr.bfOffBits;
+	srcpitch = hdr.bmpPitch;
+	srctop = hdr.topdown;
+	if ((hdr.biCompression == BI_RLE4) || (hdr.biCompression == BI_RLE8)) {
+		/* RLE isn't row addressable, unpack the indices first */
+		int used;
+
+		indices = SDL_CreateRGBSurface(SDL_SWSURFACE,
+				hdr.biWidth, hdr.biHeight, 8, 0, 0, 0, 0);
+		if ( indices == NULL ) {
+			was_error = 1;
+			goto done;
+		}
+		used = readRlePixels(indices, bits,
+				hdr.bs.size - hdr.bfOffBits,
+				hdr.biCompression == BI_RLE8);
+		if (used < 0) {
+			fprintf(stderr, "%s\n", "Error reading from BMP");
+			was_error = 1;
+			goto done;
+		}
+		fp_end = hdr.bfOffBits + used;
+		bits = (const uint8_t *)indices->pixels;
+		srcpitch = indices->pitch;
+		srctop = 1;
+		hdr.biBitCount = 8;
+	} else {
+		if ((fp_end = BMP_CheckPixels(&hdr)) < 0) {
+			was_error = 1;
+			goto done;
+		}
+		fp_end += hdr.bfOffBits;
+	}
+	if ( hdr.biBitCount < 8 ) {
+		expanded = (uint8_t *)malloc(hdr.biWidth);
+		if ( expanded == NULL ) {
+			fprintf(stderr, "Out of memory\n");
+			was_error = 1;
+			goto done;
+		}
+	}
+
+	/* Convert every source row once, straight into its output row */
+	rows = hdr.biHeight;
+	for ( y = 0; y < rows; ++y, bits += srcpitch ) {
+		const uint8_t *in = bits;
+		uint8_t *out;
+		int line = srctop ? y : (rows - 1 - y);	/* from the top */
+
+		if ( !(format & IMG_PIXELS_TOPDOWN) ) {
+			line = rows - 1 - line;
+		}
+		out = pixels + (size_t)line * outpitch;
+
+		switch (hdr.biBitCount) {
+			case 1:
+			case 4:
+				BMP_ExpandRow(expanded, in, hdr.biWidth,
+					      hdr.biBitCount);
+				in = expanded;
+				/* fall through */
+			case 8:
+				if ( outbpp == 4 ) {
+					for ( x = 0; x < hdr.biWidth; ++x ) {
+						memcpy(out, lut[in[x]], 4);
+						out += 4;
+					}
+				} else {
+					for ( x = 0; x < hdr.biWidth; ++x ) {
+						const uint8_t *c = lut[in[x]];
+						out[0] = c[0];
+						out[1] = c[1];
+						out[2] = c[2];
+						out += 3;
+					}
+				}
+				break;
+
+			case 24:
+				/* Stored as B,G,R bytes */
+				if ( outbpp == 3 && !swaprb ) {
+					memcpy(out, in, outpitch);
+					break;
+				}
+				for ( x = 0; x < hdr.biWidth; ++x ) {
+					out[0] = swaprb ? in[2] : in[0];
+					out[1] = in[1];
+					out[2] = swaprb ? in[0] : in[2];
+					if ( outbpp == 4 ) {
+						out[3] = 0xFF;
+					}
+					in += 3;
+					out += outbpp;
+				}
+				break;
+
+			case 15:
+			case 16:
+			case 32:
+				for ( x = 0; x < hdr.biWidth; ++x ) {
+					uint32_t pixel;
+					uint8_t r, b;
+
+					if ( hdr.biBitCount == 32 ) {
+						pixel = BMP_Get32(in);
+						in += 4;
+					} else {
+						pixel = BMP_Get16(in);
+						in += 2;
+					}
+					r = BMP_CHANNEL(R, pixel);
+					b = BMP_CHANNEL(B, pixel);
+					out[0] = swaprb ? r : b;
+					out[1] = BMP_CHANNEL(G, pixel);
+					out[2] = swaprb ? b : r;
+					if ( outbpp == 4 ) {
+						out[3] = BMP_CHANNEL(A, pixel);
+					}
+					out += outbpp;
+				}
+				break;
+		}
+	}
+	if (w) *w = hdr.biWidth;
+	if (h) *h = hdr.biHeight;
+done:
+	BMP_Finish(src, &hdr, fp_end, was_error);
+	if ( indices ) {
+		SDL_FreeSurface(indices);
+	}
+	if ( expanded ) {
+		free(expanded);
+	}
+	if (was_error && pixels) {
+		free(pixels);
+		pixels = NULL;
+	}
+	return pixels;
+}
+
+uint8_t *IMG_LoadBMPPixels(const char *file, int format, int *w, int *h)
+{
+	FILE *src;
+	uint8_t *pixels;
+
+	if (w) *w = 0;
+	if (h) *h = 0;
+	src = fopen(file, "rb");
+	if (!src) {
+		fprintf(stderr, "Couldn't open %s\n", file);
+		return NULL;
+	}
+	pixels = IMG_LoadBMPPixels_RW(src, format, w, h);
+	fclose(src);
+	return pixels;
+}
+
@@ -55,6 +55,62 @@ extern int IMG_isBMP(FILE *src);
 
 extern SDL_Surface * IMG_LoadBMP_RW(FILE *src);
 
+/* Decode a BMP straight into a tightly packed buffer ready for
+   glTexImage2D(), in one pass.  The byte order is the order of the
+   format name, rows start at the bottom of the image unless
+   IMG_PIXELS_TOPDOWN is or'ed into the format.  Free it with free().
+ */
+#define IMG_PIXELS_RGB24	0
+#define IMG_PIXELS_BGR24	1
+#define IMG_PIXELS_RGBA32	2
+#define IMG_PIXELS_BGRA32	3
+#define IMG_PIXELS_FORMATMASK	0x0F
+#define IMG_PIXELS_TOPDOWN	0x10
+
+extern uint8_t * IMG_LoadBMPPixels_RW(FILE *src, int format, int *w, int *h);
+extern uint8_t * IMG_LoadBMPPixels(const char *file, int format, int *w, int *h);
+
+/* Asynchronous loading on a pool of worker threads (SDL_image_async.c).
+   The callback runs on a worker thread and owns the surface, which is
+   NULL if the load failed.  When a completion event is enabled with
+   IMG_SetAsyncEvent(), an SDL_USEREVENT is posted with user.code set to
+   that code, user.data1 to the surface (NULL if a callback already took
+   it) and user.data2 to the userdata pointer.
+ */
+#define IMG_ASYNC_MAXWORKERS	8
+
+typedef void (*IMG_AsyncCallback)(int id, SDL_Surface *surface, void *userdata);
+
+extern int IMG_AsyncInit(int workers, int maxpending);
+extern void IMG_AsyncQuit(void);
+extern void IMG_SetAsyncEvent(int code);
+/* Returns a request id > 0, or -1 if maxpending loads are outstanding */
+extern int IMG_LoadAsync(const char *file, IMG_AsyncCallback callback, void *userdata);
+extern int IMG_CancelAsync(int id);
+extern int IMG_AsyncPending(void);
+
+/* Shared image cache (SDL_image_cache.c).
+   IMG_CacheLoad() returns a surface shared with every other caller that
+   loaded the same unchanged file, so treat it as read-only and release
+   it with IMG_CacheRelease(), not SDL_FreeSurface().  Surfaces nobody
+   holds are evicted least recently used first when the cached pixels
+   exceed the budget.
+ */
+typedef struct IMG_CacheStats {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+	unsigned int reloads;	/* file changed on disk since it was cached */
+	int entries;
+	size_t bytes;
+} IMG_CacheStats;
+
+extern SDL_Surface * IMG_CacheLoad(const char *file);
+extern void IMG_CacheRelease(SDL_Surface *surface);
+extern void IMG_CacheSetBudget(size_t bytes);
+extern void IMG_CacheFlush(void);
+extern void IMG_CacheGetStats(IMG_CacheStats *stats);
+
 //#define IMG_SetError	SDL_SetError
 //#define IMG_GetError	SDL_GetError
 
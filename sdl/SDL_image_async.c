@@ -0,0 +1,383 @@
+/*
+    SDL_image:  An example image loading library for use with SDL
+    Copyright (C) 1997-2006 Sam Lantinga
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Sam Lantinga
+    slouken@libsdl.org
+*/
+
+/* Background image loading on a small pool of worker threads, so the
+   GLUT main loop can keep drawing while level art is decoded.
+   A finished load is handed to the callback (on the worker thread) and,
+   if enabled with IMG_SetAsyncEvent(), posted as an SDL_USEREVENT.
+ */
+
+#include <pthread.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDL_events.h"
+#include "SDL_image.h"
+
+#define IMG_ASYNC_WORKERS	2
+#define IMG_ASYNC_MAXPENDING	16
+
+typedef struct IMG_AsyncJob {
+	int id;
+	char *file;
+	IMG_AsyncCallback callback;
+	void *userdata;
+	int cancelled;
+	struct IMG_AsyncJob *next;
+} IMG_AsyncJob;
+
+static struct {
+	pthread_t threads[IMG_ASYNC_MAXWORKERS];
+	int numthreads;
+	int initialized;	/* a pool is taking loads */
+	int stopping;		/* IMG_AsyncQuit() is waiting for it */
+	int quit;
+	IMG_AsyncJob *head;	/* waiting to be decoded */
+	IMG_AsyncJob *tail;
+	IMG_AsyncJob *running;	/* being decoded right now */
+	int pending;		/* waiting + running */
+	int maxpending;
+	int nextid;
+	int eventcode;		/* SDL_USEREVENT code, or -1 for none */
+} IMG_Async;
+
+/* Serialises IMG_AsyncInit() and IMG_AsyncQuit(), so two first callers
+   can't both start a pool */
+static pthread_mutex_t IMG_AsyncInitLock = PTHREAD_MUTEX_INITIALIZER;
+/* Guards IMG_Async.  These outlive any pool, so the other calls only
+   check IMG_Async.initialized under the lock, and a callback can still
+   call them while IMG_AsyncQuit() waits for its worker. */
+static pthread_mutex_t IMG_AsyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t IMG_AsyncWake = PTHREAD_COND_INITIALIZER;
+
+static void IMG_DeliverAsync(IMG_AsyncJob *job, SDL_Surface *surface)
+{
+	int delivered = 0;
+	int eventcode;
+
+	if ( job->callback ) {
+		job->callback(job->id, surface, job->userdata);
+		delivered = 1;
+	}
+	pthread_mutex_lock(&IMG_AsyncLock);
+	eventcode = IMG_Async.eventcode;
+	pthread_mutex_unlock(&IMG_AsyncLock);
+	if ( eventcode >= 0 ) {
+		SDL_Event event;
+
+		event.type = SDL_USEREVENT;
+		event.user.type = SDL_USEREVENT;
+		event.user.code = eventcode;
+		event.user.data1 = delivered ? NULL : surface;
+		event.user.data2 = job->userdata;
+		if ( SDL_PushEvent(&event) < 0 && ! delivered ) {
+			fprintf(stderr, "Couldn't post load event for %s\n",
+				job->file);
+		} else {
+			delivered = 1;
+		}
+	}
+	/* Nobody to take ownership of it */
+	if ( ! delivered ) {
+		SDL_FreeSurface(surface);
+	}
+}
+
+static void *IMG_AsyncWorker(void *data)
+{
+	IMG_AsyncJob *job, **prev;
+	SDL_Surface *surface;
+	int cancelled;
+
+	(void)data;
+	pthread_mutex_lock(&IMG_AsyncLock);
+	for ( ; ; ) {
+		while ( ! IMG_Async.quit && ! IMG_Async.head ) {
+			pthread_cond_wait(&IMG_AsyncWake, &IMG_AsyncLock);
+		}
+		if ( IMG_Async.quit ) {
+			break;
+		}
+		job = IMG_Async.head;
+		IMG_Async.head = job->next;
+		if ( ! IMG_Async.head ) {
+			IMG_Async.tail = NULL;
+		}
+		job->next = IMG_Async.running;
+		IMG_Async.running = job;
+		pthread_mutex_unlock(&IMG_AsyncLock);
+
+		surface = IMG_Load(job->file);
+		if ( surface == NULL ) {
+			fprintf(stderr, "Couldn't load %s\n", job->file);
+		}
+
+		pthread_mutex_lock(&IMG_AsyncLock);
+		for ( prev = &IMG_Async.running; *prev; prev = &(*prev)->next ) {
+			if ( *prev == job ) {
+				*prev = job->next;
+				break;
+			}
+		}
+		cancelled = job->cancelled;
+		pthread_mutex_unlock(&IMG_AsyncLock);
+
+		if ( cancelled ) {
+			SDL_FreeSurface(surface);
+		} else {
+			IMG_DeliverAsync(job, surface);
+		}
+		free(job->file);
+		free(job);
+
+		pthread_mutex_lock(&IMG_AsyncLock);
+		--IMG_Async.pending;
+	}
+	pthread_mutex_unlock(&IMG_AsyncLock);
+	return NULL;
+}
+
+/* Called with IMG_AsyncInitLock held */
+static void IMG_AsyncShutdown(void)
+{
+	IMG_AsyncJob *job;
+	int i;
+
+	/* Drop everything that hasn't started, let running loads finish */
+	pthread_mutex_lock(&IMG_AsyncLock);
+	IMG_Async.initialized = 0;
+	IMG_Async.stopping = 1;
+	IMG_Async.quit = 1;
+	while ( (job = IMG_Async.head) != NULL ) {
+		IMG_Async.head = job->next;
+		free(job->file);
+		free(job);
+	}
+	IMG_Async.tail = NULL;
+	for ( job = IMG_Async.running; job; job = job->next ) {
+		job->cancelled = 1;
+	}
+	pthread_cond_broadcast(&IMG_AsyncWake);
+	pthread_mutex_unlock(&IMG_AsyncLock);
+
+	for ( i = 0; i < IMG_Async.numthreads; ++i ) {
+		pthread_join(IMG_Async.threads[i], NULL);
+	}
+	IMG_Async.numthreads = 0;
+
+	pthread_mutex_lock(&IMG_AsyncLock);
+	IMG_Async.pending = 0;
+	IMG_Async.stopping = 0;
+	pthread_mutex_unlock(&IMG_AsyncLock);
+}
+
+/* Start a pool unless there is one, or one is being shut down, which
+   would wait for the init lock its caller's callback may be holding up */
+static int IMG_AsyncStart(void)
+{
+	int stopping;
+
+	pthread_mutex_lock(&IMG_AsyncLock);
+	stopping = IMG_Async.stopping;
+	pthread_mutex_unlock(&IMG_AsyncLock);
+	if ( stopping ) {
+		return(-1);
+	}
+	return IMG_AsyncInit(0, 0);
+}
+
+int IMG_AsyncInit(int workers, int maxpending)
+{
+	int i;
+
+	pthread_mutex_lock(&IMG_AsyncInitLock);
+	if ( IMG_Async.numthreads ) {
+		pthread_mutex_unlock(&IMG_AsyncInitLock);
+		return(0);
+	}
+	if ( workers <= 0 ) {
+		workers = IMG_ASYNC_WORKERS;
+	}
+	if ( workers > IMG_ASYNC_MAXWORKERS ) {
+		workers = IMG_ASYNC_MAXWORKERS;
+	}
+	if ( maxpending <= 0 ) {
+		maxpending = IMG_ASYNC_MAXPENDING;
+	}
+
+	pthread_mutex_lock(&IMG_AsyncLock);
+	IMG_Async.initialized = 1;
+	IMG_Async.quit = 0;
+	IMG_Async.head = IMG_Async.tail = IMG_Async.running = NULL;
+	IMG_Async.pending = 0;
+	IMG_Async.maxpending = maxpending;
+	IMG_Async.nextid = 1;
+	IMG_Async.eventcode = -1;
+	pthread_mutex_unlock(&IMG_AsyncLock);
+
+	IMG_Async.numthreads = 0;
+	for ( i = 0; i < workers; ++i ) {
+		if ( pthread_create(&IMG_Async.threads[i], NULL,
+				    IMG_AsyncWorker, NULL) != 0 ) {
+			break;
+		}
+		++IMG_Async.numthreads;
+	}
+	if ( IMG_Async.numthreads == 0 ) {
+		fprintf(stderr, "Couldn't create image loader thread\n");
+		IMG_AsyncShutdown();
+		pthread_mutex_unlock(&IMG_AsyncInitLock);
+		return(-1);
+	}
+	pthread_mutex_unlock(&IMG_AsyncInitLock);
+	return(0);
+}
+
+void IMG_AsyncQuit(void)
+{
+	pthread_mutex_lock(&IMG_AsyncInitLock);
+	if ( IMG_Async.numthreads ) {
+		IMG_AsyncShutdown();
+	}
+	pthread_mutex_unlock(&IMG_AsyncInitLock);
+}
+
+void IMG_SetAsyncEvent(int code)
+{
+	if ( IMG_AsyncStart() < 0 ) {
+		return;
+	}
+	pthread_mutex_lock(&IMG_AsyncLock);
+	if ( IMG_Async.initialized ) {
+		IMG_Async.eventcode = code;
+	}
+	pthread_mutex_unlock(&IMG_AsyncLock);
+}
+
+int IMG_LoadAsync(const char *file, IMG_AsyncCallback callback, void *userdata)
+{
+	IMG_AsyncJob *job;
+	int id;
+
+	if ( file == NULL ) {
+		fprintf(stderr, "%s\n", "Passed a NULL file name");
+		return(-1);
+	}
+	if ( IMG_AsyncStart() < 0 ) {
+		return(-1);
+	}
+
+	job = (IMG_AsyncJob *)malloc(sizeof(*job));
+	if ( job == NULL ) {
+		fprintf(stderr, "Out of memory\n");
+		return(-1);
+	}
+	job->file = (char *)malloc(strlen(file)+1);
+	if ( job->file == NULL ) {
+		free(job);
+		fprintf(stderr, "Out of memory\n");
+		return(-1);
+	}
+	strcpy(job->file, file);
+	job->callback = callback;
+	job->userdata = userdata;
+	job->cancelled = 0;
+	job->next = NULL;
+
+	pthread_mutex_lock(&IMG_AsyncLock);
+	if ( ! IMG_Async.initialized ||
+	     IMG_Async.pending >= IMG_Async.maxpending ) {
+		/* Don't let the caller queue up unbounded work */
+		pthread_mutex_unlock(&IMG_AsyncLock);
+		free(job->file);
+		free(job);
+		return(-1);
+	}
+	id = job->id = IMG_Async.nextid++;
+	if ( IMG_Async.nextid <= 0 ) {
+		IMG_Async.nextid = 1;
+	}
+	if ( IMG_Async.tail ) {
+		IMG_Async.tail->next = job;
+	} else {
+		IMG_Async.head = job;
+	}
+	IMG_Async.tail = job;
+	++IMG_Async.pending;
+	pthread_cond_signal(&IMG_AsyncWake);
+	pthread_mutex_unlock(&IMG_AsyncLock);
+	return(id);
+}
+
+int IMG_CancelAsync(int id)
+{
+	IMG_AsyncJob *job, *prev;
+	int retval = -1;
+
+	pthread_mutex_lock(&IMG_AsyncLock);
+	if ( ! IMG_Async.initialized ) {
+		pthread_mutex_unlock(&IMG_AsyncLock);
+		return(-1);
+	}
+	prev = NULL;
+	for ( job = IMG_Async.head; job; prev = job, job = job->next ) {
+		if ( job->id == id ) {
+			if ( prev ) {
+				prev->next = job->next;
+			} else {
+				IMG_Async.head = job->next;
+			}
+			if ( IMG_Async.tail == job ) {
+				IMG_Async.tail = prev;
+			}
+			--IMG_Async.pending;
+			free(job->file);
+			free(job);
+			retval = 0;
+			break;
+		}
+	}
+	if ( retval < 0 ) {
+		/* Already decoding, throw the result away when it's done */
+		for ( job = IMG_Async.running; job; job = job->next ) {
+			if ( job->id == id ) {
+				job->cancelled = 1;
+				retval = 0;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&IMG_AsyncLock);
+	return(retval);
+}
+
+int IMG_AsyncPending(void)
+{
+	int pending;
+
+	pthread_mutex_lock(&IMG_AsyncLock);
+	pending = IMG_Async.initialized ? IMG_Async.pending : 0;
+	pthread_mutex_unlock(&IMG_AsyncLock);
+	return(pending);
+}
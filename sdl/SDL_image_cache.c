@@ -0,0 +1,301 @@
+/*
+    SDL_image:  An example image loading library for use with SDL
+    Copyright (C) 1997-2006 Sam Lantinga
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Sam Lantinga
+    slouken@libsdl.org
+*/
+
+/* A cache of loaded images, keyed by file name plus the modification
+   time and size of the file, so an edited file is picked up again.
+   The cache keeps one reference on every surface it holds and hands out
+   extra ones, callers release them with IMG_CacheRelease() so the count
+   only ever changes under the table lock.
+   Surfaces that nobody else references are evicted least recently used
+   first once the pixel memory goes over budget.
+ */
+
+#include <pthread.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "SDL_image.h"
+
+#define USE_LOCK 1
+
+#define IMG_CACHE_BUCKETS	256
+#define IMG_CACHE_BUDGET	(32*1024*1024)
+
+typedef struct IMG_CacheEntry {
+	char *file;
+	uint32_t hash;
+	long mtime;
+	long size;
+	SDL_Surface *surface;
+	size_t bytes;
+	struct IMG_CacheEntry *next;	/* hash chain */
+	struct IMG_CacheEntry *newer;	/* LRU list */
+	struct IMG_CacheEntry *older;
+} IMG_CacheEntry;
+
+static IMG_CacheEntry *IMG_CacheTable[IMG_CACHE_BUCKETS];
+static IMG_CacheEntry *IMG_CacheNewest = NULL;
+static IMG_CacheEntry *IMG_CacheOldest = NULL;
+static size_t IMG_CacheBudget = IMG_CACHE_BUDGET;
+static IMG_CacheStats IMG_CacheCounters;
+#if USE_LOCK
+static pthread_mutex_t IMG_CacheLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void IMG_CacheLockTable(void)
+{
+#if USE_LOCK
+	pthread_mutex_lock(&IMG_CacheLock);
+#endif
+}
+
+static void IMG_CacheUnlockTable(void)
+{
+#if USE_LOCK
+	pthread_mutex_unlock(&IMG_CacheLock);
+#endif
+}
+
+/* FNV-1a */
+static uint32_t IMG_CacheHash(const char *file)
+{
+	uint32_t hash = 2166136261U;
+
+	while ( *file ) {
+		hash ^= (uint8_t)*file++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static IMG_CacheEntry *IMG_CacheFind(const char *file, uint32_t hash)
+{
+	IMG_CacheEntry *entry;
+
+	for ( entry = IMG_CacheTable[hash % IMG_CACHE_BUCKETS];
+	      entry; entry = entry->next ) {
+		if ( entry->hash == hash && strcmp(entry->file, file) == 0 ) {
+			break;
+		}
+	}
+	return entry;
+}
+
+static void IMG_CacheUnlink(IMG_CacheEntry *entry)
+{
+	if ( entry->newer ) {
+		entry->newer->older = entry->older;
+	} else {
+		IMG_CacheNewest = entry->older;
+	}
+	if ( entry->older ) {
+		entry->older->newer = entry->newer;
+	} else {
+		IMG_CacheOldest = entry->newer;
+	}
+	entry->newer = entry->older = NULL;
+}
+
+static void IMG_CacheTouch(IMG_CacheEntry *entry)
+{
+	if ( IMG_CacheNewest == entry ) {
+		return;
+	}
+	if ( entry->newer || entry->older || IMG_CacheOldest == entry ) {
+		IMG_CacheUnlink(entry);
+	}
+	entry->older = IMG_CacheNewest;
+	if ( IMG_CacheNewest ) {
+		IMG_CacheNewest->newer = entry;
+	}
+	IMG_CacheNewest = entry;
+	if ( IMG_CacheOldest == NULL ) {
+		IMG_CacheOldest = entry;
+	}
+}
+
+static void IMG_CacheRemove(IMG_CacheEntry *entry)
+{
+	IMG_CacheEntry **prev;
+
+	prev = &IMG_CacheTable[entry->hash % IMG_CACHE_BUCKETS];
+	while ( *prev != entry ) {
+		prev = &(*prev)->next;
+	}
+	*prev = entry->next;
+	IMG_CacheUnlink(entry);
+
+	IMG_CacheCounters.bytes -= entry->bytes;
+	--IMG_CacheCounters.entries;
+	SDL_FreeSurface(entry->surface);
+	free(entry->file);
+	free(entry);
+}
+
+/* Drop idle surfaces, oldest first, until we're back under budget */
+static void IMG_CacheTrim(size_t budget)
+{
+	IMG_CacheEntry *entry, *newer;
+
+	for ( entry = IMG_CacheOldest;
+	      entry && IMG_CacheCounters.bytes > budget; entry = newer ) {
+		newer = entry->newer;
+		if ( entry->surface->refcount == 1 ) {
+			IMG_CacheRemove(entry);
+			++IMG_CacheCounters.evictions;
+		}
+	}
+}
+
+SDL_Surface *IMG_CacheLoad(const char *file)
+{
+	struct stat st;
+	IMG_CacheEntry *entry, *other;
+	SDL_Surface *surface;
+	uint32_t hash;
+
+	if ( file == NULL ) {
+		fprintf(stderr, "%s\n", "Passed a NULL file name");
+		return(NULL);
+	}
+	if ( stat(file, &st) != 0 ) {
+		fprintf(stderr, "Couldn't open %s\n", file);
+		return(NULL);
+	}
+	hash = IMG_CacheHash(file);
+
+	IMG_CacheLockTable();
+	entry = IMG_CacheFind(file, hash);
+	if ( entry ) {
+		if ( entry->mtime == (long)st.st_mtime &&
+		     entry->size == (long)st.st_size ) {
+			++IMG_CacheCounters.hits;
+			IMG_CacheTouch(entry);
+			surface = entry->surface;
+			++surface->refcount;
+			IMG_CacheUnlockTable();
+			return(surface);
+		}
+		/* The file changed on disk, current holders keep the old one */
+		IMG_CacheRemove(entry);
+		++IMG_CacheCounters.reloads;
+	}
+	++IMG_CacheCounters.misses;
+	IMG_CacheUnlockTable();
+
+	/* Don't hold the lock while decoding */
+	surface = IMG_Load(file);
+	if ( surface == NULL ) {
+		return(NULL);
+	}
+	entry = (IMG_CacheEntry *)malloc(sizeof(*entry));
+	if ( entry ) {
+		entry->file = (char *)malloc(strlen(file)+1);
+		if ( entry->file == NULL ) {
+			free(entry);
+			entry = NULL;
+		}
+	}
+	if ( entry == NULL ) {
+		/* Still usable, just not shared */
+		fprintf(stderr, "Out of memory\n");
+		return(surface);
+	}
+	strcpy(entry->file, file);
+	entry->hash = hash;
+	entry->mtime = (long)st.st_mtime;
+	entry->size = (long)st.st_size;
+	entry->surface = surface;
+	entry->bytes = (size_t)surface->pitch * surface->h;
+	entry->newer = entry->older = NULL;
+
+	IMG_CacheLockTable();
+	/* Another thread may have loaded the same file meanwhile */
+	other = IMG_CacheFind(file, hash);
+	if ( other ) {
+		if ( other->mtime == entry->mtime &&
+		     other->size == entry->size ) {
+			SDL_Surface *shared = other->surface;
+
+			IMG_CacheTouch(other);
+			++shared->refcount;
+			IMG_CacheUnlockTable();
+			/* Nobody else has seen this copy */
+			SDL_FreeSurface(surface);
+			free(entry->file);
+			free(entry);
+			return(shared);
+		}
+		IMG_CacheRemove(other);
+	}
+	entry->next = IMG_CacheTable[hash % IMG_CACHE_BUCKETS];
+	IMG_CacheTable[hash % IMG_CACHE_BUCKETS] = entry;
+	IMG_CacheTouch(entry);
+	IMG_CacheCounters.bytes += entry->bytes;
+	++IMG_CacheCounters.entries;
+	++surface->refcount;	/* one for the cache, one for the caller */
+	IMG_CacheTrim(IMG_CacheBudget);
+	IMG_CacheUnlockTable();
+	return(surface);
+}
+
+void IMG_CacheRelease(SDL_Surface *surface)
+{
+	/* Freed here only once the cache has let go of it as well */
+	IMG_CacheLockTable();
+	SDL_FreeSurface(surface);
+	IMG_CacheUnlockTable();
+}
+
+void IMG_CacheSetBudget(size_t bytes)
+{
+	IMG_CacheLockTable();
+	IMG_CacheBudget = bytes;
+	IMG_CacheTrim(IMG_CacheBudget);
+	IMG_CacheUnlockTable();
+}
+
+void IMG_CacheFlush(void)
+{
+	IMG_CacheEntry *entry, *newer;
+
+	/* Surfaces still in use stay valid, the cache just forgets them */
+	IMG_CacheLockTable();
+	for ( entry = IMG_CacheOldest; entry; entry = newer ) {
+		newer = entry->newer;
+		IMG_CacheRemove(entry);
+	}
+	IMG_CacheUnlockTable();
+}
+
+void IMG_CacheGetStats(IMG_CacheStats *stats)
+{
+	if ( stats ) {
+		IMG_CacheLockTable();
+		*stats = IMG_CacheCounters;
+		IMG_CacheUnlockTable();
+	}
+}
@@ -0,0 +1,855 @@
+/*
+    SDL - Simple DirectMedia Layer
+    Copyright (C) 1997-2012 Sam Lantinga
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Sam Lantinga
+    slouken@libsdl.org
+*/
+
+/* Scaled and rotated blits.
+
+   Each destination row is walked with 16.16 fixed point source
+   coordinates, stepping by a constant per pixel.  The run of pixels
+   whose source coordinates fall inside the source rectangle is worked
+   out exactly from the steps, so the inner loops never test or clamp
+   against the source edges.  A row is sampled into a one row surface
+   and blitted to the destination with SDL_LowerBlit(), so colorkeys,
+   alpha and format conversion work as they do for SDL_BlitSurface().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "SDL_video.h"
+#include "SDL_cpuinfo.h"
+#if SDL_SSE2_INTRINSICS
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+/* Fraction bits of the bilinear weights, small enough that the
+   weighted differences of 8-bit channels fit 16-bit lanes */
+#define LINEAR_BITS	7
+#define LINEAR_ONE	(1<<LINEAR_BITS)
+
+typedef struct {
+	const uint8_t *pixels;	/* the top left of the source rectangle */
+	int pitch;
+	int w, h;
+	SDL_PixelFormat *format;
+	uint32_t colorkey;	/* keyed pixels, ~0 if none */
+	uint32_t Amask;		/* of the alpha channel blended with */
+	unsigned int alpha;	/* per-surface alpha, 255 if none */
+	int alpha_shift;	/* of the alpha byte in 32-bit rows */
+	int u, v;		/* source position of the first pixel */
+	int du, dv;		/* and the step to the next one */
+} SDL_RotoSpan;
+
+static int64_t SDL_FloorDiv(int64_t a, int64_t b)
+{
+	int64_t q = a / b;
+	if ( (a % b != 0) && ((a < 0) != (b < 0)) ) {
+		--q;
+	}
+	return(q);
+}
+
+static int64_t SDL_CeilDiv(int64_t a, int64_t b)
+{
+	return(-SDL_FloorDiv(-a, b));
+}
+
+/* Narrow [*k0, *k1] to the k where 0 <= u + k*du < limit */
+static void SDL_RotoLimit(int64_t u, int64_t du, int64_t limit,
+				int64_t *k0, int64_t *k1)
+{
+	int64_t lo, hi;
+
+	if ( du == 0 ) {
+		if ( u < 0 || u >= limit ) {
+			*k1 = *k0 - 1;
+		}
+		return;
+	}
+	if ( du > 0 ) {
+		lo = SDL_CeilDiv(-u, du);
+		hi = SDL_FloorDiv(limit - 1 - u, du);
+	} else {
+		lo = SDL_CeilDiv(limit - 1 - u, du);
+		hi = SDL_FloorDiv(-u, du);
+	}
+	if ( lo > *k0 ) {
+		*k0 = lo;
+	}
+	if ( hi < *k1 ) {
+		*k1 = hi;
+	}
+}
+
+/* Copy the nearest source pixels, the blit does the rest */
+static void SDL_RotoNearest(const SDL_RotoSpan *span, uint8_t *dst, int n)
+{
+	const uint8_t *pixels = span->pixels;
+	int pitch = span->pitch;
+	int u = span->u, v = span->v;
+	int du = span->du, dv = span->dv;
+
+	switch (span->format->BytesPerPixel) {
+	    case 1:
+		while ( n-- ) {
+			*dst++ = pixels[(v >> 16) * pitch + (u >> 16)];
+			u += du;
+			v += dv;
+		}
+		break;
+
+	    case 2:
+		{
+			uint16_t *dstp = (uint16_t *)dst;
+			while ( n-- ) {
+				*dstp++ = *(const uint16_t *)(pixels +
+					(v >> 16) * pitch + (u >> 16) * 2);
+				u += du;
+				v += dv;
+			}
+		}
+		break;
+
+	    case 3:
+		while ( n-- ) {
+			const uint8_t *p = pixels + (v >> 16) * pitch +
+						(u >> 16) * 3;
+			dst[0] = p[0];
+			dst[1] = p[1];
+			dst[2] = p[2];
+			dst += 3;
+			u += du;
+			v += dv;
+		}
+		break;
+
+	    case 4:
+		{
+			uint32_t *dstp = (uint32_t *)dst;
+			while ( n-- ) {
+				*dstp++ = *(const uint32_t *)(pixels +
+					(v >> 16) * pitch + (u >> 16) * 4);
+				u += du;
+				v += dv;
+			}
+		}
+		break;
+	}
+}
+
+/* Bilinear sample position: the texel left of and above the sample
+   point, and how far the point is towards the next one */
+#define LINEAR_SETUP(u, v, w, h, x0, x1, y0, y1, fx, fy)		\
+{									\
+	int s = (u) - 0x8000;						\
+	int t = (v) - 0x8000;						\
+	x0 = s >> 16;							\
+	y0 = t >> 16;							\
+	fx = (s >> (16 - LINEAR_BITS)) & (LINEAR_ONE - 1);		\
+	fy = (t >> (16 - LINEAR_BITS)) & (LINEAR_ONE - 1);		\
+	x1 = x0 + 1;							\
+	y1 = y0 + 1;							\
+	if ( x0 < 0 ) x0 = 0;						\
+	if ( y0 < 0 ) y0 = 0;						\
+	if ( x1 > (w) - 1 ) x1 = (w) - 1;				\
+	if ( y1 > (h) - 1 ) y1 = (h) - 1;				\
+}
+
+#define LINEAR_LERP(a, b, f)	((a) + ((((int)(b) - (int)(a)) * (f)) >> LINEAR_BITS))
+
+/* Interpolate the four bytes of 32-bit pixels separately, for sources
+   without colorkey or alpha channel to weight by */
+static uint32_t SDL_RotoLinear4Pixel(const SDL_RotoSpan *span, int u, int v)
+{
+	const uint8_t *p00, *p01, *p10, *p11;
+	int x0, x1, y0, y1, fx, fy;
+	uint32_t pixel = 0;
+	int i;
+
+	LINEAR_SETUP(u, v, span->w, span->h, x0, x1, y0, y1, fx, fy);
+	p00 = span->pixels + y0 * span->pitch + x0 * 4;
+	p01 = span->pixels + y0 * span->pitch + x1 * 4;
+	p10 = span->pixels + y1 * span->pitch + x0 * 4;
+	p11 = span->pixels + y1 * span->pitch + x1 * 4;
+	/* Down the columns, then across */
+	for ( i=0; i<4; ++i ) {
+		int left = LINEAR_LERP(p00[i], p10[i], fy);
+		int right = LINEAR_LERP(p01[i], p11[i], fy);
+		((uint8_t *)&pixel)[i] = (uint8_t)LINEAR_LERP(left, right, fx);
+	}
+	return(pixel);
+}
+
+static void SDL_RotoLinear4(const SDL_RotoSpan *span, uint8_t *dst, int n)
+{
+	uint32_t *dstp = (uint32_t *)dst;
+	int u = span->u, v = span->v;
+
+	while ( n-- ) {
+		*dstp++ = SDL_RotoLinear4Pixel(span, u, v);
+		u += span->du;
+		v += span->dv;
+	}
+}
+
+#if SDL_SSE2_INTRINSICS
+/* The same sums with the four bytes of a pixel in 16-bit lanes, and the
+   two texels of a row next to each other.  top and bottom hold the two
+   texels of each row, s and t are the sample position less half a texel */
+static uint32_t SDL_RotoLerpSSE2(__m128i top, __m128i bottom, int s, int t)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i fx = _mm_set1_epi16((short)((s >> (16 - LINEAR_BITS)) & (LINEAR_ONE - 1)));
+	__m128i fy = _mm_set1_epi16((short)((t >> (16 - LINEAR_BITS)) & (LINEAR_ONE - 1)));
+	__m128i right;
+
+	top = _mm_unpacklo_epi8(top, zero);
+	bottom = _mm_unpacklo_epi8(bottom, zero);
+	/* Down the columns, then across */
+	top = _mm_add_epi16(top, _mm_srai_epi16(_mm_mullo_epi16(
+		_mm_sub_epi16(bottom, top), fy), LINEAR_BITS));
+	right = _mm_srli_si128(top, 8);
+	top = _mm_add_epi16(top, _mm_srai_epi16(_mm_mullo_epi16(
+		_mm_sub_epi16(right, top), fx), LINEAR_BITS));
+	return((uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(top, top)));
+}
+
+/* Edge pixels, where the two texels are the same one, are left to
+   SDL_RotoLinear4Pixel() */
+static void SDL_RotoLinear4SSE2(const SDL_RotoSpan *span, uint8_t *dst, int n)
+{
+	uint32_t *dstp = (uint32_t *)dst;
+	const uint8_t *pixels = span->pixels;
+	int pitch = span->pitch;
+	int u = span->u, v = span->v;
+	unsigned int xmax = span->w - 1;
+	unsigned int ymax = span->h - 1;
+
+	while ( n-- ) {
+		int s = u - 0x8000;
+		int t = v - 0x8000;
+		unsigned int x0 = (unsigned int)(s >> 16);
+		unsigned int y0 = (unsigned int)(t >> 16);
+
+		if ( x0 < xmax && y0 < ymax ) {
+			const uint8_t *p = pixels + y0 * pitch + x0 * 4;
+
+			*dstp++ = SDL_RotoLerpSSE2(
+				_mm_loadl_epi64((const __m128i *)p),
+				_mm_loadl_epi64((const __m128i *)(p + pitch)), s, t);
+		} else {
+			*dstp++ = SDL_RotoLinear4Pixel(span, u, v);
+		}
+		u += span->du;
+		v += span->dv;
+	}
+}
+#endif /* SDL_SSE2_INTRINSICS */
+
+/* Any source to ARGB8888 with the colors weighted by alpha, so keyed and
+   transparent pixels don't bleed their color into the edges */
+static void SDL_RotoLinearAlpha(const SDL_RotoSpan *span, uint8_t *dst, int n)
+{
+	SDL_PixelFormat *fmt = span->format;
+	int bpp = fmt->BytesPerPixel;
+	uint32_t *dstp = (uint32_t *)dst;
+	int u = span->u, v = span->v;
+
+	while ( n-- ) {
+		int x[2], y[2], fx, fy;
+		unsigned int sa = 0, sr = 0, sg = 0, sb = 0;
+		int i;
+
+		LINEAR_SETUP(u, v, span->w, span->h, x[0], x[1], y[0], y[1], fx, fy);
+		for ( i=0; i<4; ++i ) {
+			const uint8_t *p = span->pixels + y[i>>1] * span->pitch +
+						x[i&1] * bpp;
+			unsigned int weight = ((i&1) ? fx : LINEAR_ONE - fx) *
+					      ((i>>1) ? fy : LINEAR_ONE - fy);
+			uint32_t Pixel;
+			unsigned int r, g, b, a;
+
+			switch (bpp) {
+			    case 1:
+				Pixel = *p;
+				break;
+			    case 2:
+				Pixel = *(const uint16_t *)p;
+				break;
+			    case 3:
+				if ( SDL_BYTEORDER == SDL_LIL_ENDIAN ) {
+					Pixel = p[0] | (p[1] << 8) | (p[2] << 16);
+				} else {
+					Pixel = (p[0] << 16) | (p[1] << 8) | p[2];
+				}
+				break;
+			    default:
+				Pixel = *(const uint32_t *)p;
+				break;
+			}
+			if ( fmt->palette ) {
+				r = fmt->palette->colors[Pixel].r;
+				g = fmt->palette->colors[Pixel].g;
+				b = fmt->palette->colors[Pixel].b;
+				a = 255;
+			} else {
+				RGBA_FROM_PIXEL(Pixel, fmt, r, g, b, a);
+				if ( ! span->Amask ) {
+					a = 255;
+				}
+			}
+			if ( (Pixel & ~fmt->Amask) == span->colorkey ) {
+				a = 0;
+			}
+			weight *= a;
+			sa += weight;
+			sr += weight * r;
+			sg += weight * g;
+			sb += weight * b;
+		}
+		if ( sa == 0 ) {
+			*dstp++ = 0;
+		} else if ( sa == 255 * LINEAR_ONE * LINEAR_ONE ) {
+			/* Inside the sprite, nothing to divide out */
+			*dstp++ = (span->alpha << 24) |
+				  (((sr / 255 + (LINEAR_ONE * LINEAR_ONE / 2)) >> (2 * LINEAR_BITS)) << 16) |
+				  (((sg / 255 + (LINEAR_ONE * LINEAR_ONE / 2)) >> (2 * LINEAR_BITS)) << 8) |
+				  ((sb / 255 + (LINEAR_ONE * LINEAR_ONE / 2)) >> (2 * LINEAR_BITS));
+		} else {
+			uint32_t a = (sa + (LINEAR_ONE * LINEAR_ONE / 2)) >>
+						(2 * LINEAR_BITS);
+			a = (a * span->alpha + 127) / 255;
+			*dstp++ = (a << 24) |
+				  (((sr + sa / 2) / sa) << 16) |
+				  (((sg + sa / 2) / sa) << 8) |
+				  ((sb + sa / 2) / sa);
+		}
+		u += span->du;
+		v += span->dv;
+	}
+}
+
+/* The same for 32-bit sources with whole byte channels, which are kept
+   in their own layout with alpha in the spare byte.  Inside the sprite,
+   where all four texels are opaque, the bytes are interpolated like
+   those of sources without colorkey */
+static uint32_t SDL_RotoLinearAlpha4Pixel(const SDL_RotoSpan *span,
+						int u, int v)
+{
+	uint32_t rgbmask = ~span->format->Amask;
+	uint32_t amask = (uint32_t)0xFF << span->alpha_shift;
+	const uint8_t *p[4];
+	unsigned int a[4];
+	uint32_t pixel = 0;
+	int x0, x1, y0, y1, fx, fy;
+	int i;
+
+	LINEAR_SETUP(u, v, span->w, span->h, x0, x1, y0, y1, fx, fy);
+	p[0] = span->pixels + y0 * span->pitch + x0 * 4;
+	p[1] = span->pixels + y0 * span->pitch + x1 * 4;
+	p[2] = span->pixels + y1 * span->pitch + x0 * 4;
+	p[3] = span->pixels + y1 * span->pitch + x1 * 4;
+	for ( i=0; i<4; ++i ) {
+		uint32_t Pixel = *(const uint32_t *)p[i];
+
+		a[i] = span->Amask ? (Pixel >> span->alpha_shift) & 0xFF : 255;
+		if ( (Pixel & rgbmask) == span->colorkey ) {
+			a[i] = 0;
+		}
+	}
+
+	if ( (a[0] & a[1] & a[2] & a[3]) == 255 ) {
+		for ( i=0; i<4; ++i ) {
+			int left = LINEAR_LERP(p[0][i], p[2][i], fy);
+			int right = LINEAR_LERP(p[1][i], p[3][i], fy);
+			((uint8_t *)&pixel)[i] = (uint8_t)LINEAR_LERP(left, right, fx);
+		}
+		pixel = (pixel & ~amask) | (span->alpha << span->alpha_shift);
+	} else {
+		unsigned int w[4], sa;
+
+		w[0] = (LINEAR_ONE - fx) * (LINEAR_ONE - fy) * a[0];
+		w[1] = fx * (LINEAR_ONE - fy) * a[1];
+		w[2] = (LINEAR_ONE - fx) * fy * a[2];
+		w[3] = fx * fy * a[3];
+		sa = w[0] + w[1] + w[2] + w[3];
+		if ( sa ) {
+			uint32_t alpha;
+
+			for ( i=0; i<4; ++i ) {
+				unsigned int sum = w[0] * p[0][i] + w[1] * p[1][i] +
+						   w[2] * p[2][i] + w[3] * p[3][i];
+				((uint8_t *)&pixel)[i] = (uint8_t)((sum + sa / 2) / sa);
+			}
+			alpha = (sa + (LINEAR_ONE * LINEAR_ONE / 2)) >>
+					(2 * LINEAR_BITS);
+			alpha = (alpha * span->alpha + 127) / 255;
+			pixel = (pixel & ~amask) | (alpha << span->alpha_shift);
+		}
+	}
+	return(pixel);
+}
+
+static void SDL_RotoLinearAlpha4(const SDL_RotoSpan *span, uint8_t *dst, int n)
+{
+	uint32_t *dstp = (uint32_t *)dst;
+	int u = span->u, v = span->v;
+
+	while ( n-- ) {
+		*dstp++ = SDL_RotoLinearAlpha4Pixel(span, u, v);
+		u += span->du;
+		v += span->dv;
+	}
+}
+
+#if SDL_SSE2_INTRINSICS
+/* The sums of SDL_RotoLinearAlpha4Pixel() for texels that are partly
+   transparent, a holding the alpha of each.  Each byte times its alpha
+   fits a 16-bit lane, times the bilinear weight a 32-bit one.  The sums
+   are below 2^31 and their total weight below 2^22, so dividing them as
+   doubles and truncating rounds exactly like the integer division */
+static uint32_t SDL_RotoWeightSSE2(const SDL_RotoSpan *span,
+			__m128i top, __m128i bottom, __m128i a, int s, int t)
+{
+	uint32_t amask = (uint32_t)0xFF << span->alpha_shift;
+	int fx = (s >> (16 - LINEAR_BITS)) & (LINEAR_ONE - 1);
+	int fy = (t >> (16 - LINEAR_BITS)) & (LINEAR_ONE - 1);
+	short w00 = (short)((LINEAR_ONE - fx) * (LINEAR_ONE - fy));
+	short w01 = (short)(fx * (LINEAR_ONE - fy));
+	short w10 = (short)((LINEAR_ONE - fx) * fy);
+	short w11 = (short)(fx * fy);
+	__m128i zero = _mm_setzero_si128();
+	__m128i a4, lo, hi, sums;
+	__m128d sa2;
+	unsigned int sa;
+	uint32_t alpha, pixel;
+
+	/* The total weight */
+	lo = _mm_madd_epi16(_mm_set_epi32(w11, w10, w01, w00), a);
+	lo = _mm_add_epi32(lo, _mm_srli_si128(lo, 8));
+	lo = _mm_add_epi32(lo, _mm_srli_si128(lo, 4));
+	sa = (unsigned int)_mm_cvtsi128_si32(lo);
+	if ( sa == 0 ) {
+		return(0);
+	}
+
+	/* Every channel of a texel times its alpha, then its weight */
+	a4 = _mm_packs_epi32(a, a);
+	a4 = _mm_unpacklo_epi16(a4, a4);
+	top = _mm_mullo_epi16(_mm_unpacklo_epi8(top, zero),
+			      _mm_unpacklo_epi32(a4, a4));
+	bottom = _mm_mullo_epi16(_mm_unpacklo_epi8(bottom, zero),
+				 _mm_unpackhi_epi32(a4, a4));
+	a4 = _mm_set_epi16(w01, w01, w01, w01, w00, w00, w00, w00);
+	lo = _mm_mullo_epi16(top, a4);
+	hi = _mm_mulhi_epu16(top, a4);
+	sums = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi),
+			     _mm_unpackhi_epi16(lo, hi));
+	a4 = _mm_set_epi16(w11, w11, w11, w11, w10, w10, w10, w10);
+	lo = _mm_mullo_epi16(bottom, a4);
+	hi = _mm_mulhi_epu16(bottom, a4);
+	sums = _mm_add_epi32(sums, _mm_add_epi32(_mm_unpacklo_epi16(lo, hi),
+						 _mm_unpackhi_epi16(lo, hi)));
+
+	/* (sum + sa / 2) / sa for the four bytes */
+	sums = _mm_add_epi32(sums, _mm_set1_epi32((int)(sa / 2)));
+	sa2 = _mm_set1_pd((double)sa);
+	lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(sums), sa2));
+	hi = _mm_cvttpd_epi32(_mm_div_pd(
+		_mm_cvtepi32_pd(_mm_srli_si128(sums, 8)), sa2));
+	sums = _mm_unpacklo_epi64(lo, hi);
+	sums = _mm_packs_epi32(sums, sums);
+	pixel = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sums, sums));
+
+	alpha = (sa + (LINEAR_ONE * LINEAR_ONE / 2)) >> (2 * LINEAR_BITS);
+	alpha = (alpha * span->alpha + 127) / 255;
+	return((pixel & ~amask) | (alpha << span->alpha_shift));
+}
+
+/* The colorkey and alpha of the four texels at once.  Where all four are
+   opaque the bytes are interpolated by SDL_RotoLerpSSE2(), where none is
+   the pixel is left out, otherwise weighted by SDL_RotoWeightSSE2().
+   Edges of the source are left to SDL_RotoLinearAlpha4Pixel() */
+static void SDL_RotoLinearAlpha4SSE2(const SDL_RotoSpan *span,
+					uint8_t *dst, int n)
+{
+	uint32_t *dstp = (uint32_t *)dst;
+	const uint8_t *pixels = span->pixels;
+	int pitch = span->pitch;
+	int u = span->u, v = span->v;
+	unsigned int xmax = span->w - 1;
+	unsigned int ymax = span->h - 1;
+	uint32_t amask = (uint32_t)0xFF << span->alpha_shift;
+	uint32_t alpha = span->alpha << span->alpha_shift;
+	__m128i zero = _mm_setzero_si128();
+	__m128i bytes = _mm_set1_epi32(0xFF);
+	__m128i rgbmask = _mm_set1_epi32((int)~span->format->Amask);
+	__m128i colorkey = _mm_set1_epi32((int)span->colorkey);
+	__m128i shift = _mm_cvtsi32_si128(span->alpha_shift);
+
+	while ( n-- ) {
+		int s = u - 0x8000;
+		int t = v - 0x8000;
+		unsigned int x0 = (unsigned int)(s >> 16);
+		unsigned int y0 = (unsigned int)(t >> 16);
+
+		if ( x0 < xmax && y0 < ymax ) {
+			const uint8_t *p = pixels + y0 * pitch + x0 * 4;
+			__m128i top = _mm_loadl_epi64((const __m128i *)p);
+			__m128i bottom = _mm_loadl_epi64((const __m128i *)(p + pitch));
+			__m128i texels = _mm_unpacklo_epi64(top, bottom);
+			__m128i a = bytes;
+
+			if ( span->Amask ) {
+				a = _mm_and_si128(_mm_srl_epi32(texels, shift), bytes);
+			}
+			a = _mm_andnot_si128(_mm_cmpeq_epi32(
+				_mm_and_si128(texels, rgbmask), colorkey), a);
+			if ( _mm_movemask_epi8(_mm_cmpeq_epi32(a, bytes)) == 0xFFFF ) {
+				*dstp++ = (SDL_RotoLerpSSE2(top, bottom, s, t) & ~amask) |
+					  alpha;
+			} else if ( _mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xFFFF ) {
+				*dstp++ = 0;
+			} else {
+				*dstp++ = SDL_RotoWeightSSE2(span, top, bottom, a, s, t);
+			}
+		} else {
+			*dstp++ = SDL_RotoLinearAlpha4Pixel(span, u, v);
+		}
+		u += span->du;
+		v += span->dv;
+	}
+}
+#endif /* SDL_SSE2_INTRINSICS */
+
+/* Whether all the channels of a 32-bit source are whole bytes */
+static int SDL_RotoBytes4(SDL_PixelFormat *fmt)
+{
+	return( fmt->BytesPerPixel == 4 && ! fmt->palette &&
+		fmt->Rloss == 0 && fmt->Gloss == 0 && fmt->Bloss == 0 &&
+		(fmt->Rshift & 7) == 0 && (fmt->Gshift & 7) == 0 &&
+		(fmt->Bshift & 7) == 0 &&
+		(! fmt->Amask || (fmt->Aloss == 0 && (fmt->Ashift & 7) == 0)) );
+}
+
+int SDL_BlitScaledRotated(SDL_Surface *src, SDL_Rect *srcrect,
+			SDL_Surface *dst, SDL_Rect *center,
+			double angle, double scale, int filter)
+{
+	void (*sample)(const SDL_RotoSpan *span, uint8_t *dst, int n);
+	SDL_Surface *row;
+	SDL_RotoSpan span;
+	SDL_Rect full_src;
+	SDL_Rect *clip = &dst->clip_rect;
+	SDL_Rect drawn;
+	double c, s, cx, cy, dx, dy;
+	int64_t du, dv;
+	double x0, y0, x1, y1;
+	int left, top, right, bottom;
+	int weighted;
+	int src_locked;
+	int y;
+	int status = 0;
+
+	if ( ! src || ! dst ) {
+		fprintf(stderr, "%s\n", "SDL_BlitScaledRotated: passed a NULL surface");
+		return(-1);
+	}
+	if ( src == dst ) {
+		fprintf(stderr, "%s\n", "Can't rotate a surface onto itself");
+		return(-1);
+	}
+	if ( src->locked || dst->locked ) {
+		fprintf(stderr, "%s\n", "Surfaces must not be locked during blit");
+		return(-1);
+	}
+	if ( src->format->BitsPerPixel < 8 || dst->format->BitsPerPixel < 8 ) {
+		fprintf(stderr, "%s\n", "Blit combination not supported");
+		return(-1);
+	}
+	/* Also false for NaN and infinities */
+	if ( !(scale > 0.0 && scale <= DBL_MAX) ) {
+		fprintf(stderr, "%s\n", "Invalid blit scale");
+		return(-1);
+	}
+	if ( !(fabs(angle) <= DBL_MAX) ) {
+		fprintf(stderr, "%s\n", "Invalid blit angle");
+		return(-1);
+	}
+	if ( srcrect ) {
+		if ( (srcrect->x < 0) || (srcrect->y < 0) ||
+		     ((srcrect->x+srcrect->w) > src->w) ||
+		     ((srcrect->y+srcrect->h) > src->h) ) {
+			fprintf(stderr, "Invalid source blit rectangle\n");
+			return(-1);
+		}
+	} else {
+		full_src.x = 0;
+		full_src.y = 0;
+		full_src.w = src->w;
+		full_src.h = src->h;
+		srcrect = &full_src;
+	}
+	if ( srcrect->w == 0 || srcrect->h == 0 ) {
+		return(0);
+	}
+	/* 16.16 source positions */
+	if ( srcrect->w > 32767 || srcrect->h > 32767 ) {
+		fprintf(stderr, "Invalid source blit rectangle\n");
+		return(-1);
+	}
+	/* Every pixel center is half a pixel or more from the center along
+	   one of the source axes, at this scale more than 32768 source
+	   pixels, so nothing is drawn.  This also keeps the 16.16 source
+	   positions below well inside 64 bits. */
+	if ( scale < 1.0 / 65536.0 ) {
+		return(0);
+	}
+	if ( center ) {
+		cx = center->x;
+		cy = center->y;
+	} else {
+		cx = dst->w / 2;
+		cy = dst->h / 2;
+	}
+
+	/* Turning counterclockwise on screen, where y goes down.  Quarter
+	   turns are kept exact so they copy pixels like an unrotated blit */
+	angle = fmod(angle, 360.0) * M_PI / 180.0;
+	c = cos(angle);
+	s = sin(angle);
+	if ( fabs(c) < 1e-12 ) {
+		c = 0.0;
+	}
+	if ( fabs(s) < 1e-12 ) {
+		s = 0.0;
+	}
+
+	/* The destination rectangle the source rectangle covers */
+	dx = srcrect->w * scale / 2.0;
+	dy = srcrect->h * scale / 2.0;
+	x1 = fabs(dx * c) + fabs(dy * s);
+	y1 = fabs(dx * s) + fabs(dy * c);
+	x0 = floor(cx - x1) - 1.0;
+	y0 = floor(cy - y1) - 1.0;
+	x1 = ceil(cx + x1) + 1.0;
+	y1 = ceil(cy + y1) + 1.0;
+	left = clip->x;
+	top = clip->y;
+	right = clip->x + clip->w;
+	bottom = clip->y + clip->h;
+	if ( x0 > left ) {
+		left = (x0 < right) ? (int)x0 : right;
+	}
+	if ( y0 > top ) {
+		top = (y0 < bottom) ? (int)y0 : bottom;
+	}
+	if ( x1 < right ) {
+		right = (x1 > left) ? (int)x1 : left;
+	}
+	if ( y1 < bottom ) {
+		bottom = (y1 > top) ? (int)y1 : top;
+	}
+	if ( left >= right || top >= bottom ) {
+		return(0);
+	}
+
+	/* Rows are sampled into this and blitted like the source would be */
+	memset(&span, 0, sizeof(span));
+	span.format = src->format;
+	span.w = srcrect->w;
+	span.h = srcrect->h;
+	span.colorkey = ~0;
+	span.alpha = 255;
+	weighted = ((src->flags & SDL_SRCCOLORKEY) ||
+		    ((src->flags & SDL_SRCALPHA) && src->format->Amask));
+	if ( src->flags & SDL_SRCCOLORKEY ) {
+		span.colorkey = src->format->colorkey & ~src->format->Amask;
+	}
+	/* Like the blitters, an alpha channel replaces the surface alpha */
+	if ( src->flags & SDL_SRCALPHA ) {
+		span.Amask = src->format->Amask;
+		if ( ! span.Amask ) {
+			span.alpha = src->format->alpha;
+		}
+	}
+	if ( filter == SDL_SCALE_LINEAR && weighted &&
+	     SDL_RotoBytes4(src->format) ) {
+		SDL_PixelFormat *fmt = src->format;
+		uint32_t spare = fmt->Amask;
+
+		if ( ! spare ) {
+			spare = ~(fmt->Rmask | fmt->Gmask | fmt->Bmask);
+		}
+		while ( span.alpha_shift < 24 &&
+			! ((spare >> span.alpha_shift) & 0xFF) ) {
+			span.alpha_shift += 8;
+		}
+		row = SDL_CreateRGBSurface(SDL_SWSURFACE, right - left, 1, 32,
+			fmt->Rmask, fmt->Gmask, fmt->Bmask,
+			(uint32_t)0xFF << span.alpha_shift);
+		if ( row == NULL ) {
+			return(-1);
+		}
+		SDL_SetAlpha(row, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+		sample = SDL_RotoLinearAlpha4;
+#if SDL_SSE2_INTRINSICS
+		if ( SDL_HasSSE2() ) {
+			sample = SDL_RotoLinearAlpha4SSE2;
+		}
+#endif
+	} else if ( filter == SDL_SCALE_LINEAR &&
+		    (weighted || ! SDL_RotoBytes4(src->format)) ) {
+		row = SDL_CreateRGBSurface(SDL_SWSURFACE, right - left, 1, 32,
+			0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+		if ( row == NULL ) {
+			return(-1);
+		}
+		/* Opaque sources give opaque rows, which are just copied */
+		if ( src->flags & (SDL_SRCCOLORKEY|SDL_SRCALPHA) ) {
+			SDL_SetAlpha(row, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+		} else {
+			SDL_SetAlpha(row, 0, 0);
+		}
+		sample = SDL_RotoLinearAlpha;
+	} else {
+		SDL_PixelFormat *fmt = src->format;
+
+		row = SDL_CreateRGBSurface(SDL_SWSURFACE, right - left, 1,
+			fmt->BitsPerPixel,
+			fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
+		if ( row == NULL ) {
+			return(-1);
+		}
+		if ( fmt->palette && row->format->palette ) {
+			memcpy(row->format->palette->colors,
+				fmt->palette->colors,
+				fmt->palette->ncolors*sizeof(SDL_Color));
+			row->format->palette->ncolors = fmt->palette->ncolors;
+		}
+		if ( src->flags & SDL_SRCCOLORKEY ) {
+			SDL_SetColorKey(row, SDL_SRCCOLORKEY, fmt->colorkey);
+		}
+		if ( src->flags & SDL_SRCALPHA ) {
+			SDL_SetAlpha(row, SDL_SRCALPHA, fmt->alpha);
+		} else {
+			SDL_SetAlpha(row, 0, 0);
+		}
+		if ( filter == SDL_SCALE_LINEAR ) {
+			sample = SDL_RotoLinear4;
+#if SDL_SSE2_INTRINSICS
+			if ( SDL_HasSSE2() ) {
+				sample = SDL_RotoLinear4SSE2;
+			}
+#endif
+		} else {
+			sample = SDL_RotoNearest;
+		}
+	}
+
+	src_locked = 0;
+	if ( SDL_MUSTLOCK(src) ) {
+		if ( SDL_LockSurface(src) < 0 ) {
+			SDL_FreeSurface(row);
+			fprintf(stderr, "Unable to lock source surface\n");
+			return(-1);
+		}
+		src_locked = 1;
+	}
+	span.pixels = (const uint8_t *)src->pixels + srcrect->y * src->pitch +
+			srcrect->x * src->format->BytesPerPixel;
+	span.pitch = src->pitch;
+
+	/* Going right one pixel moves (c, s) / scale through the source,
+	   going down moves (-s, c) / scale */
+	du = (int64_t)floor(c / scale * 65536.0 + 0.5);
+	dv = (int64_t)floor(s / scale * 65536.0 + 0.5);
+
+	drawn.w = 0;
+	for ( y=top; y<bottom; ++y ) {
+		double px = left + 0.5 - cx;
+		double py = y + 0.5 - cy;
+		int64_t u, v, k0, k1;
+		SDL_Rect sr, dr;
+
+		u = (int64_t)floor(((px * c - py * s) / scale +
+				    srcrect->w / 2.0) * 65536.0 + 0.5);
+		v = (int64_t)floor(((px * s + py * c) / scale +
+				    srcrect->h / 2.0) * 65536.0 + 0.5);
+		k0 = 0;
+		k1 = right - left - 1;
+		SDL_RotoLimit(u, du, (int64_t)span.w << 16, &k0, &k1);
+		SDL_RotoLimit(v, dv, (int64_t)span.h << 16, &k0, &k1);
+		if ( k0 > k1 ) {
+			continue;
+		}
+
+		/* Steps between two pixels inside the source fit in an int,
+		   a single pixel doesn't step at all */
+		span.u = (int)(u + k0 * du);
+		span.v = (int)(v + k0 * dv);
+		span.du = (k0 < k1) ? (int)du : 0;
+		span.dv = (k0 < k1) ? (int)dv : 0;
+		sample(&span, (uint8_t *)row->pixels, (int)(k1 - k0 + 1));
+
+		sr.x = 0;
+		sr.y = 0;
+		sr.w = (uint16_t)(k1 - k0 + 1);
+		sr.h = 1;
+		dr.x = (int16_t)(left + k0);
+		dr.y = (int16_t)y;
+		dr.w = sr.w;
+		dr.h = 1;
+		if ( SDL_LowerBlit(row, &sr, dst, &dr) < 0 ) {
+			status = -1;
+			break;
+		}
+
+		/* Grow the rectangle the rows were drawn in */
+		if ( drawn.w == 0 ) {
+			drawn = dr;
+		} else {
+			int l = (dr.x < drawn.x) ? dr.x : drawn.x;
+			int r = drawn.x + drawn.w;
+			if ( dr.x + dr.w > r ) {
+				r = dr.x + dr.w;
+			}
+			drawn.x = (int16_t)l;
+			drawn.w = (uint16_t)(r - l);
+			drawn.h = (uint16_t)(y + 1 - drawn.y);
+		}
+	}
+
+	if ( src_locked ) {
+		SDL_UnlockSurface(src);
+	}
+	SDL_FreeSurface(row);
+	if ( drawn.w ) {
+		SDL_AddDirtyRect(dst, &drawn);
+	}
+	return(status);
+}
@@ -29,6 +29,10 @@
 #include <stdio.h>
 #endif
 #include "SDL_video.h"
+#include "SDL_cpuinfo.h"
+#if SDL_SSE2_INTRINSICS
+#include <emmintrin.h>
+#endif
 
 SDL_PixelFormat *SDL_AllocFormat(int bpp,
 		uint32_t Rmask, uint32_t Gmask, uint32_t Bmask, uint32_t Amask);
@@ -36,6 +40,7 @@ SDL_PixelFormat *SDL_ReallocFormat(SDL_Surface *surface, int bpp,
 		uint32_t Rmask, uint32_t Gmask, uint32_t Bmask, uint32_t Amask);
 void SDL_FormatChanged(SDL_Surface *surface);
 void SDL_FreeFormat(SDL_PixelFormat *format);
+static void SDL_FreePaletteInverse(SDL_Palette *pal);
 
 SDL_BlitMap *SDL_AllocBlitMap(void);
 void SDL_InvalidateMap(SDL_BlitMap *map);
@@ -81,6 +86,7 @@ SDL_Surface * SDL_CreateRGBSurface (uint32_t flags,
 	surface->locked = 0;
 	surface->map = NULL;
 	surface->unused1 = 0;
+	surface->dirty = NULL;
 	SDL_SetClipRect(surface, NULL);
 	SDL_FormatChanged(surface);
 
@@ -176,9 +182,22 @@ void SDL_GetClipRect(SDL_Surface *surface, SDL_Rect *rect)
 	}
 }
 
+/* The pixels are about to change, so the copy SDL_SetAutoConvert() made
+   for blitting from the surface is out of date */
+static void SDL_DropConverted(SDL_Surface *surface)
+{
+	if ( surface->map && surface->map->converted ) {
+		SDL_InvalidateMap(surface->map);
+	}
+}
+
 int SDL_LockSurface (SDL_Surface *surface)
 {
 	if ( ! surface->locked ) {
+		/* The pixels may change, the next blit encodes them again */
+		SDL_UnRLESurface(surface);
+		/* ... or converts them again */
+		SDL_DropConverted(surface);
 		surface->pixels = (uint8_t *)surface->pixels + surface->offset;
 	}
 	++surface->locked;
@@ -204,6 +223,7 @@ void SDL_FreeSurface (SDL_Surface *surface)
 	while ( surface->locked > 0 ) {
 		SDL_UnlockSurface(surface);
 	}
+	SDL_UnRLESurface(surface);
 	if ( surface->format ) {
 		SDL_FreeFormat(surface->format);
 		surface->format = NULL;
@@ -212,6 +232,7 @@ void SDL_FreeSurface (SDL_Surface *surface)
 		SDL_FreeBlitMap(surface->map);
 		surface->map = NULL;
 	}
+	SDL_EnableDirtyRects(surface, 0);
 	if ( surface->pixels &&
 	     ((surface->flags & SDL_PREALLOC) != SDL_PREALLOC) ) {
 		free(surface->pixels);
@@ -332,6 +353,7 @@ SDL_PixelFormat *SDL_AllocFormat(int bpp,
 			return(NULL);
 		}
 		(format->palette)->ncolors = ncolors;
+		(format->palette)->inverse = NULL;
 		(format->palette)->colors = (SDL_Color *)malloc(
 				(format->palette)->ncolors*sizeof(SDL_Color));
 		if ( (format->palette)->colors == NULL ) {
@@ -450,6 +472,7 @@ void SDL_FreeFormat(SDL_PixelFormat *format)
 			if ( format->palette->colors ) {
 				free(format->palette->colors);
 			}
+			SDL_FreePaletteInverse(format->palette);
 			free(format->palette);
 		}
 		free(format);
@@ -478,17 +501,131 @@ uint16_t SDL_CalculatePitch(SDL_Surface *surface)
 
 
 
-uint8_t SDL_FindColor(SDL_Palette *pal, uint8_t r, uint8_t g, uint8_t b)
+/* The nearest color search keeps a lookup for large palettes: a grid of
+   8x8x8 cells, each listing, in palette order, only the colors that can
+   be nearest to some point in the cell.  Searching those finds the same
+   color as searching the whole palette, ties included.  Blits use a
+   32x32x32 cube of the nearest color to the middle of each cube cell.
+   Both are built by SDL_SetColors() when the colors change, lookups only
+   read them, so palettes can be looked up from several threads at once.
+   They keep the colors they were built for: a palette whose colors were
+   never set that way, or were written directly since, is searched
+   through, and blits to it build a cube just for their map.
+ */
+#define INVERSE_CELL_BITS	5
+#define INVERSE_CELL		(1<<INVERSE_CELL_BITS)
+#define INVERSE_CELLS		(1<<(3*(8-INVERSE_CELL_BITS)))
+#define INVERSE_CELL_INDEX(r, g, b)					\
+	((((r)>>INVERSE_CELL_BITS)<<(2*(8-INVERSE_CELL_BITS)))|		\
+	 (((g)>>INVERSE_CELL_BITS)<<(8-INVERSE_CELL_BITS))|		\
+	 ((b)>>INVERSE_CELL_BITS))
+/* Smaller palettes are searched through */
+#define INVERSE_MIN_COLORS	16
+
+typedef struct SDL_PaletteInverse {
+	uint32_t first[INVERSE_CELLS+1];	/* candidates of each cell */
+	uint8_t *candidates;
+	uint8_t *cube;			/* PALETTE_CUBE_SIZE entries */
+	int ncolors;			/* the colors they were built for */
+	SDL_Color colors[256];
+} SDL_PaletteInverse;
+
+static void SDL_FreePaletteInverse(SDL_Palette *pal)
+{
+	if ( pal->inverse ) {
+		if ( pal->inverse->cube ) {
+			free(pal->inverse->cube);
+		}
+		free(pal->inverse->candidates);
+		free(pal->inverse);
+		pal->inverse = NULL;
+	}
+}
+
+/* Nonzero if the lookups still match the palette colors */
+static int SDL_PaletteInverseValid(const SDL_Palette *pal)
+{
+	const SDL_PaletteInverse *inverse = pal->inverse;
+
+	return( inverse && inverse->ncolors == pal->ncolors &&
+		memcmp(inverse->colors, pal->colors,
+			pal->ncolors*sizeof(SDL_Color)) == 0 );
+}
+
+/* Squared distances from a color to the nearest and the farthest
+   point of a grid cell */
+static void SDL_CellDistance(const SDL_Color *color, int cell,
+				unsigned int *nearest, unsigned int *farthest)
+{
+	int value[3];
+	int i;
+
+	value[0] = color->r;
+	value[1] = color->g;
+	value[2] = color->b;
+	*nearest = 0;
+	*farthest = 0;
+	for ( i=0; i<3; ++i ) {
+		int lo = ((cell >> ((2-i)*(8-INVERSE_CELL_BITS))) &
+				((1<<(8-INVERSE_CELL_BITS))-1)) << INVERSE_CELL_BITS;
+		int hi = lo + INVERSE_CELL - 1;
+		int d;
+
+		if ( value[i] < lo ) {
+			d = lo - value[i];
+		} else if ( value[i] > hi ) {
+			d = value[i] - hi;
+		} else {
+			d = 0;
+		}
+		*nearest += d*d;
+		d = (value[i] - lo > hi - value[i]) ? value[i] - lo : hi - value[i];
+		*farthest += d*d;
+	}
+}
+
+/* A color can only be nearest to a point in the cell if it is no farther
+   from the cell than the color whose farthest point is nearest */
+static int SDL_CellCandidates(SDL_Palette *pal, int cell, uint8_t *list)
+{
+	unsigned int nearest, farthest, bound;
+	int count;
+	int i;
+
+	bound = ~0;
+	for ( i=0; i<pal->ncolors; ++i ) {
+		SDL_CellDistance(&pal->colors[i], cell, &nearest, &farthest);
+		if ( farthest < bound ) {
+			bound = farthest;
+		}
+	}
+	count = 0;
+	for ( i=0; i<pal->ncolors; ++i ) {
+		SDL_CellDistance(&pal->colors[i], cell, &nearest, &farthest);
+		if ( nearest <= bound ) {
+			if ( list ) {
+				list[count] = (uint8_t)i;
+			}
+			++count;
+		}
+	}
+	return(count);
+}
+
+static uint8_t SDL_FindCandidate(SDL_Palette *pal,
+		const uint8_t *candidates, int count,
+		uint8_t r, uint8_t g, uint8_t b)
 {
 	/* Do colorspace distance matching */
 	unsigned int smallest;
 	unsigned int distance;
 	int rd, gd, bd;
-	int i;
+	int i, n;
 	uint8_t pixel=0;
 	
 	smallest = ~0;
-	for ( i=0; i<pal->ncolors; ++i ) {
+	for ( n=0; n<count; ++n ) {
+		i = candidates ? candidates[n] : n;
 		rd = pal->colors[i].r - r;
 		gd = pal->colors[i].g - g;
 		bd = pal->colors[i].b - b;
@@ -504,6 +641,160 @@ uint8_t SDL_FindColor(SDL_Palette *pal, uint8_t r, uint8_t g, uint8_t b)
 	return(pixel);
 }
 
+uint8_t SDL_FindColor(SDL_Palette *pal, uint8_t r, uint8_t g, uint8_t b)
+{
+	const SDL_PaletteInverse *inverse = pal->inverse;
+
+	if ( pal->ncolors > INVERSE_MIN_COLORS && SDL_PaletteInverseValid(pal) ) {
+		int cell = INVERSE_CELL_INDEX(r, g, b);
+		return SDL_FindCandidate(pal,
+			inverse->candidates + inverse->first[cell],
+			inverse->first[cell+1] - inverse->first[cell],
+			r, g, b);
+	}
+	return SDL_FindCandidate(pal, NULL, pal->ncolors, r, g, b);
+}
+
+/* Fill in the grid and the cube of a palette */
+static int SDL_InitPaletteInverse(SDL_Palette *pal,
+				SDL_PaletteInverse *inverse, uint8_t *cube)
+{
+	int cell;
+	int r, g, b;
+
+	if ( pal->ncolors <= 0 || pal->ncolors > 256 ) {
+		return(-1);
+	}
+	inverse->ncolors = pal->ncolors;
+	memcpy(inverse->colors, pal->colors, pal->ncolors*sizeof(SDL_Color));
+	inverse->first[0] = 0;
+	for ( cell=0; cell<INVERSE_CELLS; ++cell ) {
+		inverse->first[cell+1] = inverse->first[cell] +
+					SDL_CellCandidates(pal, cell, NULL);
+	}
+	inverse->candidates = (uint8_t *)malloc(inverse->first[INVERSE_CELLS]);
+	if ( inverse->candidates == NULL ) {
+		return(-1);
+	}
+	for ( cell=0; cell<INVERSE_CELLS; ++cell ) {
+		SDL_CellCandidates(pal, cell,
+				inverse->candidates + inverse->first[cell]);
+	}
+	for ( r=4; r<256; r+=8 ) {
+		for ( g=4; g<256; g+=8 ) {
+			for ( b=4; b<256; b+=8 ) {
+				cell = INVERSE_CELL_INDEX(r, g, b);
+				cube[PALETTE_CUBE_INDEX(r, g, b)] =
+					SDL_FindCandidate(pal,
+					inverse->candidates + inverse->first[cell],
+					inverse->first[cell+1] - inverse->first[cell],
+					(uint8_t)r, (uint8_t)g, (uint8_t)b);
+			}
+		}
+	}
+	return(0);
+}
+
+/* Build the lookups for the current palette colors */
+static void SDL_BuildPaletteInverse(SDL_Palette *pal)
+{
+	SDL_PaletteInverse *inverse;
+
+	SDL_FreePaletteInverse(pal);
+	inverse = (SDL_PaletteInverse *)malloc(sizeof(*inverse));
+	if ( inverse == NULL ) {
+		return;
+	}
+	inverse->candidates = NULL;
+	inverse->cube = (uint8_t *)malloc(PALETTE_CUBE_SIZE);
+	if ( inverse->cube == NULL ||
+	     SDL_InitPaletteInverse(pal, inverse, inverse->cube) < 0 ) {
+		if ( inverse->cube ) {
+			free(inverse->cube);
+		}
+		free(inverse);
+		return;
+	}
+	pal->inverse = inverse;
+}
+
+/* Fill a blit map with the nearest colors of a palette, from its cube if
+   that is still current, otherwise from lookups built just for this and
+   thrown away.
+   The palette itself is left as it is.
+ */
+static int SDL_FillPaletteCube(SDL_Palette *pal, uint8_t *map)
+{
+	SDL_PaletteInverse inverse;
+
+	if ( SDL_PaletteInverseValid(pal) ) {
+		memcpy(map, pal->inverse->cube, PALETTE_CUBE_SIZE);
+		return(0);
+	}
+	if ( SDL_InitPaletteInverse(pal, &inverse, map) < 0 ) {
+		return(-1);
+	}
+	free(inverse.candidates);
+	return(0);
+}
+
+/* Give a palette with the same colors the lookups of another one */
+static void SDL_CopyPaletteInverse(SDL_Palette *dst, SDL_Palette *src)
+{
+	const SDL_PaletteInverse *inverse = src->inverse;
+	SDL_PaletteInverse *copy;
+
+	SDL_FreePaletteInverse(dst);
+	if ( inverse == NULL ) {
+		return;
+	}
+	copy = (SDL_PaletteInverse *)malloc(sizeof(*copy));
+	if ( copy == NULL ) {
+		return;
+	}
+	memcpy(copy, inverse, sizeof(*copy));
+	copy->candidates = (uint8_t *)malloc(inverse->first[INVERSE_CELLS]);
+	copy->cube = (uint8_t *)malloc(PALETTE_CUBE_SIZE);
+	if ( copy->candidates == NULL || copy->cube == NULL ) {
+		if ( copy->candidates ) {
+			free(copy->candidates);
+		}
+		if ( copy->cube ) {
+			free(copy->cube);
+		}
+		free(copy);
+		return;
+	}
+	memcpy(copy->candidates, inverse->candidates,
+			inverse->first[INVERSE_CELLS]);
+	memcpy(copy->cube, inverse->cube, PALETTE_CUBE_SIZE);
+	dst->inverse = copy;
+}
+
+int SDL_SetColors(SDL_Surface *surface, SDL_Color *colors,
+			int firstcolor, int ncolors)
+{
+	SDL_Palette *pal = surface->format->palette;
+	int gotall = 1;
+
+	if ( pal == NULL || firstcolor < 0 || firstcolor >= pal->ncolors ) {
+		return(0);
+	}
+	if ( ncolors > pal->ncolors - firstcolor ) {
+		ncolors = pal->ncolors - firstcolor;
+		gotall = 0;
+	}
+	if ( ncolors > 0 ) {
+		if ( colors != pal->colors + firstcolor ) {
+			memcpy(pal->colors + firstcolor, colors,
+					ncolors*sizeof(SDL_Color));
+		}
+		SDL_BuildPaletteInverse(pal);
+		SDL_FormatChanged(surface);
+	}
+	return(gotall);
+}
+
 uint32_t SDL_MapRGB(const SDL_PixelFormat* const format, const uint8_t r, const uint8_t g, const uint8_t b)
 {
 	if ( format->palette == NULL) {
@@ -603,6 +894,10 @@ void SDL_InvalidateMap(SDL_BlitMap *map)
 		free(map->table);
 		map->table = NULL;
 	}
+	if ( map->converted ) {
+		SDL_FreeSurface(map->converted);
+		map->converted = NULL;
+	}
 }
 
 void SDL_FreeBlitMap(SDL_BlitMap *map)
@@ -619,54 +914,150 @@ void SDL_FreeBlitMap(SDL_BlitMap *map)
 /*=======================================*/
 
 
-static int SDL_FillRect1(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
+/* Rects at least this big are filled with non-temporal stores, which
+   don't pull the destination into the cache only to push it out again.
+   Smaller fills are usually read back soon (blits, texture uploads).
+ */
+#define FILL_STREAM_BYTES	(256*1024)
+
+/* 1 and 4 bit pixels are packed with the leftmost pixel in the high bits
+   of a byte, as SDL_blit_0.c and the BMP loader expect */
+static void SDL_FillRectBits(SDL_Surface *dst, SDL_Rect *dstrect,
+					uint32_t color, int bits)
 {
-	/* FIXME: We have to worry about packing order.. *sigh* */
-	fprintf(stderr, "%s\n", "1-bpp rect fill not yet implemented");
-	return -1;
+	uint8_t pattern;
+	uint8_t lmask, rmask;
+	int x0, x1, first, last;
+	uint8_t *row;
+	int y;
+
+	if ( bits == 1 ) {
+		pattern = (color & 1) ? 0xFF : 0x00;
+	} else {
+		pattern = (uint8_t)((color & 0x0F) * 0x11);
+	}
+	x0 = dstrect->x * bits;
+	x1 = (dstrect->x + dstrect->w) * bits;
+	first = x0 / 8;
+	last = (x1 - 1) / 8;
+	lmask = (uint8_t)(0xFF >> (x0 & 7));
+	rmask = (uint8_t)(0xFF << (7 - ((x1 - 1) & 7)));
+	if ( first == last ) {
+		lmask &= rmask;
+	}
+
+	row = (uint8_t *)dst->pixels + dstrect->y*dst->pitch;
+	for ( y=dstrect->h; y; --y ) {
+		row[first] = (row[first] & ~lmask) | (pattern & lmask);
+		if ( last > first ) {
+			memset(row+first+1, pattern, last-first-1);
+			row[last] = (row[last] & ~rmask) | (pattern & rmask);
+		}
+		row += dst->pitch;
+	}
 }
-static int SDL_FillRect4(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
+
+static void SDL_FillRect1(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
 {
-	/* FIXME: We have to worry about packing order.. *sigh* */
-	fprintf(stderr, "%s\n", "4-bpp rect fill not yet implemented");
-	return -1;
+	SDL_FillRectBits(dst, dstrect, color, 1);
 }
-int SDL_FillRect(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
+static void SDL_FillRect4(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
 {
-	int x, y;
-	uint8_t *row;
-
-	/* This function doesn't work on surfaces < 8 bpp */
-	if ( dst->format->BitsPerPixel < 8 ) {
-		switch(dst->format->BitsPerPixel) {
-		    case 1:
-			return SDL_FillRect1(dst, dstrect, color);
-			break;
+	SDL_FillRectBits(dst, dstrect, color, 4);
+}
 
-		    case 4:
-			return SDL_FillRect4(dst, dstrect, color);
-			break;
-		    
-			default:
-			fprintf(stderr, "%s\n", "Fill rect on unsupported surface format");
-			return(-1);
-			break;
+#if SDL_SSE2_INTRINSICS
+/* pattern[i] is byte i % bpp of the pixel for i < 64, 48 bytes being a
+   whole number of pixels of every size, so three vectors repeat across
+   the row once the stores are aligned */
+static void SDL_FillRowSSE2(uint8_t *row, int len,
+				const uint8_t *pattern, int stream)
+{
+	int head = (int)((16 - ((uintptr_t)row & 15)) & 15);
+	__m128i v[3];
+	int k, n;
+
+	if ( head > len ) {
+		head = len;
+	}
+	memcpy(row, pattern, head);
+
+	for ( k=0; k<3; ++k ) {
+		v[k] = _mm_loadu_si128(
+			(const __m128i *)(pattern + (head + 16*k) % 48));
+	}
+	/* One period of the pattern per iteration, then what is left of it */
+	n = head;
+	if ( stream ) {
+		for ( ; n+48 <= len; n += 48 ) {
+			_mm_stream_si128((__m128i *)(row + n), v[0]);
+			_mm_stream_si128((__m128i *)(row + n + 16), v[1]);
+			_mm_stream_si128((__m128i *)(row + n + 32), v[2]);
 		}
-	}
-
-	/* If 'dstrect' == NULL, then fill the whole surface */
-	if ( dstrect ) {
-		/* Perform clipping */
-		if ( !SDL_IntersectRect(dstrect, &dst->clip_rect, dstrect) ) {
-			return(0);
+		for ( k=0; n+16 <= len; n += 16, ++k ) {
+			_mm_stream_si128((__m128i *)(row + n), v[k]);
 		}
 	} else {
-		dstrect = &dst->clip_rect;
+		for ( ; n+48 <= len; n += 48 ) {
+			_mm_store_si128((__m128i *)(row + n), v[0]);
+			_mm_store_si128((__m128i *)(row + n + 16), v[1]);
+			_mm_store_si128((__m128i *)(row + n + 32), v[2]);
+		}
+		for ( k=0; n+16 <= len; n += 16, ++k ) {
+			_mm_store_si128((__m128i *)(row + n), v[k]);
+		}
 	}
+	memcpy(row + n, pattern + n % 48, len - n);
+}
 
-	if ( SDL_LockSurface(dst) != 0 ) {
-		return(-1);
+static void SDL_FillRectSSE2(SDL_Surface *dst, SDL_Rect *dstrect,
+					uint32_t color)
+{
+	int bpp = dst->format->BytesPerPixel;
+	int len = dstrect->w * bpp;
+	uint8_t pattern[64];
+	uint8_t *row;
+	int stream;
+	int i, y;
+
+	switch (bpp) {
+	    case 1:
+		pattern[0] = (uint8_t)color;
+		break;
+	    case 2:
+		*(uint16_t *)pattern = (uint16_t)color;
+		break;
+	    case 3:
+		#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+			color <<= 8;
+		#endif
+		memcpy(pattern, &color, 3);
+		break;
+	    case 4:
+		*(uint32_t *)pattern = color;
+		break;
+	}
+	for ( i=bpp; i<64; ++i ) {
+		pattern[i] = pattern[i - bpp];
+	}
+	stream = (len * dstrect->h >= FILL_STREAM_BYTES);
+
+	row = (uint8_t *)dst->pixels+dstrect->y*dst->pitch+dstrect->x*bpp;
+	for ( y=dstrect->h; y; --y ) {
+		SDL_FillRowSSE2(row, len, pattern, stream);
+		row += dst->pitch;
+	}
+	if ( stream ) {
+		_mm_sfence();
 	}
+}
+#endif /* SDL_SSE2_INTRINSICS */
+
+static void SDL_FillRectN(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
+{
+	int x, y;
+	uint8_t *row;
+
 	row = (uint8_t *)dst->pixels+dstrect->y*dst->pitch+
 			dstrect->x*dst->format->BytesPerPixel;
 	if ( dst->format->palette || (color == 0) ) {
@@ -727,10 +1118,81 @@ int SDL_FillRect(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
 			break;
 		}
 	}
+}
+
+int SDL_FillRect(SDL_Surface *dst, SDL_Rect *dstrect, uint32_t color)
+{
+	/* 1 and 4 bpp are the only packed formats that can be filled */
+	if ( dst->format->BitsPerPixel < 8 &&
+	     dst->format->BitsPerPixel != 1 && dst->format->BitsPerPixel != 4 ) {
+		fprintf(stderr, "%s\n", "Fill rect on unsupported surface format");
+		return(-1);
+	}
+
+	/* If 'dstrect' == NULL, then fill the whole surface */
+	if ( dstrect ) {
+		/* Perform clipping */
+		if ( !SDL_IntersectRect(dstrect, &dst->clip_rect, dstrect) ) {
+			return(0);
+		}
+	} else {
+		dstrect = &dst->clip_rect;
+	}
+
+	if ( SDL_LockSurface(dst) != 0 ) {
+		return(-1);
+	}
+	switch (dst->format->BitsPerPixel) {
+	    case 1:
+		SDL_FillRect1(dst, dstrect, color);
+		break;
+
+	    case 4:
+		SDL_FillRect4(dst, dstrect, color);
+		break;
+
+	    default:
+#if SDL_SSE2_INTRINSICS
+		if ( SDL_HasSSE2() ) {
+			SDL_FillRectSSE2(dst, dstrect, color);
+			break;
+		}
+#endif
+		SDL_FillRectN(dst, dstrect, color);
+		break;
+	}
 	SDL_UnlockSurface(dst);
+	SDL_AddDirtyRect(dst, dstrect);
 	return(0);
 }
 
+int SDL_FillRects(SDL_Surface *dst, const SDL_Rect *rects, int count,
+			uint32_t color)
+{
+	int i;
+	int status;
+
+	if ( ! rects ) {
+		fprintf(stderr, "%s\n", "SDL_FillRects() passed NULL rects");
+		return(-1);
+	}
+
+	/* Lock once, the fills below only bump the lock count */
+	if ( SDL_LockSurface(dst) != 0 ) {
+		return(-1);
+	}
+	status = 0;
+	for ( i=0; i<count; ++i ) {
+		SDL_Rect rect = rects[i];
+		if ( SDL_FillRect(dst, &rect, color) < 0 ) {
+			status = -1;
+			break;
+		}
+	}
+	SDL_UnlockSurface(dst);
+	return(status);
+}
+
 /*=======================================*/
 
 
@@ -931,6 +1393,13 @@ int SDL_CalculateBlit(SDL_Surface *surface)
 		return(-1);
 	}
 	
+	/* Run length encode colorkeyed and alpha channel sprites if asked */
+	if ( (surface->flags & SDL_RLEACCELOK) == SDL_RLEACCELOK ) {
+		if ( SDL_RLESurface(surface) == 0 ) {
+			surface->map->sw_blit = SDL_RLEBlit;
+		}
+	}
+
 	if ( surface->map->sw_blit == NULL ) {
 		surface->map->sw_blit = SDL_SoftBlit;
 	}
@@ -1019,20 +1488,101 @@ static uint8_t *Map1toN(SDL_PixelFormat *src, SDL_PixelFormat *dst)
 }
 static uint8_t *MapNto1(SDL_PixelFormat *src, SDL_PixelFormat *dst, int *identical)
 {
-	/* Generate a 256 color dither palette */
-	SDL_Palette dithered;
-	SDL_Color colors[256];
 	SDL_Palette *pal = dst->palette;
-	
-	/* SDL_DitherColors does not initialize the 'unused' component of colors,
-	   but Map1to1 compares it against pal, so we should initialize it. */  
-	memset(colors, 0, sizeof(colors));
-
-	dithered.ncolors = 256;
-	SDL_DitherColors(colors, 8);
-	dithered.colors = colors;
-	return(Map1to1(&dithered, pal, identical));
+	uint8_t *map;
+
+	/* A 256 color dither palette is packed into directly */
+	if ( pal->ncolors >= 256 ) {
+		SDL_Color colors[256];
+
+		/* SDL_DitherColors does not initialize the 'unused' component
+		   of colors, but pal has it, so we should initialize it. */
+		memset(colors, 0, sizeof(colors));
+		SDL_DitherColors(colors, 8);
+		if ( memcmp(colors, pal->colors, sizeof(colors)) == 0 ) {
+			*identical = 1;
+			return(NULL);
+		}
+	}
+	*identical = 0;
+
+	/* The cube stays with the palette, each map gets its own copy */
+	map = (uint8_t *)malloc(PALETTE_CUBE_SIZE);
+	if ( map == NULL || SDL_FillPaletteCube(pal, map) < 0 ) {
+		if ( map ) {
+			free(map);
+		}
+		fprintf(stderr, "%s\n", "Out Of Memory");
+		return(NULL);
+	}
+	return(map);
+}
+/* Whether blitting a copy of src in the dst format gives the same pixels */
+static int SDL_CanConvertFor(SDL_Surface *src, SDL_Surface *dst)
+{
+	SDL_PixelFormat *srcfmt = src->format;
+	SDL_PixelFormat *dstfmt = dst->format;
+
+	if ( src == dst || src->map->identity ||
+	     srcfmt->BitsPerPixel < 8 || dstfmt->BitsPerPixel < 8 ) {
+		return(0);
+	}
+	/* The dither pattern starts at the corner of each blit */
+	if ( src->map->dither && dstfmt->palette ) {
+		return(0);
+	}
+	/* Blending is done differently by the identity blitters */
+	if ( (src->flags & SDL_SRCALPHA) &&
+	     (srcfmt->alpha != SDL_ALPHA_OPAQUE || srcfmt->Amask) ) {
+		return(0);
+	}
+	/* The colorkey is compared with every bit but alpha, and the key
+	   blitters don't widen channels the way the copy blitters do, so
+	   only let the channels move, not change size */
+	if ( src->flags & SDL_SRCCOLORKEY ) {
+		uint32_t used = srcfmt->Rmask | srcfmt->Gmask |
+				srcfmt->Bmask | srcfmt->Amask;
+		if ( srcfmt->palette || dstfmt->palette ||
+		     used != (0xFFFFFFFF >> (32 - srcfmt->BitsPerPixel)) ||
+		     dstfmt->Rloss != srcfmt->Rloss ||
+		     dstfmt->Gloss != srcfmt->Gloss ||
+		     dstfmt->Bloss != srcfmt->Bloss ) {
+			return(0);
+		}
+	}
+	return(1);
+}
+
+static int SDL_MapConverted(SDL_Surface *src, SDL_Surface *dst)
+{
+	SDL_BlitMap *map = src->map;
+	SDL_Surface *converted;
+	uint32_t flags;
+
+	if ( ! SDL_CanConvertFor(src, dst) ) {
+		return(-1);
+	}
+	/* The copy doesn't change until the map is invalidated, so it is
+	   always worth run length encoding a colorkeyed one */
+	flags = src->flags & (SDL_SRCCOLORKEY|SDL_RLEACCELOK);
+	if ( flags & SDL_SRCCOLORKEY ) {
+		flags |= SDL_RLEACCELOK;
+	}
+	converted = SDL_ConvertSurface(src, dst->format, flags);
+	if ( converted == NULL ) {
+		return(-1);
+	}
+	/* Without alpha blending, the dst alpha channel is just copied */
+	SDL_SetAlpha(converted, 0, 0);
+
+	/* Converting blitted through this map, point it back at dst */
+	SDL_InvalidateMap(map);
+	map->dst = dst;
+	map->format_version = dst->format_version;
+	map->converted = converted;
+	return(0);
 }
+
 int SDL_MapSurface (SDL_Surface *src, SDL_Surface *dst)
 {
 	SDL_PixelFormat *srcfmt;
@@ -1041,6 +1591,7 @@ int SDL_MapSurface (SDL_Surface *src, SDL_Surface *dst)
 
 	/* Clear out any previous mapping */
 	map = src->map;
+	SDL_UnRLESurface(src);
 	SDL_InvalidateMap(map);
 
 	/* Figure out what kind of mapping we're doing */
@@ -1102,6 +1653,11 @@ int SDL_MapSurface (SDL_Surface *src, SDL_Surface *dst)
 	map->dst = dst;
 	map->format_version = dst->format_version;
 
+	/* Blit from a copy in the destination format instead */
+	if ( map->auto_convert && SDL_MapConverted(src, dst) == 0 ) {
+		return(0);
+	}
+
 	/* Choose your blitters wisely */
 	return(SDL_CalculateBlit(src));
 }
@@ -1110,6 +1666,9 @@ int SDL_LowerBlit (SDL_Surface *src, SDL_Rect *srcrect,
 {
 	SDL_blit do_blit;
 
+	/* Blits only lock dst when they must, drop its copy here instead */
+	SDL_DropConverted(dst);
+
 	/* Check to make sure the blit mapping is valid */
 	if ( (src->map->dst != dst) ||
              (src->map->dst->format_version != src->map->format_version) ) {
@@ -1117,6 +1676,9 @@ int SDL_LowerBlit (SDL_Surface *src, SDL_Rect *srcrect,
 			return(-1);
 		}
 	}
+	if ( src->map->converted ) {
+		return(SDL_LowerBlit(src->map->converted, srcrect, dst, dstrect));
+	}
 
 	/* Figure out which blitter to use */
 	do_blit = src->map->sw_blit;
@@ -1209,7 +1771,11 @@ int SDL_UpperBlit (SDL_Surface *src, SDL_Rect *srcrect,
 		sr.y = srcy;
 		sr.w = dstrect->w = w;
 		sr.h = dstrect->h = h;
-		return SDL_LowerBlit(src, &sr, dst, dstrect);
+		if ( SDL_LowerBlit(src, &sr, dst, dstrect) < 0 ) {
+			return(-1);
+		}
+		SDL_AddDirtyRect(dst, dstrect);
+		return(0);
 	}
 	dstrect->w = dstrect->h = 0;
 	return 0;
@@ -1228,6 +1794,129 @@ int SDL_UpperBlit (SDL_Surface *src, SDL_Rect *srcrect,
 
 
 
+SDL_Surface * SDL_ConvertSurface (SDL_Surface *surface,
+			SDL_PixelFormat *format, uint32_t flags)
+{
+	SDL_Surface *convert;
+	uint32_t colorkey = 0;
+	uint8_t alpha = 0;
+	uint32_t surface_flags;
+	int auto_convert;
+	SDL_Rect bounds;
+
+	/* Check for empty destination palette! (results in empty image) */
+	if ( format->palette != NULL ) {
+		int i;
+		for ( i=0; i<format->palette->ncolors; ++i ) {
+			if ( (format->palette->colors[i].r != 0) ||
+			     (format->palette->colors[i].g != 0) ||
+			     (format->palette->colors[i].b != 0) )
+				break;
+		}
+		if ( i == format->palette->ncolors ) {
+			fprintf(stderr, "%s\n", "Empty destination palette");
+			return(NULL);
+		}
+	}
+
+	/* Create a new surface with the desired format */
+	convert = SDL_CreateRGBSurface(flags,
+				surface->w, surface->h, format->BitsPerPixel,
+		format->Rmask, format->Gmask, format->Bmask, format->Amask);
+	if ( convert == NULL ) {
+		return(NULL);
+	}
+
+	/* Copy the palette if any */
+	if ( format->palette && convert->format->palette ) {
+		memcpy(convert->format->palette->colors,
+				format->palette->colors,
+				format->palette->ncolors*sizeof(SDL_Color));
+		convert->format->palette->ncolors = format->palette->ncolors;
+
+		/* The copy looks colors up like the palette it came from */
+		SDL_CopyPaletteInverse(convert->format->palette,
+					format->palette);
+	}
+
+	/* Save the original surface color key and alpha */
+	surface_flags = surface->flags;
+	if ( (surface_flags & SDL_SRCCOLORKEY) == SDL_SRCCOLORKEY ) {
+		/* Convert colourkeyed surfaces to RGBA if requested */
+		if((flags & SDL_SRCCOLORKEY) != SDL_SRCCOLORKEY
+		   && format->Amask) {
+			surface_flags &= ~SDL_SRCCOLORKEY;
+		} else {
+			colorkey = surface->format->colorkey;
+			SDL_SetColorKey(surface, 0, 0);
+		}
+	}
+	if ( (surface_flags & SDL_SRCALPHA) == SDL_SRCALPHA ) {
+		/* Copy over the alpha channel to RGBA if requested */
+		if ( format->Amask ) {
+			surface->flags &= ~SDL_SRCALPHA;
+		} else {
+			alpha = surface->format->alpha;
+			SDL_SetAlpha(surface, 0, 0);
+		}
+	}
+
+	/* Copy over the image data, straight from this surface */
+	auto_convert = surface->map->auto_convert;
+	surface->map->auto_convert = 0;
+	bounds.x = 0;
+	bounds.y = 0;
+	bounds.w = surface->w;
+	bounds.h = surface->h;
+	SDL_LowerBlit(surface, &bounds, convert, &bounds);
+	surface->map->auto_convert = auto_convert;
+
+	/* Clean up the original surface, and update converted surface */
+	SDL_SetClipRect(convert, &surface->clip_rect);
+	if ( (surface_flags & SDL_SRCCOLORKEY) == SDL_SRCCOLORKEY ) {
+		uint32_t cflags = surface_flags&(SDL_SRCCOLORKEY|SDL_RLEACCELOK);
+		uint8_t keyR, keyG, keyB;
+
+		SDL_GetRGB(colorkey,surface->format,&keyR,&keyG,&keyB);
+		SDL_SetColorKey(convert, cflags|(flags&SDL_RLEACCELOK),
+			SDL_MapRGB(convert->format, keyR, keyG, keyB));
+		SDL_SetColorKey(surface, cflags, colorkey);
+	}
+	if ( (surface_flags & SDL_SRCALPHA) == SDL_SRCALPHA ) {
+		uint32_t aflags = surface_flags&(SDL_SRCALPHA|SDL_RLEACCELOK);
+
+		SDL_SetAlpha(convert, aflags|(flags&SDL_RLEACCELOK), alpha);
+		if ( format->Amask ) {
+			surface->flags |= SDL_SRCALPHA;
+		} else {
+			SDL_SetAlpha(surface, aflags, alpha);
+		}
+	}
+
+	/* We're ready to go! */
+	return(convert);
+}
+
+int SDL_SetAutoConvert (SDL_Surface *surface, int enable)
+{
+	enable = (enable != 0);
+	if ( surface->map->auto_convert != enable ) {
+		surface->map->auto_convert = enable;
+		SDL_InvalidateMap(surface->map);
+	}
+	return(0);
+}
+
+int SDL_SetDither (SDL_Surface *surface, int enable)
+{
+	enable = (enable != 0);
+	if ( surface->map->dither != enable ) {
+		surface->map->dither = enable;
+		SDL_InvalidateMap(surface->map);
+	}
+	return(0);
+}
+
 /*==============================================*/
 
 
@@ -1250,6 +1939,9 @@ int SDL_SetColorKey (SDL_Surface *surface, uint32_t flag, uint32_t key)
 		return(0);
 	}
 
+	/* UnRLE surfaces before we change the colorkey */
+	SDL_UnRLESurface(surface);
+
 	if ( flag ) {
 		surface->flags |= SDL_SRCCOLORKEY;
 		surface->format->colorkey = key;
@@ -1267,4 +1959,51 @@ int SDL_SetColorKey (SDL_Surface *surface, uint32_t flag, uint32_t key)
 	return(0);
 }
 
+int SDL_SetAlpha (SDL_Surface *surface, uint32_t flag, uint8_t value)
+{
+	uint32_t oldflags = surface->flags;
+	uint32_t oldalpha = surface->format->alpha;
 
+	/* Sanity check the flag as it gets passed in */
+	if ( flag & SDL_SRCALPHA ) {
+		if ( flag & (SDL_RLEACCEL|SDL_RLEACCELOK) ) {
+			flag = (SDL_SRCALPHA | SDL_RLEACCELOK);
+		} else {
+			flag = SDL_SRCALPHA;
+		}
+	} else {
+		flag = 0;
+	}
+
+	/* Optimize away operations that don't change anything */
+	if ( (flag == (surface->flags & (SDL_SRCALPHA|SDL_RLEACCELOK))) &&
+	     (!flag || value == oldalpha) ) {
+		return(0);
+	}
+
+	SDL_UnRLESurface(surface);
+
+	if ( flag ) {
+		surface->flags |= SDL_SRCALPHA;
+		surface->format->alpha = value;
+		if ( flag & SDL_RLEACCELOK ) {
+			surface->flags |= SDL_RLEACCELOK;
+		} else {
+			surface->flags &= ~SDL_RLEACCELOK;
+		}
+	} else {
+		surface->flags &= ~SDL_SRCALPHA;
+		surface->format->alpha = SDL_ALPHA_OPAQUE;
+	}
+	/*
+	 * The representation for software surfaces is independent of
+	 * per-surface alpha, so no need to invalidate the blit mapping
+	 * if just the alpha value was changed. (If either is 1, we need
+	 * to invalidate)
+	 */
+	if ( oldflags != surface->flags ||
+	     (((oldalpha + 1) ^ (value + 1)) & 0x100) ) {
+		SDL_InvalidateMap(surface->map);
+	}
+	return(0);
+}
@@ -22,6 +22,7 @@
 
 /* $Id: SDL_ttf.c 2304 2006-05-01 09:26:07Z slouken $ */
 
+#include <pthread.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,15 +43,196 @@
 #include "SDL_endian.h"
 #include <stdint.h>
 #include "SDL_ttf.h"
+#include "SDL_ext_pixel.h"
+#include "SDL_cpuinfo.h"
+#include "SDL_timer.h"
+
+/* Mono glyph bitmaps are expanded to a byte per pixel through tables,
+   and the bold style is smeared 16 pixels at a time with SSE2.  Set to 0
+   for the bit by bit loops, test_ttf_glyph_bench() compares the two.
+ */
+#define TTF_GLYPH_LUT	1
+
+#if TTF_GLYPH_LUT && SDL_SSE2_INTRINSICS
+#include <emmintrin.h>
+#endif
 
 #define NUM_GRAYS       256
 
+/* Every font has a lock around its face and caches, so one font can be
+   shared between threads.  For text drawn in parallel give each thread
+   its own font from TTF_CloneFont().
+ */
+#define TTF_USE_LOCK	1
+
 #define FT_FLOOR(X)	((X & -64) / 64)
 #define FT_CEIL(X)	(((X + 63) & -64) / 64)
 
 #define CACHED_METRICS	0x10
 #define CACHED_BITMAP	0x01
 #define CACHED_PIXMAP	0x02
+#define CACHED_SDF	0x04
+
+/* Signed distance fields are made from the antialiased pixmap at the
+   size the font was opened with, and scaled when drawn.  A value of 128
+   is the outline, each SDF_SPREAD pixels in or out moves it by 127.
+   The field has an SDF_SPREAD pixel border around the pixmap.
+ */
+#define SDF_SPREAD	TTF_SDF_SPREAD
+#define SDF_FAR		0x3FFF
+
+/* Glyphs are kept in a hash table per font, keyed by character and
+   the styles that change the rendered shape (bold and italic), so a
+   style change doesn't throw the cache away.  Each entry has a slot for
+   the mono bitmap and the antialiased pixmap.  Least recently used
+   glyphs are dropped once the font goes over its memory budget.
+ */
+#define GLYPH_CACHE_BUDGET	(2*1024*1024)
+#define GLYPH_CACHE_BUCKETS	256	/* initial size, grows with the cache */
+#define GLYPH_STYLE_MASK	(TTF_STYLE_BOLD|TTF_STYLE_ITALIC)
+
+/* Glyph entries and pixel buffers come from power of two size classes
+   carved out of big slabs, larger buffers go straight to malloc() and
+   are kept on a list so a reset frees them along with the slabs.
+ */
+#define GLYPH_SLAB_SIZE		(64*1024)
+#define GLYPH_MIN_CLASS		6	/* 64 bytes */
+#define GLYPH_NUM_CLASSES	9	/* up to 16K */
+
+typedef struct glyph_slab {
+	struct glyph_slab *next;
+	double align;
+} glyph_slab;
+
+typedef struct glyph_block {
+	struct glyph_block *next;
+} glyph_block;
+
+typedef struct glyph_large {
+	struct glyph_large *next;
+	struct glyph_large *prev;
+	double align;
+} glyph_large;
+
+typedef struct {
+	glyph_slab *slabs;
+	glyph_block *freelist[GLYPH_NUM_CLASSES];
+	glyph_large *large;
+} glyph_arena;
+
+/* Recently laid out strings keep their glyphs and pen positions, so HUD
+   text drawn every frame isn't shaped twice per call (size, then render).
+   Longer strings are laid out in chunks as they are drawn.
+ */
+#define RUN_CACHE_SLOTS		32
+#define RUN_CACHE_MAXLEN	128	/* glyphs */
+
+typedef struct text_run {
+	uint32_t *chars;	/* code points, also the cache key */
+	int *xpos;		/* pen position of each glyph */
+	int num_glyphs;
+	int width;		/* what TTF_SizeUNICODE() reports */
+	uint32_t hash;
+	int style;
+	unsigned int stamp;	/* 0 unless the run is in the cache */
+	SDL_Surface *surface;	/* last rendering, see TTF_SetRenderCache() */
+	int render_mode;
+	int render_style;
+	SDL_Color fg, bg;
+} text_run;
+
+/* Text is decoded a character at a time, whatever the encoding */
+#define TEXT_LATIN1	0
+#define TEXT_UTF8	1
+#define TEXT_UNICODE	2
+
+#define UNICODE_REPLACEMENT	0xFFFD
+
+typedef struct text_reader {
+	const void *next;
+	int encoding;
+	int swapped;
+} text_reader;
+
+/* Layout state carried from one chunk of a long string to the next */
+typedef struct text_layout {
+	text_reader reader;
+	int x;
+	int shift;		/* renderers start left of the first glyph */
+	int minx, maxx;
+	FT_UInt prev_index;
+	int first;
+	int more;		/* the chunk is full and text remains */
+	text_run *run;		/* cached run, or the chunk below */
+	text_run chunk;
+	uint32_t chars[RUN_CACHE_MAXLEN];
+	int xpos[RUN_CACHE_MAXLEN];
+} text_layout;
+
+/* Paragraphs keep the decoded text, where each glyph came from and its
+   pen position in the line.  Glyph metrics and kerning are looked up
+   once, line breaking then walks those, so no glyph is measured more
+   than a few times however long the text is.
+ */
+typedef struct para_glyph {
+	int minx, maxx;
+	int advance;
+	int kerning;		/* with the glyph before it */
+} para_glyph;
+
+typedef struct para_line {
+	int first;		/* first glyph */
+	int count;		/* glyphs drawn, not the spaces it broke at */
+	int x;			/* offset for the alignment */
+	int width;		/* what TTF_SizeUTF8() reports for the line */
+	int end;		/* pen position after the last glyph */
+} para_line;
+
+/* The pen walk of Layout_Chunk() over a line of a paragraph */
+typedef struct line_pen {
+	int x;
+	int shift;
+	int minx, maxx;
+	int count;
+} line_pen;
+
+struct _TTF_Paragraph {
+	TTF_Font *font;
+	int style;
+	int lineskip;
+	int height;
+	int width;
+	int num_glyphs;
+	uint32_t *chars;
+	int *offsets;		/* bytes into the text, one more than glyphs */
+	int *xpos;
+	int num_lines;
+	int max_lines;
+	para_line *lines;
+};
+
+#define RENDER_SOLID	1
+#define RENDER_SHADED	2
+#define RENDER_BLENDED	3
+
+/* The font file bytes, shared by a font and its clones */
+typedef struct font_data {
+	int refcount;
+	FT_Byte *bytes;
+	long size;
+} font_data;
+
+/* Glyphs to load ahead of time, on the caller's thread or another */
+typedef struct precache_job {
+	struct _TTF_Font *font;
+	uint32_t first, last;
+	char *text;		/* UTF-8, or NULL for the range */
+	int style;
+	int modes;
+	int cancel;		/* set under the font lock */
+	int count;		/* glyphs loaded, -1 on error */
+	pthread_t thread;
+} precache_job;
 
 typedef struct cached_glyph {
 	int stored;
@@ -63,10 +245,19 @@ typedef struct cached_glyph {
 	int maxy;
 	int yoffset;
 	int advance;
-	uint16_t cached;
+	uint32_t cached;
+	int style;
+	FT_Bitmap sdf;
+	size_t bitmap_size;
+	size_t pixmap_size;
+	size_t sdf_size;
+	struct cached_glyph *next;	/* hash chain */
+	struct cached_glyph *newer;	/* LRU list */
+	struct cached_glyph *older;
 } c_glyph;
 
 struct _TTF_Font {
+	FT_Library library;
 	FT_Face face;
 
 	int height;
@@ -83,19 +274,90 @@ struct _TTF_Font {
 	int underline_height;
 
 	c_glyph *current;
-	c_glyph cache[256];
-	c_glyph scratch;
+	c_glyph **glyphs;
+	int num_buckets;
+	c_glyph *newest;
+	c_glyph *oldest;
+	glyph_arena arena;
+	size_t cache_budget;
+	TTF_GlyphCacheStats cache_stats;
+
+	text_run *runs;
+	unsigned int run_stamp;
+	int render_cache;
+
+	precache_job *precache;	/* background job, if any */
+
+#if TTF_USE_LOCK
+	pthread_mutex_t *lock;
+#endif
 
 	FILE *src;
 	int freesrc;
 	FT_Open_Args args;
+	font_data *data;	/* NULL until the font is cloned */
+	int ptsize;
+	long index;
 
 	int font_size_family;
 };
 
-static FT_Library library;
+/* Every font gets its own FreeType library.  FreeType keeps the raster
+   pool in the library, so fonts sharing one couldn't rasterise on two
+   threads at once, with clones or while precaching in the background.
+ */
 static int TTF_initialized = 0;
 static int TTF_byteswapped = 0;
+#if TTF_USE_LOCK
+/* Guards the font data shared between clones */
+static pthread_mutex_t TTF_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void Lock_Library( void )
+{
+#if TTF_USE_LOCK
+	pthread_mutex_lock( &TTF_lock );
+#endif
+}
+
+static void Unlock_Library( void )
+{
+#if TTF_USE_LOCK
+	pthread_mutex_unlock( &TTF_lock );
+#endif
+}
+
+static void Lock_Font( TTF_Font* font )
+{
+#if TTF_USE_LOCK
+	pthread_mutex_lock( font->lock );
+#endif
+}
+
+static void Unlock_Font( TTF_Font* font )
+{
+#if TTF_USE_LOCK
+	pthread_mutex_unlock( font->lock );
+#endif
+}
+
+#if TTF_GLYPH_LUT
+/* The 8 pixels of each bitmap byte, as 0/1 and as 0/NUM_GRAYS-1 */
+static uint8_t mono_lut[256][8];
+static uint8_t gray_lut[256][8];
+
+static void Init_Tables( void )
+{
+	int i, bit;
+
+	for ( i = 0; i < 256; ++i ) {
+		for ( bit = 0; bit < 8; ++bit ) {
+			mono_lut[i][bit] = (i >> (7 - bit)) & 1;
+			gray_lut[i][bit] = mono_lut[i][bit] ? NUM_GRAYS - 1 : 0x00;
+		}
+	}
+}
+#endif
 
 static int UNICODE_strlen(const uint16_t *text)
 {
@@ -144,19 +406,13 @@ static void TTF_SetFTError(const char *msg, FT_Error error)
 
 int TTF_Init( void )
 {
-	int status = 0;
-
 	if ( ! TTF_initialized ) {
-		FT_Error error = FT_Init_FreeType( &library );
-		if ( error ) {
-			TTF_SetFTError("Couldn't init FreeType engine", error);
-			status = -1;
-		}
-	}
-	if ( status == 0 ) {
-		++TTF_initialized;
+#if TTF_GLYPH_LUT
+		Init_Tables();
+#endif
 	}
-	return status;
+	++TTF_initialized;
+	return 0;
 }
 
 static unsigned long RWread(
@@ -176,25 +432,9 @@ static unsigned long RWread(
 	return fread(buffer, 1, (int)count, src);
 }
 
-static TTF_Font* TTF_OpenFontIndexRW(FILE *src, int freesrc, int ptsize, long index )
+static TTF_Font* New_Font( void )
 {
 	TTF_Font* font;
-	FT_Error error;
-	FT_Face face;
-	FT_Fixed scale;
-	FT_Stream stream;
-	int position;
-
-	if ( ! TTF_initialized ) {
-		fprintf(stderr, "%s\n", "Library not initialized" );
-		return NULL;
-	}
-
-	position = ftell(src);
-	if ( position < 0 ) {
-		fprintf(stderr, "%s\n", "Can't seek in stream" );
-		return NULL;
-	}
 
 	font = (TTF_Font*) malloc(sizeof *font);
 	if ( font == NULL ) {
@@ -202,43 +442,34 @@ static TTF_Font* TTF_OpenFontIndexRW(FILE *src, int freesrc, int ptsize, long in
 		return NULL;
 	}
 	memset(font, 0, sizeof(*font));
-
-	font->src = src;
-	font->freesrc = freesrc;
-
-	stream = (FT_Stream)malloc(sizeof(*stream));
-	if ( stream == NULL ) {
+#if TTF_USE_LOCK
+	font->lock = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+	if ( font->lock == NULL ) {
 		fprintf(stderr, "%s\n", "Out of memory" );
-		TTF_CloseFont( font );
+		free(font);
 		return NULL;
 	}
-	memset(stream, 0, sizeof(*stream));
-
-	stream->memory = 0; //FIXME:library->memory;
-	stream->read = RWread;
-	stream->descriptor.pointer = src;
-	stream->pos = (unsigned long)position;
-	fseek(src, 0, SEEK_END);
-	stream->size = (unsigned long)(ftell(src) - position);
-	fseek(src, position, SEEK_SET);
+	pthread_mutex_init(font->lock, NULL);
+#endif
+	return font;
+}
 
-	font->args.flags = FT_OPEN_STREAM;
-	font->args.stream = stream;
+/* Sizes the new face and works out the font metrics */
+static int Setup_Face( TTF_Font* font, int ptsize, long index )
+{
+	FT_Error error;
+	FT_Face face;
+	FT_Fixed scale;
 
-	error = FT_Open_Face( library, &font->args, index, &font->face );
-	if( error ) {
-		TTF_SetFTError( "Couldn't load font file", error );
-		TTF_CloseFont( font );
-		return NULL;
-	}
 	face = font->face;
+	font->ptsize = ptsize;
+	font->index = index;
 
 	if ( FT_IS_SCALABLE(face) ) {
 		error = FT_Set_Char_Size( font->face, 0, ptsize * 64, 0, 0 );
 		if( error ) {
 	    	TTF_SetFTError( "Couldn't set font size", error );
-	    	TTF_CloseFont( font );
-	    	return NULL;
+	    	return -1;
 		}
 
 		scale = face->size->metrics.y_scale;
@@ -279,10 +510,75 @@ static TTF_Font* TTF_OpenFontIndexRW(FILE *src, int freesrc, int ptsize, long in
 #endif
 
 	font->style = TTF_STYLE_NORMAL;
+	font->cache_budget = GLYPH_CACHE_BUDGET;
 	font->glyph_overhang = face->size->metrics.y_ppem / 10;
 	font->glyph_italics = 0.207f;
 	font->glyph_italics *= font->height;
 
+	return 0;
+}
+
+static TTF_Font* TTF_OpenFontIndexRW(FILE *src, int freesrc, int ptsize, long index )
+{
+	TTF_Font* font;
+	FT_Error error;
+	FT_Stream stream;
+	int position;
+
+	if ( ! TTF_initialized ) {
+		fprintf(stderr, "%s\n", "Library not initialized" );
+		return NULL;
+	}
+
+	position = ftell(src);
+	if ( position < 0 ) {
+		fprintf(stderr, "%s\n", "Can't seek in stream" );
+		return NULL;
+	}
+
+	font = New_Font();
+	if ( font == NULL ) {
+		return NULL;
+	}
+
+	font->src = src;
+	font->freesrc = freesrc;
+
+	stream = (FT_Stream)malloc(sizeof(*stream));
+	if ( stream == NULL ) {
+		fprintf(stderr, "%s\n", "Out of memory" );
+		TTF_CloseFont( font );
+		return NULL;
+	}
+	memset(stream, 0, sizeof(*stream));
+
+	stream->memory = 0; //FIXME:library->memory;
+	stream->read = RWread;
+	stream->descriptor.pointer = src;
+	stream->pos = (unsigned long)position;
+	fseek(src, 0, SEEK_END);
+	stream->size = (unsigned long)(ftell(src) - position);
+	fseek(src, position, SEEK_SET);
+
+	font->args.flags = FT_OPEN_STREAM;
+	font->args.stream = stream;
+
+	error = FT_Init_FreeType( &font->library );
+	if ( error ) {
+		TTF_SetFTError( "Couldn't init FreeType engine", error );
+		TTF_CloseFont( font );
+		return NULL;
+	}
+	error = FT_Open_Face( font->library, &font->args, index, &font->face );
+	if( error ) {
+		TTF_SetFTError( "Couldn't load font file", error );
+		TTF_CloseFont( font );
+		return NULL;
+	}
+	if ( Setup_Face( font, ptsize, index ) < 0 ) {
+		TTF_CloseFont( font );
+		return NULL;
+	}
 	return font;
 }
 
@@ -306,62 +602,496 @@ TTF_Font* TTF_OpenFont( const char *file, int ptsize )
 	return TTF_OpenFontIndex(file, ptsize, 0);
 }
 
-static void Flush_Glyph( c_glyph* glyph )
+static int Arena_Class( size_t size )
+{
+	int n = 0;
+
+	size = (size - 1) >> GLYPH_MIN_CLASS;
+	while ( size ) {
+		size >>= 1;
+		++n;
+	}
+	return n;
+}
+
+static void* Arena_Alloc( glyph_arena* arena, size_t size )
+{
+	glyph_block* block;
+	int n = Arena_Class( size );
+
+	if ( n >= GLYPH_NUM_CLASSES ) {
+		glyph_large* large;
+
+		large = (glyph_large*)malloc( sizeof(*large) + size );
+		if ( !large ) {
+			return NULL;
+		}
+		large->prev = NULL;
+		large->next = arena->large;
+		if ( arena->large ) {
+			arena->large->prev = large;
+		}
+		arena->large = large;
+		return large + 1;
+	}
+	if ( !arena->freelist[n] ) {
+		size_t blocksize = (size_t)1 << (GLYPH_MIN_CLASS + n);
+		glyph_slab* slab;
+		uint8_t* p;
+		int i;
+
+		slab = (glyph_slab*)malloc( sizeof(*slab) + GLYPH_SLAB_SIZE );
+		if ( !slab ) {
+			return NULL;
+		}
+		slab->next = arena->slabs;
+		arena->slabs = slab;
+		p = (uint8_t*)(slab + 1);
+		for ( i = GLYPH_SLAB_SIZE / blocksize; i > 0; --i ) {
+			block = (glyph_block*)p;
+			block->next = arena->freelist[n];
+			arena->freelist[n] = block;
+			p += blocksize;
+		}
+	}
+	block = arena->freelist[n];
+	arena->freelist[n] = block->next;
+	return block;
+}
+
+static void Arena_Free( glyph_arena* arena, void* p, size_t size )
+{
+	glyph_block* block = (glyph_block*)p;
+	int n = Arena_Class( size );
+
+	if ( n >= GLYPH_NUM_CLASSES ) {
+		glyph_large* large = (glyph_large*)p - 1;
+
+		if ( large->prev ) {
+			large->prev->next = large->next;
+		} else {
+			arena->large = large->next;
+		}
+		if ( large->next ) {
+			large->next->prev = large->prev;
+		}
+		free( large );
+		return;
+	}
+	block->next = arena->freelist[n];
+	arena->freelist[n] = block;
+}
+
+static void Arena_Reset( glyph_arena* arena )
+{
+	glyph_slab* slab;
+	glyph_large* large;
+
+	while ( (slab = arena->slabs) != NULL ) {
+		arena->slabs = slab->next;
+		free( slab );
+	}
+	while ( (large = arena->large) != NULL ) {
+		arena->large = large->next;
+		free( large );
+	}
+	memset( arena, 0, sizeof(*arena) );
+}
+
+/* Bytes a glyph is charged against the cache budget */
+static size_t Glyph_Cost( size_t size )
+{
+	if ( Arena_Class( size ) >= GLYPH_NUM_CLASSES ) {
+		return size;
+	}
+	return (size_t)1 << (GLYPH_MIN_CLASS + Arena_Class( size ));
+}
+
+static void Flush_Glyph( TTF_Font* font, c_glyph* glyph )
 {
 	glyph->stored = 0;
 	glyph->index = 0;
 	if( glyph->bitmap.buffer ) {
-		free( glyph->bitmap.buffer );
+		Arena_Free( &font->arena, glyph->bitmap.buffer, glyph->bitmap_size );
+		font->cache_stats.bytes -= Glyph_Cost( glyph->bitmap_size );
 		glyph->bitmap.buffer = 0;
 	}
 	if( glyph->pixmap.buffer ) {
-		free( glyph->pixmap.buffer );
+		Arena_Free( &font->arena, glyph->pixmap.buffer, glyph->pixmap_size );
+		font->cache_stats.bytes -= Glyph_Cost( glyph->pixmap_size );
 		glyph->pixmap.buffer = 0;
 	}
+	if( glyph->sdf.buffer ) {
+		Arena_Free( &font->arena, glyph->sdf.buffer, glyph->sdf_size );
+		font->cache_stats.bytes -= Glyph_Cost( glyph->sdf_size );
+		glyph->sdf.buffer = 0;
+	}
 	glyph->cached = 0;
 }
-	
+
+static void Unlink_Glyph( TTF_Font* font, c_glyph* glyph )
+{
+	if ( glyph->newer ) {
+		glyph->newer->older = glyph->older;
+	} else {
+		font->newest = glyph->older;
+	}
+	if ( glyph->older ) {
+		glyph->older->newer = glyph->newer;
+	} else {
+		font->oldest = glyph->newer;
+	}
+	glyph->newer = glyph->older = NULL;
+}
+
+static void Touch_Glyph( TTF_Font* font, c_glyph* glyph )
+{
+	if ( font->newest == glyph ) {
+		return;
+	}
+	if ( glyph->newer || glyph->older || font->oldest == glyph ) {
+		Unlink_Glyph( font, glyph );
+	}
+	glyph->older = font->newest;
+	if ( font->newest ) {
+		font->newest->newer = glyph;
+	}
+	font->newest = glyph;
+	if ( !font->oldest ) {
+		font->oldest = glyph;
+	}
+}
+
+static unsigned int Hash_Glyph( uint32_t ch, int style )
+{
+	return ((unsigned int)ch * 2654435761U) ^ (unsigned int)style;
+}
+
+static void Remove_Glyph( TTF_Font* font, c_glyph* glyph )
+{
+	c_glyph** prev;
+
+	prev = &font->glyphs[Hash_Glyph(glyph->cached, glyph->style) &
+	                     (font->num_buckets - 1)];
+	while ( *prev != glyph ) {
+		prev = &(*prev)->next;
+	}
+	*prev = glyph->next;
+	Unlink_Glyph( font, glyph );
+	Flush_Glyph( font, glyph );
+	Arena_Free( &font->arena, glyph, sizeof(*glyph) );
+	font->cache_stats.bytes -= Glyph_Cost( sizeof(*glyph) );
+	--font->cache_stats.glyphs;
+}
+
+/* Drop the least recently used glyphs, but never the one in use */
+static void Trim_Cache( TTF_Font* font, size_t budget )
+{
+	while ( font->cache_stats.bytes > budget &&
+	        font->oldest && font->oldest != font->current ) {
+		Remove_Glyph( font, font->oldest );
+		++font->cache_stats.evictions;
+	}
+}
+
 static void Flush_Cache( TTF_Font* font )
 {
+	font->current = NULL;
+	if ( font->glyphs ) {
+		free( font->glyphs );
+		font->glyphs = NULL;
+	}
+	font->num_buckets = 0;
+	font->newest = font->oldest = NULL;
+	Arena_Reset( &font->arena );
+	font->cache_stats.glyphs = 0;
+	font->cache_stats.bytes = 0;
+}
+
+static int Grow_Cache( TTF_Font* font )
+{
+	c_glyph** glyphs;
+	c_glyph* glyph;
+	c_glyph* next;
+	int num_buckets;
 	int i;
-	int size = sizeof( font->cache ) / sizeof( font->cache[0] );
 
-	for( i = 0; i < size; ++i ) {
-		if( font->cache[i].cached ) {
-			Flush_Glyph( &font->cache[i] );
+	num_buckets = font->num_buckets ? font->num_buckets * 2 : GLYPH_CACHE_BUCKETS;
+	glyphs = (c_glyph**)malloc( num_buckets * sizeof(*glyphs) );
+	if ( !glyphs ) {
+		return -1;
+	}
+	memset( glyphs, 0, num_buckets * sizeof(*glyphs) );
+	for ( i = 0; i < font->num_buckets; ++i ) {
+		for ( glyph = font->glyphs[i]; glyph; glyph = next ) {
+			int bucket = Hash_Glyph(glyph->cached, glyph->style) & (num_buckets - 1);
+			next = glyph->next;
+			glyph->next = glyphs[bucket];
+			glyphs[bucket] = glyph;
 		}
-
 	}
-	if( font->scratch.cached ) {
-		Flush_Glyph( &font->scratch );
+	if ( font->glyphs ) {
+		free( font->glyphs );
 	}
-
+	font->glyphs = glyphs;
+	font->num_buckets = num_buckets;
+	return 0;
 }
 
-static FT_Error Load_Glyph( TTF_Font* font, uint16_t ch, c_glyph* cached, int want )
+/* One pass of the 8-point sequential Euclidean distance transform.
+   Each cell holds the offset to the nearest seed, and takes over its
+   neighbour's seed when that one is closer.
+ */
+static void SDF_Compare( int* grid, int w, int h, int x, int y, int ox, int oy )
 {
-	FT_Face face;
-	FT_Error error;
-	FT_GlyphSlot glyph;
-	FT_Glyph_Metrics* metrics;
-	FT_Outline* outline;
+	int* p = grid + 2 * (y * w + x);
+	int* q;
+	int dx, dy;
 
-	if ( !font || !font->face ) {
-		return FT_Err_Invalid_Handle;
+	if ( x + ox < 0 || x + ox >= w || y + oy < 0 || y + oy >= h ) {
+		return;
 	}
+	q = grid + 2 * ((y + oy) * w + x + ox);
+	dx = q[0] + ox;
+	dy = q[1] + oy;
+	if ( dx * dx + dy * dy < p[0] * p[0] + p[1] * p[1] ) {
+		p[0] = dx;
+		p[1] = dy;
+	}
+}
 
-	face = font->face;
+static void SDF_Sweep( int* grid, int w, int h )
+{
+	int x, y;
 
-	if ( ! cached->index ) {
-		cached->index = FT_Get_Char_Index( face, ch );
+	for ( y = 0; y < h; ++y ) {
+		for ( x = 0; x < w; ++x ) {
+			SDF_Compare( grid, w, h, x, y, -1, 0 );
+			SDF_Compare( grid, w, h, x, y, 0, -1 );
+			SDF_Compare( grid, w, h, x, y, -1, -1 );
+			SDF_Compare( grid, w, h, x, y, 1, -1 );
+		}
+		for ( x = w - 1; x >= 0; --x ) {
+			SDF_Compare( grid, w, h, x, y, 1, 0 );
+		}
 	}
-	error = FT_Load_Glyph( face, cached->index, FT_LOAD_DEFAULT | FT_LOAD_NO_BITMAP ); //FIXME:FT_LOAD_DEFAULT
-	if( error ) {
-		return error;
+	for ( y = h - 1; y >= 0; --y ) {
+		for ( x = w - 1; x >= 0; --x ) {
+			SDF_Compare( grid, w, h, x, y, 1, 0 );
+			SDF_Compare( grid, w, h, x, y, 0, 1 );
+			SDF_Compare( grid, w, h, x, y, -1, 1 );
+			SDF_Compare( grid, w, h, x, y, 1, 1 );
+		}
+		for ( x = 0; x < w; ++x ) {
+			SDF_Compare( grid, w, h, x, y, -1, 0 );
+		}
 	}
+}
 
-	glyph = face->glyph;
-	metrics = &glyph->metrics;
+static FT_Error Make_SDF( TTF_Font* font, c_glyph* cached )
+{
+	FT_Bitmap* src = &cached->pixmap;
+	FT_Bitmap* dst = &cached->sdf;
+	int *inside, *outside;
+	int width, w, h, x, y, i;
+	size_t size;
+
+	/* Same clipping as the Blended renderer */
+	width = src->width;
+	if ( width > cached->maxx - cached->minx ) {
+		width = cached->maxx - cached->minx;
+	}
+	memset( dst, 0, sizeof(*dst) );
+	if ( src->rows == 0 || width <= 0 ) {
+		return 0;
+	}
+	w = width + 2 * SDF_SPREAD;
+	h = src->rows + 2 * SDF_SPREAD;
+
+	/* inside: offset to the nearest pixel in the glyph,
+	   outside: offset to the nearest one out of it */
+	inside = (int*)malloc( 4 * sizeof(int) * w * h );
+	if ( !inside ) {
+		return FT_Err_Out_Of_Memory;
+	}
+	outside = inside + 2 * w * h;
+	for ( y = 0; y < h; ++y ) {
+		for ( x = 0; x < w; ++x ) {
+			int sx = x - SDF_SPREAD, sy = y - SDF_SPREAD;
+			int in = 0;
+
+			if ( sx >= 0 && sx < width && sy >= 0 && sy < src->rows ) {
+				in = src->buffer[sy * src->pitch + sx] >= 128;
+			}
+			i = 2 * (y * w + x);
+			inside[i] = inside[i+1] = in ? 0 : SDF_FAR;
+			outside[i] = outside[i+1] = in ? SDF_FAR : 0;
+		}
+	}
+	SDF_Sweep( inside, w, h );
+	SDF_Sweep( outside, w, h );
+
+	size = w * h;
+	dst->buffer = (unsigned char *)Arena_Alloc( &font->arena, size );
+	if ( !dst->buffer ) {
+		free( inside );
+		return FT_Err_Out_Of_Memory;
+	}
+	dst->width = dst->pitch = w;
+	dst->rows = h;
+	cached->sdf_size = size;
+	font->cache_stats.bytes += Glyph_Cost( size );
+
+	for ( y = 0; y < h; ++y ) {
+		for ( x = 0; x < w; ++x ) {
+			int sx = x - SDF_SPREAD, sy = y - SDF_SPREAD;
+			double d;
+			int v;
+
+			i = 2 * (y * w + x);
+			d = sqrt( (double)(outside[i] * outside[i] + outside[i+1] * outside[i+1]) ) -
+			    sqrt( (double)(inside[i] * inside[i] + inside[i+1] * inside[i+1]) );
+			/* Distances are between pixel centres, the outline runs
+			   half way, or where the antialiasing puts it */
+			if ( d > 0 ) {
+				d -= 0.5;
+			} else {
+				d += 0.5;
+			}
+			if ( d > -1 && d < 1 &&
+			     sx >= 0 && sx < width && sy >= 0 && sy < src->rows ) {
+				int c = src->buffer[sy * src->pitch + sx];
+				if ( c > 0 && c < NUM_GRAYS - 1 ) {
+					d = (c - 127.5) / 255.0;
+				}
+			}
+			v = (int)floor( 127.5 + d * 127.5 / SDF_SPREAD + 0.5 );
+			if ( v < 0 ) {
+				v = 0;
+			} else if ( v > 255 ) {
+				v = 255;
+			}
+			dst->buffer[y * w + x] = (unsigned char)v;
+		}
+	}
+	free( inside );
+	return 0;
+}
+
+/* One row of a 1-bit bitmap to a byte per pixel, 0/1 for mono glyphs or
+   0/NUM_GRAYS-1 for the pixmap of a bitmap font.  Whole source bytes are
+   expanded, the destination pitch leaves room for that.
+ */
+static void Expand_Bits( uint8_t* dstp, const uint8_t* srcp, int width, int mono )
+{
+	int j;
+#if TTF_GLYPH_LUT
+	const uint8_t (*lut)[8] = mono ? mono_lut : gray_lut;
+
+	for ( j = 0; j < width; j += 8 ) {
+		memcpy( dstp, lut[*srcp++], 8 );
+		dstp += 8;
+	}
+#else
+	if ( mono ) {
+		for ( j = 0; j < width; j += 8 ) {
+			unsigned char ch = *srcp++;
+			*dstp++ = (ch&0x80) >> 7;
+			ch <<= 1;
+			*dstp++ = (ch&0x80) >> 7;
+			ch <<= 1;
+			*dstp++ = (ch&0x80) >> 7;
+			ch <<= 1;
+			*dstp++ = (ch&0x80) >> 7;
+			ch <<= 1;
+			*dstp++ = (ch&0x80) >> 7;
+			ch <<= 1;
+			*dstp++ = (ch&0x80) >> 7;
+			ch <<= 1;
+			*dstp++ = (ch&0x80) >> 7;
+			ch <<= 1;
+			*dstp++ = (ch&0x80) >> 7;
+		}
+	} else {
+		unsigned char ch;
+		int k;
+		for ( j = 0; j < width; j += 8) {
+			ch = *srcp++;
+			for (k = 0; k < 8; ++k) {
+				if ((ch&0x80) >> 7) {
+					*dstp++ = NUM_GRAYS - 1;
+				} else {
+					*dstp++ = 0x00;
+				}
+				ch <<= 1;
+			}
+		}
+	}
+#endif
+}
+
+/* The bold style: each pass adds every pixel's left neighbour to it,
+   saturating.  Columns are independent within a pass as long as they
+   are done right to left, so SSE2 does 16 at a time.
+ */
+static void Bold_Row( uint8_t* pixmap, int width, int passes )
+{
+	int col;
+	int pixel;
+#if TTF_GLYPH_LUT && SDL_SSE2_INTRINSICS
+	int sse2 = SDL_HasSSE2();
+#endif
+
+	for( ; passes > 0; --passes ) {
+		col = width - 1;
+#if TTF_GLYPH_LUT && SDL_SSE2_INTRINSICS
+		if ( sse2 ) {
+			for( ; col >= 16; col -= 16 ) {
+				__m128i a = _mm_loadu_si128( (const __m128i*)(pixmap + col - 15) );
+				__m128i b = _mm_loadu_si128( (const __m128i*)(pixmap + col - 16) );
+				_mm_storeu_si128( (__m128i*)(pixmap + col - 15), _mm_adds_epu8( a, b ) );
+			}
+		}
+#endif
+		for( ; col > 0; --col ) {
+			pixel = (pixmap[col] + pixmap[col-1]);
+			if( pixel > NUM_GRAYS - 1 ) {
+				pixel = NUM_GRAYS - 1;
+			}
+			pixmap[col] = (uint8_t) pixel;
+		}
+	}
+}
+
+static FT_Error Load_Glyph( TTF_Font* font, uint32_t ch, c_glyph* cached, int want )
+{
+	FT_Face face;
+	FT_Error error;
+	FT_GlyphSlot glyph;
+	FT_Glyph_Metrics* metrics;
+	FT_Outline* outline;
+
+	if ( !font || !font->face ) {
+		return FT_Err_Invalid_Handle;
+	}
+
+	face = font->face;
+
+	/* The distance field is made from the pixmap */
+	if ( (want & CACHED_SDF) && !(cached->stored & CACHED_SDF) ) {
+		want |= CACHED_PIXMAP;
+	}
+
+	if ( ! cached->index ) {
+		cached->index = FT_Get_Char_Index( face, ch );
+	}
+	error = FT_Load_Glyph( face, cached->index, FT_LOAD_DEFAULT | FT_LOAD_NO_BITMAP ); //FIXME:FT_LOAD_DEFAULT
+	if( error ) {
+		return error;
+	}
+
+	glyph = face->glyph;
+	metrics = &glyph->metrics;
 	outline = &glyph->outline;
 
 	if ( (want & CACHED_METRICS) && !(cached->stored & CACHED_METRICS) ) {
@@ -381,10 +1111,10 @@ static FT_Error Load_Glyph( TTF_Font* font, uint16_t ch, c_glyph* cached, int wa
 			cached->advance = FT_CEIL(metrics->horiAdvance);
 		}
 		
-		if( font->style & TTF_STYLE_BOLD ) {
+		if( cached->style & TTF_STYLE_BOLD ) {
 			cached->maxx += font->glyph_overhang;
 		}
-		if( font->style & TTF_STYLE_ITALIC ) {
+		if( cached->style & TTF_STYLE_ITALIC ) {
 			cached->maxx += (int)ceil(font->glyph_italics);
 		}
 		cached->stored |= CACHED_METRICS;
@@ -397,7 +1127,7 @@ static FT_Error Load_Glyph( TTF_Font* font, uint16_t ch, c_glyph* cached, int wa
 		FT_Bitmap* src;
 		FT_Bitmap* dst;
 
-		if( font->style & TTF_STYLE_ITALIC ) {
+		if( cached->style & TTF_STYLE_ITALIC ) {
 			FT_Matrix shear;
 
 			shear.xx = 1 << 16;
@@ -429,65 +1159,40 @@ static FT_Error Load_Glyph( TTF_Font* font, uint16_t ch, c_glyph* cached, int wa
 			dst->pitch *= 8;
 		}
 
-		if( font->style & TTF_STYLE_BOLD ) {
+		if( cached->style & TTF_STYLE_BOLD ) {
 			int bump = font->glyph_overhang;
 			dst->pitch += bump;
 			dst->width += bump;
 		}
-		if( font->style & TTF_STYLE_ITALIC ) {
+		if( cached->style & TTF_STYLE_ITALIC ) {
 			int bump = (int)ceil(font->glyph_italics);
 			dst->pitch += bump;
 			dst->width += bump;
 		}
 
 		if (dst->rows != 0) {
-			dst->buffer = (unsigned char *)malloc( dst->pitch * dst->rows );
+			size_t size = dst->pitch * dst->rows;
+
+			dst->buffer = (unsigned char *)Arena_Alloc( &font->arena, size );
 			if( !dst->buffer ) {
 				return FT_Err_Out_Of_Memory;
 			}
+			if ( mono ) {
+				cached->bitmap_size = size;
+			} else {
+				cached->pixmap_size = size;
+			}
+			font->cache_stats.bytes += Glyph_Cost( size );
 			memset( dst->buffer, 0, dst->pitch * dst->rows );
 
-			for( i = 0; i < src->rows; i++ ) {
+			if ( !mono && FT_IS_SCALABLE(face) && src->pitch == dst->pitch ) {
+				memcpy( dst->buffer, src->buffer, src->pitch * src->rows );
+			} else for( i = 0; i < src->rows; i++ ) {
 				int soffset = i * src->pitch;
 				int doffset = i * dst->pitch;
-				if ( mono ) {
-					unsigned char *srcp = src->buffer + soffset;
-					unsigned char *dstp = dst->buffer + doffset;
-					int j;
-					for ( j = 0; j < src->width; j += 8 ) {
-						unsigned char ch = *srcp++;
-						*dstp++ = (ch&0x80) >> 7;
-						ch <<= 1;
-						*dstp++ = (ch&0x80) >> 7;
-						ch <<= 1;
-						*dstp++ = (ch&0x80) >> 7;
-						ch <<= 1;
-						*dstp++ = (ch&0x80) >> 7;
-						ch <<= 1;
-						*dstp++ = (ch&0x80) >> 7;
-						ch <<= 1;
-						*dstp++ = (ch&0x80) >> 7;
-						ch <<= 1;
-						*dstp++ = (ch&0x80) >> 7;
-						ch <<= 1;
-						*dstp++ = (ch&0x80) >> 7;
-					}
-				} else if ( !FT_IS_SCALABLE(face) ) {
-					unsigned char *srcp = src->buffer + soffset;
-					unsigned char *dstp = dst->buffer + doffset;
-					unsigned char ch;
-					int j, k;
-					for ( j = 0; j < src->width; j += 8) {
-						ch = *srcp++;
-						for (k = 0; k < 8; ++k) {
-							if ((ch&0x80) >> 7) {
-								*dstp++ = NUM_GRAYS - 1;
-							} else {
-								*dstp++ = 0x00;
-							}
-							ch <<= 1;
-						}
-					}
+				if ( mono || !FT_IS_SCALABLE(face) ) {
+					Expand_Bits( dst->buffer + doffset, src->buffer + soffset,
+					             src->width, mono );
 				} else {
 					memcpy(dst->buffer+doffset,
 					       src->buffer+soffset, src->pitch);
@@ -495,24 +1200,12 @@ static FT_Error Load_Glyph( TTF_Font* font, uint16_t ch, c_glyph* cached, int wa
 			}
 		}
 
-		if ( font->style & TTF_STYLE_BOLD ) {
+		if ( cached->style & TTF_STYLE_BOLD ) {
 			int row;
-			int col;
-			int offset;
-			int pixel;
-			uint8_t* pixmap;
 
 			for( row = dst->rows - 1; row >= 0; --row ) {
-				pixmap = (uint8_t*) dst->buffer + row * dst->pitch;
-				for( offset=1; offset <= font->glyph_overhang; ++offset ) {
-					for( col = dst->width - 1; col > 0; --col ) {
-						pixel = (pixmap[col] + pixmap[col-1]);
-						if( pixel > NUM_GRAYS - 1 ) {
-							pixel = NUM_GRAYS - 1;
-						}
-						pixmap[col] = (uint8_t) pixel;
-					}
-				}
+				Bold_Row( (uint8_t*) dst->buffer + row * dst->pitch,
+				          dst->width, font->glyph_overhang );
 			}
 		}
 
@@ -523,83 +1216,596 @@ static FT_Error Load_Glyph( TTF_Font* font, uint16_t ch, c_glyph* cached, int wa
 		}
 	}
 
+	if ( (want & CACHED_SDF) && !(cached->stored & CACHED_SDF) &&
+	     (cached->stored & CACHED_PIXMAP) ) {
+		error = Make_SDF( font, cached );
+		if( error ) {
+			return error;
+		}
+		cached->stored |= CACHED_SDF;
+	}
+
 	cached->cached = ch;
 
 	return 0;
 }
 
-static FT_Error Find_Glyph( TTF_Font* font, uint16_t ch, int want )
+static FT_Error Find_Glyph( TTF_Font* font, uint32_t ch, int want )
 {
 	int retval = 0;
+	int style = font->style & GLYPH_STYLE_MASK;
+	unsigned int hash = Hash_Glyph( ch, style );
+	c_glyph* glyph = NULL;
 
-	if( ch < 256 ) {
-		font->current = &font->cache[ch];
-	} else {
-		if ( font->scratch.cached != ch ) {
-			Flush_Glyph( &font->scratch );
+	if ( font->glyphs ) {
+		glyph = font->glyphs[hash & (font->num_buckets - 1)];
+		while ( glyph && (glyph->cached != ch || glyph->style != style) ) {
+			glyph = glyph->next;
 		}
-		font->current = &font->scratch;
 	}
-	if ( (font->current->stored & want) != want ) {
-		retval = Load_Glyph( font, ch, font->current, want );
+	if ( glyph && (glyph->stored & want) == want ) {
+		++font->cache_stats.hits;
+	} else {
+		++font->cache_stats.misses;
+	}
+	if ( !glyph ) {
+		if ( font->cache_stats.glyphs >= font->num_buckets &&
+		     Grow_Cache( font ) < 0 && !font->glyphs ) {
+			return FT_Err_Out_Of_Memory;
+		}
+		glyph = (c_glyph*)Arena_Alloc( &font->arena, sizeof(*glyph) );
+		if ( !glyph ) {
+			return FT_Err_Out_Of_Memory;
+		}
+		memset( glyph, 0, sizeof(*glyph) );
+		glyph->cached = ch;
+		glyph->style = style;
+		glyph->next = font->glyphs[hash & (font->num_buckets - 1)];
+		font->glyphs[hash & (font->num_buckets - 1)] = glyph;
+		font->cache_stats.bytes += Glyph_Cost( sizeof(*glyph) );
+		++font->cache_stats.glyphs;
+	}
+	Touch_Glyph( font, glyph );
+	font->current = glyph;
+	if ( (glyph->stored & want) != want ) {
+		retval = Load_Glyph( font, ch, glyph, want );
+		Trim_Cache( font, font->cache_budget );
 	}
 	return retval;
 }
 
+static void Flush_Runs( TTF_Font* font )
+{
+	int i;
+
+	if ( font->runs ) {
+		for ( i = 0; i < RUN_CACHE_SLOTS; ++i ) {
+			if ( font->runs[i].surface ) {
+				SDL_FreeSurface( font->runs[i].surface );
+			}
+		}
+		free( font->runs );
+		font->runs = NULL;
+	}
+}
+
+static int Open_Runs( TTF_Font* font )
+{
+	size_t size;
+	uint8_t* p;
+	int i;
+
+	if ( font->runs ) {
+		return 0;
+	}
+	/* One block: the slots, then the glyph and position arrays */
+	size = RUN_CACHE_SLOTS * (sizeof(text_run) +
+	       RUN_CACHE_MAXLEN * (sizeof(uint32_t) + sizeof(int)));
+	p = (uint8_t*)malloc( size );
+	if ( !p ) {
+		return -1;
+	}
+	memset( p, 0, size );
+	font->runs = (text_run*)p;
+	p += RUN_CACHE_SLOTS * sizeof(text_run);
+	for ( i = 0; i < RUN_CACHE_SLOTS; ++i ) {
+		font->runs[i].chars = (uint32_t*)p;
+		p += RUN_CACHE_MAXLEN * sizeof(uint32_t);
+		font->runs[i].xpos = (int*)p;
+		p += RUN_CACHE_MAXLEN * sizeof(int);
+	}
+	return 0;
+}
+
+static void Start_Text( text_reader* reader, const void* text, int encoding )
+{
+	reader->next = text;
+	reader->encoding = encoding;
+	reader->swapped = TTF_byteswapped;
+}
+
+static uint32_t UTF8_getch( const uint8_t** src )
+{
+	const uint8_t* p = *src;
+	uint32_t ch = *p++;
+	uint32_t min = 0;
+	int left = 0;
+
+	if ( ch >= 0xF8 || (ch >= 0x80 && ch < 0xC0) ) {
+		*src = p;
+		return UNICODE_REPLACEMENT;
+	}
+	if ( ch >= 0xF0 ) {
+		ch &= 0x07;
+		left = 3;
+		min = 0x10000;
+	} else if ( ch >= 0xE0 ) {
+		ch &= 0x0F;
+		left = 2;
+		min = 0x800;
+	} else if ( ch >= 0xC0 ) {
+		ch &= 0x1F;
+		left = 1;
+		min = 0x80;
+	}
+	/* Stops at the terminating NUL, which isn't a continuation byte */
+	while ( left > 0 && (*p & 0xC0) == 0x80 ) {
+		ch = (ch << 6) | (*p++ & 0x3F);
+		--left;
+	}
+	*src = p;
+	if ( left > 0 || ch < min || ch > 0x10FFFF ||
+	     (ch >= 0xD800 && ch <= 0xDFFF) ) {
+		return UNICODE_REPLACEMENT;
+	}
+	return ch;
+}
+
+/* Returns the next code point, or 0 at the end of the text */
+static uint32_t Read_Char( text_reader* reader )
+{
+	const uint8_t* p;
+	const uint16_t* q;
+	uint32_t ch;
+	uint16_t lo;
+
+	switch ( reader->encoding ) {
+	case TEXT_LATIN1:
+		p = (const uint8_t*)reader->next;
+		ch = *p;
+		if ( ch ) {
+			reader->next = p + 1;
+		}
+		return ch;
+
+	case TEXT_UTF8:
+		p = (const uint8_t*)reader->next;
+		if ( !*p ) {
+			return 0;
+		}
+		ch = UTF8_getch( &p );
+		reader->next = p;
+		return ch;
+
+	default:
+		q = (const uint16_t*)reader->next;
+		for ( ; ; ) {
+			ch = *q;
+			if ( !ch ) {
+				reader->next = q;
+				return 0;
+			}
+			++q;
+			if ( ch == UNICODE_BOM_NATIVE ) {
+				reader->swapped = 0;
+				continue;
+			}
+			if ( ch == UNICODE_BOM_SWAPPED ) {
+				reader->swapped = 1;
+				continue;
+			}
+			break;
+		}
+		if ( reader->swapped ) {
+			ch = SDL_Swap16((uint16_t)ch);
+		}
+		if ( ch >= 0xD800 && ch <= 0xDFFF ) {
+			/* Surrogate pair, anything unpaired is replaced */
+			lo = *q;
+			if ( reader->swapped ) {
+				lo = SDL_Swap16(lo);
+			}
+			if ( ch < 0xDC00 && lo >= 0xDC00 && lo <= 0xDFFF ) {
+				ch = 0x10000 + ((ch - 0xD800) << 10) + (lo - 0xDC00);
+				++q;
+			} else {
+				ch = UNICODE_REPLACEMENT;
+			}
+		}
+		reader->next = q;
+		return ch;
+	}
+}
+
+static void Start_Layout( text_layout* layout, const void* text, int encoding )
+{
+	Start_Text( &layout->reader, text, encoding );
+	layout->x = 0;
+	layout->shift = 0;
+	layout->minx = layout->maxx = 0;
+	layout->prev_index = 0;
+	layout->first = 1;
+	layout->more = 0;
+	layout->chunk.chars = layout->chars;
+	layout->chunk.xpos = layout->xpos;
+	layout->chunk.stamp = 0;
+	layout->chunk.surface = NULL;
+}
+
+/* The pen walk of TTF_SizeUNICODE() over as many glyphs as fit in the
+   run, the positions are shifted the way the renderers shift them when
+   the first glyph starts left of the pen.
+ */
+static int Layout_Chunk( TTF_Font* font, text_layout* layout, text_run* run )
+{
+	text_reader next;
+	uint32_t c;
+	int x, z;
+	c_glyph *glyph;
+	FT_Error error;
+	FT_Long use_kerning;
+
+	use_kerning = FT_HAS_KERNING( font->face );
+
+	x = layout->x;
+	run->num_glyphs = 0;
+	layout->more = 0;
+	for ( ; ; ) {
+		if ( run->num_glyphs == RUN_CACHE_MAXLEN ) {
+			next = layout->reader;
+			layout->more = Read_Char( &next ) != 0;
+			break;
+		}
+		c = Read_Char( &layout->reader );
+		if ( !c ) {
+			break;
+		}
+
+		error = Find_Glyph(font, c, CACHED_METRICS);
+		if ( error ) {
+			return -1;
+		}
+		glyph = font->current;
+
+		if ( use_kerning && layout->prev_index && glyph->index ) {
+			FT_Vector delta; 
+			FT_Get_Kerning( font->face, layout->prev_index, glyph->index, ft_kerning_default, &delta ); 
+			x += delta.x >> 6;
+		}
+		if ( layout->first && glyph->minx < 0 ) {
+			layout->shift = -glyph->minx;
+		}
+		layout->first = 0;
+		run->chars[run->num_glyphs] = c;
+		run->xpos[run->num_glyphs] = x + layout->shift;
+		++run->num_glyphs;
+		
+		z = x + glyph->minx;
+		if ( layout->minx > z ) {
+			layout->minx = z;
+		}
+		if ( font->style & TTF_STYLE_BOLD ) {
+			x += font->glyph_overhang;
+		}
+		if ( glyph->advance > glyph->maxx ) {
+			z = x + glyph->advance;
+		} else {
+			z = x + glyph->maxx;
+		}
+		if ( layout->maxx < z ) {
+			layout->maxx = z;
+		}
+		x += glyph->advance;
+		layout->prev_index = glyph->index;
+	}
+	layout->x = x;
+	run->width = layout->maxx - layout->minx;
+	return 0;
+}
+
+static int Same_Text( text_run* run, const void* text, int encoding )
+{
+	text_reader reader;
+	int i;
+
+	Start_Text( &reader, text, encoding );
+	for ( i = 0; i < run->num_glyphs; ++i ) {
+		if ( Read_Char( &reader ) != run->chars[i] ) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Finds the text in the run cache or lays it out, layout->run is the
+   first (for cached text, only) chunk of glyphs to draw.
+ */
+static int Layout_Text( TTF_Font* font, text_layout* layout,
+	const void* text, int encoding )
+{
+	uint32_t hash = 2166136261U;
+	int style = font->style & GLYPH_STYLE_MASK;
+	text_reader reader;
+	text_run *run, *oldest;
+	uint32_t c;
+	int count, width, i;
+
+	Start_Text( &reader, text, encoding );
+	for ( count = 0; (c = Read_Char( &reader )) != 0; ++count ) {
+		hash ^= c;
+		hash *= 16777619U;
+	}
+	Start_Layout( layout, text, encoding );
+
+	if ( count <= RUN_CACHE_MAXLEN && Open_Runs( font ) == 0 ) {
+		oldest = NULL;
+		for ( i = 0; i < RUN_CACHE_SLOTS; ++i ) {
+			run = &font->runs[i];
+			if ( run->stamp && run->hash == hash &&
+			     run->num_glyphs == count && run->style == style &&
+			     Same_Text( run, text, encoding ) ) {
+				run->stamp = ++font->run_stamp;
+				++font->cache_stats.run_hits;
+				layout->run = run;
+				return 0;
+			}
+			if ( !oldest || run->stamp < oldest->stamp ) {
+				oldest = run;
+			}
+		}
+		++font->cache_stats.run_misses;
+
+		run = oldest;
+		if ( run->surface ) {
+			SDL_FreeSurface( run->surface );
+			run->surface = NULL;
+		}
+		run->stamp = 0;
+		if ( Layout_Chunk( font, layout, run ) < 0 ) {
+			return -1;
+		}
+		run->hash = hash;
+		run->style = style;
+		run->stamp = ++font->run_stamp;
+		layout->run = run;
+		return 0;
+	}
+
+	/* Too long to cache: one pass for the size, then lay it out again
+	   a chunk at a time while drawing.
+	 */
+	layout->run = &layout->chunk;
+	do {
+		if ( Layout_Chunk( font, layout, layout->run ) < 0 ) {
+			return -1;
+		}
+	} while ( layout->more );
+	width = layout->run->width;
+
+	Start_Layout( layout, text, encoding );
+	if ( Layout_Chunk( font, layout, layout->run ) < 0 ) {
+		return -1;
+	}
+	layout->run->width = width;
+	return 0;
+}
+
+/* Lays out the next chunk of a long string into layout->run,
+   returns 1 if there was one, 0 at the end, -1 on error.
+ */
+static int Next_Chunk( TTF_Font* font, text_layout* layout )
+{
+	int width = layout->run->width;
+
+	if ( !layout->more ) {
+		return 0;
+	}
+	if ( Layout_Chunk( font, layout, layout->run ) < 0 ) {
+		return -1;
+	}
+	layout->run->width = width;
+	return 1;
+}
+
+/* Steps *i to the next glyph of layout->run, laying out the next chunk
+   of a long string when needed.  Returns 1 while there are glyphs left,
+   0 at the end, -1 on error.
+ */
+static int Next_Glyph( TTF_Font* font, text_layout* layout, int* i )
+{
+	int status;
+
+	if ( ++*i < layout->run->num_glyphs ) {
+		return 1;
+	}
+	status = Next_Chunk( font, layout );
+	if ( status <= 0 ) {
+		return status;
+	}
+	*i = 0;
+	return 1;
+}
+
+/* A still valid earlier rendering of the run, with a reference for the caller */
+static SDL_Surface* Find_Rendering( TTF_Font* font, text_run* run,
+	int mode, SDL_Color fg, SDL_Color bg )
+{
+	SDL_Surface* surface = run->surface;
+
+	if ( !surface || run->render_mode != mode ||
+	     run->render_style != font->style ||
+	     run->fg.r != fg.r || run->fg.g != fg.g || run->fg.b != fg.b ) {
+		return NULL;
+	}
+	if ( mode == RENDER_SHADED &&
+	     (run->bg.r != bg.r || run->bg.g != bg.g || run->bg.b != bg.b) ) {
+		return NULL;
+	}
+	++surface->refcount;
+	return surface;
+}
+
+static void Keep_Rendering( TTF_Font* font, text_run* run,
+	int mode, SDL_Color fg, SDL_Color bg, SDL_Surface* surface )
+{
+	if ( !font->render_cache || !run->stamp || !surface ) {
+		return;
+	}
+	if ( run->surface ) {
+		SDL_FreeSurface( run->surface );
+	}
+	run->surface = surface;
+	run->render_mode = mode;
+	run->render_style = font->style;
+	run->fg = fg;
+	run->bg = bg;
+	++surface->refcount;
+}
+
 void TTF_CloseFont( TTF_Font* font )
 {
+	if ( font->precache ) {
+		Lock_Font( font );
+		font->precache->cancel = 1;
+		Unlock_Font( font );
+		TTF_WaitPrecache( font );
+	}
+	Flush_Runs( font );
 	Flush_Cache( font );
 	if ( font->face ) {
 		FT_Done_Face( font->face );
 	}
+	if ( font->library ) {
+		FT_Done_FreeType( font->library );
+	}
+	Lock_Library();
+	if ( font->data && --font->data->refcount == 0 ) {
+		free( font->data->bytes );
+		free( font->data );
+	}
+	Unlock_Library();
 	if ( font->args.stream ) {
 		free( font->args.stream );
 	}
 	if ( font->freesrc ) {
 		fclose( font->src );
 	}
+#if TTF_USE_LOCK
+	if ( font->lock ) {
+		pthread_mutex_destroy( font->lock );
+		free( font->lock );
+	}
+#endif
 	free( font );
 }
 
-static uint16_t *LATIN1_to_UNICODE(uint16_t *unicode, const char *text, int len)
+/* Read the whole font file so clones can share it from memory */
+static font_data* Load_Font_Data( TTF_Font* font )
 {
-	int i;
+	font_data* data;
 
-	for ( i=0; i < len; ++i ) {
-		unicode[i] = ((const unsigned char *)text)[i];
+	if ( font->data ) {
+		return font->data;
 	}
-	unicode[i] = 0;
-
-	return unicode;
+	data = (font_data*)malloc( sizeof(*data) );
+	if ( data == NULL ) {
+		fprintf(stderr, "%s\n", "Out of memory");
+		return NULL;
+	}
+	data->refcount = 1;
+	data->size = (long)font->args.stream->size;
+	data->bytes = (FT_Byte*)malloc( data->size );
+	if ( data->bytes == NULL ) {
+		fprintf(stderr, "%s\n", "Out of memory");
+		free( data );
+		return NULL;
+	}
+	/* Like FreeType, offsets are from the start of the file */
+	if ( RWread( font->args.stream, 0,
+	             data->bytes, data->size ) != (unsigned long)data->size ) {
+		fprintf(stderr, "%s\n", "Couldn't read font file");
+		free( data->bytes );
+		free( data );
+		return NULL;
+	}
+	font->data = data;
+	return data;
 }
 
-static uint16_t *UTF8_to_UNICODE(uint16_t *unicode, const char *utf8, int len)
+TTF_Font* TTF_CloneFont( TTF_Font* font )
 {
-	int i, j;
-	uint16_t ch;
+	TTF_Font* clone;
+	font_data* data;
+	FT_Error error;
+	int style, render_cache;
+	size_t cache_budget;
 
-	for ( i=0, j=0; i < len; ++i, ++j ) {
-		ch = ((const unsigned char *)utf8)[i];
-		if ( ch >= 0xF0 ) {
-			ch  =  (uint16_t)(utf8[i]&0x07) << 18;
-			ch |=  (uint16_t)(utf8[++i]&0x3F) << 12;
-			ch |=  (uint16_t)(utf8[++i]&0x3F) << 6;
-			ch |=  (uint16_t)(utf8[++i]&0x3F);
-		} else
-		if ( ch >= 0xE0 ) {
-			ch  =  (uint16_t)(utf8[i]&0x0F) << 12;
-			ch |=  (uint16_t)(utf8[++i]&0x3F) << 6;
-			ch |=  (uint16_t)(utf8[++i]&0x3F);
-		} else
-		if ( ch >= 0xC0 ) {
-			ch  =  (uint16_t)(utf8[i]&0x1F) << 6;
-			ch |=  (uint16_t)(utf8[++i]&0x3F);
-		}
-		unicode[j] = ch;
+	clone = New_Font();
+	if ( clone == NULL ) {
+		return NULL;
+	}
+
+	/* The face reads the file through the stream, so hold the lock */
+	Lock_Font( font );
+	data = Load_Font_Data( font );
+	if ( data == NULL ) {
+		Unlock_Font( font );
+		TTF_CloseFont( clone );
+		return NULL;
+	}
+	style = font->style;
+	render_cache = font->render_cache;
+	cache_budget = font->cache_budget;
+	Unlock_Font( font );
+
+	Lock_Library();
+	++data->refcount;
+	clone->data = data;
+	Unlock_Library();
+	error = FT_Init_FreeType( &clone->library );
+	if ( error ) {
+		TTF_SetFTError( "Couldn't init FreeType engine", error );
+		TTF_CloseFont( clone );
+		return NULL;
+	}
+	error = FT_New_Memory_Face( clone->library, data->bytes, data->size,
+	                            font->index, &clone->face );
+	if ( error ) {
+		TTF_SetFTError( "Couldn't load font file", error );
+		TTF_CloseFont( clone );
+		return NULL;
+	}
+	if ( Setup_Face( clone, font->ptsize, font->index ) < 0 ) {
+		TTF_CloseFont( clone );
+		return NULL;
 	}
-	unicode[j] = 0;
+	clone->style = style;
+	clone->render_cache = render_cache;
+	clone->cache_budget = cache_budget;
+	return clone;
+}
 
-	return unicode;
+uint32_t TTF_DecodeUTF8(const char **text)
+{
+	const uint8_t *p = (const uint8_t *)*text;
+	uint32_t ch;
+
+	if ( !*p ) {
+		return 0;
+	}
+	ch = UTF8_getch(&p);
+	*text = (const char *)p;
+	return ch;
 }
 
 int TTF_FontHeight(TTF_Font *font)
@@ -622,6 +1828,11 @@ int TTF_FontLineSkip(TTF_Font *font)
 	return(font->lineskip);
 }
 
+int TTF_FontPtSize(TTF_Font *font)
+{
+	return(font->ptsize);
+}
+
 long TTF_FontFaces(TTF_Font *font)
 {
 	return(font->face->num_faces);
@@ -647,8 +1858,10 @@ int TTF_GlyphMetrics(TTF_Font *font, uint16_t ch,
 {
 	FT_Error error;
 
+	Lock_Font(font);
 	error = Find_Glyph(font, ch, CACHED_METRICS);
 	if ( error ) {
+		Unlock_Font(font);
 		TTF_SetFTError("Couldn't find glyph", error);
 		return -1;
 	}
@@ -674,212 +1887,220 @@ int TTF_GlyphMetrics(TTF_Font *font, uint16_t ch,
 			*advance += font->glyph_overhang;
 		}
 	}
+	Unlock_Font(font);
 	return 0;
 }
 
-int TTF_SizeText(TTF_Font *font, const char *text, int *w, int *h)
+int TTF_GetGlyph(TTF_Font *font, uint32_t ch, int pixels, TTF_GlyphInfo *info)
 {
-	uint16_t *unicode_text;
-	int unicode_len;
-	int status;
+	FT_Error error;
+	c_glyph *glyph;
 
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
+	Lock_Font(font);
+	if ( pixels == TTF_GLYPH_SDF ) {
+		error = Find_Glyph(font, ch, CACHED_METRICS|CACHED_SDF);
+	} else {
+		error = Find_Glyph(font, ch, CACHED_METRICS|(pixels ? CACHED_PIXMAP : 0));
+	}
+	if ( error ) {
+		Unlock_Font(font);
+		TTF_SetFTError("Couldn't find glyph", error);
 		return -1;
 	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	LATIN1_to_UNICODE(unicode_text+1, text, unicode_len);
-
-	status = TTF_SizeUNICODE(font, unicode_text, w, h);
+	glyph = font->current;
+	info->index = glyph->index;
+	info->minx = glyph->minx;
+	info->maxx = glyph->maxx;
+	info->miny = glyph->miny;
+	info->maxy = glyph->maxy;
+	info->yoffset = glyph->yoffset;
+	info->advance = glyph->advance;
+	info->overhang = 0;
+	if ( font->style & TTF_STYLE_BOLD ) {
+		info->overhang = font->glyph_overhang;
+	}
+	info->padding = 0;
+	if ( pixels == TTF_GLYPH_SDF ) {
+		info->width = glyph->sdf.width;
+		info->rows = glyph->sdf.rows;
+		info->pitch = glyph->sdf.pitch;
+		info->pixels = glyph->sdf.buffer;
+		info->padding = SDF_SPREAD;
+	} else if ( pixels ) {
+		/* Same clipping as the Blended renderer */
+		info->width = glyph->pixmap.width;
+		if ( info->width > glyph->maxx - glyph->minx ) {
+			info->width = glyph->maxx - glyph->minx;
+		}
+		info->rows = glyph->pixmap.rows;
+		info->pitch = glyph->pixmap.pitch;
+		info->pixels = glyph->pixmap.buffer;
+	} else {
+		info->width = info->rows = info->pitch = 0;
+		info->pixels = NULL;
+	}
+	/* The caller unlocks with TTF_ReleaseGlyph() */
+	return 0;
+}
 
-	free(unicode_text);
-	return status;
+void TTF_ReleaseGlyph(TTF_Font *font)
+{
+	Unlock_Font(font);
 }
 
-int TTF_SizeUTF8(TTF_Font *font, const char *text, int *w, int *h)
+int TTF_GetKerning(TTF_Font *font, int prev_index, int index)
 {
-	uint16_t *unicode_text;
-	int unicode_len;
-	int status;
+	FT_Vector delta;
 
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
-		return -1;
+	if ( !prev_index || !index || !FT_HAS_KERNING( font->face ) ) {
+		return 0;
 	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	UTF8_to_UNICODE(unicode_text+1, text, unicode_len);
-
-	status = TTF_SizeUNICODE(font, unicode_text, w, h);
+	Lock_Font( font );
+	FT_Get_Kerning( font->face, prev_index, index, ft_kerning_default, &delta );
+	Unlock_Font( font );
+	return delta.x >> 6;
+}
 
-	free(unicode_text);
-	return status;
+int TTF_FontUnderline(TTF_Font *font, int *offset, int *height)
+{
+	if ( offset ) {
+		*offset = font->ascent - font->underline_offset - 1;
+		if ( *offset >= font->height ) {
+			*offset = (font->height-1) - font->underline_height;
+		}
+	}
+	if ( height ) {
+		*height = font->underline_height;
+	}
+	return (font->style & TTF_STYLE_UNDERLINE) != 0;
 }
 
-int TTF_SizeUNICODE(TTF_Font *font, const uint16_t *text, int *w, int *h)
+/* The *_Locked functions expect the caller to hold the font lock */
+static int Size_Text_Locked(TTF_Font *font, const void *text, int encoding, int *w, int *h)
 {
-	int status;
-	const uint16_t *ch;
-	int swapped;
-	int x, z;
-	int minx, maxx;
-	int miny, maxy;
-	c_glyph *glyph;
-	FT_Error error;
-	FT_Long use_kerning;
-	FT_UInt prev_index = 0;
+	text_layout layout;
 
 	if ( ! TTF_initialized ) {
 		fprintf(stderr, "%s\n", "Library not initialized" );
 		return -1;
 	}
-	status = 0;
-	minx = maxx = 0;
-	miny = maxy = 0;
-	swapped = TTF_byteswapped;
-
-	use_kerning = FT_HAS_KERNING( font->face );
-
-	x= 0;
-	for ( ch=text; *ch; ++ch ) {
-		uint16_t c = *ch;
-		if ( c == UNICODE_BOM_NATIVE ) {
-			swapped = 0;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( c == UNICODE_BOM_SWAPPED ) {
-			swapped = 1;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( swapped ) {
-			c = SDL_Swap16(c);
-		}
-
-		error = Find_Glyph(font, c, CACHED_METRICS);
-		if ( error ) {
-			return -1;
-		}
-		glyph = font->current;
-
-		if ( use_kerning && prev_index && glyph->index ) {
-			FT_Vector delta; 
-			FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta ); 
-			x += delta.x >> 6;
-		}
-		
-		z = x + glyph->minx;
-		if ( minx > z ) {
-			minx = z;
-		}
-		if ( font->style & TTF_STYLE_BOLD ) {
-			x += font->glyph_overhang;
-		}
-		if ( glyph->advance > glyph->maxx ) {
-			z = x + glyph->advance;
-		} else {
-			z = x + glyph->maxx;
-		}
-		if ( maxx < z ) {
-			maxx = z;
-		}
-		x += glyph->advance;
-
-		if ( glyph->miny < miny ) {
-			miny = glyph->miny;
-		}
-		if ( glyph->maxy > maxy ) {
-			maxy = glyph->maxy;
-		}
-		prev_index = glyph->index;
+	if ( Layout_Text(font, &layout, text, encoding) < 0 ) {
+		return -1;
 	}
-
 	if ( w ) {
-		*w = (maxx - minx);
+		*w = layout.run->width;
 	}
 	if ( h ) {
 		*h = font->height;
 	}
+	return 0;
+}
+
+static int Size_Text(TTF_Font *font, const void *text, int encoding, int *w, int *h)
+{
+	int status;
+
+	Lock_Font(font);
+	status = Size_Text_Locked(font, text, encoding, w, h);
+	Unlock_Font(font);
 	return status;
 }
 
-SDL_Surface *TTF_RenderText_Solid(TTF_Font *font,
-	const char *text, SDL_Color fg)
+int TTF_SizeText(TTF_Font *font, const char *text, int *w, int *h)
 {
-	SDL_Surface *textbuf;
-	uint16_t *unicode_text;
-	int unicode_len;
+	return Size_Text(font, text, TEXT_LATIN1, w, h);
+}
 
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
-		return(NULL);
-	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	LATIN1_to_UNICODE(unicode_text+1, text, unicode_len);
+int TTF_SizeUTF8(TTF_Font *font, const char *text, int *w, int *h)
+{
+	return Size_Text(font, text, TEXT_UTF8, w, h);
+}
 
-	textbuf = TTF_RenderUNICODE_Solid(font, unicode_text, fg);
+int TTF_SizeUNICODE(TTF_Font *font, const uint16_t *text, int *w, int *h)
+{
+	return Size_Text(font, text, TEXT_UNICODE, w, h);
+}
 
-	free(unicode_text);
-	return(textbuf);
+/* v * num / den rounded down, also for negative v */
+static int Scale_Floor(int v, int num, int den)
+{
+	if ( v >= 0 ) {
+		return (int)(((int64_t)v * num) / den);
+	}
+	return (int)-(((int64_t)-v * num + den - 1) / den);
 }
 
-SDL_Surface *TTF_RenderUTF8_Solid(TTF_Font *font,
-	const char *text, SDL_Color fg)
+static int Scale_Ceil(int v, int num, int den)
 {
-	SDL_Surface *textbuf;
-	uint16_t *unicode_text;
-	int unicode_len;
+	return -Scale_Floor(-v, num, den);
+}
 
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
-		return(NULL);
+static int Size_Scaled(TTF_Font *font, const void *text, int encoding,
+	int ptsize, int *w, int *h)
+{
+	int width;
+
+	if ( ptsize <= 0 ) {
+		fprintf(stderr, "%s\n", "Invalid point size");
+		return -1;
+	}
+	if ( Size_Text(font, text, encoding, &width, NULL) < 0 ) {
+		return -1;
 	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	UTF8_to_UNICODE(unicode_text, text, unicode_len);
+	if ( w ) {
+		*w = Scale_Ceil(width, ptsize, font->ptsize);
+	}
+	if ( h ) {
+		*h = Scale_Ceil(font->height, ptsize, font->ptsize);
+	}
+	return 0;
+}
+
+int TTF_SizeText_Scaled(TTF_Font *font, const char *text, int ptsize, int *w, int *h)
+{
+	return Size_Scaled(font, text, TEXT_LATIN1, ptsize, w, h);
+}
 
-	textbuf = TTF_RenderUNICODE_Solid(font, unicode_text, fg);
+int TTF_SizeUTF8_Scaled(TTF_Font *font, const char *text, int ptsize, int *w, int *h)
+{
+	return Size_Scaled(font, text, TEXT_UTF8, ptsize, w, h);
+}
 
-	free(unicode_text);
-	return(textbuf);
+int TTF_SizeUNICODE_Scaled(TTF_Font *font, const uint16_t *text, int ptsize, int *w, int *h)
+{
+	return Size_Scaled(font, text, TEXT_UNICODE, ptsize, w, h);
 }
 
-SDL_Surface *TTF_RenderUNICODE_Solid(TTF_Font *font,
-	const uint16_t *text, SDL_Color fg)
+static SDL_Surface *Render_Solid_Locked(TTF_Font *font,
+	const void *text, int encoding, SDL_Color fg)
 {
 	int xstart;
 	int width;
 	int height;
 	SDL_Surface* textbuf;
 	SDL_Palette* palette;
-	const uint16_t* ch;
 	uint8_t* src;
 	uint8_t* dst;
 	uint8_t *dst_check;
-	int swapped;
-	int row, col;
+	int i, row, col;
 	c_glyph *glyph;
+	text_layout layout;
+	text_run *run;
+	int status;
 
 	FT_Bitmap *current;
 	FT_Error error;
-	FT_Long use_kerning;
-	FT_UInt prev_index = 0;
 
-	if( ( TTF_SizeUNICODE(font, text, &width, NULL) < 0 ) || !width ) {
+	if ( Layout_Text(font, &layout, text, encoding) < 0 || !layout.run->width ) {
 		fprintf(stderr, "%s\n", "Text has zero width" );
 		return NULL;
 	}
+	run = layout.run;
+	textbuf = Find_Rendering(font, run, RENDER_SOLID, fg, fg);
+	if ( textbuf ) {
+		return textbuf;
+	}
+	width = run->width;
 	height = font->height;
 
 	textbuf = SDL_AllocSurface(SDL_SWSURFACE, width, height, 8, 0, 0, 0, 0);
@@ -898,31 +2119,8 @@ SDL_Surface *TTF_RenderUNICODE_Solid(TTF_Font *font,
 	palette->colors[1].b = fg.b;
 	SDL_SetColorKey( textbuf, SDL_SRCCOLORKEY, 0 );
 
-	use_kerning = FT_HAS_KERNING( font->face );
-	
-	xstart = 0;
-	swapped = TTF_byteswapped;
-	for( ch=text; *ch; ++ch ) {
-		uint16_t c = *ch;
-		if ( c == UNICODE_BOM_NATIVE ) {
-			swapped = 0;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( c == UNICODE_BOM_SWAPPED ) {
-			swapped = 1;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( swapped ) {
-			c = SDL_Swap16(c);
-		}
-
-		error = Find_Glyph(font, c, CACHED_METRICS|CACHED_BITMAP);
+	for ( i = -1; (status = Next_Glyph(font, &layout, &i)) > 0; ) {
+		error = Find_Glyph(font, run->chars[i], CACHED_METRICS|CACHED_BITMAP);
 		if( error ) {
 			SDL_FreeSurface( textbuf );
 			return NULL;
@@ -933,14 +2131,7 @@ SDL_Surface *TTF_RenderUNICODE_Solid(TTF_Font *font,
 		if (width > glyph->maxx - glyph->minx) {
 			width = glyph->maxx - glyph->minx;
 		}
-		if ( use_kerning && prev_index && glyph->index ) {
-			FT_Vector delta; 
-			FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta ); 
-			xstart += delta.x >> 6;
-		}
-		if ( (ch == text) && (glyph->minx < 0) ) {
-			xstart -= glyph->minx;
-		}
+		xstart = run->xpos[i];
 		
 		for( row = 0; row < current->rows; ++row ) {
 			if ( row+glyph->yoffset < 0 ) {
@@ -960,12 +2151,11 @@ SDL_Surface *TTF_RenderUNICODE_Solid(TTF_Font *font,
 				*dst++ |= *src++;
 			}
 		}
+	}
 
-		xstart += glyph->advance;
-		if ( font->style & TTF_STYLE_BOLD ) {
-			xstart += font->glyph_overhang;
-		}
-		prev_index = glyph->index;
+	if ( status < 0 ) {
+		SDL_FreeSurface( textbuf );
+		return NULL;
 	}
 
 	if( font->style & TTF_STYLE_UNDERLINE ) {
@@ -979,10 +2169,40 @@ SDL_Surface *TTF_RenderUNICODE_Solid(TTF_Font *font,
 			dst += textbuf->pitch;
 		}
 	}
+	Keep_Rendering(font, run, RENDER_SOLID, fg, fg, textbuf);
 	return textbuf;
 }
 
-SDL_Surface *TTF_RenderGlyph_Solid(TTF_Font *font, uint16_t ch, SDL_Color fg)
+static SDL_Surface *Render_Solid(TTF_Font *font,
+	const void *text, int encoding, SDL_Color fg)
+{
+	SDL_Surface *textbuf;
+
+	Lock_Font(font);
+	textbuf = Render_Solid_Locked(font, text, encoding, fg);
+	Unlock_Font(font);
+	return textbuf;
+}
+
+SDL_Surface *TTF_RenderText_Solid(TTF_Font *font,
+	const char *text, SDL_Color fg)
+{
+	return Render_Solid(font, text, TEXT_LATIN1, fg);
+}
+
+SDL_Surface *TTF_RenderUTF8_Solid(TTF_Font *font,
+	const char *text, SDL_Color fg)
+{
+	return Render_Solid(font, text, TEXT_UTF8, fg);
+}
+
+SDL_Surface *TTF_RenderUNICODE_Solid(TTF_Font *font,
+	const uint16_t *text, SDL_Color fg)
+{
+	return Render_Solid(font, text, TEXT_UNICODE, fg);
+}
+
+static SDL_Surface *Render_Glyph_Solid_Locked(TTF_Font *font, uint16_t ch, SDL_Color fg)
 {
 	SDL_Surface *textbuf;
 	SDL_Palette *palette;
@@ -1036,52 +2256,19 @@ SDL_Surface *TTF_RenderGlyph_Solid(TTF_Font *font, uint16_t ch, SDL_Color fg)
 	return(textbuf);
 }
 
-SDL_Surface *TTF_RenderText_Shaded(TTF_Font *font,
-	const char *text, SDL_Color fg, SDL_Color bg)
-{
-	SDL_Surface *textbuf;
-	uint16_t *unicode_text;
-	int unicode_len;
-
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
-		return(NULL);
-	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	LATIN1_to_UNICODE(unicode_text+1, text, unicode_len);
-
-	textbuf = TTF_RenderUNICODE_Shaded(font, unicode_text, fg, bg);
-
-	free(unicode_text);
-	return(textbuf);
-}
-
-SDL_Surface *TTF_RenderUTF8_Shaded(TTF_Font *font,
-				const char *text, SDL_Color fg, SDL_Color bg)
+SDL_Surface *TTF_RenderGlyph_Solid(TTF_Font *font, uint16_t ch, SDL_Color fg)
 {
 	SDL_Surface *textbuf;
-	uint16_t *unicode_text;
-	int unicode_len;
-
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
-		return(NULL);
-	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	UTF8_to_UNICODE(unicode_text+1, text, unicode_len);
 
-	textbuf = TTF_RenderUNICODE_Shaded(font, unicode_text, fg, bg);
-
-	free(unicode_text);
-	return(textbuf);
+	Lock_Font(font);
+	textbuf = Render_Glyph_Solid_Locked(font, ch, fg);
+	Unlock_Font(font);
+	return textbuf;
 }
 
-SDL_Surface* TTF_RenderUNICODE_Shaded( TTF_Font* font,
-	const uint16_t* text,
+static SDL_Surface* Render_Shaded_Locked( TTF_Font* font,
+	const void* text,
+	int encoding,
 	SDL_Color fg,
 	SDL_Color bg )
 {
@@ -1094,22 +2281,27 @@ SDL_Surface* TTF_RenderUNICODE_Shaded( TTF_Font* font,
 	int rdiff;
 	int gdiff;
 	int bdiff;
-	const uint16_t* ch;
 	uint8_t* src;
 	uint8_t* dst;
 	uint8_t* dst_check;
-	int swapped;
-	int row, col;
+	int i, row, col;
 	FT_Bitmap* current;
 	c_glyph *glyph;
 	FT_Error error;
-	FT_Long use_kerning;
-	FT_UInt prev_index = 0;
+	text_layout layout;
+	text_run *run;
+	int status;
 
-	if( ( TTF_SizeUNICODE(font, text, &width, NULL) < 0 ) || !width ) {
+	if ( Layout_Text(font, &layout, text, encoding) < 0 || !layout.run->width ) {
 		fprintf(stderr, "%s\n", "Text has zero width");
 		return NULL;
 	}
+	run = layout.run;
+	textbuf = Find_Rendering(font, run, RENDER_SHADED, fg, bg);
+	if ( textbuf ) {
+		return textbuf;
+	}
+	width = run->width;
 	height = font->height;
 
 	textbuf = SDL_AllocSurface(SDL_SWSURFACE, width, height, 8, 0, 0, 0, 0);
@@ -1130,31 +2322,8 @@ SDL_Surface* TTF_RenderUNICODE_Shaded( TTF_Font* font,
 		palette->colors[index].b = bg.b + (index*bdiff) / (NUM_GRAYS-1);
 	}
 
-	use_kerning = FT_HAS_KERNING( font->face );
-	
-	xstart = 0;
-	swapped = TTF_byteswapped;
-	for( ch = text; *ch; ++ch ) {
-		uint16_t c = *ch;
-		if ( c == UNICODE_BOM_NATIVE ) {
-			swapped = 0;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( c == UNICODE_BOM_SWAPPED ) {
-			swapped = 1;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( swapped ) {
-			c = SDL_Swap16(c);
-		}
-
-		error = Find_Glyph(font, c, CACHED_METRICS|CACHED_PIXMAP);
+	for ( i = -1; (status = Next_Glyph(font, &layout, &i)) > 0; ) {
+		error = Find_Glyph(font, run->chars[i], CACHED_METRICS|CACHED_PIXMAP);
 		if( error ) {
 			SDL_FreeSurface( textbuf );
 			return NULL;
@@ -1164,14 +2333,7 @@ SDL_Surface* TTF_RenderUNICODE_Shaded( TTF_Font* font,
 		if (width > glyph->maxx - glyph->minx) {
 			width = glyph->maxx - glyph->minx;
 		}
-		if ( use_kerning && prev_index && glyph->index ) {
-			FT_Vector delta; 
-			FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta ); 
-			xstart += delta.x >> 6;
-		}
-		if ( (ch == text) && (glyph->minx < 0) ) {
-			xstart -= glyph->minx;
-		}
+		xstart = run->xpos[i];
 		
 		current = &glyph->pixmap;
 		for( row = 0; row < current->rows; ++row ) {
@@ -1189,12 +2351,11 @@ SDL_Surface* TTF_RenderUNICODE_Shaded( TTF_Font* font,
 				*dst++ |= *src++;
 			}
 		}
+	}
 
-		xstart += glyph->advance;
-		if( font->style & TTF_STYLE_BOLD ) {
-			xstart += font->glyph_overhang;
-		}
-		prev_index = glyph->index;
+	if ( status < 0 ) {
+		SDL_FreeSurface( textbuf );
+		return NULL;
 	}
 
 	if( font->style & TTF_STYLE_UNDERLINE ) {
@@ -1208,10 +2369,40 @@ SDL_Surface* TTF_RenderUNICODE_Shaded( TTF_Font* font,
 			dst += textbuf->pitch;
 		}
 	}
+	Keep_Rendering(font, run, RENDER_SHADED, fg, bg, textbuf);
 	return textbuf;
 }
 
-SDL_Surface* TTF_RenderGlyph_Shaded( TTF_Font* font,
+static SDL_Surface *Render_Shaded(TTF_Font *font,
+	const void *text, int encoding, SDL_Color fg, SDL_Color bg)
+{
+	SDL_Surface *textbuf;
+
+	Lock_Font(font);
+	textbuf = Render_Shaded_Locked(font, text, encoding, fg, bg);
+	Unlock_Font(font);
+	return textbuf;
+}
+
+SDL_Surface *TTF_RenderText_Shaded(TTF_Font *font,
+	const char *text, SDL_Color fg, SDL_Color bg)
+{
+	return Render_Shaded(font, text, TEXT_LATIN1, fg, bg);
+}
+
+SDL_Surface *TTF_RenderUTF8_Shaded(TTF_Font *font,
+	const char *text, SDL_Color fg, SDL_Color bg)
+{
+	return Render_Shaded(font, text, TEXT_UTF8, fg, bg);
+}
+
+SDL_Surface *TTF_RenderUNICODE_Shaded(TTF_Font *font,
+	const uint16_t *text, SDL_Color fg, SDL_Color bg)
+{
+	return Render_Shaded(font, text, TEXT_UNICODE, fg, bg);
+}
+
+static SDL_Surface* Render_Glyph_Shaded_Locked( TTF_Font* font,
 	uint16_t ch,
 	SDL_Color fg,
 	SDL_Color bg )
@@ -1274,73 +2465,47 @@ SDL_Surface* TTF_RenderGlyph_Shaded( TTF_Font* font,
 	return textbuf;
 }
 
-SDL_Surface *TTF_RenderText_Blended(TTF_Font *font,
-	const char *text, SDL_Color fg)
+SDL_Surface* TTF_RenderGlyph_Shaded( TTF_Font* font,
+	uint16_t ch,
+	SDL_Color fg,
+	SDL_Color bg )
 {
-	SDL_Surface *textbuf;
-	uint16_t *unicode_text;
-	int unicode_len;
-
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
-		return(NULL);
-	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	LATIN1_to_UNICODE(unicode_text+1, text, unicode_len);
-
-	textbuf = TTF_RenderUNICODE_Blended(font, unicode_text, fg);
+	SDL_Surface* textbuf;
 
-	free(unicode_text);
-	return(textbuf);
+	Lock_Font( font );
+	textbuf = Render_Glyph_Shaded_Locked( font, ch, fg, bg );
+	Unlock_Font( font );
+	return textbuf;
 }
 
-SDL_Surface *TTF_RenderUTF8_Blended(TTF_Font *font,
-	const char *text, SDL_Color fg)
+static SDL_Surface *Render_Blended_Locked(TTF_Font *font,
+	const void *text, int encoding, SDL_Color fg)
 {
-	SDL_Surface *textbuf;
-	uint16_t *unicode_text;
-	int unicode_len;
-
-	unicode_len = strlen(text);
-	unicode_text = (uint16_t *)malloc((1+unicode_len+1)*(sizeof *unicode_text));
-	if ( unicode_text == NULL ) {
-		fprintf(stderr, "%s\n", "Out of memory");
-		return(NULL);
-	}
-	*unicode_text = UNICODE_BOM_NATIVE;
-	UTF8_to_UNICODE(unicode_text+1, text, unicode_len);
-
-	textbuf = TTF_RenderUNICODE_Blended(font, unicode_text, fg);
-
-	free(unicode_text);
-	return(textbuf);
-}
-
-SDL_Surface *TTF_RenderUNICODE_Blended(TTF_Font *font,
-	const uint16_t *text, SDL_Color fg)
-{
-	int xstart;
-	int width, height;
+	int xstart;
+	int width, height;
 	SDL_Surface *textbuf;
 	uint32_t alpha;
 	uint32_t pixel;
-	const uint16_t *ch;
 	uint8_t *src;
 	uint32_t *dst;
 	uint32_t *dst_check;
-	int swapped;
-	int row, col;
+	int i, row, col;
 	c_glyph *glyph;
 	FT_Error error;
-	FT_Long use_kerning;
-	FT_UInt prev_index = 0;
+	text_layout layout;
+	text_run *run;
+	int status;
 
-	if ( (TTF_SizeUNICODE(font, text, &width, NULL) < 0) || !width ) {
+	if ( Layout_Text(font, &layout, text, encoding) < 0 || !layout.run->width ) {
 		fprintf(stderr, "%s\n", "Text has zero width");
 		return(NULL);
 	}
+	run = layout.run;
+	textbuf = Find_Rendering(font, run, RENDER_BLENDED, fg, fg);
+	if ( textbuf ) {
+		return(textbuf);
+	}
+	width = run->width;
 	height = font->height;
 
 	textbuf = SDL_AllocSurface(SDL_SWSURFACE, width, height, 32,
@@ -1351,33 +2516,11 @@ SDL_Surface *TTF_RenderUNICODE_Blended(TTF_Font *font,
 
 	dst_check = (uint32_t*)textbuf->pixels + textbuf->pitch/4 * textbuf->h;
 
-	use_kerning = FT_HAS_KERNING( font->face );
-	
-	xstart = 0;
-	swapped = TTF_byteswapped;
 	pixel = (fg.r<<16)|(fg.g<<8)|fg.b;
 	SDL_FillRect(textbuf, NULL, pixel);	
 	
-	for ( ch=text; *ch; ++ch ) {
-		uint16_t c = *ch;
-		if ( c == UNICODE_BOM_NATIVE ) {
-			swapped = 0;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( c == UNICODE_BOM_SWAPPED ) {
-			swapped = 1;
-			if ( text == ch ) {
-				++text;
-			}
-			continue;
-		}
-		if ( swapped ) {
-			c = SDL_Swap16(c);
-		}
-		error = Find_Glyph(font, c, CACHED_METRICS|CACHED_PIXMAP);
+	for ( i = -1; (status = Next_Glyph(font, &layout, &i)) > 0; ) {
+		error = Find_Glyph(font, run->chars[i], CACHED_METRICS|CACHED_PIXMAP);
 		if( error ) {
 			SDL_FreeSurface( textbuf );
 			return NULL;
@@ -1387,15 +2530,7 @@ SDL_Surface *TTF_RenderUNICODE_Blended(TTF_Font *font,
 		if (width > glyph->maxx - glyph->minx) {
 			width = glyph->maxx - glyph->minx;
 		}
-		if ( use_kerning && prev_index && glyph->index ) {
-			FT_Vector delta; 
-			FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta ); 
-			xstart += delta.x >> 6;
-		}
-		
-		if ( (ch == text) && (glyph->minx < 0) ) {
-			xstart -= glyph->minx;
-		}
+		xstart = run->xpos[i];
 
 		for ( row = 0; row < glyph->pixmap.rows; ++row ) {
 			if ( row+glyph->yoffset < 0 ) {
@@ -1414,12 +2549,11 @@ SDL_Surface *TTF_RenderUNICODE_Blended(TTF_Font *font,
 				*dst++ |= pixel | (alpha << 24);
 			}
 		}
+	}
 
-		xstart += glyph->advance;
-		if ( font->style & TTF_STYLE_BOLD ) {
-			xstart += font->glyph_overhang;
-		}
-		prev_index = glyph->index;
+	if ( status < 0 ) {
+		SDL_FreeSurface( textbuf );
+		return(NULL);
 	}
 
 	if( font->style & TTF_STYLE_UNDERLINE ) {
@@ -1436,10 +2570,40 @@ SDL_Surface *TTF_RenderUNICODE_Blended(TTF_Font *font,
 			dst += textbuf->pitch/4;
 		}
 	}
+	Keep_Rendering(font, run, RENDER_BLENDED, fg, fg, textbuf);
 	return(textbuf);
 }
 
-SDL_Surface *TTF_RenderGlyph_Blended(TTF_Font *font, uint16_t ch, SDL_Color fg)
+static SDL_Surface *Render_Blended(TTF_Font *font,
+	const void *text, int encoding, SDL_Color fg)
+{
+	SDL_Surface *textbuf;
+
+	Lock_Font(font);
+	textbuf = Render_Blended_Locked(font, text, encoding, fg);
+	Unlock_Font(font);
+	return textbuf;
+}
+
+SDL_Surface *TTF_RenderText_Blended(TTF_Font *font,
+	const char *text, SDL_Color fg)
+{
+	return Render_Blended(font, text, TEXT_LATIN1, fg);
+}
+
+SDL_Surface *TTF_RenderUTF8_Blended(TTF_Font *font,
+	const char *text, SDL_Color fg)
+{
+	return Render_Blended(font, text, TEXT_UTF8, fg);
+}
+
+SDL_Surface *TTF_RenderUNICODE_Blended(TTF_Font *font,
+	const uint16_t *text, SDL_Color fg)
+{
+	return Render_Blended(font, text, TEXT_UNICODE, fg);
+}
+
+static SDL_Surface *Render_Glyph_Blended_Locked(TTF_Font *font, uint16_t ch, SDL_Color fg)
 {
 	SDL_Surface *textbuf;
 	uint32_t alpha;
@@ -1492,10 +2656,782 @@ SDL_Surface *TTF_RenderGlyph_Blended(TTF_Font *font, uint16_t ch, SDL_Color fg)
 	return(textbuf);
 }
 
+SDL_Surface *TTF_RenderGlyph_Blended(TTF_Font *font, uint16_t ch, SDL_Color fg)
+{
+	SDL_Surface *textbuf;
+
+	Lock_Font(font);
+	textbuf = Render_Glyph_Blended_Locked(font, ch, fg);
+	Unlock_Font(font);
+	return textbuf;
+}
+
+/* Intersects the text box at (x, y), the caller's clip and the surface
+   clip rectangle, returns 0 if nothing is left to draw.
+ */
+static int Clip_Text(SDL_Surface *dst, const SDL_Rect *clip,
+	int x, int y, int width, int height, SDL_Rect *box)
+{
+	int left, top, right, bottom;
+
+	left = dst->clip_rect.x;
+	top = dst->clip_rect.y;
+	right = left + dst->clip_rect.w;
+	bottom = top + dst->clip_rect.h;
+	if ( clip ) {
+		if ( clip->x > left ) left = clip->x;
+		if ( clip->y > top ) top = clip->y;
+		if ( clip->x + clip->w < right ) right = clip->x + clip->w;
+		if ( clip->y + clip->h < bottom ) bottom = clip->y + clip->h;
+	}
+	if ( x > left ) left = x;
+	if ( y > top ) top = y;
+	if ( x + width < right ) right = x + width;
+	if ( y + height < bottom ) bottom = y + height;
+	if ( left >= right || top >= bottom ) {
+		return 0;
+	}
+	box->x = left;
+	box->y = top;
+	box->w = right - left;
+	box->h = bottom - top;
+	return 1;
+}
+
+/* Blends glyphs laid out at pen positions xpos into the destination, row
+   by row as coverage spans, inside box.  The surface is locked.
+ */
+static int Blend_Glyphs(TTF_Font *font, const uint32_t *chars,
+	const int *xpos, int count, SDL_Color fg,
+	SDL_Surface *dst, int x, int y, const SDL_Rect *box)
+{
+	int width;
+	int x0, x1, y0;
+	uint8_t *src;
+	int i, row;
+	c_glyph *glyph;
+	FT_Error error;
+
+	for ( i = 0; i < count; ++i ) {
+		error = Find_Glyph(font, chars[i], CACHED_METRICS|CACHED_PIXMAP);
+		if( error ) {
+			return(-1);
+		}
+		glyph = font->current;
+		width = glyph->pixmap.width;
+		if (width > glyph->maxx - glyph->minx) {
+			width = glyph->maxx - glyph->minx;
+		}
+
+		x0 = x + xpos[i] + glyph->minx;
+		x1 = x0 + width;
+		if ( x0 < box->x ) x0 = box->x;
+		if ( x1 > box->x + box->w ) x1 = box->x + box->w;
+		for ( row = 0; x0 < x1 && row < glyph->pixmap.rows; ++row ) {
+			y0 = y + row + glyph->yoffset;
+			if ( y0 < box->y ) {
+				continue;
+			}
+			if ( y0 >= box->y + box->h ) {
+				break;
+			}
+			src = glyph->pixmap.buffer + glyph->pixmap.pitch * row +
+				(x0 - (x + xpos[i] + glyph->minx));
+			SDL_ext_blendSpan(dst, x0, y0, x1 - x0, src,
+			                  fg.r, fg.g, fg.b, 255);
+		}
+	}
+	return(0);
+}
+
+/* Underlines box->x to box->x + width for text at y, inside box */
+static void Blend_Underline(TTF_Font *font, SDL_Color fg,
+	SDL_Surface *dst, int y, int width, const SDL_Rect *box)
+{
+	int row, height, y0;
+
+	TTF_FontUnderline(font, &row, &height);
+	if ( width > box->w ) {
+		width = box->w;
+	}
+	for ( y0 = y + row; height > 0 && width > 0; --height, ++y0 ) {
+		if ( y0 >= box->y && y0 < box->y + box->h ) {
+			SDL_ext_blendSpan(dst, box->x, y0, width, NULL,
+			                  fg.r, fg.g, fg.b, 255);
+		}
+	}
+}
+
+/* Same layout as TTF_RenderUNICODE_Blended(), but each glyph row is
+   blended into the destination as a coverage span.
+ */
+static int Render_BlendedTo_Locked(TTF_Font *font,
+	const void *text, int encoding, SDL_Color fg,
+	SDL_Surface *dst, int x, int y, const SDL_Rect *clip)
+{
+	text_layout layout;
+	text_run *run;
+	int status;
+	SDL_Rect box;
+
+	if ( dst == NULL ) {
+		fprintf(stderr, "%s\n", "Passed a NULL surface");
+		return(-1);
+	}
+	if ( dst->format->BytesPerPixel != 2 && dst->format->BytesPerPixel != 4 ) {
+		fprintf(stderr, "%s\n", "Only 16 and 32-bit surfaces are supported");
+		return(-1);
+	}
+	if ( Layout_Text(font, &layout, text, encoding) < 0 ) {
+		return(-1);
+	}
+	run = layout.run;
+	if ( ! Clip_Text(dst, clip, x, y, run->width, font->height, &box) ) {
+		return(0);
+	}
+
+	if ( SDL_LockSurface(dst) < 0 ) {
+		return(-1);
+	}
+	do {
+		status = Blend_Glyphs(font, run->chars, run->xpos, run->num_glyphs,
+		                      fg, dst, x, y, &box);
+	} while ( status == 0 && (status = Next_Chunk(font, &layout)) > 0 );
+
+	if ( status < 0 ) {
+		SDL_UnlockSurface(dst);
+		return(-1);
+	}
+
+	if( font->style & TTF_STYLE_UNDERLINE ) {
+		Blend_Underline(font, fg, dst, y, box.w, &box);
+	}
+	SDL_UnlockSurface(dst);
+
+	SDL_AddDirtyRect(dst, &box);
+	return(0);
+}
+
+static int Render_BlendedTo(TTF_Font *font,
+	const void *text, int encoding, SDL_Color fg, SDL_Surface *dst,
+	int x, int y, const SDL_Rect *clip)
+{
+	int status;
+
+	Lock_Font(font);
+	status = Render_BlendedTo_Locked(font, text, encoding, fg, dst, x, y, clip);
+	Unlock_Font(font);
+	return status;
+}
+
+int TTF_RenderText_BlendedTo(TTF_Font *font,
+	const char *text, SDL_Color fg, SDL_Surface *dst, int x, int y,
+	const SDL_Rect *clip)
+{
+	return Render_BlendedTo(font, text, TEXT_LATIN1, fg, dst, x, y, clip);
+}
+
+int TTF_RenderUTF8_BlendedTo(TTF_Font *font,
+	const char *text, SDL_Color fg, SDL_Surface *dst, int x, int y,
+	const SDL_Rect *clip)
+{
+	return Render_BlendedTo(font, text, TEXT_UTF8, fg, dst, x, y, clip);
+}
+
+int TTF_RenderUNICODE_BlendedTo(TTF_Font *font,
+	const uint16_t *text, SDL_Color fg, SDL_Surface *dst, int x, int y,
+	const SDL_Rect *clip)
+{
+	return Render_BlendedTo(font, text, TEXT_UNICODE, fg, dst, x, y, clip);
+}
+
+/* Same layout as TTF_RenderUNICODE_BlendedTo(), scaled from the size the
+   font was opened with to ptsize.  Every destination pixel samples the
+   glyph's distance field bilinearly and turns the distance into coverage
+   with a smoothstep one destination pixel wide.
+ */
+static int Render_SDFTo_Locked(TTF_Font *font,
+	const void *text, int encoding, int ptsize, SDL_Color fg,
+	SDL_Surface *dst, int x, int y, const SDL_Rect *clip)
+{
+	int num, den, step;
+	int width, height;
+	int left, top, right, bottom;
+	int x0, x1, y0, y1, gx, gy;
+	int px, py, i, row;
+	uint8_t lut[256];
+	uint8_t *coverage;
+	c_glyph *glyph;
+	FT_Bitmap *sdf;
+	FT_Error error;
+	text_layout layout;
+	text_run *run;
+	int status;
+	double k;
+	SDL_Rect rect;
+
+	if ( dst == NULL ) {
+		fprintf(stderr, "%s\n", "Passed a NULL surface");
+		return(-1);
+	}
+	if ( dst->format->BytesPerPixel != 2 && dst->format->BytesPerPixel != 4 ) {
+		fprintf(stderr, "%s\n", "Only 16 and 32-bit surfaces are supported");
+		return(-1);
+	}
+	if ( ptsize <= 0 ) {
+		fprintf(stderr, "%s\n", "Invalid point size");
+		return(-1);
+	}
+	if ( Layout_Text(font, &layout, text, encoding) < 0 ) {
+		return(-1);
+	}
+	run = layout.run;
+	num = ptsize;
+	den = font->ptsize;
+	width = Scale_Ceil(run->width, num, den);
+	height = Scale_Ceil(font->height, num, den);
+	if ( ! Clip_Text(dst, clip, x, y, width, height, &rect) ) {
+		return(0);
+	}
+	left = rect.x;
+	top = rect.y;
+	right = rect.x + rect.w;
+	bottom = rect.y + rect.h;
+
+	/* Field values per destination pixel, and the coverage for each */
+	k = 127.5 / SDF_SPREAD * den / num;
+	for ( i = 0; i < 256; ++i ) {
+		double t = (i - 127.5) / k + 0.5;
+		if ( t < 0 ) {
+			t = 0;
+		} else if ( t > 1 ) {
+			t = 1;
+		}
+		lut[i] = (uint8_t)(t * t * (3 - 2 * t) * 255 + 0.5);
+	}
+	/* Source pixels per destination pixel, 16.16 */
+	step = ((den << 16) + num / 2) / num;
+
+	coverage = (uint8_t *)malloc(right - left);
+	if ( coverage == NULL ) {
+		fprintf(stderr, "%s\n", "Out of memory");
+		return(-1);
+	}
+	if ( SDL_LockSurface(dst) < 0 ) {
+		free(coverage);
+		return(-1);
+	}
+
+	for ( i = -1; (status = Next_Glyph(font, &layout, &i)) > 0; ) {
+		error = Find_Glyph(font, run->chars[i], CACHED_METRICS|CACHED_SDF);
+		if( error ) {
+			status = -1;
+			break;
+		}
+		glyph = font->current;
+		sdf = &glyph->sdf;
+		if ( !sdf->buffer ) {
+			continue;
+		}
+
+		/* The field's top left corner in unscaled text coordinates */
+		gx = run->xpos[i] + glyph->minx - SDF_SPREAD;
+		gy = glyph->yoffset - SDF_SPREAD;
+		x0 = x + Scale_Floor(gx, num, den);
+		x1 = x + Scale_Ceil(gx + sdf->width, num, den);
+		y0 = y + Scale_Floor(gy, num, den);
+		y1 = y + Scale_Ceil(gy + sdf->rows, num, den);
+		if ( x0 < left ) x0 = left;
+		if ( x1 > right ) x1 = right;
+		if ( y0 < top ) y0 = top;
+		if ( y1 > bottom ) y1 = bottom;
+
+		for ( py = y0; x0 < x1 && py < y1; ++py ) {
+			/* 64 bits: pen positions past 32767 don't fit 16.16 */
+			int64_t v = ((((int64_t)2 * (py - y) + 1) * step) >> 1)
+			            - 32768 - (int64_t)gy * 65536;
+			int64_t iy = v >> 16;
+			int fy = (int)(v >> 8) & 0xFF;
+			const uint8_t *r0 = NULL, *r1 = NULL;
+
+			if ( iy >= 0 && iy < sdf->rows ) {
+				r0 = sdf->buffer + iy * sdf->pitch;
+			}
+			if ( iy + 1 >= 0 && iy + 1 < sdf->rows ) {
+				r1 = sdf->buffer + (iy + 1) * sdf->pitch;
+			}
+			for ( px = x0; px < x1; ++px ) {
+				int64_t u = ((((int64_t)2 * (px - x) + 1) * step) >> 1)
+				            - 32768 - (int64_t)gx * 65536;
+				int64_t ix = u >> 16;
+				int fx = (int)(u >> 8) & 0xFF;
+				int a = 0, b = 0, c = 0, d = 0;
+
+				/* Outside the field is as far out as it gets */
+				if ( ix >= 0 && ix < sdf->width ) {
+					if ( r0 ) a = r0[ix];
+					if ( r1 ) c = r1[ix];
+				}
+				if ( ix + 1 >= 0 && ix + 1 < sdf->width ) {
+					if ( r0 ) b = r0[ix + 1];
+					if ( r1 ) d = r1[ix + 1];
+				}
+				a = (a << 8) + (b - a) * fx;
+				c = (c << 8) + (d - c) * fx;
+				coverage[px - x0] = lut[((a << 8) + (c - a) * fy) >> 16];
+			}
+			SDL_ext_blendSpan(dst, x0, py, x1 - x0, coverage,
+			                  fg.r, fg.g, fg.b, 255);
+		}
+	}
+	free(coverage);
+
+	if ( status < 0 ) {
+		SDL_UnlockSurface(dst);
+		return(-1);
+	}
+
+	if( font->style & TTF_STYLE_UNDERLINE ) {
+		TTF_FontUnderline(font, &row, &height);
+		y0 = y + Scale_Floor(row, num, den);
+		y1 = y0 + Scale_Ceil(height, num, den);
+		for ( ; y0 < y1; ++y0 ) {
+			if ( y0 >= top && y0 < bottom ) {
+				SDL_ext_blendSpan(dst, left, y0, right - left, NULL,
+				                  fg.r, fg.g, fg.b, 255);
+			}
+		}
+	}
+	SDL_UnlockSurface(dst);
+
+	SDL_AddDirtyRect(dst, &rect);
+	return(0);
+}
+
+static int Render_SDFTo(TTF_Font *font,
+	const void *text, int encoding, int ptsize, SDL_Color fg,
+	SDL_Surface *dst, int x, int y, const SDL_Rect *clip)
+{
+	int status;
+
+	Lock_Font(font);
+	status = Render_SDFTo_Locked(font, text, encoding, ptsize, fg, dst, x, y, clip);
+	Unlock_Font(font);
+	return status;
+}
+
+int TTF_RenderText_SDFTo(TTF_Font *font,
+	const char *text, int ptsize, SDL_Color fg, SDL_Surface *dst,
+	int x, int y, const SDL_Rect *clip)
+{
+	return Render_SDFTo(font, text, TEXT_LATIN1, ptsize, fg, dst, x, y, clip);
+}
+
+int TTF_RenderUTF8_SDFTo(TTF_Font *font,
+	const char *text, int ptsize, SDL_Color fg, SDL_Surface *dst,
+	int x, int y, const SDL_Rect *clip)
+{
+	return Render_SDFTo(font, text, TEXT_UTF8, ptsize, fg, dst, x, y, clip);
+}
+
+int TTF_RenderUNICODE_SDFTo(TTF_Font *font,
+	const uint16_t *text, int ptsize, SDL_Color fg, SDL_Surface *dst,
+	int x, int y, const SDL_Rect *clip)
+{
+	return Render_SDFTo(font, text, TEXT_UNICODE, ptsize, fg, dst, x, y, clip);
+}
+
+/* Adds a glyph to the line, returns its pen position */
+static int Pen_Add( TTF_Font* font, line_pen* pen, const para_glyph* glyph )
+{
+	int pos, z;
+
+	if ( pen->count ) {
+		pen->x += glyph->kerning;
+	} else if ( glyph->minx < 0 ) {
+		pen->shift = -glyph->minx;
+	}
+	pos = pen->x + pen->shift;
+	z = pen->x + glyph->minx;
+	if ( pen->minx > z ) {
+		pen->minx = z;
+	}
+	if ( font->style & TTF_STYLE_BOLD ) {
+		pen->x += font->glyph_overhang;
+	}
+	if ( glyph->advance > glyph->maxx ) {
+		z = pen->x + glyph->advance;
+	} else {
+		z = pen->x + glyph->maxx;
+	}
+	if ( pen->maxx < z ) {
+		pen->maxx = z;
+	}
+	pen->x += glyph->advance;
+	++pen->count;
+	return pos;
+}
+
+static int Add_Line( TTF_Paragraph* para, const para_glyph* glyphs,
+	int first, int count )
+{
+	para_line* line;
+	line_pen pen;
+	int i;
+
+	if ( para->num_lines == para->max_lines ) {
+		int max_lines = para->max_lines ? para->max_lines * 2 : 16;
+		line = (para_line*)realloc( para->lines, max_lines * sizeof(*line) );
+		if ( !line ) {
+			fprintf(stderr, "%s\n", "Out of memory");
+			return -1;
+		}
+		para->lines = line;
+		para->max_lines = max_lines;
+	}
+	line = &para->lines[para->num_lines++];
+	memset( &pen, 0, sizeof(pen) );
+	for ( i = first; i < first + count; ++i ) {
+		para->xpos[i] = Pen_Add( para->font, &pen, &glyphs[i] );
+	}
+	line->first = first;
+	line->count = count;
+	line->x = 0;
+	line->width = pen.maxx - pen.minx;
+	line->end = pen.x + pen.shift;
+	return 0;
+}
+
+/* Greedy line breaking, at the last run of spaces that fits, inside a
+   word that is wider than the line on its own, and at newlines.
+ */
+static int Break_Lines( TTF_Paragraph* para, const para_glyph* glyphs, int width )
+{
+	TTF_Font* font = para->font;
+	line_pen pen, trial;
+	int start, brk, brk_end;
+	int i, n;
+	uint32_t c;
+
+	n = para->num_glyphs;
+	memset( &pen, 0, sizeof(pen) );
+	start = 0;
+	brk = brk_end = -1;
+	for ( i = 0; i <= n; ) {
+		c = (i < n) ? para->chars[i] : '\n';
+		if ( c == '\n' || (c == '\r' && i + 1 < n && para->chars[i+1] == '\n') ) {
+			if ( Add_Line( para, glyphs, start, pen.count ) < 0 ) {
+				return -1;
+			}
+			i += (c == '\r') ? 2 : 1;
+			start = i;
+			memset( &pen, 0, sizeof(pen) );
+			brk = brk_end = -1;
+			continue;
+		}
+		if ( c == ' ' ) {
+			/* Spaces can hang past the end of the line */
+			if ( brk_end != i ) {
+				brk = i;
+			}
+			Pen_Add( font, &pen, &glyphs[i] );
+			brk_end = ++i;
+			continue;
+		}
+		trial = pen;
+		Pen_Add( font, &trial, &glyphs[i] );
+		if ( width > 0 && pen.count > 0 && trial.maxx - trial.minx > width ) {
+			if ( brk > start ) {
+				/* Wrap the word after the spaces */
+				if ( Add_Line( para, glyphs, start, brk - start ) < 0 ) {
+					return -1;
+				}
+				start = brk_end;
+			} else {
+				if ( Add_Line( para, glyphs, start, pen.count ) < 0 ) {
+					return -1;
+				}
+				start = i;
+			}
+			memset( &pen, 0, sizeof(pen) );
+			for ( brk = start; brk < i; ++brk ) {
+				Pen_Add( font, &pen, &glyphs[brk] );
+			}
+			brk = brk_end = -1;
+			continue;
+		}
+		pen = trial;
+		++i;
+	}
+	return 0;
+}
+
+static TTF_Paragraph* Layout_Paragraph( TTF_Font* font, const char* text,
+	int width, int align )
+{
+	TTF_Paragraph* para;
+	para_glyph* glyphs;
+	text_reader reader;
+	c_glyph* glyph;
+	FT_UInt prev_index;
+	FT_Error error;
+	FT_Long use_kerning;
+	uint32_t c;
+	int i, n, x;
+
+	if ( ! TTF_initialized ) {
+		fprintf(stderr, "%s\n", "Library not initialized" );
+		return NULL;
+	}
+	Start_Text( &reader, text, TEXT_UTF8 );
+	for ( n = 0; Read_Char( &reader ) != 0; ++n ) {
+	}
+
+	para = (TTF_Paragraph*)malloc( sizeof(*para) );
+	if ( !para ) {
+		fprintf(stderr, "%s\n", "Out of memory");
+		return NULL;
+	}
+	memset( para, 0, sizeof(*para) );
+	para->font = font;
+	para->style = font->style;
+	para->lineskip = font->lineskip;
+	para->num_glyphs = n;
+	para->chars = (uint32_t*)malloc( (n + 1) * sizeof(*para->chars) );
+	para->offsets = (int*)malloc( (n + 1) * sizeof(*para->offsets) );
+	para->xpos = (int*)malloc( (n + 1) * sizeof(*para->xpos) );
+	glyphs = (para_glyph*)malloc( (n + 1) * sizeof(*glyphs) );
+	if ( !para->chars || !para->offsets || !para->xpos || !glyphs ) {
+		fprintf(stderr, "%s\n", "Out of memory");
+		goto error;
+	}
+
+	use_kerning = FT_HAS_KERNING( font->face );
+	prev_index = 0;
+	Start_Text( &reader, text, TEXT_UTF8 );
+	for ( i = 0; i < n; ++i ) {
+		para->offsets[i] = (int)((const char*)reader.next - text);
+		c = Read_Char( &reader );
+		para->chars[i] = c;
+		memset( &glyphs[i], 0, sizeof(glyphs[i]) );
+		if ( c == '\n' || c == '\r' ) {
+			prev_index = 0;
+			continue;
+		}
+		error = Find_Glyph( font, c, CACHED_METRICS );
+		if ( error ) {
+			TTF_SetFTError( "Couldn't find glyph", error );
+			goto error;
+		}
+		glyph = font->current;
+		glyphs[i].minx = glyph->minx;
+		glyphs[i].maxx = glyph->maxx;
+		glyphs[i].advance = glyph->advance;
+		if ( use_kerning && prev_index && glyph->index ) {
+			FT_Vector delta;
+			FT_Get_Kerning( font->face, prev_index, glyph->index, ft_kerning_default, &delta );
+			glyphs[i].kerning = delta.x >> 6;
+		}
+		prev_index = glyph->index;
+	}
+	para->offsets[n] = (int)((const char*)reader.next - text);
+
+	if ( Break_Lines( para, glyphs, width ) < 0 ) {
+		goto error;
+	}
+	free( glyphs );
+
+	/* Align in the wrapping width, or the widest line without one */
+	if ( width <= 0 ) {
+		for ( i = 0; i < para->num_lines; ++i ) {
+			if ( width < para->lines[i].width ) {
+				width = para->lines[i].width;
+			}
+		}
+	}
+	for ( i = 0; i < para->num_lines; ++i ) {
+		para_line* line = &para->lines[i];
+
+		x = 0;
+		if ( align == TTF_ALIGN_CENTER ) {
+			x = (width - line->width) / 2;
+		} else if ( align == TTF_ALIGN_RIGHT ) {
+			x = width - line->width;
+		}
+		line->x = (x > 0) ? x : 0;
+		if ( para->width < line->x + line->width ) {
+			para->width = line->x + line->width;
+		}
+	}
+	para->height = (para->num_lines - 1) * font->lineskip + font->height;
+	return para;
+
+error:
+	free( glyphs );
+	TTF_FreeParagraph( para );
+	return NULL;
+}
+
+TTF_Paragraph* TTF_LayoutParagraph( TTF_Font* font, const char* text,
+	int width, int align )
+{
+	TTF_Paragraph* para;
+
+	Lock_Font( font );
+	para = Layout_Paragraph( font, text, width, align );
+	Unlock_Font( font );
+	return para;
+}
+
+void TTF_SizeParagraph( TTF_Paragraph* para, int* w, int* h )
+{
+	if ( w ) {
+		*w = para->width;
+	}
+	if ( h ) {
+		*h = para->height;
+	}
+}
+
+int TTF_ParagraphLines( TTF_Paragraph* para )
+{
+	return para->num_lines;
+}
+
+static int Render_Paragraph_Locked( TTF_Paragraph* para, SDL_Color fg,
+	SDL_Surface* dst, int x, int y, const SDL_Rect* clip )
+{
+	TTF_Font* font = para->font;
+	para_line* line;
+	SDL_Rect box;
+	int i, status;
+
+	if ( dst == NULL ) {
+		fprintf(stderr, "%s\n", "Passed a NULL surface");
+		return(-1);
+	}
+	if ( dst->format->BytesPerPixel != 2 && dst->format->BytesPerPixel != 4 ) {
+		fprintf(stderr, "%s\n", "Only 16 and 32-bit surfaces are supported");
+		return(-1);
+	}
+	if ( ! Clip_Text(dst, clip, x, y, para->width, para->height, &box) ) {
+		return(0);
+	}
+	if ( SDL_LockSurface(dst) < 0 ) {
+		return(-1);
+	}
+	status = 0;
+	for ( i = 0; status == 0 && i < para->num_lines; ++i ) {
+		SDL_Rect linebox;
+		int ly = y + i * para->lineskip;
+
+		line = &para->lines[i];
+		if ( ! Clip_Text(dst, &box, x + line->x, ly, line->width,
+		                 font->height, &linebox) ) {
+			continue;
+		}
+		status = Blend_Glyphs(font, para->chars + line->first,
+		                      para->xpos + line->first, line->count,
+		                      fg, dst, x + line->x, ly, &linebox);
+		if ( status == 0 && (font->style & TTF_STYLE_UNDERLINE) ) {
+			Blend_Underline(font, fg, dst, ly, linebox.w, &linebox);
+		}
+	}
+	SDL_UnlockSurface(dst);
+	if ( status < 0 ) {
+		return(-1);
+	}
+	SDL_AddDirtyRect(dst, &box);
+	return(0);
+}
+
+int TTF_RenderParagraph_BlendedTo( TTF_Paragraph* para, SDL_Color fg,
+	SDL_Surface* dst, int x, int y, const SDL_Rect* clip )
+{
+	TTF_Font* font = para->font;
+	int style, status;
+
+	/* Draw with the style the paragraph was laid out in */
+	Lock_Font( font );
+	style = font->style;
+	font->style = para->style;
+	status = Render_Paragraph_Locked( para, fg, dst, x, y, clip );
+	font->style = style;
+	Unlock_Font( font );
+	return status;
+}
+
+int TTF_ParagraphHitTest( TTF_Paragraph* para, int x, int y )
+{
+	para_line* line;
+	int i, left, right;
+
+	i = (y < 0) ? 0 : y / para->lineskip;
+	if ( i >= para->num_lines ) {
+		i = para->num_lines - 1;
+	}
+	line = &para->lines[i];
+	x -= line->x;
+	for ( i = line->first; i < line->first + line->count; ++i ) {
+		left = para->xpos[i];
+		if ( i + 1 < line->first + line->count ) {
+			right = para->xpos[i+1];
+		} else {
+			right = line->end;
+		}
+		if ( x < (left + right) / 2 ) {
+			return para->offsets[i];
+		}
+	}
+	return para->offsets[i];
+}
+
+int TTF_ParagraphCaret( TTF_Paragraph* para, int offset, int* x, int* y )
+{
+	para_line* line;
+	int i, k;
+
+	if ( offset < 0 || offset > para->offsets[para->num_glyphs] ) {
+		fprintf(stderr, "%s\n", "Offset is outside the text");
+		return -1;
+	}
+	for ( k = para->num_lines - 1; k > 0; --k ) {
+		if ( para->offsets[para->lines[k].first] <= offset ) {
+			break;
+		}
+	}
+	line = &para->lines[k];
+	for ( i = line->first; i < line->first + line->count; ++i ) {
+		if ( para->offsets[i] >= offset ) {
+			break;
+		}
+	}
+	if ( x ) {
+		*x = line->x + ((i < line->first + line->count) ? para->xpos[i] : line->end);
+	}
+	if ( y ) {
+		*y = k * para->lineskip;
+	}
+	return 0;
+}
+
+void TTF_FreeParagraph( TTF_Paragraph* para )
+{
+	if ( para ) {
+		free( para->chars );
+		free( para->offsets );
+		free( para->xpos );
+		free( para->lines );
+		free( para );
+	}
+}
+
 void TTF_SetFontStyle( TTF_Font* font, int style )
 {
+	/* Glyphs are cached per style, nothing to flush */
+	Lock_Font( font );
 	font->style = style;
-	Flush_Cache( font );
+	Unlock_Font( font );
 }
 
 int TTF_GetFontStyle( TTF_Font* font )
@@ -1503,12 +3439,229 @@ int TTF_GetFontStyle( TTF_Font* font )
 	return font->style;
 }
 
+void TTF_SetGlyphCacheBudget( TTF_Font* font, size_t bytes )
+{
+	Lock_Font( font );
+	font->cache_budget = bytes;
+	font->current = NULL;
+	Trim_Cache( font, font->cache_budget );
+	Unlock_Font( font );
+}
+
+void TTF_FlushGlyphCache( TTF_Font* font )
+{
+	Lock_Font( font );
+	Flush_Runs( font );
+	Flush_Cache( font );
+	Unlock_Font( font );
+}
+
+void TTF_SetRenderCache( TTF_Font* font, int enable )
+{
+	int i;
+
+	Lock_Font( font );
+	font->render_cache = enable;
+	if ( !enable && font->runs ) {
+		for ( i = 0; i < RUN_CACHE_SLOTS; ++i ) {
+			if ( font->runs[i].surface ) {
+				SDL_FreeSurface( font->runs[i].surface );
+				font->runs[i].surface = NULL;
+			}
+		}
+	}
+	Unlock_Font( font );
+}
+
+void TTF_GetGlyphCacheStats( TTF_Font* font, TTF_GlyphCacheStats* stats )
+{
+	if ( stats ) {
+		Lock_Font( font );
+		*stats = font->cache_stats;
+		stats->budget = font->cache_budget;
+		Unlock_Font( font );
+	}
+}
+
+/* Load_Glyph renders one kind of pixels per call, so ask for each */
+static FT_Error Precache_Glyph( TTF_Font* font, uint32_t ch, int modes )
+{
+	FT_Error error;
+
+	error = Find_Glyph( font, ch, CACHED_METRICS );
+	if ( !error && (modes & TTF_PRECACHE_SOLID) ) {
+		error = Find_Glyph( font, ch, CACHED_METRICS|CACHED_BITMAP );
+	}
+	if ( !error && (modes & TTF_PRECACHE_PIXELS) ) {
+		error = Find_Glyph( font, ch, CACHED_METRICS|CACHED_PIXMAP );
+	}
+	if ( !error && (modes & TTF_PRECACHE_SDF) ) {
+		error = Find_Glyph( font, ch, CACHED_METRICS|CACHED_SDF );
+	}
+	return error;
+}
+
+/* The font lock is taken for one glyph at a time, and the job's style
+   swapped in meanwhile, so renderers on other threads slot in between */
+static int Run_Precache( precache_job* job )
+{
+	TTF_Font* font = job->font;
+	text_reader reader;
+	uint32_t start, ch, next;
+	int saved, more, cancel = 0, count = 0;
+	FT_Error error = 0;
+
+	start = SDL_GetTicks();
+	if ( job->text ) {
+		Start_Text( &reader, job->text, TEXT_UTF8 );
+		more = 1;
+	} else {
+		more = (job->first <= job->last);
+	}
+	next = job->first;
+	while ( more ) {
+		if ( job->text ) {
+			ch = Read_Char( &reader );
+			if ( !ch ) {
+				break;
+			}
+		} else {
+			ch = next++;
+			more = (ch != job->last);
+		}
+		Lock_Font( font );
+		cancel = job->cancel;
+		if ( !cancel &&
+		     (job->text || FT_Get_Char_Index( font->face, ch )) ) {
+			saved = font->style;
+			font->style = job->style;
+			error = Precache_Glyph( font, ch, job->modes );
+			font->style = saved;
+			if ( !error ) {
+				++count;
+			}
+		}
+		Unlock_Font( font );
+		if ( cancel || error ) {
+			break;
+		}
+	}
+	Lock_Font( font );
+	font->cache_stats.precached += count;
+	font->cache_stats.precache_ms += SDL_GetTicks() - start;
+	Unlock_Font( font );
+	if ( error ) {
+		TTF_SetFTError( "Couldn't precache glyph", error );
+		return -1;
+	}
+	return count;
+}
+
+static void Init_Precache( precache_job* job, TTF_Font* font, int modes )
+{
+	memset( job, 0, sizeof(*job) );
+	job->font = font;
+	job->modes = modes;
+	Lock_Font( font );
+	job->style = font->style;
+	Unlock_Font( font );
+}
+
+int TTF_PrecacheRange( TTF_Font* font, uint32_t first, uint32_t last, int modes )
+{
+	precache_job job;
+
+	Init_Precache( &job, font, modes );
+	job.first = first;
+	job.last = last;
+	return Run_Precache( &job );
+}
+
+int TTF_PrecacheString( TTF_Font* font, const char* text, int modes )
+{
+	precache_job job;
+
+	Init_Precache( &job, font, modes );
+	job.text = (char*)text;
+	return Run_Precache( &job );
+}
+
+static void* Precache_Thread( void* data )
+{
+	precache_job* job = (precache_job*)data;
+
+	job->count = Run_Precache( job );
+	return NULL;
+}
+
+static int Start_Precache( TTF_Font* font, precache_job* job )
+{
+	TTF_WaitPrecache( font );
+#if TTF_USE_LOCK
+	if ( pthread_create( &job->thread, NULL, Precache_Thread, job ) != 0 ) {
+		fprintf(stderr, "%s\n", "Couldn't start precache thread");
+		free( job );
+		return -1;
+	}
+#else
+	Precache_Thread( job );
+#endif
+	font->precache = job;
+	return 0;
+}
+
+int TTF_PrecacheRangeAsync( TTF_Font* font, uint32_t first, uint32_t last, int modes )
+{
+	precache_job* job;
+
+	job = (precache_job*)malloc( sizeof(*job) );
+	if ( job == NULL ) {
+		fprintf(stderr, "%s\n", "Out of memory");
+		return -1;
+	}
+	Init_Precache( job, font, modes );
+	job->first = first;
+	job->last = last;
+	return Start_Precache( font, job );
+}
+
+int TTF_PrecacheStringAsync( TTF_Font* font, const char* text, int modes )
+{
+	precache_job* job;
+
+	/* The caller's string may be gone before the thread is done */
+	job = (precache_job*)malloc( sizeof(*job) + strlen(text) + 1 );
+	if ( job == NULL ) {
+		fprintf(stderr, "%s\n", "Out of memory");
+		return -1;
+	}
+	Init_Precache( job, font, modes );
+	job->text = (char*)(job + 1);
+	strcpy( job->text, text );
+	return Start_Precache( font, job );
+}
+
+int TTF_WaitPrecache( TTF_Font* font )
+{
+	precache_job* job = font->precache;
+	int count;
+
+	if ( job == NULL ) {
+		return 0;
+	}
+#if TTF_USE_LOCK
+	pthread_join( job->thread, NULL );
+#endif
+	count = job->count;
+	font->precache = NULL;
+	free( job );
+	return count;
+}
+
 void TTF_Quit( void )
 {
 	if ( TTF_initialized ) {
-		if ( --TTF_initialized == 0 ) {
-			FT_Done_FreeType( library );
-		}
+		--TTF_initialized;
 	}
 }
 
@@ -66,6 +66,13 @@ extern int TTF_Init(void);
 extern TTF_Font * TTF_OpenFont(const char *file, int ptsize);
 extern TTF_Font * TTF_OpenFontIndex(const char *file, int ptsize, long index);
 
+/* Fonts can be shared between threads, calls on one font are serialised.
+   To render in parallel open a copy of the font for each thread, it has
+   its own glyph cache and FreeType instance but shares the font file
+   data with the original.
+ */
+extern TTF_Font * TTF_CloneFont(TTF_Font *font);
+
 #define TTF_STYLE_NORMAL	0x00
 #define TTF_STYLE_BOLD		0x01
 #define TTF_STYLE_ITALIC	0x02
@@ -82,20 +89,117 @@ extern int TTF_FontDescent(TTF_Font *font);
 
 extern int TTF_FontLineSkip(TTF_Font *font);
 
+/* The size the font was opened with */
+extern int TTF_FontPtSize(TTF_Font *font);
+
 extern long TTF_FontFaces(TTF_Font *font);
 
 extern int TTF_FontFaceIsFixedWidth(TTF_Font *font);
 extern char * TTF_FontFaceFamilyName(TTF_Font *font);
 extern char * TTF_FontFaceStyleName(TTF_Font *font);
 
+/* Per font glyph cache, the default budget is 2MB */
+typedef struct TTF_GlyphCacheStats {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+	int glyphs;
+	size_t bytes;
+	size_t budget;
+	unsigned int run_hits;		/* strings found already laid out */
+	unsigned int run_misses;
+	unsigned int precached;		/* glyphs loaded ahead of time */
+	unsigned int precache_ms;	/* time spent loading them */
+} TTF_GlyphCacheStats;
+
+extern void TTF_SetGlyphCacheBudget(TTF_Font *font, size_t bytes);
+extern void TTF_FlushGlyphCache(TTF_Font *font);
+extern void TTF_GetGlyphCacheStats(TTF_Font *font, TTF_GlyphCacheStats *stats);
+
+/* Keep the last surface rendered for each recently used string and hand
+   it out again, with its refcount raised, while the text, style and
+   colours stay the same.  Those surfaces are shared, don't draw on them.
+   Off by default.
+ */
+extern void TTF_SetRenderCache(TTF_Font *font, int enable);
+
+/* Load glyphs into the cache ahead of time, in the current style, so the
+   first string using them doesn't stall on FreeType.  modes says which
+   renderers to get ready for, 0 loads the metrics only.  Code points the
+   font has no glyph for are skipped by the range but not by the string,
+   which caches whatever its characters render as.  Anything over the
+   cache budget pushes out the glyphs loaded first.  Both return the
+   number of glyphs loaded, or -1 on error, and add the time taken to
+   the precache_ms count in TTF_GlyphCacheStats.
+ */
+#define TTF_PRECACHE_SOLID	0x01	/* TTF_Render*_Solid */
+#define TTF_PRECACHE_PIXELS	0x02	/* Shaded, Blended and TTF_GetGlyph */
+#define TTF_PRECACHE_SDF	0x04	/* *_SDFTo */
+
+extern int TTF_PrecacheRange(TTF_Font *font, uint32_t first, uint32_t last, int modes);
+extern int TTF_PrecacheString(TTF_Font *font, const char *text, int modes);
+
+/* The same on a background thread, one job per font at a time.  The font
+   lock is taken glyph by glyph, so other threads keep rendering with it
+   meanwhile.  TTF_WaitPrecache() returns the number of glyphs the last
+   job loaded, 0 if there was none, and TTF_CloseFont() stops a job still
+   running.  Without thread support the job runs before returning.
+ */
+extern int TTF_PrecacheRangeAsync(TTF_Font *font, uint32_t first, uint32_t last, int modes);
+extern int TTF_PrecacheStringAsync(TTF_Font *font, const char *text, int modes);
+extern int TTF_WaitPrecache(TTF_Font *font);
+
 extern int TTF_GlyphMetrics(TTF_Font *font, uint16_t ch,
 	int *minx, int *maxx,
     int *miny, int *maxy, int *advance);
 
+/* Cached glyph data for renderers outside SDL_ttf (e.g. a GL atlas),
+   ch is a code point from any plane.  The pixels are 8-bit coverage and
+   point into the glyph cache, so a successful TTF_GetGlyph() keeps the
+   font locked until TTF_ReleaseGlyph().  Don't call other functions on
+   the same font in between.
+ */
+typedef struct TTF_GlyphInfo {
+	int index;		/* for TTF_GetKerning() */
+	int minx, maxx;
+	int miny, maxy;
+	int yoffset;		/* first pixel row below the top of the line */
+	int advance;
+	int overhang;		/* extra advance for the bold style */
+	int width, rows, pitch;
+	const uint8_t *pixels;	/* NULL unless pixels were asked for */
+	int padding;		/* border around the distance field */
+} TTF_GlyphInfo;
+
+/* What TTF_GetGlyph() returns in pixels: nothing, coverage or a signed
+   distance field, where 128 is the outline and every TTF_SDF_SPREAD
+   pixels further in or out moves the value by 127.  The field starts
+   padding pixels left of minx and above yoffset.
+ */
+#define TTF_GLYPH_METRICS	0
+#define TTF_GLYPH_PIXELS	1
+#define TTF_GLYPH_SDF		2
+#define TTF_SDF_SPREAD		4
+
+extern int TTF_GetGlyph(TTF_Font *font, uint32_t ch, int pixels, TTF_GlyphInfo *info);
+extern void TTF_ReleaseGlyph(TTF_Font *font);
+/* Returns the code point at *text and steps past it, or 0 at the end.
+   Malformed sequences come back as U+FFFD.
+ */
+extern uint32_t TTF_DecodeUTF8(const char **text);
+extern int TTF_GetKerning(TTF_Font *font, int prev_index, int index);
+/* Returns non-zero if the underline style is set */
+extern int TTF_FontUnderline(TTF_Font *font, int *offset, int *height);
+
 extern int TTF_SizeText(TTF_Font *font, const char *text, int *w, int *h);
 extern int TTF_SizeUTF8(TTF_Font *font, const char *text, int *w, int *h);
 extern int TTF_SizeUNICODE(TTF_Font *font, const uint16_t *text, int *w, int *h);
 
+/* The size of the text drawn at ptsize by the *_SDFTo functions */
+extern int TTF_SizeText_Scaled(TTF_Font *font, const char *text, int ptsize, int *w, int *h);
+extern int TTF_SizeUTF8_Scaled(TTF_Font *font, const char *text, int ptsize, int *w, int *h);
+extern int TTF_SizeUNICODE_Scaled(TTF_Font *font, const uint16_t *text, int ptsize, int *w, int *h);
+
 extern SDL_Surface * TTF_RenderText_Solid(TTF_Font *font,
 	const char *text, SDL_Color fg);
 extern SDL_Surface * TTF_RenderUTF8_Solid(TTF_Font *font,
@@ -126,6 +230,63 @@ extern SDL_Surface * TTF_RenderUNICODE_Blended(TTF_Font *font,
 extern SDL_Surface * TTF_RenderGlyph_Blended(TTF_Font *font,
 	uint16_t ch, SDL_Color fg);
 
+/* Blend anti-aliased text straight into an existing 16 or 32-bit surface,
+   with the top left of the text at (x, y), instead of allocating a new
+   surface for it.  Drawing is limited to the clip rectangle, or the
+   surface clip rectangle if it is NULL, and the destination alpha is kept.
+   Returns 0, or -1 on error.
+ */
+extern int TTF_RenderText_BlendedTo(TTF_Font *font,
+	const char *text, SDL_Color fg, SDL_Surface *dst, int x, int y,
+	const SDL_Rect *clip);
+extern int TTF_RenderUTF8_BlendedTo(TTF_Font *font,
+	const char *text, SDL_Color fg, SDL_Surface *dst, int x, int y,
+	const SDL_Rect *clip);
+extern int TTF_RenderUNICODE_BlendedTo(TTF_Font *font,
+	const uint16_t *text, SDL_Color fg, SDL_Surface *dst, int x, int y,
+	const SDL_Rect *clip);
+
+/* Like the *_BlendedTo functions, but the text is drawn at any ptsize
+   from distance fields made once at the size the font was opened with,
+   so one font and one glyph cache serve every size.  Open the font at
+   the largest size in use, edges soften when scaled up much further.
+ */
+extern int TTF_RenderText_SDFTo(TTF_Font *font,
+	const char *text, int ptsize, SDL_Color fg, SDL_Surface *dst,
+	int x, int y, const SDL_Rect *clip);
+extern int TTF_RenderUTF8_SDFTo(TTF_Font *font,
+	const char *text, int ptsize, SDL_Color fg, SDL_Surface *dst,
+	int x, int y, const SDL_Rect *clip);
+extern int TTF_RenderUNICODE_SDFTo(TTF_Font *font,
+	const uint16_t *text, int ptsize, SDL_Color fg, SDL_Surface *dst,
+	int x, int y, const SDL_Rect *clip);
+
+/* Word wrapped UTF-8 text.  The layout keeps its own copy of the glyphs
+   and their positions, so it can be measured, drawn and hit tested as
+   often as needed.  Lines break at runs of spaces, inside words wider
+   than the line and at newlines, a width <= 0 only breaks at newlines.
+   It is drawn with the font and style it was laid out with, free it
+   before closing the font.
+ */
+#define TTF_ALIGN_LEFT		0
+#define TTF_ALIGN_CENTER	1
+#define TTF_ALIGN_RIGHT		2
+
+typedef struct _TTF_Paragraph TTF_Paragraph;
+
+extern TTF_Paragraph * TTF_LayoutParagraph(TTF_Font *font,
+	const char *text, int width, int align);
+extern void TTF_SizeParagraph(TTF_Paragraph *para, int *w, int *h);
+extern int TTF_ParagraphLines(TTF_Paragraph *para);
+extern int TTF_RenderParagraph_BlendedTo(TTF_Paragraph *para,
+	SDL_Color fg, SDL_Surface *dst, int x, int y, const SDL_Rect *clip);
+/* Byte offset in the text of the caret position nearest (x, y), which
+   are relative to the top left corner of the paragraph */
+extern int TTF_ParagraphHitTest(TTF_Paragraph *para, int x, int y);
+/* Where the caret goes for a byte offset in the text */
+extern int TTF_ParagraphCaret(TTF_Paragraph *para, int offset, int *x, int *y);
+extern void TTF_FreeParagraph(TTF_Paragraph *para);
+
 #define TTF_RenderText(font, text, fg, bg)	\
 	TTF_RenderText_Shaded(font, text, fg, bg)
 #define TTF_RenderUTF8(font, text, fg, bg)	\
@@ -0,0 +1,337 @@
+/*
+    SDL - Simple DirectMedia Layer
+    Copyright (C) 1997-2012 Sam Lantinga
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Sam Lantinga
+    slouken@libsdl.org
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <memory.h>
+#include <string.h>
+#include "SDL_video.h"
+
+/* There is no video driver in this port: the "screen" is an ordinary
+   software surface that the GLUT display callback uploads as a texture.
+   SDL_UpdateRects() therefore doesn't push pixels anywhere, it records
+   which parts of the surface changed, and the display path consumes the
+   list with SDL_GetDirtyRects() / SDL_ClearDirtyRects().
+   SDL_UpperBlit(), SDL_FillRect() and the SDL_ext_draw* primitives add
+   to the list automatically once tracking is enabled on a surface.
+ */
+
+/* Maximum number of separate rectangles kept per surface */
+#define DIRTY_MAXRECTS	64
+
+/* Fixed cost of presenting one more rectangle, expressed in pixels.
+   Two rectangles are merged into their bounding box when the pixels
+   wasted by the union cost less than presenting them separately.
+ */
+#define DIRTY_RECTCOST	1024
+
+struct private_dirty {
+	int numrects;
+	SDL_Rect rects[DIRTY_MAXRECTS];
+};
+
+static inline int Dirty_Area(const SDL_Rect *r)
+{
+	return (int)r->w * (int)r->h;
+}
+
+static inline void Dirty_Union(const SDL_Rect *a, const SDL_Rect *b,
+				SDL_Rect *u)
+{
+	int x1, y1, x2, y2;
+
+	x1 = a->x < b->x ? a->x : b->x;
+	y1 = a->y < b->y ? a->y : b->y;
+	x2 = (a->x + a->w) > (b->x + b->w) ? (a->x + a->w) : (b->x + b->w);
+	y2 = (a->y + a->h) > (b->y + b->h) ? (a->y + a->h) : (b->y + b->h);
+	u->x = x1;
+	u->y = y1;
+	u->w = x2 - x1;
+	u->h = y2 - y1;
+}
+
+int SDL_EnableDirtyRects(SDL_Surface *surface, int enable)
+{
+	if ( ! surface ) {
+		return(-1);
+	}
+	if ( ! enable ) {
+		if ( surface->dirty ) {
+			free(surface->dirty);
+			surface->dirty = NULL;
+		}
+		return(0);
+	}
+	if ( surface->dirty == NULL ) {
+		surface->dirty = (struct private_dirty *)malloc(
+					sizeof(*surface->dirty));
+		if ( surface->dirty == NULL ) {
+			fprintf(stderr, "Out of memory\n");
+			return(-1);
+		}
+		/* Everything is dirty until the first present */
+		surface->dirty->numrects = 1;
+		surface->dirty->rects[0].x = 0;
+		surface->dirty->rects[0].y = 0;
+		surface->dirty->rects[0].w = surface->w;
+		surface->dirty->rects[0].h = surface->h;
+	}
+	return(0);
+}
+
+void SDL_AddDirtyRect(SDL_Surface *surface, const SDL_Rect *rect)
+{
+	struct private_dirty *dirty;
+	SDL_Rect r, u;
+	int x1, y1, x2, y2;
+	int i, best, bestcost, cost;
+
+	if ( ! surface || ! (dirty = surface->dirty) ) {
+		return;
+	}
+
+	/* Clip to the surface, a NULL rectangle means all of it */
+	if ( rect ) {
+		x1 = rect->x;
+		y1 = rect->y;
+		x2 = x1 + rect->w;
+		y2 = y1 + rect->h;
+		if ( x1 < 0 ) x1 = 0;
+		if ( y1 < 0 ) y1 = 0;
+		if ( x2 > surface->w ) x2 = surface->w;
+		if ( y2 > surface->h ) y2 = surface->h;
+		if ( x1 >= x2 || y1 >= y2 ) {
+			return;
+		}
+	} else {
+		x1 = y1 = 0;
+		x2 = surface->w;
+		y2 = surface->h;
+	}
+	r.x = x1;
+	r.y = y1;
+	r.w = x2 - x1;
+	r.h = y2 - y1;
+
+	/* Merge with any rectangle where the union is cheaper than keeping
+	   both, then retry with the grown rectangle since it may now be
+	   worth merging with one we already passed.
+	 */
+	i = 0;
+	while ( i < dirty->numrects ) {
+		Dirty_Union(&dirty->rects[i], &r, &u);
+		if ( Dirty_Area(&u) <= Dirty_Area(&dirty->rects[i]) +
+					Dirty_Area(&r) + DIRTY_RECTCOST ) {
+			r = u;
+			dirty->rects[i] = dirty->rects[--dirty->numrects];
+			i = 0;
+			continue;
+		}
+		++i;
+	}
+
+	if ( dirty->numrects < DIRTY_MAXRECTS ) {
+		dirty->rects[dirty->numrects++] = r;
+		return;
+	}
+
+	/* Out of slots, fold it into the rectangle that grows the least */
+	best = 0;
+	bestcost = 0x7FFFFFFF;
+	for ( i = 0; i < dirty->numrects; ++i ) {
+		Dirty_Union(&dirty->rects[i], &r, &u);
+		cost = Dirty_Area(&u) - Dirty_Area(&dirty->rects[i]);
+		if ( cost < bestcost ) {
+			bestcost = cost;
+			best = i;
+		}
+	}
+	Dirty_Union(&dirty->rects[best], &r, &u);
+	dirty->rects[best] = dirty->rects[--dirty->numrects];
+	SDL_AddDirtyRect(surface, &u);
+}
+
+int SDL_GetDirtyRects(SDL_Surface *surface, SDL_Rect **rects)
+{
+	if ( ! surface || ! surface->dirty ) {
+		if ( rects ) {
+			*rects = NULL;
+		}
+		return(-1);
+	}
+	if ( rects ) {
+		*rects = surface->dirty->rects;
+	}
+	return(surface->dirty->numrects);
+}
+
+void SDL_ClearDirtyRects(SDL_Surface *surface)
+{
+	if ( surface && surface->dirty ) {
+		surface->dirty->numrects = 0;
+	}
+}
+
+void SDL_UpdateRects(SDL_Surface *screen, int numrects, SDL_Rect *rects)
+{
+	int i;
+
+	if ( ! screen ) {
+		return;
+	}
+	if ( ! screen->dirty ) {
+		if ( SDL_EnableDirtyRects(screen, 1) < 0 ) {
+			return;
+		}
+		/* Enabling already marked the whole surface */
+		return;
+	}
+	for ( i = 0; i < numrects; ++i ) {
+		SDL_AddDirtyRect(screen, &rects[i]);
+	}
+}
+
+void SDL_UpdateRect(SDL_Surface *screen, int32_t x, int32_t y, uint32_t w, uint32_t h)
+{
+	if ( screen ) {
+		SDL_Rect rect;
+
+		/* Perform some checking */
+		if ( w == 0 )
+			w = screen->w;
+		if ( h == 0 )
+			h = screen->h;
+		if ( (int)(x+w) > screen->w )
+			return;
+		if ( (int)(y+h) > screen->h )
+			return;
+
+		/* Fill the rectangle */
+		rect.x = (int16_t)x;
+		rect.y = (int16_t)y;
+		rect.w = (uint16_t)w;
+		rect.h = (uint16_t)h;
+		SDL_UpdateRects(screen, 1, &rect);
+	}
+}
+
+/* Defined in SDL_surface.c */
+extern SDL_PixelFormat *SDL_AllocFormat(int bpp,
+			uint32_t Rmask, uint32_t Gmask, uint32_t Bmask, uint32_t Amask);
+extern void SDL_FreeFormat(SDL_PixelFormat *format);
+
+static SDL_Surface *SDL_VideoSurface = NULL;
+
+void SDL_SetVideoSurface(SDL_Surface *screen)
+{
+	SDL_VideoSurface = screen;
+}
+
+SDL_Surface * SDL_GetVideoSurface(void)
+{
+	return(SDL_VideoSurface);
+}
+
+/*
+ * Convert a surface into the video pixel format.
+ */
+SDL_Surface * SDL_DisplayFormat (SDL_Surface *surface)
+{
+	SDL_Surface *converted;
+	uint32_t flags;
+
+	if ( ! SDL_VideoSurface ) {
+		fprintf(stderr, "%s\n", "No video mode has been set");
+		return(NULL);
+	}
+	/* Set the flags appropriate for copying to display surface */
+	flags = SDL_SWSURFACE;
+	flags |= (surface->flags & (SDL_SRCCOLORKEY|SDL_SRCALPHA|SDL_RLEACCELOK));
+	converted = SDL_ConvertSurface(surface, SDL_VideoSurface->format, flags);
+
+	/* The screen of this port has an alpha channel, which would make
+	   every copy of an opaque surface blend instead of copy */
+	if ( converted && !(surface->flags & SDL_SRCALPHA) ) {
+		SDL_SetAlpha(converted, 0, 0);
+	}
+	return(converted);
+}
+
+/*
+ * Convert a surface into a format that's suitable for blitting to
+ * the screen, but including an alpha channel.
+ */
+SDL_Surface * SDL_DisplayFormatAlpha (SDL_Surface *surface)
+{
+	SDL_PixelFormat *vf;
+	SDL_PixelFormat *format;
+	SDL_Surface *converted;
+	uint32_t flags;
+	/* default to ARGB8888 */
+	uint32_t amask = 0xff000000;
+	uint32_t rmask = 0x00ff0000;
+	uint32_t gmask = 0x0000ff00;
+	uint32_t bmask = 0x000000ff;
+
+	if ( ! SDL_VideoSurface ) {
+		fprintf(stderr, "%s\n", "No video mode has been set");
+		return(NULL);
+	}
+	vf = SDL_VideoSurface->format;
+
+	switch(vf->BytesPerPixel) {
+	    case 2:
+		/* For XGY5[56]5, use, AXGY8888, where {X, Y} = {R, B}.
+		   For anything else (like ARGB4444) it doesn't matter
+		   since we have no special code for it anyway */
+		if ( (vf->Rmask == 0x1f) &&
+		     (vf->Bmask == 0xf800 || vf->Bmask == 0x7c00)) {
+			rmask = 0xff;
+			bmask = 0xff0000;
+		}
+		break;
+
+	    case 3:
+	    case 4:
+		/* Keep the video format, as long as the high 8 bits are
+		   unused or alpha */
+		if ( (vf->Rmask == 0xff) && (vf->Bmask == 0xff0000) ) {
+			rmask = 0xff;
+			bmask = 0xff0000;
+		}
+		break;
+
+	    default:
+		/* We have no other optimised formats right now. When/if a new
+		   optimised alpha format is written, add the converter here */
+		break;
+	}
+	format = SDL_AllocFormat(32, rmask, gmask, bmask, amask);
+	if ( format == NULL ) {
+		return(NULL);
+	}
+	flags = surface->flags & (SDL_SRCALPHA | SDL_RLEACCELOK);
+	converted = SDL_ConvertSurface(surface, format, flags);
+	SDL_FreeFormat(format);
+	return(converted);
+}
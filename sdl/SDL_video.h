@@ -48,6 +48,7 @@ typedef struct SDL_Color {
 typedef struct SDL_Palette {
 	int       ncolors;
 	SDL_Color *colors;
+	struct SDL_PaletteInverse *inverse;	/* set up by SDL_SetColors() */
 } SDL_Palette;
 
 typedef struct SDL_PixelFormat {
@@ -84,6 +85,7 @@ typedef struct SDL_Surface {
 	struct SDL_BlitMap *map;
 	unsigned int format_version;
 	int refcount;
+	struct private_dirty *dirty;
 } SDL_Surface;
 
 #define SDL_SWSURFACE	0x00000000
@@ -133,6 +135,16 @@ typedef struct SDL_Overlay {
 
 extern uint8_t SDL_FindColor(SDL_Palette *pal, 
 				uint8_t r, uint8_t g, uint8_t b);
+/* Set palette colors, blits to the surface are mapped again for them.
+   This also builds the nearest color lookups of SDL_MapRGB().  Colors
+   written to palette->colors directly are searched through until they
+   are passed through here again, e.g.
+   SDL_SetColors(surface, palette->colors, 0, palette->ncolors), which
+   also maps blits again.
+   Returns 1 if all colors were set.
+ */
+extern int SDL_SetColors(SDL_Surface *surface, SDL_Color *colors,
+				int firstcolor, int ncolors);
 extern uint32_t SDL_MapRGB(const SDL_PixelFormat* const format, 
 				const uint8_t r, const uint8_t g, const uint8_t b);
 extern uint32_t SDL_MapRGBA(const SDL_PixelFormat* const format, 
@@ -155,6 +167,14 @@ extern void SDL_UnlockSurface(SDL_Surface *surface);
 
 extern int SDL_SetClipRect(SDL_Surface *surface, const SDL_Rect *rect);
 
+extern void SDL_UpdateRects(SDL_Surface *screen, int numrects, SDL_Rect *rects);
+extern void SDL_UpdateRect(SDL_Surface *screen, 
+			int32_t x, int32_t y, uint32_t w, uint32_t h);
+extern int SDL_EnableDirtyRects(SDL_Surface *surface, int enable);
+extern void SDL_AddDirtyRect(SDL_Surface *surface, const SDL_Rect *rect);
+extern int SDL_GetDirtyRects(SDL_Surface *surface, SDL_Rect **rects);
+extern void SDL_ClearDirtyRects(SDL_Surface *surface);
+
 extern SDL_Overlay * SDL_CreateYUVOverlay(int width, int height,
 				uint32_t format, SDL_Surface *display);
 extern int SDL_LockYUVOverlay(SDL_Overlay *overlay);
@@ -165,13 +185,58 @@ extern void SDL_FreeYUVOverlay(SDL_Overlay *overlay);
 extern int SDL_SoftStretch(SDL_Surface *src, SDL_Rect *srcrect,
 			SDL_Surface *dst, SDL_Rect *dstrect);
 
+/* Blit srcrect of src (all of it if NULL) scaled by scale and turned angle
+   degrees counterclockwise about its middle, which lands on center->x,
+   center->y in dst (the middle of dst if NULL).  The colorkey and alpha
+   of src are used as by SDL_BlitSurface(), and only pixels inside the
+   clip rectangle of dst are drawn.
+ */
+#define SDL_SCALE_NEAREST	0	/* the nearest source pixel */
+#define SDL_SCALE_LINEAR	1	/* bilinear filtering */
+extern int SDL_BlitScaledRotated(SDL_Surface *src, SDL_Rect *srcrect,
+			SDL_Surface *dst, SDL_Rect *center,
+			double angle, double scale, int filter);
+
 
 extern int SDL_FillRect(SDL_Surface *dst, 
 			SDL_Rect *dstrect, uint32_t color);
+/* Fill count rects with one color, each clipped like SDL_FillRect() */
+extern int SDL_FillRects(SDL_Surface *dst,
+			const SDL_Rect *rects, int count, uint32_t color);
 
 
 extern int SDL_SetColorKey(SDL_Surface *surface, 
 			uint32_t flag, uint32_t key);
+/* flag is SDL_SRCALPHA, optionally with SDL_RLEACCEL, or 0 to turn off
+   the per-surface alpha and the alpha channel of the surface */
+extern int SDL_SetAlpha(SDL_Surface *surface, uint32_t flag, uint8_t alpha);
+
+extern SDL_Surface * SDL_ConvertSurface(SDL_Surface *src,
+			SDL_PixelFormat *fmt, uint32_t flags);
+
+/* There is no video mode to set in this port, so tell SDL_DisplayFormat()
+   and SDL_DisplayFormatAlpha() which surface is the screen */
+extern void SDL_SetVideoSurface(SDL_Surface *screen);
+extern SDL_Surface * SDL_GetVideoSurface(void);
+extern SDL_Surface * SDL_DisplayFormat(SDL_Surface *surface);
+extern SDL_Surface * SDL_DisplayFormatAlpha(SDL_Surface *surface);
+
+/* Convert the surface to the format of whatever it is blitted to on the
+   first blit, and blit from that copy while the destination stays the
+   same, so repeated blits are plain copies.  Only used for blits the copy
+   reproduces exactly: no alpha blending, and colorkeys only if the
+   destination has the same channel sizes, and those copies are run
+   length encoded.  Blits and fills into the surface drop the copy, draw
+   on its pixels between SDL_LockSurface() and SDL_UnlockSurface(),
+   locking drops it too.
+ */
+extern int SDL_SetAutoConvert(SDL_Surface *surface, int enable);
+
+/* Use ordered dithering for copy blits from the surface to palettized
+   surfaces, SDL_ConvertSurface() to an 8-bit format included.  The
+   pattern starts at the corner of each blit.
+ */
+extern int SDL_SetDither(SDL_Surface *surface, int enable);
 
 //FIXME: SDL_SaveBMP(glyph, outname);
 //dummy: use dumpBMPRaw(outname, glyph2->pixels, glyph2->w, glyph2->h, 1);
@@ -211,6 +276,9 @@ typedef struct SDL_BlitMap {
 	struct private_hwaccel *hw_data;
 	struct private_swaccel *sw_data;
     unsigned int format_version;
+	int auto_convert;		/* see SDL_SetAutoConvert() */
+	int dither;			/* see SDL_SetDither() */
+	struct SDL_Surface *converted;	/* the source in the dst format */
 } SDL_BlitMap;
 
 extern SDL_loblit SDL_CalculateBlit0(SDL_Surface *surface, int complex);
@@ -218,12 +286,21 @@ extern SDL_loblit SDL_CalculateBlit1(SDL_Surface *surface, int complex);
 extern SDL_loblit SDL_CalculateBlitN(SDL_Surface *surface, int complex);
 extern SDL_loblit SDL_CalculateAlphaBlit(SDL_Surface *surface, int complex);
 
+/* SDL_RLEaccel.c, a surface is encoded for the destination in its map */
+extern int SDL_RLESurface(SDL_Surface *surface);
+extern void SDL_UnRLESurface(SDL_Surface *surface);
+extern int SDL_RLEBlit(SDL_Surface *src, SDL_Rect *srcrect,
+	SDL_Surface *dst, SDL_Rect *dstrect);
+
 
 
 #define SDL_BlitSurface SDL_UpperBlit
 
 extern int SDL_UpperBlit(SDL_Surface *src, SDL_Rect *srcrect,
 	SDL_Surface *dst, SDL_Rect *dstrect);
+/* Unclipped, the rectangles must be inside both surfaces */
+extern int SDL_LowerBlit(SDL_Surface *src, SDL_Rect *srcrect,
+	SDL_Surface *dst, SDL_Rect *dstrect);
 
 
 
@@ -400,6 +477,12 @@ do {						\
     ((A)->BitsPerPixel == (B)->BitsPerPixel				\
      && ((A)->Rmask == (B)->Rmask) && ((A)->Amask == (B)->Amask))
 
+/* Blits from RGB to palettized surfaces look pixels up in a cube of the
+   nearest palette index for the top 5 bits of each channel */
+#define PALETTE_CUBE_SIZE	32768
+#define PALETTE_CUBE_INDEX(r, g, b)					\
+	((((r)>>3)<<10)|(((g)>>3)<<5)|((b)>>3))
+
 
 #ifdef __NDS__ /* FIXME */
 #define PIXEL_FROM_RGBA(Pixel, fmt, r, g, b, a)				\
@@ -1279,14 +1279,12 @@ int SDL_SoftStretch(SDL_Surface *src, SDL_Rect *srcrect,
 		full_dst.h = dst->h;
 		dstrect = &full_dst;
 	}
-	dst_locked = 0;
-	if ( SDL_MUSTLOCK(dst) ) {
-		if ( SDL_LockSurface(dst) < 0 ) {
-			fprintf(stderr, "Unable to lock destination surface\n");
-			return(-1);
-		}
-		dst_locked = 1;
+	/* Always locked, which also drops an auto-converted copy of it */
+	if ( SDL_LockSurface(dst) < 0 ) {
+		fprintf(stderr, "Unable to lock destination surface\n");
+		return(-1);
 	}
+	dst_locked = 1;
 	src_locked = 0;
 	if ( SDL_MUSTLOCK(src) ) {
 		if ( SDL_LockSurface(src) < 0 ) {
@@ -1338,5 +1336,6 @@ int SDL_SoftStretch(SDL_Surface *src, SDL_Rect *srcrect,
 	if ( src_locked ) {
 		SDL_UnlockSurface(src);
 	}
+	SDL_AddDirtyRect(dst, dstrect);
 	return(0);
 }
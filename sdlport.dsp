@@ -87,6 +87,10 @@ LINK32=link.exe
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
+SOURCE=.\GlyphAtlas.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\main.c
 # End Source File
 # Begin Source File
@@ -107,6 +111,10 @@ SOURCE=.\common.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\GlyphAtlas.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\SDL_mixer.h
 # End Source File
 # Begin Source File
@@ -167,6 +175,14 @@ SOURCE=.\sdl\SDL_blit_N.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\sdl\SDL_cpuinfo.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\sdl\SDL_cpuinfo.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\sdl\SDL_effect_position.c
 # End Source File
 # Begin Source File
@@ -207,6 +223,14 @@ SOURCE=.\sdl\SDL_image.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\sdl\SDL_image_async.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\sdl\SDL_image_cache.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\sdl\SDL_mixer.c
 # End Source File
 # Begin Source File
@@ -219,6 +243,14 @@ SOURCE=.\sdl\SDL_music.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\sdl\SDL_RLEaccel.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\sdl\SDL_rotozoom.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\sdl\SDL_surface.c
 # End Source File
 # Begin Source File
@@ -239,6 +271,10 @@ SOURCE=.\sdl\SDL_ttf.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\sdl\SDL_video.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\sdl\SDL_video.h
 # End Source File
 # Begin Source File
@@ -5,10 +5,14 @@
 #include <SDL_image.h>
 #include <SDL_mixer.h>
 #include <SDL_timer.h>
+#include <SDL_ext_pixel.h>
+#include <pthread.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include "TextureLoader.h"
+#include "GlyphAtlas.h"
 #include "test.h"
 
 #define DEFAULT_FONTNAME "default.ttf"
@@ -19,24 +23,16 @@
 
 void test_bmp(SDL_Surface* screen)
 {
-	unsigned int g_TextureWidth, g_TextureHeight;
-	unsigned char * data = loadBMPRaw("image1.bmp", &g_TextureWidth, &g_TextureHeight, 1, 1);	
+	int g_TextureWidth, g_TextureHeight;
+	//R,G,B,A bytes, top row first: the layout of MY_*mask surfaces
+	unsigned char * data = IMG_LoadBMPPixels("image1.bmp", 
+		IMG_PIXELS_RGBA32 | IMG_PIXELS_TOPDOWN, 
+		&g_TextureWidth, &g_TextureHeight);	
 	SDL_Rect sr, ds;
 	if (data)
 	{
 		SDL_Surface* surface;
-		int j;
-		int size = g_TextureWidth * g_TextureHeight * 4;
-		unsigned char * data2 = (unsigned char *)malloc(size);
-		memset(data2, 0, size);
-		for (j = 0; j < (int)(g_TextureWidth * g_TextureHeight); j++)
-		{
-			*(data2 + j * 4 + 0) = *(data + j * 3 + 0);
-			*(data2 + j * 4 + 1) = *(data + j * 3 + 1);
-			*(data2 + j * 4 + 2) = *(data + j * 3 + 2);
-			*(data2 + j * 4 + 3) = 0xff;
-		}
-		surface = SDL_CreateRGBSurfaceFrom(data2,
+		surface = SDL_CreateRGBSurfaceFrom(data,
 			g_TextureWidth, g_TextureHeight, 32, 4 * g_TextureWidth,
 			MY_Rmask, MY_Gmask, MY_Bmask, MY_Amask
 			);
@@ -193,9 +189,8 @@ void test_ttf2(SDL_Surface* screen)
 		
 		if (useBlend)
 		{
-			//, *backcol
-			//NOTE: glyph.pixel32 = (font.a or 0xff(fillrect)) | forecol.r | forecol.g | forecol.b 
-			glyph = TTF_RenderText_Blended(font, str, *forecol);
+			//blended straight into the screen, no temporary surface
+			TTF_RenderText_BlendedTo(font, str, *forecol, screen, 200, 200, NULL);
 		}
 		else if (useSolid)
 		{
@@ -309,7 +304,7 @@ void image_swap_rgb(SDL_Surface *screen)
 
 void test_image(SDL_Surface* screen)
 {
-	SDL_Surface* surface = IMG_Load("image1.bmp");	
+	SDL_Surface* surface = IMG_CacheLoad("image1.bmp");	
 	SDL_Rect sr, ds;
 	int j;
 	SDL_Surface* surface2 = NULL;
@@ -349,6 +344,2266 @@ void test_image(SDL_Surface* screen)
 		ds.h = surface->h;
 		SDL_SoftStretch(surface2, &sr, screen, &ds);
 	}
+	IMG_CacheRelease(surface);
+}
+
+//NOTE: call from display() after the screen quad, needs a GL context
+void test_ttf_atlas(int width, int height)
+{
+	static TTF_Font *font = NULL;
+	static GlyphAtlas *atlas = NULL;
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	SDL_Color red = { 0xFF, 0x00, 0x00, 0 };
+	int y;
+
+	if (atlas == NULL)
+	{
+		TTF_Init();
+		font = TTF_OpenFont(DEFAULT_FONTNAME, DEFAULT_PTSIZE);
+		if (font == NULL) {
+			fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+				DEFAULT_PTSIZE, DEFAULT_FONTNAME);
+			return;
+		}
+		atlas = createGlyphAtlas(font, 0);
+		if (atlas == NULL)
+		{
+			return;
+		}
+	}
+	//every string is only quads, one draw call for all of them
+	for (y = 0; y < 10; y++)
+	{
+		drawGlyphAtlasUTF8(atlas, DEFAULT_TEXT, 10, 200 + y * TTF_FontLineSkip(font), 
+			(y & 1) ? red : black);
+	}
+	flushGlyphAtlas(atlas, width, height);
+}
+
+#define SDF_PTSIZE 48
+
+//NOTE: one font, opened once at SDF_PTSIZE, drawn at six sizes
+void test_ttf_sdf(SDL_Surface* screen)
+{
+	static const int sizes[] = { 10, 12, 16, 24, 32, 48 };
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	TTF_Font *font;
+	int i, y, h;
+
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, SDF_PTSIZE);
+	if (font == NULL) {
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			SDF_PTSIZE, DEFAULT_FONTNAME);
+		TTF_Quit();
+		return;
+	}
+	y = 10;
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+	{
+		TTF_RenderText_SDFTo(font, DEFAULT_TEXT, sizes[i], black, screen, 10, y, NULL);
+		TTF_SizeText_Scaled(font, DEFAULT_TEXT, sizes[i], NULL, &h);
+		y += h;
+	}
+	TTF_CloseFont(font);
+	TTF_Quit();
+}
+
+//NOTE: a wrapped help panel, centred in a 300 pixel column, with the
+//caret under where a click at (150, 30) would put it
+void test_ttf_paragraph(SDL_Surface* screen)
+{
+	const char *text = "Use the arrow keys to move. Press space to jump, "
+		"hold shift to run.\nPress escape to leave the game.";
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	SDL_Color red = { 0xFF, 0x00, 0x00, 0 };
+	SDL_Rect caret;
+	TTF_Paragraph *para;
+	TTF_Font *font;
+	int x, y;
+
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, DEFAULT_PTSIZE);
+	if (font == NULL) {
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			DEFAULT_PTSIZE, DEFAULT_FONTNAME);
+		TTF_Quit();
+		return;
+	}
+	para = TTF_LayoutParagraph(font, text, 300, TTF_ALIGN_CENTER);
+	if (para != NULL)
+	{
+		TTF_RenderParagraph_BlendedTo(para, black, screen, 10, 10, NULL);
+		TTF_ParagraphCaret(para, TTF_ParagraphHitTest(para, 150, 30), &x, &y);
+		caret.x = 10 + x;
+		caret.y = 10 + y;
+		caret.w = 1;
+		caret.h = TTF_FontHeight(font);
+		SDL_FillRect(screen, &caret, SDL_MapRGB(screen->format, red.r, red.g, red.b));
+		TTF_FreeParagraph(para);
+	}
+	TTF_CloseFont(font);
+	TTF_Quit();
+}
+
+#define BENCH_ITERATIONS 20
+
+//NOTE: pass a NULL terminated list of (large) BMP files, NULL for image1.bmp
+void test_bmp_bench(const char **files)
+{
+	static const char *default_files[] = { "image1.bmp", NULL };
+	int i, j;
+
+	if (files == NULL)
+	{
+		files = default_files;
+	}
+	for (i = 0; files[i] != NULL; i++)
+	{
+		uint32_t t0, t1, t2;
+		unsigned int w = 0, h = 0;
+		double mb = 0;
+		SDL_Surface *surface = IMG_Load(files[i]);
+		
+		if (surface == NULL)
+		{
+			fprintf(stderr, "Couldn't load %s\n", files[i]);
+			continue;
+		}
+		mb = (double)surface->pitch * surface->h / (1024.0 * 1024.0);
+		SDL_FreeSurface(surface);
+
+		t0 = SDL_GetTicks();
+		for (j = 0; j < BENCH_ITERATIONS; j++)
+		{
+			SDL_FreeSurface(IMG_Load(files[i]));
+		}
+		t1 = SDL_GetTicks();
+		for (j = 0; j < BENCH_ITERATIONS; j++)
+		{
+			free(loadBMPRaw(files[i], &w, &h, 1, 1));
+		}
+		t2 = SDL_GetTicks();
+		printf("%s: %.2f MB, IMG_Load %.2f ms, loadBMPRaw %.2f ms\n", 
+			files[i], mb, 
+			(double)(t1 - t0) / BENCH_ITERATIONS, 
+			(double)(t2 - t1) / BENCH_ITERATIONS);
+	}
+}
+
+#define THREAD_LABELS 8
+#define THREAD_ROUNDS 50
+#define THREAD_MAX 16
+
+typedef struct ttf_thread_job {
+	TTF_Font *font;
+	SDL_Surface **reference;
+	int errors;
+} ttf_thread_job;
+
+static const char *thread_labels[THREAD_LABELS] = {
+	DEFAULT_TEXT, "Score: 1234567", "Hello, World!", "The quick brown fox",
+	"jumps over the lazy dog", "0123456789", "Level 3", "Game Over"
+};
+
+static int compare_surface(SDL_Surface *a, SDL_Surface *b)
+{
+	int y;
+
+	if (a == NULL || b == NULL || a->w != b->w || a->h != b->h)
+	{
+		return -1;
+	}
+	for (y = 0; y < a->h; y++)
+	{
+		if (memcmp((uint8_t *)a->pixels + y * a->pitch, 
+			(uint8_t *)b->pixels + y * b->pitch, 
+			a->w * a->format->BytesPerPixel) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void *ttf_thread_proc(void *data)
+{
+	ttf_thread_job *job = (ttf_thread_job *)data;
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	int i, j;
+
+	for (i = 0; i < THREAD_ROUNDS; i++)
+	{
+		for (j = 0; j < THREAD_LABELS; j++)
+		{
+			SDL_Surface *text = TTF_RenderUTF8_Blended(job->font, 
+				thread_labels[j], black);
+			if (compare_surface(text, job->reference[j]) != 0)
+			{
+				job->errors++;
+			}
+			SDL_FreeSurface(text);
+		}
+	}
+	return NULL;
+}
+
+//NOTE: renders the same labels from several threads, once with a clone
+//of the font per thread and once with the font shared, and compares
+//every result with a single threaded render, returns the mismatches
+int test_ttf_threads(int nthreads)
+{
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	SDL_Surface *reference[THREAD_LABELS];
+	ttf_thread_job jobs[THREAD_MAX];
+	pthread_t threads[THREAD_MAX];
+	TTF_Font *font;
+	int failures = 0;
+	int shared, started, i;
+
+	if (nthreads <= 0 || nthreads > THREAD_MAX)
+	{
+		nthreads = 4;
+	}
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, DEFAULT_PTSIZE);
+	if (font == NULL) {
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			DEFAULT_PTSIZE, DEFAULT_FONTNAME);
+		return 1;
+	}
+	for (i = 0; i < THREAD_LABELS; i++)
+	{
+		reference[i] = TTF_RenderUTF8_Blended(font, thread_labels[i], black);
+	}
+	for (shared = 0; shared <= 1; shared++)
+	{
+		uint32_t t0 = SDL_GetTicks();
+		int errors = 0;
+
+		for (i = 0; i < nthreads; i++)
+		{
+			jobs[i].font = shared ? font : TTF_CloneFont(font);
+			jobs[i].reference = reference;
+			jobs[i].errors = 0;
+			if (jobs[i].font == NULL || 
+				pthread_create(&threads[i], NULL, ttf_thread_proc, &jobs[i]) != 0)
+			{
+				fprintf(stderr, "Couldn't start render thread %d\n", i);
+				if (!shared && jobs[i].font != NULL)
+				{
+					TTF_CloseFont(jobs[i].font);
+				}
+				errors++;
+				break;
+			}
+		}
+		started = i;
+		for (i = 0; i < started; i++)
+		{
+			pthread_join(threads[i], NULL);
+			errors += jobs[i].errors;
+			if (!shared)
+			{
+				TTF_CloseFont(jobs[i].font);
+			}
+		}
+		printf("%d threads, %s font: %d renders in %u ms, %s\n", 
+			started, shared ? "shared" : "cloned", 
+			started * THREAD_ROUNDS * THREAD_LABELS, 
+			SDL_GetTicks() - t0, errors ? "FAILED" : "ok");
+		failures += errors;
+	}
+	for (i = 0; i < THREAD_LABELS; i++)
+	{
+		SDL_FreeSurface(reference[i]);
+	}
+	TTF_CloseFont(font);
+	return failures;
+}
+
+#define GLYPH_BENCH_ROUNDS 20
+
+//NOTE: cold cache glyph rasterisation, the printable ASCII glyphs in mono
+//and antialiased, plain and bold, at a few sizes, build SDL_ttf.c with
+//TTF_GLYPH_LUT 0 to time the bit by bit loops instead
+void test_ttf_glyph_bench(void)
+{
+	static const int sizes[] = { 12, 24, 48, 96 };
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	char text[96];
+	int i, j, style;
+
+	for (i = 0; i < 95; i++)
+	{
+		text[i] = (char)(32 + i);
+	}
+	text[95] = 0;
+	TTF_Init();
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+	{
+		uint32_t t0;
+		TTF_Font *font = TTF_OpenFont(DEFAULT_FONTNAME, sizes[i]);
+
+		if (font == NULL) {
+			fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+				sizes[i], DEFAULT_FONTNAME);
+			continue;
+		}
+		t0 = SDL_GetTicks();
+		for (j = 0; j < GLYPH_BENCH_ROUNDS; j++)
+		{
+			for (style = 0; style < 2; style++)
+			{
+				TTF_SetFontStyle(font, style ? TTF_STYLE_BOLD : TTF_STYLE_NORMAL);
+				TTF_FlushGlyphCache(font);
+				SDL_FreeSurface(TTF_RenderText_Solid(font, text, black));
+				SDL_FreeSurface(TTF_RenderText_Blended(font, text, black));
+			}
+		}
+		printf("%d pt: %.2f ms to rasterise %d glyphs\n", sizes[i], 
+			(double)(SDL_GetTicks() - t0) / GLYPH_BENCH_ROUNDS, 95 * 4);
+		TTF_CloseFont(font);
+	}
+	TTF_Quit();
+}
+
+//NOTE: first render of a label with a cold glyph cache, then with the
+//glyphs precached on this thread and on a background one, the render
+//time left over is what a frame would see
+void test_ttf_precache(void)
+{
+	static const char *label = "Press any key to continue \xC3\xA0 \xC3\xA9";
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	TTF_GlyphCacheStats stats;
+	int mode, count;
+
+	TTF_Init();
+	for (mode = 0; mode < 3; mode++)
+	{
+		uint32_t t0, t1;
+		TTF_Font *font = TTF_OpenFont(DEFAULT_FONTNAME, 32);
+
+		if (font == NULL) {
+			fprintf(stderr, "Couldn't load 32 pt font from %s\n", 
+				DEFAULT_FONTNAME);
+			break;
+		}
+		t0 = SDL_GetTicks();
+		count = 0;
+		if (mode == 1)
+		{
+			count = TTF_PrecacheRange(font, 0x20, 0xFF, TTF_PRECACHE_PIXELS);
+		}
+		else if (mode == 2)
+		{
+			TTF_PrecacheRangeAsync(font, 0x20, 0xFF, TTF_PRECACHE_PIXELS);
+			//NOTE: a loading screen would keep drawing here
+			count = TTF_WaitPrecache(font);
+		}
+		t1 = SDL_GetTicks();
+		SDL_FreeSurface(TTF_RenderUTF8_Blended(font, label, black));
+		TTF_GetGlyphCacheStats(font, &stats);
+		printf("%s: %d glyphs in %u ms (%u ms waited), first render %u ms\n", 
+			mode == 0 ? "cold" : mode == 1 ? "precached" : "background", 
+			count, stats.precache_ms, t1 - t0, SDL_GetTicks() - t1);
+		TTF_CloseFont(font);
+	}
+	TTF_Quit();
+}
+
+#define RLE_SPRITES 5000
+
+//NOTE: round sprites, a colorkeyed one and one with a soft alpha edge,
+//blitted all over (and off the edges of) a screen sized surface with
+//and without SDL_RLEACCEL, both runs must leave the same pixels
+void test_blit_rle_bench(void)
+{
+	int pass, i, x, y;
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		SDL_Surface *screen[2];
+		SDL_Surface *sprite = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 
+			MY_Rmask, MY_Gmask, MY_Bmask, pass ? MY_Amask : 0);
+		uint32_t key = SDL_MapRGB(sprite->format, 0xFF, 0x00, 0xFF);
+		uint32_t times[2];
+		int rle;
+
+		for (y = 0; y < sprite->h; y++)
+		{
+			uint32_t *row = (uint32_t *)((uint8_t *)sprite->pixels + y * sprite->pitch);
+			for (x = 0; x < sprite->w; x++)
+			{
+				int d2 = (x - 32) * (x - 32) + (y - 32) * (y - 32);
+				if (pass == 0)
+				{
+					row[x] = d2 < 24 * 24 ? SDL_MapRGB(sprite->format, x * 4, y * 4, 0x80) : key;
+				}
+				else
+				{
+					int a = d2 < 20 * 20 ? 255 : 
+						d2 < 28 * 28 ? (28 * 28 - d2) * 255 / (28 * 28 - 20 * 20) : 0;
+					row[x] = SDL_MapRGBA(sprite->format, x * 4, y * 4, 0x80, a);
+				}
+			}
+		}
+		for (rle = 0; rle < 2; rle++)
+		{
+			uint32_t seed = 12345;
+			uint32_t t0;
+
+			screen[rle] = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 32, 
+				MY_Rmask, MY_Gmask, MY_Bmask, MY_Amask);
+			SDL_FillRect(screen[rle], NULL, 
+				SDL_MapRGBA(screen[rle]->format, 0x20, 0x40, 0x60, 0x80));
+			if (pass == 0)
+			{
+				SDL_SetColorKey(sprite, SDL_SRCCOLORKEY | (rle ? SDL_RLEACCEL : 0), key);
+			}
+			else
+			{
+				SDL_SetAlpha(sprite, SDL_SRCALPHA | (rle ? SDL_RLEACCEL : 0), 255);
+			}
+			t0 = SDL_GetTicks();
+			for (i = 0; i < RLE_SPRITES; i++)
+			{
+				SDL_Rect dst;
+				seed = seed * 1103515245 + 12345;
+				dst.x = (int)((seed >> 8) % 700) - 32;
+				seed = seed * 1103515245 + 12345;
+				dst.y = (int)((seed >> 8) % 540) - 32;
+				SDL_BlitSurface(sprite, NULL, screen[rle], &dst);
+			}
+			times[rle] = SDL_GetTicks() - t0;
+		}
+		printf("%s: %d blits %u ms, RLE %u ms, %s\n", 
+			pass ? "alpha" : "colorkey", RLE_SPRITES, times[0], times[1], 
+			compare_surface(screen[0], screen[1]) == 0 ? "same" : "DIFFERENT");
+		SDL_FreeSurface(screen[0]);
+		SDL_FreeSurface(screen[1]);
+		SDL_FreeSurface(sprite);
+	}
+}
+
+#define CONVERT_BLITS 5000
+
+//NOTE: a 24 bit sprite, opaque and then colorkeyed, blitted to a screen 
+//format surface directly, from an SDL_DisplayFormat() copy, and with 
+//SDL_SetAutoConvert(), all three must leave the same pixels
+void test_blit_convert_bench(void)
+{
+	SDL_Surface *video = SDL_GetVideoSurface();
+	int pass, i, x, y;
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		SDL_Surface *screen[3];
+		SDL_Surface *sprite = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 24, 
+			0xFF0000, 0x00FF00, 0x0000FF, 0);
+		uint32_t key = SDL_MapRGB(sprite->format, 0xFF, 0x00, 0xFF);
+		uint32_t times[3];
+		int mode;
+
+		for (y = 0; y < sprite->h; y++)
+		{
+			uint8_t *row = (uint8_t *)sprite->pixels + y * sprite->pitch;
+			for (x = 0; x < sprite->w; x++)
+			{
+				int d2 = (x - 32) * (x - 32) + (y - 32) * (y - 32);
+				uint32_t pixel = pass == 0 || d2 < 24 * 24 ? 
+					SDL_MapRGB(sprite->format, x * 4, y * 4, 0x80) : key;
+				memcpy(row + x * 3, &pixel, 3);
+			}
+		}
+		if (pass == 1)
+		{
+			SDL_SetColorKey(sprite, SDL_SRCCOLORKEY, key);
+		}
+		for (mode = 0; mode < 3; mode++)
+		{
+			SDL_Surface *src = sprite;
+			uint32_t seed = 12345;
+			uint32_t t0;
+
+			screen[mode] = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 32, 
+				MY_Rmask, MY_Gmask, MY_Bmask, MY_Amask);
+			SDL_FillRect(screen[mode], NULL, 
+				SDL_MapRGBA(screen[mode]->format, 0x20, 0x40, 0x60, 0x80));
+			t0 = SDL_GetTicks();
+			if (mode == 1)
+			{
+				SDL_SetVideoSurface(screen[mode]);
+				src = SDL_DisplayFormat(sprite);
+			}
+			SDL_SetAutoConvert(sprite, mode == 2);
+			for (i = 0; i < CONVERT_BLITS; i++)
+			{
+				SDL_Rect dst;
+				seed = seed * 1103515245 + 12345;
+				dst.x = (int)((seed >> 8) % 700) - 32;
+				seed = seed * 1103515245 + 12345;
+				dst.y = (int)((seed >> 8) % 540) - 32;
+				SDL_BlitSurface(src, NULL, screen[mode], &dst);
+			}
+			times[mode] = SDL_GetTicks() - t0;
+			if (src != sprite)
+			{
+				SDL_FreeSurface(src);
+			}
+		}
+		SDL_SetAutoConvert(sprite, 0);
+		SDL_SetVideoSurface(video);
+		printf("%s: %d blits %u ms, SDL_DisplayFormat %u ms, auto convert %u ms, %s\n", 
+			pass ? "colorkey" : "opaque", CONVERT_BLITS, times[0], times[1], times[2], 
+			compare_surface(screen[0], screen[1]) == 0 && 
+			compare_surface(screen[0], screen[2]) == 0 ? "same" : "DIFFERENT");
+		SDL_FreeSurface(screen[0]);
+		SDL_FreeSurface(screen[1]);
+		SDL_FreeSurface(screen[2]);
+		SDL_FreeSurface(sprite);
+	}
+}
+
+#define BLIT_BENCH_LOOPS 50
+
+//NOTE: plain (no colorkey, no alpha) 640x480 blits between every pair of 
+//the formats below, ms per BLIT_BENCH_LOOPS blits, source format per row
+void test_blit_bench(void)
+{
+	static const struct
+	{
+		const char *name;
+		int bpp;
+		uint32_t Rmask, Gmask, Bmask, Amask;
+	} formats[] = {
+		{"RGB565",   16, 0x0000F800, 0x000007E0, 0x0000001F, 0},
+		{"RGB555",   16, 0x00007C00, 0x000003E0, 0x0000001F, 0},
+		{"RGB24",    24, 0x00FF0000, 0x0000FF00, 0x000000FF, 0},
+		{"BGR24",    24, 0x000000FF, 0x0000FF00, 0x00FF0000, 0},
+		{"RGB888",   32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0},
+		{"ARGB8888", 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000},
+		{"ABGR8888", 32, MY_Rmask, MY_Gmask, MY_Bmask, MY_Amask},
+		{"RGBA8888", 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF},
+		{"BGRA8888", 32, 0x0000FF00, 0x00FF0000, 0xFF000000, 0x000000FF},
+	};
+	const int count = sizeof(formats) / sizeof(formats[0]);
+	int i, j, k;
+
+	printf("%-9s", "src\\dst");
+	for (j = 0; j < count; j++)
+	{
+		printf(" %8s", formats[j].name);
+	}
+	printf("\n");
+	for (i = 0; i < count; i++)
+	{
+		SDL_Surface *src = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 
+			formats[i].bpp, formats[i].Rmask, formats[i].Gmask, 
+			formats[i].Bmask, formats[i].Amask);
+		//copy the alpha channel instead of blending
+		SDL_SetAlpha(src, 0, 0);
+		printf("%-9s", formats[i].name);
+		for (j = 0; j < count; j++)
+		{
+			SDL_Surface *dst = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 
+				formats[j].bpp, formats[j].Rmask, formats[j].Gmask, 
+				formats[j].Bmask, formats[j].Amask);
+			uint32_t t0 = SDL_GetTicks();
+			for (k = 0; k < BLIT_BENCH_LOOPS; k++)
+			{
+				SDL_BlitSurface(src, NULL, dst, NULL);
+			}
+			printf(" %8u", SDL_GetTicks() - t0);
+			SDL_FreeSurface(dst);
+		}
+		printf("\n");
+		SDL_FreeSurface(src);
+	}
+}
+
+#define FILL_BENCH_LOOPS 200
+#define FILL_BENCH_RECTS 256
+
+//NOTE: whole screen fills, and many small rects in one SDL_FillRects() 
+//call, at every depth SDL_FillRect() handles
+void test_fill_bench(void)
+{
+	static const int depths[] = {1, 4, 8, 16, 24, 32};
+	SDL_Rect rects[FILL_BENCH_RECTS];
+	uint32_t seed = 12345;
+	int i, j;
+
+	for (i = 0; i < FILL_BENCH_RECTS; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		rects[i].x = (int16_t)((seed >> 8) % 640) - 16;
+		seed = seed * 1103515245 + 12345;
+		rects[i].y = (int16_t)((seed >> 8) % 480) - 16;
+		rects[i].w = 7 + i % 57;
+		rects[i].h = 5 + i % 23;
+	}
+	for (i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); i++)
+	{
+		SDL_Surface *surface = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 
+			depths[i], 0, 0, 0, 0);
+		uint32_t t0, t1;
+
+		t0 = SDL_GetTicks();
+		for (j = 0; j < FILL_BENCH_LOOPS; j++)
+		{
+			SDL_FillRect(surface, NULL, j);
+		}
+		t1 = SDL_GetTicks();
+		for (j = 0; j < FILL_BENCH_LOOPS; j++)
+		{
+			SDL_FillRects(surface, rects, FILL_BENCH_RECTS, j);
+		}
+		printf("%2d bpp: %d screen fills %u ms, %d x %d rects %u ms\n", 
+			depths[i], FILL_BENCH_LOOPS, t1 - t0, 
+			FILL_BENCH_LOOPS, FILL_BENCH_RECTS, SDL_GetTicks() - t1);
+		SDL_FreeSurface(surface);
+	}
+}
+
+#define BATCH_BENCH_CALLS 20000
+#define BATCH_BENCH_FRAMES 10
+
+//NOTE: the same random points, lines and rects drawn with the immediate 
+//SDL_ext_draw* calls and through one SDL_ext_Batch, which must match. 
+//the batch is kept from frame to frame like a game would keep it
+void test_ext_batch_bench(void)
+{
+	static const int depths[] = {16, 32};
+	uint32_t seed = 12345;
+	int i, j;
+
+	for (i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); i++)
+	{
+		SDL_Surface *surface[2];
+		SDL_ext_Batch *batch;
+		uint32_t t0, t1, t2;
+		uint32_t immediate = 0, batched = 0;
+		int frame;
+
+		for (j = 0; j < 2; j++)
+		{
+			surface[j] = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 
+				depths[i], 0, 0, 0, 0);
+		}
+		batch = SDL_ext_createBatch(surface[1]);
+		for (frame = 0; frame < BATCH_BENCH_FRAMES; frame++)
+		{
+			t0 = t1 = SDL_GetTicks();
+			for (j = 0; j < 2 * BATCH_BENCH_CALLS; j++)
+			{
+				int call = j % BATCH_BENCH_CALLS;
+				int x1, y1, x2, y2;
+				uint8_t r, g, b, a;
+
+				if (call == 0)
+				{
+					seed = 12345;
+					t1 = SDL_GetTicks();
+				}
+				seed = seed * 1103515245 + 12345;
+				x1 = (int)((seed >> 8) % 700) - 30;
+				y1 = (int)((seed >> 20) % 540) - 30;
+				seed = seed * 1103515245 + 12345;
+				x2 = x1 + (int)((seed >> 8) % 121) - 60;
+				y2 = y1 + (int)((seed >> 20) % 121) - 60;
+				r = (uint8_t)(seed >> 3);
+				g = (uint8_t)(seed >> 11);
+				b = (uint8_t)(seed >> 19);
+				a = (seed & 3) ? 255 : (uint8_t)(seed >> 24);
+				if (j < BATCH_BENCH_CALLS)
+				{
+					switch (call % 4)
+					{
+					case 0:
+						SDL_ext_drawPoint(surface[0], r, g, b, a, x1, y1);
+						break;
+					case 1:
+						SDL_ext_drawLine(surface[0], r, g, b, a, x1, y1, x2, y2);
+						break;
+					case 2:
+						SDL_ext_drawRectangle(surface[0], r, g, b, a, 
+							x1, y1, abs(x2 - x1), abs(y2 - y1));
+						break;
+					default:
+						SDL_ext_fillRectangle(surface[0], r, g, b, a, 
+							x1, y1, abs(x2 - x1) / 4, abs(y2 - y1) / 4);
+						break;
+					}
+				}
+				else
+				{
+					switch (call % 4)
+					{
+					case 0:
+						SDL_ext_batchPoint(batch, r, g, b, a, x1, y1);
+						break;
+					case 1:
+						SDL_ext_batchLine(batch, r, g, b, a, x1, y1, x2, y2);
+						break;
+					case 2:
+						SDL_ext_batchRectangle(batch, r, g, b, a, 
+							x1, y1, abs(x2 - x1), abs(y2 - y1));
+						break;
+					default:
+						SDL_ext_batchFillRectangle(batch, r, g, b, a, 
+							x1, y1, abs(x2 - x1) / 4, abs(y2 - y1) / 4);
+						break;
+					}
+				}
+			}
+			SDL_ext_flushBatch(batch);
+			t2 = SDL_GetTicks();
+			immediate += t1 - t0;
+			batched += t2 - t1;
+		}
+		printf("%2d bpp: %d x %d calls immediate %u ms, batched %u ms, %s\n", 
+			depths[i], BATCH_BENCH_FRAMES, BATCH_BENCH_CALLS, immediate, batched, 
+			compare_surface(surface[0], surface[1]) == 0 ? "same" : "DIFFERENT");
+		SDL_ext_freeBatch(batch);
+		SDL_FreeSurface(surface[0]);
+		SDL_FreeSurface(surface[1]);
+	}
+}
+
+#define AA_BENCH_SHAPES 200
+
+//NOTE: translucent circles plotted pixel by pixel with 
+//SDL_ext_putPixelAlpha, against the anti-aliased span fillers
+void test_ext_aa_bench(void)
+{
+	static const int depths[] = {16, 32};
+	int i, j;
+
+	for (i = 0; i < (int)(sizeof(depths) / sizeof(depths[0])); i++)
+	{
+		SDL_Surface *surface = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 
+			depths[i], 0, 0, 0, 0);
+		uint32_t seed = 12345;
+		uint32_t t0, t1, t2, t3;
+
+		t0 = SDL_GetTicks();
+		for (j = 0; j < AA_BENCH_SHAPES; j++)
+		{
+			int x, y, r, dx, dy;
+
+			seed = seed * 1103515245 + 12345;
+			x = (seed >> 8) % 640;
+			y = (seed >> 16) % 480;
+			r = 10 + (seed >> 4) % 100;
+			for (dy = -r; dy <= r; dy++)
+			{
+				for (dx = -r; dx <= r; dx++)
+				{
+					if (dx * dx + dy * dy <= r * r && 
+						x + dx >= 0 && x + dx < 640 && 
+						y + dy >= 0 && y + dy < 480)
+					{
+						SDL_ext_putPixelAlpha(surface, x + dx, y + dy, 
+							10, 200, 30, 128);
+					}
+				}
+			}
+		}
+		t1 = SDL_GetTicks();
+		seed = 12345;
+		for (j = 0; j < AA_BENCH_SHAPES; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+			SDL_ext_fillCircle(surface, 10, 200, 30, 128, 
+				(seed >> 8) % 640, (seed >> 16) % 480, 10 + (seed >> 4) % 100);
+		}
+		t2 = SDL_GetTicks();
+		for (j = 0; j < AA_BENCH_SHAPES * 10; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+			SDL_ext_drawLineAA(surface, 200, 100, 30, 255, 
+				(seed >> 8) % 640, (seed >> 16) % 480, 
+				(seed >> 4) % 640, (seed >> 20) % 480);
+		}
+		t3 = SDL_GetTicks();
+		printf("%2d bpp: %d circles putPixelAlpha %u ms, fillCircle %u ms, "
+			"%d drawLineAA %u ms\n", depths[i], AA_BENCH_SHAPES, t1 - t0, 
+			t2 - t1, AA_BENCH_SHAPES * 10, t3 - t2);
+		SDL_FreeSurface(surface);
+	}
+}
+
+#define PALETTE_BENCH_MAPS 1000000
+
+//NOTE: true colour art to a random 256 colour palette, looking colours 
+//up one by one with SDL_MapRGB and converting with and without dithering
+void test_palette_bench(void)
+{
+	SDL_Surface *art = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *screen = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 8, 
+		0, 0, 0, 0);
+	SDL_Color colors[256];
+	SDL_Surface *plain, *dithered;
+	uint32_t seed = 12345;
+	uint32_t sum = 0;
+	uint32_t t0, t1, t2, t3;
+	int x, y, i;
+
+	for (i = 0; i < 256; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		colors[i].r = (uint8_t)(seed >> 8);
+		colors[i].g = (uint8_t)(seed >> 16);
+		colors[i].b = (uint8_t)(seed >> 24);
+		colors[i].unused = 0;
+	}
+	SDL_SetColors(screen, colors, 0, 256);
+	for (y = 0; y < art->h; y++)
+	{
+		uint32_t *row = (uint32_t *)((uint8_t *)art->pixels + y * art->pitch);
+		for (x = 0; x < art->w; x++)
+		{
+			row[x] = SDL_MapRGB(art->format, x * 255 / art->w, 
+				y * 255 / art->h, (x + y) & 0xff);
+		}
+	}
+
+	t0 = SDL_GetTicks();
+	for (i = 0; i < PALETTE_BENCH_MAPS; i++)
+	{
+		sum += SDL_MapRGB(screen->format, i, i >> 8, i >> 16);
+	}
+	t1 = SDL_GetTicks();
+	plain = SDL_ConvertSurface(art, screen->format, SDL_SWSURFACE);
+	t2 = SDL_GetTicks();
+	SDL_SetDither(art, 1);
+	dithered = SDL_ConvertSurface(art, screen->format, SDL_SWSURFACE);
+	t3 = SDL_GetTicks();
+	printf("%d SDL_MapRGB %u ms (%u), convert %u ms, dithered %u ms\n", 
+		PALETTE_BENCH_MAPS, t1 - t0, sum, t2 - t1, t3 - t2);
+
+	SDL_FreeSurface(plain);
+	SDL_FreeSurface(dithered);
+	SDL_FreeSurface(screen);
+	SDL_FreeSurface(art);
+}
+
+#define ROTOZOOM_BENCH_BLITS 1000
+
+//NOTE: a 128x128 sprite spun and zoomed onto a 640x480 screen, plain 
+//and colorkeyed, with nearest and bilinear sampling
+void test_rotozoom_bench(void)
+{
+	SDL_Surface *sprite = SDL_CreateRGBSurface(SDL_SWSURFACE, 128, 128, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *screen = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Rect center;
+	int x, y, i, pass;
+
+	for (y = 0; y < sprite->h; y++)
+	{
+		uint32_t *row = (uint32_t *)((uint8_t *)sprite->pixels + 
+			y * sprite->pitch);
+		for (x = 0; x < sprite->w; x++)
+		{
+			int dx = x - 64, dy = y - 64;
+			row[x] = dx * dx + dy * dy > 60 * 60 ? 0 : 
+				SDL_MapRGB(sprite->format, x * 2, y * 2, 128);
+		}
+	}
+	center.x = 320;
+	center.y = 240;
+	center.w = 0;
+	center.h = 0;
+
+	for (pass = 0; pass < 4; pass++)
+	{
+		int filter = (pass & 1) ? SDL_SCALE_LINEAR : SDL_SCALE_NEAREST;
+		uint32_t t0, t1;
+
+		if (pass == 2)
+		{
+			SDL_SetColorKey(sprite, SDL_SRCCOLORKEY, 0);
+		}
+		t0 = SDL_GetTicks();
+		for (i = 0; i < ROTOZOOM_BENCH_BLITS; i++)
+		{
+			SDL_BlitScaledRotated(sprite, NULL, screen, &center, 
+				i * 0.36, 1.0 + (i % 100) * 0.02, filter);
+		}
+		t1 = SDL_GetTicks();
+		printf("%d SDL_BlitScaledRotated %s%s %u ms\n", 
+			ROTOZOOM_BENCH_BLITS, (pass & 1) ? "linear" : "nearest", 
+			(pass & 2) ? " keyed" : "", t1 - t0);
+	}
+	SDL_FreeSurface(screen);
+	SDL_FreeSurface(sprite);
+}
+
+//NOTE: self checks, run with "sdlport -test" from the directory with 
+//image1.bmp and default.ttf. each returns the number of failures
+
+#define ASYNC_THREADS 4
+#define ASYNC_LOADS 2
+
+typedef struct async_check {
+	pthread_mutex_t lock;
+	int calls[ASYNC_THREADS * ASYNC_LOADS * 2 + 1];
+	int loaded;
+	int failed;
+	int w, h;
+	int errors;
+} async_check;
+
+static void async_check_done(int id, SDL_Surface *surface, void *userdata)
+{
+	async_check *check = (async_check *)userdata;
+
+	pthread_mutex_lock(&check->lock);
+	if (id <= 0 || id >= (int)(sizeof(check->calls) / sizeof(check->calls[0])))
+	{
+		check->errors++;
+	}
+	else
+	{
+		check->calls[id]++;
+	}
+	if (surface == NULL)
+	{
+		check->failed++;
+	}
+	else
+	{
+		if (surface->w != check->w || surface->h != check->h)
+		{
+			check->errors++;
+		}
+		check->loaded++;
+	}
+	pthread_mutex_unlock(&check->lock);
+	SDL_FreeSurface(surface);
+}
+
+static void *async_check_proc(void *data)
+{
+	async_check *check = (async_check *)data;
+	int i;
+
+	//every thread starts the pool, only one of them may create it
+	for (i = 0; i < ASYNC_LOADS; i++)
+	{
+		if (IMG_LoadAsync("image1.bmp", async_check_done, check) < 0 ||
+			IMG_LoadAsync("missing.bmp", async_check_done, check) < 0)
+		{
+			pthread_mutex_lock(&check->lock);
+			check->errors++;
+			pthread_mutex_unlock(&check->lock);
+		}
+	}
+	return NULL;
+}
+
+#define ASYNC_CYCLES 20
+#define ASYNC_POLLS 20000
+
+static void async_cycle_done(int id, SDL_Surface *surface, void *userdata)
+{
+	(void)id;
+	(void)userdata;
+	//NOTE: calling back into the pool while it shuts down must not block
+	IMG_AsyncPending();
+	IMG_LoadAsync("missing.bmp", NULL, NULL);
+	SDL_FreeSurface(surface);
+}
+
+static void *async_poll_proc(void *data)
+{
+	int i;
+
+	(void)data;
+	for (i = 0; i < ASYNC_POLLS; i++)
+	{
+		IMG_AsyncPending();
+		IMG_CancelAsync(i % 8);
+	}
+	return NULL;
+}
+
+//NOTE: several threads queue loads on a cold pool at once, every load 
+//must call back exactly once, with a surface or NULL if the file is missing
+int test_img_async(void)
+{
+	async_check check;
+	pthread_t threads[ASYNC_THREADS];
+	SDL_Surface *image = IMG_Load("image1.bmp");
+	uint32_t t0;
+	int started, i;
+
+	if (image == NULL)
+	{
+		fprintf(stderr, "Couldn't load image1.bmp\n");
+		return 1;
+	}
+	memset(&check, 0, sizeof(check));
+	pthread_mutex_init(&check.lock, NULL);
+	check.w = image->w;
+	check.h = image->h;
+	SDL_FreeSurface(image);
+
+	IMG_AsyncQuit();
+	for (started = 0; started < ASYNC_THREADS; started++)
+	{
+		if (pthread_create(&threads[started], NULL, 
+			async_check_proc, &check) != 0)
+		{
+			check.errors++;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	t0 = SDL_GetTicks();
+	while (IMG_AsyncPending() > 0 && SDL_GetTicks() - t0 < 10000)
+	{
+		SDL_Delay(1);
+	}
+	IMG_AsyncQuit();
+
+	if (check.loaded != started * ASYNC_LOADS || 
+		check.failed != started * ASYNC_LOADS)
+	{
+		check.errors++;
+	}
+	for (i = 1; i <= started * ASYNC_LOADS * 2; i++)
+	{
+		if (check.calls[i] != 1)
+		{
+			check.errors++;
+		}
+	}
+
+	//NOTE: start and stop the pool under a thread polling and cancelling
+	{
+		pthread_t poller;
+
+		if (pthread_create(&poller, NULL, async_poll_proc, NULL) != 0)
+		{
+			check.errors++;
+		}
+		else
+		{
+			for (i = 0; i < ASYNC_CYCLES; i++)
+			{
+				IMG_AsyncInit(2, 0);
+				IMG_LoadAsync("image1.bmp", async_cycle_done, NULL);
+				IMG_LoadAsync("missing.bmp", async_cycle_done, NULL);
+				IMG_AsyncQuit();
+			}
+			pthread_join(poller, NULL);
+		}
+		if (IMG_AsyncPending() != 0 || IMG_CancelAsync(1) != -1)
+		{
+			check.errors++;
+		}
+	}
+	pthread_mutex_destroy(&check.lock);
+	printf("IMG_LoadAsync: %d loads, %d missing, %s\n", 
+		check.loaded, check.failed, check.errors ? "FAILED" : "ok");
+	return check.errors;
+}
+
+#define CACHE_THREADS 4
+#define CACHE_ROUNDS 100
+
+typedef struct cache_check {
+	SDL_Surface *first;
+	int errors;
+} cache_check;
+
+static void *cache_first_proc(void *data)
+{
+	cache_check *check = (cache_check *)data;
+
+	check->first = IMG_CacheLoad("image1.bmp");
+	return NULL;
+}
+
+static void *cache_check_proc(void *data)
+{
+	cache_check *check = (cache_check *)data;
+	int i;
+
+	for (i = 0; i < CACHE_ROUNDS; i++)
+	{
+		SDL_Surface *surface = IMG_CacheLoad("image1.bmp");
+		if (surface == NULL)
+		{
+			check->errors++;
+		}
+		IMG_CacheRelease(surface);
+	}
+	return NULL;
+}
+
+//NOTE: threads miss on the same file at once and must all get the one
+//cached surface, then load and release it while the cache is flushed
+int test_img_cache(void)
+{
+	cache_check checks[CACHE_THREADS];
+	pthread_t threads[CACHE_THREADS];
+	IMG_CacheStats stats;
+	int errors = 0;
+	int started, i;
+
+	IMG_CacheFlush();
+	memset(checks, 0, sizeof(checks));
+	for (started = 0; started < CACHE_THREADS; started++)
+	{
+		if (pthread_create(&threads[started], NULL, 
+			cache_first_proc, &checks[started]) != 0)
+		{
+			errors++;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+		if (checks[i].first == NULL || checks[i].first != checks[0].first)
+		{
+			errors++;
+		}
+	}
+
+	//NOTE: the flushes forget surfaces still held, so only the first 
+	//loads above can be expected to share one
+	for (started = 0; started < CACHE_THREADS; started++)
+	{
+		if (pthread_create(&threads[started], NULL, 
+			cache_check_proc, &checks[started]) != 0)
+		{
+			errors++;
+			break;
+		}
+	}
+	for (i = 0; i < 20; i++)
+	{
+		IMG_CacheFlush();
+		SDL_Delay(1);
+	}
+	for (i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+		errors += checks[i].errors;
+	}
+	for (i = 0; i < CACHE_THREADS; i++)
+	{
+		IMG_CacheRelease(checks[i].first);
+	}
+	IMG_CacheFlush();
+	IMG_CacheGetStats(&stats);
+	if (stats.entries != 0 || stats.bytes != 0)
+	{
+		errors++;
+	}
+	printf("IMG_CacheLoad: %u hits, %u misses, %s\n", 
+		stats.hits, stats.misses, errors ? "FAILED" : "ok");
+	return errors;
+}
+
+#define FLUSH_PTSIZE 300
+
+//NOTE: glyphs this big don't fit the cache slabs and get their own
+//blocks, flushing and evicting them must free those too and leave
+//nothing charged to the cache (run under a leak checker)
+int test_ttf_flush(void)
+{
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	TTF_GlyphCacheStats stats;
+	SDL_Surface *before, *after;
+	TTF_Font *font;
+	int errors = 0;
+
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, FLUSH_PTSIZE);
+	if (font == NULL)
+	{
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			FLUSH_PTSIZE, DEFAULT_FONTNAME);
+		return 1;
+	}
+	before = TTF_RenderUTF8_Blended(font, "W@M", black);
+	TTF_GetGlyphCacheStats(font, &stats);
+	if (stats.glyphs == 0 || stats.bytes < 16 * 1024)
+	{
+		errors++;
+	}
+	TTF_FlushGlyphCache(font);
+	TTF_GetGlyphCacheStats(font, &stats);
+	if (stats.glyphs != 0 || stats.bytes != 0)
+	{
+		errors++;
+	}
+	after = TTF_RenderUTF8_Blended(font, "W@M", black);
+	if (compare_surface(before, after) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(after);
+
+	//too small a budget for more than one of them
+	TTF_SetGlyphCacheBudget(font, 1);
+	after = TTF_RenderUTF8_Blended(font, "W@M", black);
+	if (compare_surface(before, after) != 0)
+	{
+		errors++;
+	}
+	TTF_GetGlyphCacheStats(font, &stats);
+	if (stats.evictions == 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(after);
+	SDL_FreeSurface(before);
+	TTF_CloseFont(font);
+	printf("TTF_FlushGlyphCache: %d pt glyphs, %s\n", 
+		FLUSH_PTSIZE, errors ? "FAILED" : "ok");
+	return errors;
+}
+
+#define GLYPH_ROUNDS 2000
+#define GLYPH_FLUSHES 500
+
+static void *glyph_flush_proc(void *data)
+{
+	TTF_Font *font = (TTF_Font *)data;
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	int i;
+
+	for (i = 0; i < GLYPH_FLUSHES; i++)
+	{
+		TTF_FlushGlyphCache(font);
+		SDL_FreeSurface(TTF_RenderUTF8_Blended(font, "Wg", black));
+	}
+	return NULL;
+}
+
+//NOTE: the pixels TTF_GetGlyph hands out must survive another thread
+//flushing the same font until TTF_ReleaseGlyph
+int test_ttf_get_glyph(void)
+{
+	TTF_Font *font;
+	pthread_t thread;
+	TTF_GlyphInfo info;
+	uint8_t *reference;
+	int errors = 0;
+	int started, i, y;
+
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, DEFAULT_PTSIZE);
+	if (font == NULL)
+	{
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			DEFAULT_PTSIZE, DEFAULT_FONTNAME);
+		return 1;
+	}
+	if (TTF_GetGlyph(font, 'A', TTF_GLYPH_PIXELS, &info) < 0)
+	{
+		TTF_CloseFont(font);
+		return 1;
+	}
+	reference = (uint8_t *)malloc(info.rows * info.width + 1);
+	for (y = 0; y < info.rows; y++)
+	{
+		memcpy(reference + y * info.width, info.pixels + y * info.pitch, 
+			info.width);
+	}
+	TTF_ReleaseGlyph(font);
+
+	started = pthread_create(&thread, NULL, glyph_flush_proc, font) == 0;
+	if (!started)
+	{
+		errors++;
+	}
+	for (i = 0; i < GLYPH_ROUNDS; i++)
+	{
+		if (TTF_GetGlyph(font, 'A', TTF_GLYPH_PIXELS, &info) < 0)
+		{
+			errors++;
+			continue;
+		}
+		for (y = 0; y < info.rows; y++)
+		{
+			if (memcmp(reference + y * info.width, 
+				info.pixels + y * info.pitch, info.width) != 0)
+			{
+				errors++;
+				break;
+			}
+		}
+		TTF_ReleaseGlyph(font);
+	}
+	if (started)
+	{
+		pthread_join(thread, NULL);
+	}
+	free(reference);
+	TTF_CloseFont(font);
+	printf("TTF_GetGlyph: %d lookups against a flushing thread, %s\n", 
+		i, errors ? "FAILED" : "ok");
+	return errors;
+}
+
+//NOTE: a string sized and then rendered is laid out once, the run cache 
+//gives the same pixels as a fresh layout, and with TTF_SetRenderCache 
+//the same text and colour hand back the one shared surface
+int test_ttf_runs(void)
+{
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	SDL_Color red = { 0xff, 0x00, 0x00, 0 };
+	const char *label = "Score: 1234567";
+	TTF_GlyphCacheStats stats;
+	SDL_Surface *first, *again, *shared, *other;
+	TTF_Font *font;
+	int errors = 0;
+	int w, h;
+
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, DEFAULT_PTSIZE);
+	if (font == NULL)
+	{
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			DEFAULT_PTSIZE, DEFAULT_FONTNAME);
+		return 1;
+	}
+	TTF_SizeUTF8(font, label, &w, &h);
+	first = TTF_RenderUTF8_Blended(font, label, black);
+	TTF_GetGlyphCacheStats(font, &stats);
+	if (first == NULL || first->w != w || first->h != h ||
+		stats.run_misses != 1 || stats.run_hits != 1)
+	{
+		errors++;
+	}
+
+	//laid out again from scratch after a flush
+	TTF_FlushGlyphCache(font);
+	again = TTF_RenderUTF8_Blended(font, label, black);
+	if (compare_surface(first, again) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(again);
+
+	//bold is a different run
+	TTF_SetFontStyle(font, TTF_STYLE_BOLD);
+	TTF_SizeUTF8(font, label, &w, &h);
+	TTF_GetGlyphCacheStats(font, &stats);
+	if (stats.run_misses != 3 || w <= first->w)
+	{
+		errors++;
+	}
+	TTF_SetFontStyle(font, TTF_STYLE_NORMAL);
+
+	TTF_SetRenderCache(font, 1);
+	shared = TTF_RenderUTF8_Blended(font, label, black);
+	again = TTF_RenderUTF8_Blended(font, label, black);
+	other = TTF_RenderUTF8_Blended(font, label, red);
+	if (shared == NULL || again != shared || other == shared ||
+		compare_surface(first, shared) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(other);
+	SDL_FreeSurface(again);
+	SDL_FreeSurface(shared);
+	SDL_FreeSurface(first);
+	TTF_CloseFont(font);
+	printf("TTF run cache: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+//NOTE: the UTF-8 decoder, and the Latin-1, UTF-8 and UNICODE entry points 
+//laying out the same code points alike, surrogate pairs included
+int test_ttf_decode(void)
+{
+	static const struct {
+		const char *utf8;
+		uint32_t expect[5];
+	} cases[] = {
+		{ "A\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80", 
+			{ 'A', 0xE9, 0x20AC, 0x1F600, 0 } },
+		//truncated, overlong and a surrogate, one U+FFFD each
+		{ "\xC3(", { 0xFFFD, '(', 0 } },
+		{ "\xC0\xAFx", { 0xFFFD, 'x', 0 } },
+		{ "\xED\xA0\x80", { 0xFFFD, 0 } },
+	};
+	static const uint16_t unicode[] = { 'c', 'a', 'f', 0xE9, ' ', 
+		0xD83D, 0xDE00, 0 };
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	SDL_Surface *a, *b, *c;
+	TTF_Font *font;
+	int errors = 0;
+	int i, j;
+
+	for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++)
+	{
+		const char *text = cases[i].utf8;
+		for (j = 0; j < 5; j++)
+		{
+			uint32_t ch = TTF_DecodeUTF8(&text);
+			if (ch != cases[i].expect[j])
+			{
+				errors++;
+				break;
+			}
+			if (ch == 0)
+			{
+				break;
+			}
+		}
+	}
+
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, DEFAULT_PTSIZE);
+	if (font == NULL)
+	{
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			DEFAULT_PTSIZE, DEFAULT_FONTNAME);
+		return errors + 1;
+	}
+	a = TTF_RenderText_Blended(font, "caf\xE9", black);
+	b = TTF_RenderUTF8_Blended(font, "caf\xC3\xA9", black);
+	if (compare_surface(a, b) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(a);
+	SDL_FreeSurface(b);
+
+	b = TTF_RenderUTF8_Blended(font, "caf\xC3\xA9 \xF0\x9F\x98\x80", black);
+	c = TTF_RenderUNICODE_Blended(font, unicode, black);
+	if (compare_surface(b, c) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(b);
+	SDL_FreeSurface(c);
+	TTF_CloseFont(font);
+	printf("TTF text decoding: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+static void fill_pattern(SDL_Surface *surface, int seed)
+{
+	int x, y;
+
+	SDL_LockSurface(surface);
+	for (y = 0; y < surface->h; y++)
+	{
+		for (x = 0; x < surface->w; x++)
+		{
+			uint32_t pixel = SDL_MapRGB(surface->format, 
+				(x * 4 + seed) & 0xff, (y * 4) & 0xff, (x ^ y ^ seed) & 0xff);
+			uint8_t *p = (uint8_t *)surface->pixels + y * surface->pitch + 
+				x * surface->format->BytesPerPixel;
+			memcpy(p, &pixel, surface->format->BytesPerPixel);
+		}
+	}
+	SDL_UnlockSurface(surface);
+}
+
+//NOTE: an auto-converted sprite that is blitted, filled and stretched 
+//into after its copy was made must blit its new pixels, like a twin of 
+//it without auto-convert does
+int test_blit_autoconvert(void)
+{
+	SDL_Surface *sprite = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 24, 
+		0xFF0000, 0x00FF00, 0x0000FF, 0);
+	SDL_Surface *twin = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 24, 
+		0xFF0000, 0x00FF00, 0x0000FF, 0);
+	SDL_Surface *patch = SDL_CreateRGBSurface(SDL_SWSURFACE, 16, 16, 24, 
+		0xFF0000, 0x00FF00, 0x0000FF, 0);
+	SDL_Surface *screen = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *expect = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Rect r;
+	int errors = 0;
+	int step, i;
+
+	fill_pattern(sprite, 0);
+	fill_pattern(twin, 0);
+	fill_pattern(patch, 100);
+	SDL_SetAutoConvert(sprite, 1);
+	SDL_BlitSurface(sprite, NULL, screen, NULL);
+	if (sprite->map->converted == NULL)
+	{
+		errors++;
+	}
+	for (step = 0; step < 3; step++)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			SDL_Surface *target = i ? twin : sprite;
+
+			r.x = (int16_t)(8 + step * 16);
+			r.y = (int16_t)(8 + step * 8);
+			r.w = r.h = 16;
+			switch (step)
+			{
+			case 0:
+				SDL_BlitSurface(patch, NULL, target, &r);
+				break;
+			case 1:
+				SDL_FillRect(target, &r, SDL_MapRGB(target->format, 1, 2, 3));
+				break;
+			case 2:
+				SDL_SoftStretch(patch, NULL, target, &r);
+				break;
+			}
+		}
+		SDL_BlitSurface(sprite, NULL, screen, NULL);
+		SDL_BlitSurface(twin, NULL, expect, NULL);
+		if (compare_surface(screen, expect) != 0)
+		{
+			errors++;
+		}
+	}
+	SDL_FreeSurface(expect);
+	SDL_FreeSurface(screen);
+	SDL_FreeSurface(patch);
+	SDL_FreeSurface(twin);
+	SDL_FreeSurface(sprite);
+	printf("SDL_SetAutoConvert: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+typedef struct blit_key_case
+{
+	const char *name;
+	int srcbpp;
+	uint32_t srcR, srcG, srcB, srcA;
+	int dstbpp;
+	uint32_t dstR, dstG, dstB, dstA;
+} blit_key_case;
+
+static const blit_key_case blit_key_cases[] = {
+	{ "565", 16, 0xF800, 0x07E0, 0x001F, 0, 
+		16, 0xF800, 0x07E0, 0x001F, 0 },
+	{ "555", 15, 0x7C00, 0x03E0, 0x001F, 0, 
+		15, 0x7C00, 0x03E0, 0x001F, 0 },
+	{ "XRGB", 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0, 
+		32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0 },
+	{ "ARGB", 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000, 
+		32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 },
+	{ "XRGB to ARGB", 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0, 
+		32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 },
+	{ "RGB to ABGR", 24, 0xFF0000, 0x00FF00, 0x0000FF, 0, 
+		32, 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 },
+	{ "XRGB to XBGR", 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0, 
+		32, 0x000000FF, 0x0000FF00, 0x00FF0000, 0 },
+};
+
+static uint32_t get_pixel(SDL_Surface *surface, int x, int y)
+{
+	uint8_t *p = (uint8_t *)surface->pixels + y * surface->pitch + 
+		x * surface->format->BytesPerPixel;
+	uint32_t pixel = 0;
+
+	memcpy(&pixel, p, surface->format->BytesPerPixel);
+	return pixel;
+}
+
+//NOTE: colorkey blits, which take the SSE2/SSSE3 blitters where the cpu
+//has them, must give what the scalar Blit2to2Key, BlitNtoNKey and 
+//BlitNtoNKeyCopyAlpha give pixel by pixel, bit for bit, including the 
+//stray bits of unused channels and the odd pixels at the end of a row
+int test_blit_key_simd(void)
+{
+	int errors = 0;
+	int i, x, y;
+
+	for (i = 0; i < (int)(sizeof(blit_key_cases) / sizeof(blit_key_cases[0])); i++)
+	{
+		const blit_key_case *c = &blit_key_cases[i];
+		SDL_Surface *src = SDL_CreateRGBSurface(SDL_SWSURFACE, 37, 13, 
+			c->srcbpp, c->srcR, c->srcG, c->srcB, c->srcA);
+		SDL_Surface *dst = SDL_CreateRGBSurface(SDL_SWSURFACE, 45, 17, 
+			c->dstbpp, c->dstR, c->dstG, c->dstB, c->dstA);
+		SDL_Surface *expect = SDL_CreateRGBSurface(SDL_SWSURFACE, 45, 17, 
+			c->dstbpp, c->dstR, c->dstG, c->dstB, c->dstA);
+		uint32_t seed = 12345;
+		uint32_t key = 0, keymask;
+		SDL_Rect r;
+
+		if (src == NULL || dst == NULL || expect == NULL)
+		{
+			errors++;
+			SDL_FreeSurface(expect);
+			SDL_FreeSurface(dst);
+			SDL_FreeSurface(src);
+			continue;
+		}
+		//NOTE: raw random bytes, so unused bits are set too, and about 
+		//a third of the pixels are the key with random alpha on top
+		for (y = 0; y < src->h; y++)
+		{
+			uint8_t *p = (uint8_t *)src->pixels + y * src->pitch;
+			for (x = 0; x < src->w * src->format->BytesPerPixel; x++)
+			{
+				seed = seed * 1103515245 + 12345;
+				p[x] = (uint8_t)(seed >> 16);
+			}
+		}
+		key = get_pixel(src, 0, 0);
+		keymask = ~src->format->Amask;
+		for (y = 0; y < src->h; y++)
+		{
+			for (x = 0; x < src->w; x++)
+			{
+				seed = seed * 1103515245 + 12345;
+				if ((seed >> 16) % 3 == 0)
+				{
+					uint32_t pixel = (key & keymask) | 
+						(get_pixel(src, x, y) & ~keymask);
+					memcpy((uint8_t *)src->pixels + y * src->pitch + 
+						x * src->format->BytesPerPixel, &pixel, 
+						src->format->BytesPerPixel);
+				}
+			}
+		}
+		fill_pattern(dst, i);
+		fill_pattern(expect, i);
+		SDL_SetAlpha(src, 0, SDL_ALPHA_OPAQUE);
+		SDL_SetColorKey(src, SDL_SRCCOLORKEY, key);
+
+		r.x = 5;
+		r.y = 3;
+		SDL_BlitSurface(src, NULL, dst, &r);
+		for (y = 0; y < src->h; y++)
+		{
+			for (x = 0; x < src->w; x++)
+			{
+				uint32_t pixel = get_pixel(src, x, y);
+				uint8_t *p;
+				uint8_t cr, cg, cb, ca;
+
+				if ((pixel & keymask) == (key & keymask))
+				{
+					continue;
+				}
+				if (src->format->BytesPerPixel != 2)
+				{
+					SDL_GetRGBA(pixel, src->format, &cr, &cg, &cb, &ca);
+					pixel = SDL_MapRGBA(expect->format, cr, cg, cb, ca);
+				}
+				p = (uint8_t *)expect->pixels + (y + r.y) * expect->pitch + 
+					(x + r.x) * expect->format->BytesPerPixel;
+				memcpy(p, &pixel, expect->format->BytesPerPixel);
+			}
+		}
+		if (compare_surface(dst, expect) != 0)
+		{
+			printf("colorkey blit %s: differs from the scalar blit\n", c->name);
+			errors++;
+		}
+		SDL_FreeSurface(expect);
+		SDL_FreeSurface(dst);
+		SDL_FreeSurface(src);
+	}
+	printf("colorkey blit SIMD: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+//NOTE: a translucent SDL_ext_fillRectangle at 16bpp, which blends 8 
+//pixels at a time, must leave the same pixels as blending the rect one 
+//pixel at a time with SDL_ext_drawPoint, clipped at all four edges, 
+//with odd widths and with the unused bit of 555 kept
+int test_fill_rect_alpha16(void)
+{
+	static const uint32_t masks[2][3] = {
+		{ 0xF800, 0x07E0, 0x001F },
+		{ 0x7C00, 0x03E0, 0x001F },
+	};
+	static const uint8_t alphas[] = { 1, 64, 128, 200, 254 };
+	int errors = 0;
+	int i, j, x, y;
+
+	for (i = 0; i < 2; i++)
+	{
+		SDL_Surface *fill = SDL_CreateRGBSurface(SDL_SWSURFACE, 61, 23, 
+			i ? 15 : 16, masks[i][0], masks[i][1], masks[i][2], 0);
+		SDL_Surface *expect = SDL_CreateRGBSurface(SDL_SWSURFACE, 61, 23, 
+			i ? 15 : 16, masks[i][0], masks[i][1], masks[i][2], 0);
+		SDL_Rect clip;
+
+		clip.x = 2;
+		clip.y = 1;
+		clip.w = 55;
+		clip.h = 20;
+		for (j = 0; j < (int)(sizeof(alphas) / sizeof(alphas[0])); j++)
+		{
+			uint8_t r = (uint8_t)(40 + j * 50), g = (uint8_t)(200 - j * 30), 
+				b = (uint8_t)(j * 60);
+
+			fill_pattern(fill, j);
+			fill_pattern(expect, j);
+			if (i)
+			{
+				//NOTE: set the unused top bit on every other pixel
+				for (y = 0; y < fill->h; y++)
+				{
+					for (x = 0; x < fill->w; x += 2)
+					{
+						((uint16_t *)((uint8_t *)fill->pixels + 
+							y * fill->pitch))[x] |= 0x8000;
+						((uint16_t *)((uint8_t *)expect->pixels + 
+							y * expect->pitch))[x] |= 0x8000;
+					}
+				}
+			}
+			SDL_SetClipRect(fill, &clip);
+			SDL_SetClipRect(expect, &clip);
+			SDL_ext_fillRectangle(fill, r, g, b, alphas[j], 
+				-3 + j, -2, 37 + j * 9, 30);
+			for (y = -2; y < 28; y++)
+			{
+				for (x = -3 + j; x < -3 + j + 37 + j * 9; x++)
+				{
+					SDL_ext_drawPoint(expect, r, g, b, alphas[j], x, y);
+				}
+			}
+			if (compare_surface(fill, expect) != 0)
+			{
+				printf("SDL_ext_fillRectangle: %dbpp alpha %d differs\n", 
+					i ? 15 : 16, alphas[j]);
+				errors++;
+			}
+		}
+		SDL_FreeSurface(expect);
+		SDL_FreeSurface(fill);
+	}
+	printf("SDL_ext_fillRectangle 16bpp alpha: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+//NOTE: the clip rect is half open, SDL_ext_putPixel and 
+//SDL_ext_putPixelAlpha just past its right and bottom edges must not 
+//touch the surface
+int test_put_pixel_clip(void)
+{
+	SDL_Surface *surface = SDL_CreateRGBSurface(SDL_SWSURFACE, 16, 8, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *expect = SDL_CreateRGBSurface(SDL_SWSURFACE, 16, 8, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Rect clip;
+	int errors = 0;
+	int i;
+
+	fill_pattern(surface, 7);
+	fill_pattern(expect, 7);
+	clip.x = 2;
+	clip.y = 1;
+	clip.w = 10;
+	clip.h = 5;
+	SDL_SetClipRect(surface, &clip);
+	for (i = 0; i < 2; i++)
+	{
+		if (i)
+		{
+			SDL_SetClipRect(surface, NULL);
+			clip.x = clip.y = 0;
+			clip.w = (uint16_t)surface->w;
+			clip.h = (uint16_t)surface->h;
+		}
+		SDL_ext_putPixel(surface, clip.x + clip.w, clip.y, 255, 255, 255);
+		SDL_ext_putPixel(surface, clip.x, clip.y + clip.h, 255, 255, 255);
+		SDL_ext_putPixelAlpha(surface, clip.x + clip.w, clip.y, 
+			255, 255, 255, 128);
+		SDL_ext_putPixelAlpha(surface, clip.x, clip.y + clip.h, 
+			255, 255, 255, 128);
+	}
+	if (compare_surface(surface, expect) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(expect);
+	SDL_FreeSurface(surface);
+	printf("SDL_ext_putPixel clip: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+#define PALETTE_THREADS 4
+
+typedef struct palette_job
+{
+	SDL_Surface *surface;
+	int first;
+	int errors;
+} palette_job;
+
+static uint8_t nearest_color(SDL_Palette *pal, int r, int g, int b)
+{
+	unsigned int smallest = ~0u;
+	uint8_t pixel = 0;
+	int i;
+
+	for (i = 0; i < pal->ncolors; i++)
+	{
+		int rd = pal->colors[i].r - r;
+		int gd = pal->colors[i].g - g;
+		int bd = pal->colors[i].b - b;
+		unsigned int distance = (unsigned int)(rd * rd + gd * gd + bd * bd);
+		if (distance < smallest)
+		{
+			smallest = distance;
+			pixel = (uint8_t)i;
+		}
+	}
+	return pixel;
+}
+
+static void *palette_thread_proc(void *data)
+{
+	palette_job *job = (palette_job *)data;
+	SDL_Palette *pal = job->surface->format->palette;
+	int i;
+
+	for (i = job->first; i < 1 << 18; i += PALETTE_THREADS * 7)
+	{
+		int r = (i >> 12) << 2, g = ((i >> 6) & 63) << 2, b = (i & 63) << 2;
+		if (SDL_MapRGB(job->surface->format, (uint8_t)r, (uint8_t)g, 
+			(uint8_t)b) != nearest_color(pal, r, g, b))
+		{
+			job->errors++;
+		}
+	}
+	return NULL;
+}
+
+//NOTE: SDL_MapRGB on a palette set with SDL_SetColors finds the nearest 
+//colour like a full search, from several threads at once, and without 
+//touching the palette lookups. A palette written directly and never set 
+//is searched through, and converting to it gives the same pixels. So 
+//are colours written directly over ones set with SDL_SetColors
+int test_palette_lookup(void)
+{
+	SDL_Surface *screen = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 8, 
+		0, 0, 0, 0);
+	SDL_Surface *twin = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 8, 
+		0, 0, 0, 0);
+	SDL_Surface *art = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *plain, *direct;
+	SDL_Palette *pal = screen->format->palette;
+	struct SDL_PaletteInverse *inverse;
+	pthread_t threads[PALETTE_THREADS];
+	palette_job jobs[PALETTE_THREADS];
+	SDL_Color colors[256];
+	uint32_t seed = 4321;
+	int errors = 0;
+	int round, i, started;
+
+	for (round = 0; round < 2; round++)
+	{
+		for (i = 0; i < 256; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			colors[i].r = (uint8_t)(seed >> 8);
+			colors[i].g = (uint8_t)(seed >> 16);
+			//NOTE: the second round leaves blue out, giving many ties
+			colors[i].b = round ? 0 : (uint8_t)(seed >> 24);
+			colors[i].unused = 0;
+		}
+		SDL_SetColors(screen, colors, 0, 256);
+		inverse = pal->inverse;
+		if (inverse == NULL)
+		{
+			errors++;
+		}
+		for (started = 0; started < PALETTE_THREADS; started++)
+		{
+			jobs[started].surface = screen;
+			jobs[started].first = started * 7;
+			jobs[started].errors = 0;
+			if (pthread_create(&threads[started], NULL, 
+				palette_thread_proc, &jobs[started]) != 0)
+			{
+				errors++;
+				break;
+			}
+		}
+		for (i = 0; i < started; i++)
+		{
+			pthread_join(threads[i], NULL);
+			errors += jobs[i].errors;
+		}
+		if (pal->inverse != inverse)
+		{
+			errors++;
+		}
+	}
+
+	//NOTE: the same colours written directly have no lookups to go stale
+	memcpy(twin->format->palette->colors, colors, sizeof(colors));
+	if (twin->format->palette->inverse != NULL || 
+		SDL_MapRGB(twin->format, 10, 200, 30) != 
+			nearest_color(twin->format->palette, 10, 200, 30) || 
+		twin->format->palette->inverse != NULL)
+	{
+		errors++;
+	}
+	fill_pattern(art, 3);
+	plain = SDL_ConvertSurface(art, screen->format, SDL_SWSURFACE);
+	direct = SDL_ConvertSurface(art, twin->format, SDL_SWSURFACE);
+	if (compare_surface(plain, direct) != 0 || 
+		twin->format->palette->inverse != NULL)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(direct);
+	SDL_FreeSurface(plain);
+
+	//NOTE: the lookups SDL_SetColors built for screen are stale now
+	for (i = 0; i < 256; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		colors[i].r = (uint8_t)(seed >> 24);
+		colors[i].g = (uint8_t)(seed >> 8);
+		colors[i].b = (uint8_t)(seed >> 16);
+	}
+	memcpy(pal->colors, colors, sizeof(colors));
+	memcpy(twin->format->palette->colors, colors, sizeof(colors));
+	for (i = 0; i < 1 << 18; i += 61)
+	{
+		int r = (i >> 12) << 2, g = ((i >> 6) & 63) << 2, b = (i & 63) << 2;
+		if (SDL_MapRGB(screen->format, (uint8_t)r, (uint8_t)g, 
+			(uint8_t)b) != nearest_color(pal, r, g, b))
+		{
+			errors++;
+			break;
+		}
+	}
+	plain = SDL_ConvertSurface(art, screen->format, SDL_SWSURFACE);
+	direct = SDL_ConvertSurface(art, twin->format, SDL_SWSURFACE);
+	if (compare_surface(plain, direct) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(direct);
+	SDL_FreeSurface(plain);
+	SDL_FreeSurface(art);
+	SDL_FreeSurface(twin);
+	SDL_FreeSurface(screen);
+	printf("SDL_MapRGB palette: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+//NOTE: SDL_BlitScaledRotated refuses a scale or angle that is not a 
+//finite number and a scale that is not above 0, draws nothing at scales 
+//too small to cover a pixel centre and one source pixel everywhere at 
+//huge scales, without overflowing its 16.16 steps on the way
+int test_rotozoom_scale(void)
+{
+	static const double bad[] = { 0.0, -1.0, 1e300 * 1e300, -1e300 * 1e300 };
+	static const double tiny[] = { 1e-2, 3e-5, 1e-5, 1.0 / 40000.0, 
+		1.0 / 65536.0, 1e-9, 1e-300 };
+	SDL_Surface *sprite = SDL_CreateRGBSurface(SDL_SWSURFACE, 64, 64, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *screen = SDL_CreateRGBSurface(SDL_SWSURFACE, 40, 30, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *expect = SDL_CreateRGBSurface(SDL_SWSURFACE, 40, 30, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	double nan = bad[2] - bad[2];
+	uint32_t middle;
+	int errors = 0;
+	int i, filter, x, y;
+
+	fill_pattern(sprite, 5);
+	fill_pattern(screen, 9);
+	fill_pattern(expect, 9);
+	for (filter = SDL_SCALE_NEAREST; filter <= SDL_SCALE_LINEAR; filter++)
+	{
+		for (i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++)
+		{
+			if (SDL_BlitScaledRotated(sprite, NULL, screen, NULL, 
+				30.0, bad[i], filter) != -1)
+			{
+				errors++;
+			}
+		}
+		if (SDL_BlitScaledRotated(sprite, NULL, screen, NULL, 
+				30.0, nan, filter) != -1 || 
+			SDL_BlitScaledRotated(sprite, NULL, screen, NULL, 
+				nan, 1.0, filter) != -1 || 
+			SDL_BlitScaledRotated(sprite, NULL, screen, NULL, 
+				bad[2], 1.0, filter) != -1)
+		{
+			errors++;
+		}
+		for (i = 0; i < (int)(sizeof(tiny) / sizeof(tiny[0])); i++)
+		{
+			if (SDL_BlitScaledRotated(sprite, NULL, screen, NULL, 
+				30.0 * i, tiny[i], filter) != 0)
+			{
+				errors++;
+			}
+		}
+	}
+	if (compare_surface(screen, expect) != 0)
+	{
+		errors++;
+	}
+
+	//NOTE: every pixel centre lands next to the middle of the sprite
+	middle = ((uint32_t *)((uint8_t *)sprite->pixels + 32 * sprite->pitch))[32];
+	for (i = 0; i < 2; i++)
+	{
+		if (SDL_BlitScaledRotated(sprite, NULL, screen, NULL, 
+			i * 90.0, i ? 1e300 : 1e12, SDL_SCALE_NEAREST) != 0)
+		{
+			errors++;
+		}
+		for (y = 0; y < screen->h; y++)
+		{
+			for (x = 0; x < screen->w; x++)
+			{
+				if (((uint32_t *)((uint8_t *)screen->pixels + 
+					y * screen->pitch))[x] != middle)
+				{
+					errors++;
+					y = screen->h;
+					break;
+				}
+			}
+		}
+	}
+	SDL_FreeSurface(expect);
+	SDL_FreeSurface(screen);
+	SDL_FreeSurface(sprite);
+	printf("SDL_BlitScaledRotated scale: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+//NOTE: bilinear blits of a colorkeyed sprite: with a key no pixel has 
+//they match the unkeyed blit, a sprite that is all key leaves the screen 
+//alone, and a half keyed one blends only its own colour into the edges
+int test_rotozoom_keyed(void)
+{
+	SDL_Surface *sprite = SDL_CreateRGBSurface(SDL_SWSURFACE, 40, 40, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *plain = SDL_CreateRGBSurface(SDL_SWSURFACE, 120, 120, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	SDL_Surface *keyed = SDL_CreateRGBSurface(SDL_SWSURFACE, 120, 120, 32, 
+		0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+	uint32_t key = SDL_MapRGB(sprite->format, 0xFF, 0x00, 0xFF);
+	uint32_t color = SDL_MapRGB(sprite->format, 0x20, 0x90, 0x40);
+	SDL_Rect half = { 0, 0, 20, 40 };
+	int errors = 0;
+	int i, x, y;
+
+	for (i = 0; i < 3; i++)
+	{
+		double angle = 17.0 + i * 41.0, scale = 0.6 + i * 0.9;
+
+		fill_pattern(sprite, 5);
+		fill_pattern(plain, 9);
+		fill_pattern(keyed, 9);
+		SDL_SetColorKey(sprite, 0, 0);
+		SDL_BlitScaledRotated(sprite, NULL, plain, NULL, angle, scale, 
+			SDL_SCALE_LINEAR);
+		SDL_SetColorKey(sprite, SDL_SRCCOLORKEY, key);
+		SDL_BlitScaledRotated(sprite, NULL, keyed, NULL, angle, scale, 
+			SDL_SCALE_LINEAR);
+		if (compare_surface(plain, keyed) != 0)
+		{
+			errors++;
+		}
+
+		SDL_FillRect(sprite, NULL, key);
+		fill_pattern(plain, 9);
+		fill_pattern(keyed, 9);
+		SDL_BlitScaledRotated(sprite, NULL, keyed, NULL, angle, scale, 
+			SDL_SCALE_LINEAR);
+		if (compare_surface(plain, keyed) != 0)
+		{
+			errors++;
+		}
+
+		SDL_FillRect(sprite, NULL, color);
+		SDL_FillRect(sprite, &half, key);
+		SDL_FillRect(keyed, NULL, color);
+		SDL_BlitScaledRotated(sprite, NULL, keyed, NULL, angle, scale, 
+			SDL_SCALE_LINEAR);
+		for (y = 0; y < keyed->h; y++)
+		{
+			for (x = 0; x < keyed->w; x++)
+			{
+				if (get_pixel(keyed, x, y) != color)
+				{
+					errors++;
+					y = keyed->h;
+					break;
+				}
+			}
+		}
+	}
+	SDL_FreeSurface(keyed);
+	SDL_FreeSurface(plain);
+	SDL_FreeSurface(sprite);
+	printf("SDL_BlitScaledRotated keyed linear: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+//NOTE: a 118 byte BMP whose header claims a width that overflows the 
+//row pitch must be refused by both loaders, a 2x2 one still loads
+int test_bmp_header(void)
+{
+	static const struct
+	{
+		uint32_t width;
+		int bpp;
+	} sizes[] = {
+		{ 2, 24 }, { 0x08000001, 32 }, { 0x7FFFFFFF, 24 }, { 16384, 8 },
+	};
+	int errors = 0;
+	int i;
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+	{
+		uint8_t bmp[118];
+		FILE *file = tmpfile();
+		SDL_Surface *surface;
+		uint8_t *pixels;
+		int w, h;
+
+		if (file == NULL)
+		{
+			errors++;
+			continue;
+		}
+		memset(bmp, 0x5A, sizeof(bmp));
+		bmp[0] = 'B';
+		bmp[1] = 'M';
+		put_le32(bmp + 2, sizeof(bmp));
+		put_le32(bmp + 6, 0);
+		put_le32(bmp + 10, 54);
+		put_le32(bmp + 14, 40);
+		put_le32(bmp + 18, sizes[i].width);
+		put_le32(bmp + 22, 2);
+		put_le32(bmp + 26, 1 | sizes[i].bpp << 16);
+		put_le32(bmp + 30, 0);
+		put_le32(bmp + 46, 0);
+		fwrite(bmp, 1, sizeof(bmp), file);
+
+		rewind(file);
+		surface = IMG_LoadBMP_RW(file);
+		rewind(file);
+		pixels = IMG_LoadBMPPixels_RW(file, IMG_PIXELS_RGBA32, &w, &h);
+		if (i == 0)
+		{
+			if (surface == NULL || pixels == NULL || w != 2 || h != 2)
+			{
+				errors++;
+			}
+		}
+		else if (surface != NULL || pixels != NULL)
+		{
+			errors++;
+		}
+		SDL_FreeSurface(surface);
+		free(pixels);
+		fclose(file);
+	}
+	printf("BMP header sizes: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+//NOTE: the tail of a line of SDF text further out than 32767 pixels must 
+//draw the same as the same glyphs at the start of a short line
+#define SDF_FAR_GLYPHS 2000
+int test_ttf_sdf_far(void)
+{
+	SDL_Color black = { 0x00, 0x00, 0x00, 0 };
+	char text[SDF_FAR_GLYPHS + 1];
+	SDL_Surface *near, *far;
+	TTF_Font *font;
+	int errors = 0;
+	int one, two, h;
+	int advance;
+
+	TTF_Init();
+	font = TTF_OpenFont(DEFAULT_FONTNAME, SDF_PTSIZE);
+	if (font == NULL)
+	{
+		fprintf(stderr, "Couldn't load %d pt font from %s\n", 
+			SDF_PTSIZE, DEFAULT_FONTNAME);
+		return 1;
+	}
+	memset(text, 'W', SDF_FAR_GLYPHS);
+	text[SDF_FAR_GLYPHS] = '\0';
+	TTF_SizeText(font, "W", &one, &h);
+	TTF_SizeText(font, "WW", &two, &h);
+	advance = two - one;
+
+	near = SDL_CreateRGBSurface(SDL_SWSURFACE, two + 20, h, 32, 
+		MY_Rmask, MY_Gmask, MY_Bmask, MY_Amask);
+	far = SDL_CreateRGBSurface(SDL_SWSURFACE, two + 20, h, 32, 
+		MY_Rmask, MY_Gmask, MY_Bmask, MY_Amask);
+	SDL_FillRect(near, NULL, 0xFFFFFFFF);
+	SDL_FillRect(far, NULL, 0xFFFFFFFF);
+	//the glyph before the last two pokes into the left edge of both
+	TTF_RenderText_SDFTo(font, "WWW", SDF_PTSIZE, black, near, 
+		10 - advance, 0, NULL);
+	TTF_RenderText_SDFTo(font, text, SDF_PTSIZE, black, far, 
+		10 - (SDF_FAR_GLYPHS - 2) * advance, 0, NULL);
+	if ((SDF_FAR_GLYPHS - 2) * advance <= 32767 || 
+		compare_surface(near, far) != 0)
+	{
+		errors++;
+	}
+	SDL_FreeSurface(far);
+	SDL_FreeSurface(near);
+	TTF_CloseFont(font);
+	printf("TTF SDF far pen: %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+int test_checks(void)
+{
+	int failures = 0;
+
+	failures += test_img_async();
+	failures += test_img_cache();
+	failures += test_ttf_flush();
+	failures += test_ttf_get_glyph();
+	failures += test_ttf_threads(4);
+	failures += test_ttf_runs();
+	failures += test_ttf_decode();
+	failures += test_blit_autoconvert();
+	failures += test_blit_key_simd();
+	failures += test_fill_rect_alpha16();
+	failures += test_put_pixel_clip();
+	failures += test_palette_lookup();
+	failures += test_rotozoom_scale();
+	failures += test_rotozoom_keyed();
+	failures += test_bmp_header();
+	failures += test_ttf_sdf_far();
+	printf("%s\n", failures ? "FAILED" : "all checks passed");
+	return failures;
 }
 
 static int audio_open = 0;
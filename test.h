@@ -4,4 +4,35 @@ extern void test_bmp(SDL_Surface* screen);
 extern void test_ttf(SDL_Surface* screen);
 extern void test_ttf2(SDL_Surface* screen);
 extern void test_image(SDL_Surface* screen);
+extern void test_ttf_atlas(int width, int height);
+extern void test_ttf_sdf(SDL_Surface* screen);
+extern void test_ttf_paragraph(SDL_Surface* screen);
+extern void test_bmp_bench(const char **files);
+extern int test_ttf_threads(int nthreads);
+extern void test_ttf_glyph_bench(void);
+extern void test_ttf_precache(void);
+extern void test_blit_rle_bench(void);
+extern void test_blit_convert_bench(void);
+extern void test_blit_bench(void);
+extern void test_fill_bench(void);
+extern void test_ext_batch_bench(void);
+extern void test_ext_aa_bench(void);
+extern void test_palette_bench(void);
+extern void test_rotozoom_bench(void);
+extern int test_img_async(void);
+extern int test_img_cache(void);
+extern int test_ttf_flush(void);
+extern int test_ttf_get_glyph(void);
+extern int test_ttf_runs(void);
+extern int test_ttf_decode(void);
+extern int test_blit_autoconvert(void);
+extern int test_blit_key_simd(void);
+extern int test_fill_rect_alpha16(void);
+extern int test_put_pixel_clip(void);
+extern int test_palette_lookup(void);
+extern int test_rotozoom_scale(void);
+extern int test_rotozoom_keyed(void);
+extern int test_bmp_header(void);
+extern int test_ttf_sdf_far(void);
+extern int test_checks(void);
 extern void test_wav();